@@ -27,7 +27,8 @@ static bool _bForceRestart = FALSE;
 static bool _bForceNextMap = FALSE;
 
 extern CTString _strSamVersion = "no version information";
-extern INDEX ded_iMaxFPS = 100;
+extern INDEX ded_iMaxFPS = 100;   // max frames per second when woken by network data (ticks always wake)
+extern FLOAT ded_tmSpinWait = 0.001f;  // last part of each wait that is spun instead of slept
 extern CTString ded_strConfig = "";
 extern CTString ded_strLevel = "";
 extern INDEX ded_bRestartWhenEmpty = TRUE;
@@ -85,22 +86,106 @@ static void NextMap(void)
 
 void End(void);
 
-// limit current frame rate if neeeded
+// scheduler statistics
+static INDEX ded_ctFrames = 0;        // frames done since last report
+static INDEX ded_ctTickFrames = 0;    // frames woken by a game tick
+static INDEX ded_ctDataFrames = 0;    // frames woken by incoming network data
+static INDEX ded_ctOverruns = 0;      // frames that took longer than one tick
+static FLOAT ded_tmBusyLast = 0.0f;   // time spent working in last frame
+static FLOAT ded_tmBusyMax = 0.0f;    // max time spent working in a frame
+static FLOAT ded_tmBusyTotal = 0.0f;  // total time spent working
+static FLOAT ded_tmLateMax = 0.0f;    // max delay between a game tick and the frame that handles it
 
-void LimitFrameRate(void)
+static CTimerValue _tvFrameStart(-1.0f);  // when current frame started
+static TIME _tmFrameTick = -1.0f;         // game tick that was last when current frame started
+
+static void ReportScheduler(void)
+{
+  CPrintF(TRANS("Frames: %d (%d on tick, %d on network data), overruns: %d\n"),
+    ded_ctFrames, ded_ctTickFrames, ded_ctDataFrames, ded_ctOverruns);
+  CPrintF(TRANS("Tick budget: %.1f ms, frame work: %.2f ms avg, %.2f ms max, tick handled %.2f ms late at most\n"),
+    _pTimer->TickQuantum*1000.0f, ded_tmBusyTotal*1000.0f/ClampDn(ded_ctFrames, INDEX(1)),
+    ded_tmBusyMax*1000.0f, ded_tmLateMax*1000.0f);
+  ded_ctFrames = 0;
+  ded_ctTickFrames = 0;
+  ded_ctDataFrames = 0;
+  ded_ctOverruns = 0;
+  ded_tmBusyMax = 0.0f;
+  ded_tmBusyTotal = 0.0f;
+  ded_tmLateMax = 0.0f;
+}
+
+// wait for the given time, or until network data arrives if bNetwork (returns TRUE if data arrived)
+static BOOL Wait(TIME tmWait, BOOL bNetwork)
 {
-  // measure passed time for each loop
-  static CTimerValue tvLast(-1.0f);
-  CTimerValue tvNow   = _pTimer->GetHighPrecisionTimer();
-  TIME tmCurrentDelta = (tvNow-tvLast).GetSeconds();
+  // sleep through most of the wait, and spin the rest for precision
+  if (tmWait>ded_tmSpinWait) {
+    if (bNetwork) {
+      return _pNetwork->WaitForIncomingData(tmWait-ded_tmSpinWait);
+    }
+    Sleep(DWORD((tmWait-ded_tmSpinWait)*1000.0f));
+  } else {
+    Sleep(0);
+  }
+  return FALSE;
+}
+
+// wait until there is something to do - a game tick happened or network data arrived
+void WaitForNextFrame(void)
+{
+  // measure the frame that was just done
+  CTimerValue tvNow = _pTimer->GetHighPrecisionTimer();
+  if (_tvFrameStart.tv_llValue>0) {
+    ded_tmBusyLast = (tvNow-_tvFrameStart).GetSeconds();
+    ded_tmBusyMax = Max(ded_tmBusyMax, ded_tmBusyLast);
+    ded_tmBusyTotal += ded_tmBusyLast;
+    if (ded_tmBusyLast>_pTimer->TickQuantum) {
+      ded_ctOverruns++;
+    }
+    ded_ctFrames++;
+  }
 
-  // limit maximum frame rate
+  // network data may not wake frames more often than max frame rate allows
   ded_iMaxFPS = ClampDn( ded_iMaxFPS,   1L);
-  TIME tmWantedDelta  = 1.0f / ded_iMaxFPS;
-  if( tmCurrentDelta<tmWantedDelta) Sleep( (tmWantedDelta-tmCurrentDelta)*1000.0f);
-  
-  // remember new time
-  tvLast = _pTimer->GetHighPrecisionTimer();
+  ded_tmSpinWait = Clamp( ded_tmSpinWait, 0.0f, 0.01f);
+  const CTimerValue tvDataAllowed = _tvFrameStart + CTimerValue(1.0/ded_iMaxFPS);
+
+  for (;;) {
+    // timer thread sets when it was last on time while holding its hooks lock
+    CTimerValue tvLastOnTime;
+    {
+      CTSingleLock slHooks(&_pTimer->tm_csHooks, TRUE);
+      tvLastOnTime = _pTimer->tm_tvLastTimeOnTime;
+    }
+    // if a game tick happened since this frame started
+    if (_pTimer->GetRealTimeTick()!=_tmFrameTick) {
+      // handle it right away
+      ded_tmLateMax = Max(ded_tmLateMax, FLOAT((tvNow-tvLastOnTime).GetSeconds()));
+      ded_ctTickFrames++;
+      break;
+    }
+    // next tick is due one quantum after the timer was last on time
+    const CTimerValue tvTick = tvLastOnTime + CTimerValue(DOUBLE(_pTimer->TickQuantum));
+    const TIME tmToTick = (tvTick-tvNow).GetSeconds();
+    const TIME tmToData = (tvDataAllowed-tvNow).GetSeconds();
+    // if network data may wake the frame already
+    if (tmToData<=0) {
+      // wait for it, but not past the tick
+      if (Wait(tmToTick, TRUE)) {
+        ded_ctDataFrames++;
+        break;
+      }
+    // otherwise
+    } else {
+      // just wait
+      Wait(Min(tmToTick, tmToData), FALSE);
+    }
+    tvNow = _pTimer->GetHighPrecisionTimer();
+  }
+
+  // start next frame
+  _tvFrameStart = _pTimer->GetHighPrecisionTimer();
+  _tmFrameTick = _pTimer->GetRealTimeTick();
 }
 
 // break/close handler
@@ -232,6 +317,12 @@ bool Init(int argc, char* argv[])
 
   // declare shell symbols
   _pShell->DeclareSymbol("persistent user INDEX ded_iMaxFPS;", &ded_iMaxFPS);
+  _pShell->DeclareSymbol("persistent user FLOAT ded_tmSpinWait;", &ded_tmSpinWait);
+  _pShell->DeclareSymbol("user const INDEX ded_ctOverruns;", &ded_ctOverruns);
+  _pShell->DeclareSymbol("user const FLOAT ded_tmBusyLast;", &ded_tmBusyLast);
+  _pShell->DeclareSymbol("user const FLOAT ded_tmBusyMax;", &ded_tmBusyMax);
+  _pShell->DeclareSymbol("user const FLOAT ded_tmLateMax;", &ded_tmLateMax);
+  _pShell->DeclareSymbol("user void ReportScheduler(void);", &ReportScheduler);
   _pShell->DeclareSymbol("user void Quit(void);", &QuitGame);
   _pShell->DeclareSymbol("user CTString ded_strLevel;", &ded_strLevel);
   _pShell->DeclareSymbol("user FLOAT ded_tmTimeout;", &ded_tmTimeout);
@@ -380,8 +471,8 @@ void DoGame(void)
     _pNetwork->GameInactive();
   }
 
-  // limit current frame rate if needed
-  LimitFrameRate();
+  // wait until there is something to do
+  WaitForNextFrame();
 }
 
 int SubMain(int argc, char* argv[])
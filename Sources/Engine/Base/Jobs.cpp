@@ -0,0 +1,178 @@
+/* Copyright (c) 2002-2012 Croteam Ltd.
+This program is free software; you can redistribute it and/or modify
+it under the terms of version 2 of the GNU General Public License as published by
+the Free Software Foundation
+
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA. */
+
+#include "StdH.h"
+
+#include <Engine/Base/Jobs.h>
+#include <Engine/Base/Console.h>
+#include <Engine/Base/Translation.h>
+#include <Engine/Math/Functions.h>
+
+/*
+Worker threads are started on first use, one less than there are processors,
+and are then kept waiting on a semaphore. Each batch releases the semaphore once
+per worker, and every worker (and the calling thread) takes jobs by incrementing
+a shared counter until there are none left. The caller doesn't return before all
+workers are done with the batch, so no worker can stray into the next one.
+*/
+
+static BOOL _bWorkersStarted = FALSE;
+static INDEX _ctWorkers = 0;                    // number of worker threads (excluding main)
+static HANDLE _ahWorkers[JOB_MAX_THREADS-1];
+static HANDLE _hStartSemaphore = NULL;           // released once per worker for each batch
+static HANDLE _hDoneEvent = NULL;                // set by the last worker that finishes a batch
+static BOOL _bQuitWorkers = FALSE;
+
+// current batch
+static JobFunction *_pJobFunction = NULL;
+static void *_pvJobData = NULL;
+static INDEX _ctJobs = 0;
+static LONG _lNextJob = 0;         // index of next job to take
+static LONG _lBusyWorkers = 0;     // workers that haven't finished the batch yet
+
+static _declspec(thread) INDEX _iThreadIndex = 0;
+
+// take and do jobs from current batch until there are none left
+static void DoJobs(void)
+{
+  for (;;) {
+    const INDEX iJob = InterlockedIncrement(&_lNextJob)-1;
+    if (iJob>=_ctJobs) {
+      break;
+    }
+    _pJobFunction(iJob, _pvJobData);
+  }
+}
+
+static DWORD WINAPI WorkerThread(LPVOID lpParameter)
+{
+  _iThreadIndex = (INDEX)lpParameter;
+  for (;;) {
+    WaitForSingleObject(_hStartSemaphore, INFINITE);
+    if (_bQuitWorkers) {
+      break;
+    }
+    DoJobs();
+    if (InterlockedDecrement(&_lBusyWorkers)==0) {
+      SetEvent(_hDoneEvent);
+    }
+  }
+  return 0;
+}
+
+static void StartWorkers(void)
+{
+  _bWorkersStarted = TRUE;
+
+  SYSTEM_INFO si;
+  GetSystemInfo(&si);
+  INDEX ctWorkers = Clamp(INDEX(si.dwNumberOfProcessors)-1, INDEX(0), INDEX(JOB_MAX_THREADS-1));
+  if (ctWorkers==0) {
+    return;
+  }
+
+  _hStartSemaphore = CreateSemaphore(NULL, 0, JOB_MAX_THREADS, NULL);
+  _hDoneEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+  if (_hStartSemaphore==NULL || _hDoneEvent==NULL) {
+    JOB_EndWorkers();
+    _bWorkersStarted = TRUE;  // don't retry, just run everything on the main thread
+    return;
+  }
+  _bQuitWorkers = FALSE;
+  for (INDEX iWorker=0; iWorker<ctWorkers; iWorker++) {
+    DWORD dwThreadID;
+    HANDLE hThread = CreateThread(NULL, 0, WorkerThread, (LPVOID)(iWorker+1), 0, &dwThreadID);
+    if (hThread==NULL) {
+      break;
+    }
+    _ahWorkers[_ctWorkers++] = hThread;
+  }
+  CPrintF(TRANS("Started %d job worker threads\n"), _ctWorkers);
+}
+
+// stop all worker threads
+void JOB_EndWorkers(void)
+{
+  ASSERT(_iThreadIndex==0);
+  if (_ctWorkers>0) {
+    _bQuitWorkers = TRUE;
+    ReleaseSemaphore(_hStartSemaphore, _ctWorkers, NULL);
+    WaitForMultipleObjects(_ctWorkers, _ahWorkers, TRUE, INFINITE);
+    for (INDEX iWorker=0; iWorker<_ctWorkers; iWorker++) {
+      CloseHandle(_ahWorkers[iWorker]);
+    }
+    _ctWorkers = 0;
+  }
+  if (_hStartSemaphore!=NULL) {
+    CloseHandle(_hStartSemaphore);
+    _hStartSemaphore = NULL;
+  }
+  if (_hDoneEvent!=NULL) {
+    CloseHandle(_hDoneEvent);
+    _hDoneEvent = NULL;
+  }
+  _bWorkersStarted = FALSE;
+}
+
+// get number of threads that take part in JOB_Run()
+INDEX JOB_GetThreadCount(void)
+{
+  if (!_bWorkersStarted) {
+    StartWorkers();
+  }
+  return _ctWorkers+1;
+}
+
+// get index of the thread executing current code (0 for the main thread)
+INDEX JOB_GetThreadIndex(void)
+{
+  return _iThreadIndex;
+}
+
+// run jobs 0..ctJobs-1 on worker threads and on the calling thread, return when all are done
+void JOB_Run(INDEX ctJobs, JobFunction *pFunction, void *pvData)
+{
+  if (ctJobs<=0) {
+    return;
+  }
+  if (!_bWorkersStarted) {
+    StartWorkers();
+  }
+  // if no workers, or just one job, or called from inside a job
+  if (_ctWorkers==0 || ctJobs==1 || _iThreadIndex!=0) {
+    // just do all jobs here
+    for (INDEX iJob=0; iJob<ctJobs; iJob++) {
+      pFunction(iJob, pvData);
+    }
+    return;
+  }
+
+  // wake only as many workers as there is use for
+  const INDEX ctWorkers = Min(_ctWorkers, ctJobs-1);
+  _pJobFunction = pFunction;
+  _pvJobData = pvData;
+  _ctJobs = ctJobs;
+  _lNextJob = 0;
+  _lBusyWorkers = ctWorkers;
+  ReleaseSemaphore(_hStartSemaphore, ctWorkers, NULL);
+
+  // help with the jobs and wait for the workers to finish
+  DoJobs();
+  WaitForSingleObject(_hDoneEvent, INFINITE);
+
+  _pJobFunction = NULL;
+  _pvJobData = NULL;
+  _ctJobs = 0;
+}
@@ -0,0 +1,40 @@
+/* Copyright (c) 2002-2012 Croteam Ltd.
+This program is free software; you can redistribute it and/or modify
+it under the terms of version 2 of the GNU General Public License as published by
+the Free Software Foundation
+
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA. */
+
+#ifndef SE_INCL_JOBS_H
+#define SE_INCL_JOBS_H
+#ifdef PRAGMA_ONCE
+  #pragma once
+#endif
+
+// max number of threads that can take part in a batch of jobs (including the calling one)
+#define JOB_MAX_THREADS 16
+
+// function that does one job of a batch
+typedef void JobFunction(INDEX iJob, void *pvData);
+
+// run jobs 0..ctJobs-1 on worker threads and on the calling thread, return when all are done
+// NOTE: order in which jobs are done is undefined, each job must touch only its own data
+ENGINE_API void JOB_Run(INDEX ctJobs, JobFunction *pFunction, void *pvData);
+// get number of threads that take part in JOB_Run()
+ENGINE_API INDEX JOB_GetThreadCount(void);
+// get index of the thread executing current code (0 for the main thread)
+ENGINE_API INDEX JOB_GetThreadIndex(void);
+// stop all worker threads
+ENGINE_API void JOB_EndWorkers(void);
+
+
+#endif  /* include-once check. */
+
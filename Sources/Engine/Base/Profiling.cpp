@@ -16,6 +16,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "stdh.h"
 
 #include <Engine/Base/Profiling.h>
+#include <Engine/Base/Jobs.h>
 
 #include <Engine/Templates/StaticArray.cpp>
 template CStaticArray<CProfileCounter>;
@@ -187,6 +188,10 @@ const CTString &CProfileForm::GetTimerName(INDEX iTimer)
 /* Start a timer. */
 void CProfileForm::StartTimer_internal(INDEX iTimer)
 {
+  // timers are not thread safe, so only main thread is profiled
+  if (JOB_GetThreadIndex()!=0) {
+    return;
+  }
   CProfileTimer &pt = pf_aptTimers[iTimer];
   //ASSERT(pt.pt_tvStarted.tv_llValue<0);
   CTimerValue tvNow = CTimerValue(ReadTSC_profile())-_tvCurrentProfilingEpsilon;
@@ -201,6 +206,10 @@ void CProfileForm::StartTimer_internal(INDEX iTimer)
 /* Stop a timer. */
 void CProfileForm::StopTimer_internal(INDEX iTimer)
 {
+  // timers are not thread safe, so only main thread is profiled
+  if (JOB_GetThreadIndex()!=0) {
+    return;
+  }
   CProfileTimer &pt = pf_aptTimers[iTimer];
   //ASSERT(pt.pt_tvStarted.tv_llValue>0);
   CTimerValue tvNow = CTimerValue(ReadTSC_profile())-_tvCurrentProfilingEpsilon;
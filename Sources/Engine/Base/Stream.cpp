@@ -873,6 +873,7 @@ CTFileStream::CTFileStream(void)
   fstrm_iZipHandle = -1;
   fstrm_iZipLocation = 0;
   fstrm_pubZipBuffer = NULL;
+  fstrm_bZipBufferMapped = FALSE;
 }
 
 /*
@@ -917,9 +918,14 @@ void CTFileStream::Open_t(const CTFileName &fnFileName, CTStream::OpenMode om/*=
       // open from zip
       fstrm_iZipHandle = UNZIPOpen_t(fnmFullFileName);
       fstrm_slZipSize = UNZIPGetSize(fstrm_iZipHandle);
-      // load the file from the zip in the buffer
-      fstrm_pubZipBuffer = (UBYTE*)VirtualAlloc(NULL, fstrm_slZipSize, MEM_COMMIT, PAGE_READWRITE);
-      UNZIPReadBlock_t(fstrm_iZipHandle, (UBYTE*)fstrm_pubZipBuffer, 0, fstrm_slZipSize);
+      // if the file is stored in a mapped archive
+      fstrm_pubZipBuffer = (UBYTE*)UNZIPGetStoredData(fstrm_iZipHandle);
+      fstrm_bZipBufferMapped = fstrm_pubZipBuffer!=NULL;
+      if (!fstrm_bZipBufferMapped) {
+        // load the file from the zip in the buffer
+        fstrm_pubZipBuffer = (UBYTE*)VirtualAlloc(NULL, fstrm_slZipSize, MEM_COMMIT, PAGE_READWRITE);
+        UNZIPReadBlock_t(fstrm_iZipHandle, (UBYTE*)fstrm_pubZipBuffer, 0, fstrm_slZipSize);
+      }
     // if it is a physical file
     } else if (iFile==EFP_FILE) {
       // open file in read only mode
@@ -1023,10 +1029,17 @@ void CTFileStream::Close(void)
     UNZIPClose(fstrm_iZipHandle);
     fstrm_iZipHandle = -1;
 
-    VirtualFree(fstrm_pubZipBuffer, 0, MEM_RELEASE);
+    // if buffer was just pointing into the mapped archive
+    if (fstrm_bZipBufferMapped) {
+      // nothing to free
+      fstrm_pubZipBuffer = NULL;
+      fstrm_bZipBufferMapped = FALSE;
+    } else {
+      VirtualFree(fstrm_pubZipBuffer, 0, MEM_RELEASE);
 
-    _ulVirtuallyAllocatedSpace -= fstrm_slZipSize;
-    //CPrintF("Freed virtual memory with size ^c00ff00%d KB^C (now %d KB)\n", (fstrm_slZipSize / 1000), (_ulVirtuallyAllocatedSpace / 1000));
+      _ulVirtuallyAllocatedSpace -= fstrm_slZipSize;
+      //CPrintF("Freed virtual memory with size ^c00ff00%d KB^C (now %d KB)\n", (fstrm_slZipSize / 1000), (_ulVirtuallyAllocatedSpace / 1000));
+    }
   }
 
   // clear dictionary vars
@@ -239,6 +239,7 @@ private:
   INDEX fstrm_iZipLocation; // location in zip-file entry
   UBYTE* fstrm_pubZipBuffer; // buffer for zip-file entry
   SLONG fstrm_slZipSize; // size of the zip-file entry
+  BOOL fstrm_bZipBufferMapped; // set if buffer points into mapped archive instead of being allocated
 
   BOOL fstrm_bReadOnly;  // set if file is opened in read-only mode
 public:
@@ -22,7 +22,9 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <Engine/Base/Translation.h>
 #include <Engine/Base/ErrorReporting.h>
 #include <Engine/Base/Console.h>
+#include <Engine/Base/CRC.h>
 #include <Engine/Base/Synchronization.h>
+#include <Engine/Base/Timer.h>
 #include <Engine/Math/Functions.h>
 
 #include <Engine/Templates/StaticArray.cpp>
@@ -122,15 +124,23 @@ public:
   }
 };
 
+// size of history of decompressed data kept for seeking back (must be power of 2)
+#define ZIP_HISTORY_SIZE (64*1024)
+
 // an open instance of a file inside a zip
 class CZipHandle {
 public:
   BOOL zh_bOpen;          // set if the handle is used
   CZipEntry zh_zeEntry;   // the entry itself
   z_stream zh_zstream;    // zlib filestream for decompression
-  FILE *zh_fFile;         // open handle of the archive
+  FILE *zh_fFile;         // open handle of the archive (if not mapped)
 #define BUF_SIZE  1024
-  UBYTE *zh_pubBufIn;     // input buffer
+  UBYTE *zh_pubBufIn;     // input buffer (if not mapped)
+  void *zh_pvView;        // mapped view of the archive around the entry (NULL if not mapped)
+  UBYTE *zh_pubData;      // entry data inside the view
+  SLONG zh_slDataInView;  // size of view from start of entry data on
+  UBYTE *zh_pubHistory;   // last decompressed bytes (NULL until entry is read in parts)
+  SLONG zh_slHistoryStart;  // decompressed position where history starts being valid
 
   CZipHandle(void);
   void Clear(void);
@@ -167,15 +177,19 @@ CZipHandle::CZipHandle(void)
   zh_bOpen = FALSE;
   zh_fFile = NULL;
   zh_pubBufIn = NULL;
+  zh_pvView = NULL;
+  zh_pubData = NULL;
+  zh_slDataInView = 0;
+  zh_pubHistory = NULL;
+  zh_slHistoryStart = 0;
   memset(&zh_zstream, 0, sizeof(zh_zstream));
 }
+// NOTE: must be called with zip_csLock locked, as it releases the handle for reuse
 void CZipHandle::Clear(void) 
 {
-  zh_bOpen = FALSE;
   zh_zeEntry.Clear();
 
   // clear the zlib stream
-  CTSingleLock slZip(&zip_csLock, TRUE);
   inflateEnd(&zh_zstream);
   memset(&zh_zstream, 0, sizeof(zh_zstream));
 
@@ -184,11 +198,25 @@ void CZipHandle::Clear(void)
     FreeMemory(zh_pubBufIn);
     zh_pubBufIn = NULL;
   }
+  if (zh_pubHistory!=NULL) {
+    FreeMemory(zh_pubHistory);
+    zh_pubHistory = NULL;
+  }
+  zh_slHistoryStart = 0;
   // close the zip archive file
   if (zh_fFile!=NULL) {
     fclose(zh_fFile);
     zh_fFile = NULL;
   }
+  // unmap the archive
+  if (zh_pvView!=NULL) {
+    UnmapViewOfFile(zh_pvView);
+    zh_pvView = NULL;
+  }
+  zh_pubData = NULL;
+  zh_slDataInView = 0;
+
+  zh_bOpen = FALSE;
 }
 void CZipHandle::ThrowZLIBError_t(int ierr, const CTString &strDescription)
 {
@@ -200,10 +228,74 @@ void CZipHandle::ThrowZLIBError_t(int ierr, const CTString &strDescription)
 
 // all files in all active zip archives
 static CStaticStackArray<CZipEntry>  _azeFiles;
-// handles for currently open files
-static CStaticStackArray<CZipHandle> _azhHandles;
+// handles for currently open files (pointers, so they don't move while read from other threads)
+// NOTE: the array itself is accessed only with zip_csLock locked, but reading an open handle
+// isn't, since each handle is used by only one reader at a time
+static CStaticStackArray<CZipHandle *> _apzhHandles;
 // filenames of all archives
 static CStaticStackArray<CTFileName> _afnmArchives;
+// hash table of indices in _azeFiles, by filename (-1 for empty slot)
+static CStaticArray<INDEX> _aiFileSlots;
+static INDEX _ctIndexedFiles = 0;   // number of files that were indexed
+
+// memory mapping of an archive
+class CZipArchiveMap {
+public:
+  BOOL zam_bTried;      // set once mapping was attempted
+  HANDLE zam_hMapping;  // file mapping object (NULL if it failed)
+  SLONG zam_slSize;     // size of the archive file
+  CZipArchiveMap(void) { zam_bTried = FALSE; zam_hMapping = NULL; zam_slSize = 0; }
+};
+// mappings of archives, in same order as their filenames
+static CStaticArray<CZipArchiveMap> _azamArchiveMaps;
+// set to read archives through fopen/fread only (changed only with zip_csLock locked)
+static BOOL _bNoArchiveMapping = FALSE;
+
+// case insensitive hash of a filename
+static ULONG FileNameHash(const char *str)
+{
+  ULONG ulHash = 2166136261UL;
+  for (; *str!=0; str++) {
+    ulHash ^= (UBYTE)tolower((UBYTE)*str);
+    ulHash *= 16777619UL;
+  }
+  return ulHash;
+}
+
+// rebuild the filename hash for all files in active set
+static void IndexFiles(void)
+{
+  // make table at least twice as large as number of files (size must be power of 2)
+  INDEX ctSlots = 1024;
+  while (ctSlots<_azeFiles.Count()*2) {
+    ctSlots*=2;
+  }
+  _aiFileSlots.Clear();
+  _aiFileSlots.New(ctSlots);
+  for (INDEX iSlot=0; iSlot<ctSlots; iSlot++) {
+    _aiFileSlots[iSlot] = -1;
+  }
+
+  // for each file, in order of priority
+  for (INDEX iFile=0; iFile<_azeFiles.Count(); iFile++) {
+    const CTFileName &fnm = _azeFiles[iFile].ze_fnm;
+    INDEX iSlot = FileNameHash(fnm)&(ctSlots-1);
+    for (;;) {
+      INDEX iInSlot = _aiFileSlots[iSlot];
+      // if free, put it here
+      if (iInSlot<0) {
+        _aiFileSlots[iSlot] = iFile;
+        break;
+      }
+      // if same name is already in, it overrides this one
+      if (_azeFiles[iInSlot].ze_fnm==fnm) {
+        break;
+      }
+      iSlot = (iSlot+1)&(ctSlots-1);
+    }
+  }
+  _ctIndexedFiles = _azeFiles.Count();
+}
 
 // convert slashes to backslashes in a file path
 void ConvertSlashes(char *p)
@@ -459,6 +551,17 @@ void UNZIPReadDirectoriesReverse_t(void)
     }
   }
 
+  // index all files that were read
+  IndexFiles();
+  // archives will be mapped when first needed
+  {for (INDEX iMap=0; iMap<_azamArchiveMaps.Count(); iMap++) {
+    if (_azamArchiveMaps[iMap].zam_hMapping!=NULL) {
+      CloseHandle(_azamArchiveMaps[iMap].zam_hMapping);
+    }
+  }}
+  _azamArchiveMaps.Clear();
+  _azamArchiveMaps.New(_afnmArchives.Count());
+
   // if there were errors
   if (strAllErrors!="") {
     // report them
@@ -469,14 +572,7 @@ void UNZIPReadDirectoriesReverse_t(void)
 // check if a zip file entry exists
 BOOL UNZIPFileExists(const CTFileName &fnm)
 {
-  // for each file
-  for(INDEX iFile=0; iFile<_azeFiles.Count(); iFile++) {
-    // if it is that one
-    if (_azeFiles[iFile].ze_fnm == fnm) {
-      return TRUE;
-    }
-  }
-  return FALSE;
+  return UNZIPGetFileIndex(fnm)>=0;
 }
 
 // enumeration for all files in all zips
@@ -497,33 +593,134 @@ BOOL UNZIPIsFileAtIndexMod(INDEX i)
 // get index of a file (-1 for no file)
 INDEX UNZIPGetFileIndex(const CTFileName &fnm)
 {
-  // for each file
-  for(INDEX iFile=0; iFile<_azeFiles.Count(); iFile++) {
-    // if it is that one
+  // if no files
+  if (_azeFiles.Count()==0) {
+    return -1;
+  }
+  // if files changed since they were indexed
+  if (_ctIndexedFiles!=_azeFiles.Count()) {
+    // index them again
+    IndexFiles();
+  }
+
+  // probe the hash until the file or an empty slot is found
+  const INDEX ctSlots = _aiFileSlots.Count();
+  INDEX iSlot = FileNameHash(fnm)&(ctSlots-1);
+  for (;;) {
+    INDEX iFile = _aiFileSlots[iSlot];
+    if (iFile<0) {
+      return -1;
+    }
     if (_azeFiles[iFile].ze_fnm == fnm) {
       return iFile;
     }
+    iSlot = (iSlot+1)&(ctSlots-1);
   }
-  return -1;
 }
 
-// get info on a zip file entry
-void UNZIPGetFileInfo(INDEX iHandle, CTFileName &fnmZip, 
-  SLONG &slOffset, SLONG &slSizeCompressed, SLONG &slSizeUncompressed, 
-  BOOL &bCompressed)
+// max number of names looked up in archive lookup benchmark
+#define LOOKUP_BENCHMARK_NAMES 2000
+
+// look up archived file names (a sample of them if there are many) and same names with
+// an extension that isn't there, by linear search as it used to be done and through the index
+void BenchmarkArchiveLookup(void)
 {
+  const INDEX ctFiles = _azeFiles.Count();
+  if (ctFiles==0) {
+    CPrintF(TRANS("No archived files to look up.\n"));
+    return;
+  }
+  if (_ctIndexedFiles!=ctFiles) {
+    IndexFiles();
+  }
+
+  // pick names to look up, half of them found and half missing
+  const INDEX iStep = ctFiles/LOOKUP_BENCHMARK_NAMES+1;
+  CStaticStackArray<CTFileName> afnmNames;
+  {for (INDEX iFile=0; iFile<ctFiles; iFile+=iStep) {
+    afnmNames.Push() = _azeFiles[iFile].ze_fnm;
+  }}
+  const INDEX ctFound = afnmNames.Count();
+  {for (INDEX iName=0; iName<ctFound; iName++) {
+    afnmNames.Push() = afnmNames[iName]+CTString(".missing");
+  }}
+  const INDEX ctNames = afnmNames.Count();
+
+  // find each name both ways
+  CStaticArray<INDEX> aiFound[2];
+  DOUBLE adSeconds[2][2];
+  {for (INDEX iMethod=0; iMethod<2; iMethod++) {
+    aiFound[iMethod].New(ctNames);
+    for (INDEX iHalf=0; iHalf<2; iHalf++) {
+      CTimerValue tvStart = _pTimer->GetHighPrecisionTimer();
+      for (INDEX iName=iHalf*ctFound; iName<(iHalf+1)*ctFound; iName++) {
+        const CTFileName &fnm = afnmNames[iName];
+        INDEX iFound = -1;
+        if (iMethod==0) {
+          for (INDEX iFile=0; iFile<ctFiles; iFile++) {
+            if (_azeFiles[iFile].ze_fnm == fnm) {
+              iFound = iFile;
+              break;
+            }
+          }
+        } else {
+          iFound = UNZIPGetFileIndex(fnm);
+        }
+        aiFound[iMethod][iName] = iFound;
+      }
+      adSeconds[iMethod][iHalf] = (_pTimer->GetHighPrecisionTimer()-tvStart).GetSeconds();
+    }
+  }}
+
+  INDEX ctMismatches = 0;
+  {for (INDEX iName=0; iName<ctNames; iName++) {
+    if (aiFound[0][iName]!=aiFound[1][iName]) {
+      ctMismatches++;
+    }
+  }}
+
+  CPrintF(TRANS("%d archived files, %d names looked up (%d found, %d missing)\n"),
+    ctFiles, ctNames, ctFound, ctNames-ctFound);
+  CPrintF(TRANS("  linear search: %.2fus per found name, %.2fus per missing name\n"),
+    adSeconds[0][0]*1E6/ctFound, adSeconds[0][1]*1E6/ctFound);
+  CPrintF(TRANS("  index:         %.2fus per found name, %.2fus per missing name\n"),
+    adSeconds[1][0]*1E6/ctFound, adSeconds[1][1]*1E6/ctFound);
+  if (ctMismatches>0) {
+    CPrintF(TRANS("  %d names found DIFFERENTLY!\n"), ctMismatches);
+  } else {
+    CPrintF(TRANS("  both found the same files\n"));
+  }
+}
+
+// get an open handle (NULL if invalid)
+static CZipHandle *GetOpenHandle(INDEX iHandle)
+{
+  CTSingleLock slZip(&zip_csLock, TRUE);
   // check handle number
-  if(iHandle<0 || iHandle>=_azhHandles.Count()) {
+  if(iHandle<0 || iHandle>=_apzhHandles.Count()) {
     ASSERT(FALSE);
-    return;
+    return NULL;
   }
-  // get the handle
-  CZipHandle &zh = _azhHandles[iHandle];
   // check the handle
-  if (!zh.zh_bOpen) {
+  CZipHandle *pzh = _apzhHandles[iHandle];
+  if (!pzh->zh_bOpen) {
     ASSERT(FALSE);
+    return NULL;
+  }
+  return pzh;
+}
+
+// get info on a zip file entry
+void UNZIPGetFileInfo(INDEX iHandle, CTFileName &fnmZip, 
+  SLONG &slOffset, SLONG &slSizeCompressed, SLONG &slSizeUncompressed, 
+  BOOL &bCompressed)
+{
+  // get the handle
+  CZipHandle *pzh = GetOpenHandle(iHandle);
+  if (pzh==NULL) {
     return;
   }
+  CZipHandle &zh = *pzh;
 
   // get parameters
   fnmZip = *zh.zh_zeEntry.ze_pfnmArchive;
@@ -533,18 +730,89 @@ void UNZIPGetFileInfo(INDEX iHandle, CTFileName &fnmZip,
   slSizeUncompressed = zh.zh_zeEntry.ze_slUncompressedSize;
 }
 
+// get mapping of an archive (NULL if it cannot be mapped)
+// NOTE: must be called with zip_csLock locked
+static HANDLE GetArchiveMapping(const CTFileName *pfnmArchive, SLONG &slSize)
+{
+  // find the archive
+  INDEX iArchive = pfnmArchive-&_afnmArchives[0];
+  if (iArchive<0 || iArchive>=_azamArchiveMaps.Count()) {
+    return NULL;
+  }
+  CZipArchiveMap &zam = _azamArchiveMaps[iArchive];
+
+  // if not tried to map yet
+  if (!zam.zam_bTried) {
+    zam.zam_bTried = TRUE;
+    // map the whole file (this takes no address space until viewed)
+    HANDLE hFile = CreateFileA(*pfnmArchive, GENERIC_READ, FILE_SHARE_READ, NULL,
+      OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile!=INVALID_HANDLE_VALUE) {
+      zam.zam_slSize = GetFileSize(hFile, NULL);
+      zam.zam_hMapping = CreateFileMappingA(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+      // the mapping keeps the file open by itself
+      CloseHandle(hFile);
+    }
+  }
+  slSize = zam.zam_slSize;
+  return zam.zam_hMapping;
+}
+
+// map view of the archive around an entry, and find its data there (FALSE if not possible)
+// NOTE: must be called with zip_csLock locked
+static BOOL MapEntry(CZipHandle &zh)
+{
+  SLONG slArchiveSize;
+  HANDLE hMapping = GetArchiveMapping(zh.zh_zeEntry.ze_pfnmArchive, slArchiveSize);
+  if (hMapping==NULL) {
+    return FALSE;
+  }
+
+  // entry offset still points to its local header here
+  const SLONG slHeader = zh.zh_zeEntry.ze_slDataOffset;
+  const SLONG slHeaderSize = sizeof(int)+sizeof(LocalFileHeader);
+  // view must start at allocation granularity
+  SYSTEM_INFO si;
+  GetSystemInfo(&si);
+  const SLONG slViewStart = slHeader-slHeader%si.dwAllocationGranularity;
+  // view must hold the header, filename and extra field (up to 64k each), the data,
+  // and one byte more, that inflate needs when there is no zlib header
+  SLONG slViewEnd = slHeader+slHeaderSize+2*65536+zh.zh_zeEntry.ze_slCompressedSize+1;
+  slViewEnd = Min(slViewEnd, slArchiveSize);
+  if (slHeader+slHeaderSize>slViewEnd) {
+    return FALSE;
+  }
+  zh.zh_pvView = MapViewOfFile(hMapping, FILE_MAP_READ, 0, slViewStart, slViewEnd-slViewStart);
+  if (zh.zh_pvView==NULL) {
+    return FALSE;
+  }
+
+  // check the header (if anything is wrong, file reading will report it)
+  UBYTE *pubHeader = (UBYTE*)zh.zh_pvView+(slHeader-slViewStart);
+  const LocalFileHeader &lfh = *(LocalFileHeader*)(pubHeader+sizeof(int));
+  const SLONG slData = slHeader+slHeaderSize+lfh.lfh_swFileNameLen+lfh.lfh_swExtraFieldLen;
+  if (*(int*)pubHeader!=SIGNATURE_LFH
+    ||slViewEnd-slData<zh.zh_zeEntry.ze_slCompressedSize) {
+    UnmapViewOfFile(zh.zh_pvView);
+    zh.zh_pvView = NULL;
+    return FALSE;
+  }
+
+  // determine exact compressed data position
+  zh.zh_zeEntry.ze_slDataOffset = slData;
+  zh.zh_pubData = (UBYTE*)zh.zh_pvView+(slData-slViewStart);
+  zh.zh_slDataInView = slViewEnd-slData;
+  return TRUE;
+}
+
 // open a zip file entry for reading
 INDEX UNZIPOpen_t(const CTFileName &fnm)
 {
   CZipEntry *pze = NULL;
-  // for each file
-  for(INDEX iFile=0; iFile<_azeFiles.Count(); iFile++) {
-    // if it is that one
-    if (_azeFiles[iFile].ze_fnm == fnm) {
-      // stop searching
-      pze = &_azeFiles[iFile];
-      break;
-    }
+  // find the file
+  INDEX iFile = UNZIPGetFileIndex(fnm);
+  if (iFile>=0) {
+    pze = &_azeFiles[iFile];
   }
 
   // if not found
@@ -553,12 +821,14 @@ INDEX UNZIPOpen_t(const CTFileName &fnm)
     ThrowF_t(TRANS("File not found: %s"), (const CTString&)fnm);
   }
 
+  CTSingleLock slZip(&zip_csLock, TRUE);
+
   // for each existing handle
   BOOL bHandleFound = FALSE;
   INDEX iHandle=1;
-  for (; iHandle<_azhHandles.Count(); iHandle++) {
+  for (; iHandle<_apzhHandles.Count(); iHandle++) {
     // if unused
-    if (!_azhHandles[iHandle].zh_bOpen) {
+    if (!_apzhHandles[iHandle]->zh_bOpen) {
       // use that one
       bHandleFound = TRUE;
       break;
@@ -567,50 +837,58 @@ INDEX UNZIPOpen_t(const CTFileName &fnm)
   // if no free handle found
   if (!bHandleFound) {
     // create a new one
-    iHandle = _azhHandles.Count();
-    _azhHandles.Push(1);
+    iHandle = _apzhHandles.Count();
+    _apzhHandles.Push() = new CZipHandle;
   }
   
   // get the handle
-  CZipHandle &zh = _azhHandles[iHandle];
+  CZipHandle &zh = *_apzhHandles[iHandle];
   ASSERT(!zh.zh_bOpen);
   zh.zh_zeEntry = *pze;
 
-  // open zip archive for reading
-  zh.zh_fFile = fopen(*pze->ze_pfnmArchive, "rb");
-  // if failed to open it
-  if (zh.zh_fFile==NULL) {
-    // clear the handle
-    zh.Clear();
-    // fail
-    ThrowF_t(TRANS("Cannot open '%s': %s"), (const CTString&)*pze->ze_pfnmArchive,
-      strerror(errno));
-  }
-  // seek to the local header of the entry
-  fseek(zh.zh_fFile, zh.zh_zeEntry.ze_slDataOffset, SEEK_SET);
-  // read the sig
-  int slSig;
-  fread(&slSig, sizeof(slSig), 1, zh.zh_fFile);
-  // if this is not the expected sig
-  if (slSig!=SIGNATURE_LFH) {
-    // fail
-    ThrowF_t(TRANS("%s/%s: Wrong signature for 'local file header'"), 
-      (CTString&)*zh.zh_zeEntry.ze_pfnmArchive, zh.zh_zeEntry.ze_fnm);
-  }
-  // read the header
-  LocalFileHeader lfh;
-  fread(&lfh, sizeof(lfh), 1, zh.zh_fFile);
-  // determine exact compressed data position
-  zh.zh_zeEntry.ze_slDataOffset = 
-    ftell(zh.zh_fFile)+lfh.lfh_swFileNameLen+lfh.lfh_swExtraFieldLen;
-  // seek there
-  fseek(zh.zh_fFile, zh.zh_zeEntry.ze_slDataOffset, SEEK_SET);
+  // if the archive can be mapped
+  if (!_bNoArchiveMapping && MapEntry(zh)) {
+    // entry will be read right from memory
 
-  // allocate buffers
-  zh.zh_pubBufIn  = (UBYTE*)AllocMemory(BUF_SIZE);
+  // otherwise
+  } else {
+    // open zip archive for reading
+    zh.zh_fFile = fopen(*pze->ze_pfnmArchive, "rb");
+    // if failed to open it
+    if (zh.zh_fFile==NULL) {
+      // clear the handle
+      zh.Clear();
+      // fail
+      ThrowF_t(TRANS("Cannot open '%s': %s"), (const CTString&)*pze->ze_pfnmArchive,
+        strerror(errno));
+    }
+    // seek to the local header of the entry
+    fseek(zh.zh_fFile, zh.zh_zeEntry.ze_slDataOffset, SEEK_SET);
+    // read the sig
+    int slSig;
+    fread(&slSig, sizeof(slSig), 1, zh.zh_fFile);
+    // if this is not the expected sig
+    if (slSig!=SIGNATURE_LFH) {
+      // clear the handle
+      zh.Clear();
+      // fail
+      ThrowF_t(TRANS("%s/%s: Wrong signature for 'local file header'"), 
+        (CTString&)*pze->ze_pfnmArchive, pze->ze_fnm);
+    }
+    // read the header
+    LocalFileHeader lfh;
+    fread(&lfh, sizeof(lfh), 1, zh.zh_fFile);
+    // determine exact compressed data position
+    zh.zh_zeEntry.ze_slDataOffset = 
+      ftell(zh.zh_fFile)+lfh.lfh_swFileNameLen+lfh.lfh_swExtraFieldLen;
+    // seek there
+    fseek(zh.zh_fFile, zh.zh_zeEntry.ze_slDataOffset, SEEK_SET);
+
+    // allocate buffers
+    zh.zh_pubBufIn  = (UBYTE*)AllocMemory(BUF_SIZE);
+  }
 
   // initialize zlib stream
-  CTSingleLock slZip(&zip_csLock, TRUE);
   zh.zh_zstream.next_out  = NULL;
   zh.zh_zstream.avail_out = 0;
   zh.zh_zstream.next_in   = NULL;
@@ -621,12 +899,13 @@ INDEX UNZIPOpen_t(const CTFileName &fnm)
   // if failed
   if (err!=Z_OK) {
     // clean up what is possible
-    FreeMemory(zh.zh_pubBufIn );
-    zh.zh_pubBufIn  = NULL;
-    fclose(zh.zh_fFile);
-    zh.zh_fFile = NULL;
+    CTString strError;
+    strError.PrintF(TRANS("(%s/%s) %s - ZLIB error: %s - %s"), 
+      (const CTString&)*pze->ze_pfnmArchive, (const CTString&)pze->ze_fnm,
+      TRANS("Cannot init inflation"), GetZlibError(err), zh.zh_zstream.msg);
+    zh.Clear();
     // throw error
-    zh.ThrowZLIBError_t(err, TRANS("Cannot init inflation"));
+    ThrowF_t("%s", strError);
   }
 
   // return the handle successfully
@@ -637,56 +916,111 @@ INDEX UNZIPOpen_t(const CTFileName &fnm)
 // get uncompressed size of a file
 SLONG UNZIPGetSize(INDEX iHandle)
 {
-  // check handle number
-  if(iHandle<0 || iHandle>=_azhHandles.Count()) {
-    ASSERT(FALSE);
-    return 0;
-  }
   // get the handle
-  CZipHandle &zh = _azhHandles[iHandle];
-  // check the handle
-  if (!zh.zh_bOpen) {
-    ASSERT(FALSE);
+  CZipHandle *pzh = GetOpenHandle(iHandle);
+  if (pzh==NULL) {
     return 0;
   }
 
-  return zh.zh_zeEntry.ze_slUncompressedSize;
+  return pzh->zh_zeEntry.ze_slUncompressedSize;
 }
 
 // get CRC of a file
 ULONG UNZIPGetCRC(INDEX iHandle)
 {
-  // check handle number
-  if(iHandle<0 || iHandle>=_azhHandles.Count()) {
-    ASSERT(FALSE);
+  // get the handle
+  CZipHandle *pzh = GetOpenHandle(iHandle);
+  if (pzh==NULL) {
     return 0;
   }
+
+  return pzh->zh_zeEntry.ze_ulCRC;
+}
+
+// get data of a stored file, if it can be read without copying (NULL if not)
+const UBYTE *UNZIPGetStoredData(INDEX iHandle)
+{
   // get the handle
-  CZipHandle &zh = _azhHandles[iHandle];
-  // check the handle
-  if (!zh.zh_bOpen) {
-    ASSERT(FALSE);
-    return 0;
+  CZipHandle *pzh = GetOpenHandle(iHandle);
+  if (pzh==NULL || !pzh->zh_zeEntry.ze_bStored) {
+    return NULL;
   }
 
-  return zh.zh_zeEntry.ze_ulCRC;
+  return pzh->zh_pubData;
 }
 
-// read a block from zip file
-void UNZIPReadBlock_t(INDEX iHandle, UBYTE *pub, SLONG slStart, SLONG slLen)
+// give zlib more compressed input (FALSE if there is no more)
+static BOOL FeedInput(CZipHandle &zh)
 {
-  // check handle number
-  if(iHandle<0 || iHandle>=_azhHandles.Count()) {
-    ASSERT(FALSE);
+  // if mapped
+  if (zh.zh_pubData!=NULL) {
+    // give it all that is left
+    SLONG slLeft = zh.zh_slDataInView-zh.zh_zstream.total_in;
+    if (slLeft<=0) {
+      return FALSE;
+    }
+    zh.zh_zstream.next_in = zh.zh_pubData+zh.zh_zstream.total_in;
+    zh.zh_zstream.avail_in = slLeft;
+    return TRUE;
+  }
+
+  // read more to it
+  SLONG slRead = fread(zh.zh_pubBufIn, 1, BUF_SIZE, zh.zh_fFile);
+  if (slRead<=0) {
+    return FALSE;
+  }
+  // tell zlib that there is more to read
+  zh.zh_zstream.next_in = zh.zh_pubBufIn;
+  zh.zh_zstream.avail_in  = slRead;
+  return TRUE;
+}
+
+// remember decompressed data that has just been output, in history
+static void RememberOutput(CZipHandle &zh, const UBYTE *pub, SLONG slCount)
+{
+  if (zh.zh_pubHistory==NULL) {
     return;
   }
+  SLONG slPos = zh.zh_zstream.total_out-slCount;
+  // only the last part fits
+  if (slCount>ZIP_HISTORY_SIZE) {
+    pub += slCount-ZIP_HISTORY_SIZE;
+    slPos += slCount-ZIP_HISTORY_SIZE;
+    slCount = ZIP_HISTORY_SIZE;
+  }
+  // copy it around the ring
+  while (slCount>0) {
+    SLONG slOffset = slPos&(ZIP_HISTORY_SIZE-1);
+    SLONG slChunk = Min(slCount, ZIP_HISTORY_SIZE-slOffset);
+    memcpy(zh.zh_pubHistory+slOffset, pub, slChunk);
+    pub += slChunk;
+    slPos += slChunk;
+    slCount -= slChunk;
+  }
+}
+
+// copy decompressed data from history
+static void CopyFromHistory(CZipHandle &zh, UBYTE *pub, SLONG slPos, SLONG slCount)
+{
+  while (slCount>0) {
+    SLONG slOffset = slPos&(ZIP_HISTORY_SIZE-1);
+    SLONG slChunk = Min(slCount, ZIP_HISTORY_SIZE-slOffset);
+    memcpy(pub, zh.zh_pubHistory+slOffset, slChunk);
+    pub += slChunk;
+    slPos += slChunk;
+    slCount -= slChunk;
+  }
+}
+
+// read a block from zip file
+void UNZIPReadBlock_t(INDEX iHandle, UBYTE *pub, SLONG slStart, SLONG slLen)
+{
   // get the handle
-  CZipHandle &zh = _azhHandles[iHandle];
-  // check the handle
-  if (!zh.zh_bOpen) {
-    ASSERT(FALSE);
+  CZipHandle *pzh = GetOpenHandle(iHandle);
+  if (pzh==NULL) {
     return;
   }
+  CZipHandle &zh = *pzh;
 
   // if behind the end of file
   if (slStart>=zh.zh_zeEntry.ze_slUncompressedSize) {
@@ -699,39 +1033,66 @@ void UNZIPReadBlock_t(INDEX iHandle, UBYTE *pub, SLONG slStart, SLONG slLen)
 
   // if not compressed
   if (zh.zh_zeEntry.ze_bStored) {
-    // just read from file
-    fseek(zh.zh_fFile, zh.zh_zeEntry.ze_slDataOffset+slStart, SEEK_SET);
-    fread(pub, 1, slLen, zh.zh_fFile);
+    // if mapped
+    if (zh.zh_pubData!=NULL) {
+      // just copy from memory
+      memcpy(pub, zh.zh_pubData+slStart, slLen);
+    } else {
+      // just read from file
+      fseek(zh.zh_fFile, zh.zh_zeEntry.ze_slDataOffset+slStart, SEEK_SET);
+      fread(pub, 1, slLen, zh.zh_fFile);
+    }
     return;
   }
 
-  CTSingleLock slZip(&zip_csLock, TRUE);
+  // NOTE: zlib streams are independent, so there is no need to lock anything while inflating
+
+  // if the entry is read in parts, keep history of what was read, for seeking back
+  if (zh.zh_pubHistory==NULL && slLen<zh.zh_zeEntry.ze_slUncompressedSize) {
+    zh.zh_pubHistory = (UBYTE*)AllocMemory(ZIP_HISTORY_SIZE);
+    zh.zh_slHistoryStart = zh.zh_zstream.total_out;
+  }
 
   // if behind the current pointer
   if (slStart<zh.zh_zstream.total_out) {
-    // reset the zlib stream to beginning
-    inflateReset(&zh.zh_zstream);
-    zh.zh_zstream.avail_in = 0;
-    zh.zh_zstream.next_in = NULL;
-    // seek to start of zip entry data inside archive
-    fseek(zh.zh_fFile, zh.zh_zeEntry.ze_slDataOffset, SEEK_SET);
+    const SLONG slOut = zh.zh_zstream.total_out;
+    // if it is still in history
+    if (zh.zh_pubHistory!=NULL && slStart>=zh.zh_slHistoryStart
+      && slOut-slStart<=ZIP_HISTORY_SIZE) {
+      // copy as much as is there
+      const SLONG slCopy = Min(slLen, slOut-slStart);
+      CopyFromHistory(zh, pub, slStart, slCopy);
+      pub += slCopy;
+      slStart += slCopy;
+      slLen -= slCopy;
+      if (slLen<=0) {
+        return;
+      }
+    // if not
+    } else {
+      // reset the zlib stream to beginning
+      inflateReset(&zh.zh_zstream);
+      zh.zh_zstream.avail_in = 0;
+      zh.zh_zstream.next_in = NULL;
+      zh.zh_slHistoryStart = 0;
+      // seek to start of zip entry data inside archive
+      if (zh.zh_fFile!=NULL) {
+        fseek(zh.zh_fFile, zh.zh_zeEntry.ze_slDataOffset, SEEK_SET);
+      }
+    }
   }
 
   // while ahead of the current pointer
   while (slStart>zh.zh_zstream.total_out) {
     // if zlib has no more input
-    while(zh.zh_zstream.avail_in==0) {
-      // read more to it
-      SLONG slRead = fread(zh.zh_pubBufIn, 1, BUF_SIZE, zh.zh_fFile);
-      if (slRead<=0) {
+    if (zh.zh_zstream.avail_in==0) {
+      // give it more
+      if (!FeedInput(zh)) {
         return; // !!!!
       }
-      // tell zlib that there is more to read
-      zh.zh_zstream.next_in = zh.zh_pubBufIn;
-      zh.zh_zstream.avail_in  = slRead;
     }
     // read dummy data from the output
-    #define DUMMY_SIZE 256
+    #define DUMMY_SIZE 4096
     UBYTE aubDummy[DUMMY_SIZE];
     // decode to output
     zh.zh_zstream.avail_out = Min(SLONG(slStart-zh.zh_zstream.total_out), SLONG(DUMMY_SIZE));
@@ -740,6 +1101,7 @@ void UNZIPReadBlock_t(INDEX iHandle, UBYTE *pub, SLONG slStart, SLONG slLen)
     if (ierr!=Z_OK && ierr!=Z_STREAM_END) {
       zh.ThrowZLIBError_t(ierr, TRANS("Error seeking in zip"));
     }
+    RememberOutput(zh, aubDummy, zh.zh_zstream.next_out-aubDummy);
   }
 
   // if not streaming continuously
@@ -758,39 +1120,146 @@ void UNZIPReadBlock_t(INDEX iHandle, UBYTE *pub, SLONG slStart, SLONG slLen)
   // while there is something to write to given block
   while (zh.zh_zstream.avail_out>0) {
     // if zlib has no more input
-    while(zh.zh_zstream.avail_in==0) {
-      // read more to it
-      SLONG slRead = fread(zh.zh_pubBufIn, 1, BUF_SIZE, zh.zh_fFile);
-      if (slRead<=0) {
-        return; // !!!!
+    if (zh.zh_zstream.avail_in==0) {
+      // give it more
+      if (!FeedInput(zh)) {
+        break; // !!!!
       }
-      // tell zlib that there is more to read
-      zh.zh_zstream.next_in = zh.zh_pubBufIn;
-      zh.zh_zstream.avail_in  = slRead;
     }
     // decode to output
+    UBYTE *pubOut = zh.zh_zstream.next_out;
     int ierr = inflate(&zh.zh_zstream, Z_SYNC_FLUSH);
     if (ierr!=Z_OK && ierr!=Z_STREAM_END) {
       zh.ThrowZLIBError_t(ierr, TRANS("Error reading from zip"));
     }
+    RememberOutput(zh, pubOut, zh.zh_zstream.next_out-pubOut);
   }
 }
 
 // close a zip file entry
 void UNZIPClose(INDEX iHandle)
 {
-  // check handle number
-  if(iHandle<0 || iHandle>=_azhHandles.Count()) {
-    ASSERT(FALSE);
-    return;
-  }
   // get the handle
-  CZipHandle &zh = _azhHandles[iHandle];
-  // check the handle
-  if (!zh.zh_bOpen) {
-    ASSERT(FALSE);
+  CZipHandle *pzh = GetOpenHandle(iHandle);
+  if (pzh==NULL) {
     return;
   }
   // clear it
-  zh.Clear();
+  CTSingleLock slZip(&zip_csLock, TRUE);
+  pzh->Clear();
+}
+
+// max number of files read in archive read benchmark
+#define READ_BENCHMARK_FILES 1000
+#define READ_BENCHMARK_PASSES 3
+
+// read archived files (a sample of them if there are many) whole, from mapped views and
+// through fopen/fread, and check them against their CRCs
+void BenchmarkArchiveRead(void)
+{
+  const INDEX ctFiles = _azeFiles.Count();
+  if (ctFiles==0) {
+    CPrintF(TRANS("No archived files to read.\n"));
+    return;
+  }
+  const INDEX iStep = ctFiles/READ_BENCHMARK_FILES+1;
+
+  UBYTE *pubBuffer = NULL;
+  SLONG slBufferSize = 0;
+  // [method][0=stored, 1=deflated]
+  DOUBLE adSeconds[2][2];
+  SLONG aslBytes[2][2];
+  INDEX actFiles[2][2];
+  INDEX actErrors[2];
+  {for (INDEX iMethod=0; iMethod<2; iMethod++) {
+    {
+      CTSingleLock slZip(&zip_csLock, TRUE);
+      _bNoArchiveMapping = iMethod==1;
+    }
+    actErrors[iMethod] = 0;
+    for (INDEX iType=0; iType<2; iType++) {
+      adSeconds[iMethod][iType] = 1E10;
+    }
+    for (INDEX iPass=0; iPass<READ_BENCHMARK_PASSES; iPass++) {
+      DOUBLE adPass[2] = { 0, 0 };
+      SLONG aslPass[2] = { 0, 0 };
+      INDEX actPass[2] = { 0, 0 };
+      for (INDEX iFile=0; iFile<ctFiles; iFile+=iStep) {
+        const CZipEntry &ze = _azeFiles[iFile];
+        const SLONG slSize = ze.ze_slUncompressedSize;
+        if (slSize>slBufferSize) {
+          if (pubBuffer!=NULL) {
+            FreeMemory(pubBuffer);
+          }
+          slBufferSize = slSize;
+          pubBuffer = (UBYTE*)AllocMemory(slBufferSize);
+        }
+        const INDEX iType = ze.ze_bStored ? 0 : 1;
+        CTimerValue tvStart = _pTimer->GetHighPrecisionTimer();
+        INDEX iHandle = -1;
+        BOOL bRead = FALSE;
+        try {
+          iHandle = UNZIPOpen_t(ze.ze_fnm);
+          UNZIPReadBlock_t(iHandle, pubBuffer, 0, slSize);
+          bRead = TRUE;
+        } catch (char *strError) {
+          if (iPass==0) {
+            CPrintF("%s\n", strError);
+            actErrors[iMethod]++;
+          }
+        }
+        if (iHandle>=0) {
+          UNZIPClose(iHandle);
+        }
+        adPass[iType] += (_pTimer->GetHighPrecisionTimer()-tvStart).GetSeconds();
+        aslPass[iType] += slSize;
+        actPass[iType]++;
+        // check what was read, once
+        if (iPass==0 && bRead) {
+          ULONG ulCRC;
+          CRC_Start(ulCRC);
+          CRC_AddBlock(ulCRC, pubBuffer, slSize);
+          CRC_Finish(ulCRC);
+          if (ulCRC!=ze.ze_ulCRC) {
+            CPrintF(TRANS("CRC mismatch: %s/%s\n"), (const CTString&)*ze.ze_pfnmArchive,
+              (const CTString&)ze.ze_fnm);
+            actErrors[iMethod]++;
+          }
+        }
+      }
+      for (INDEX iType=0; iType<2; iType++) {
+        adSeconds[iMethod][iType] = Min(adSeconds[iMethod][iType], adPass[iType]);
+        aslBytes[iMethod][iType] = aslPass[iType];
+        actFiles[iMethod][iType] = actPass[iType];
+      }
+    }
+  }}
+  {
+    CTSingleLock slZip(&zip_csLock, TRUE);
+    _bNoArchiveMapping = FALSE;
+  }
+  if (pubBuffer!=NULL) {
+    FreeMemory(pubBuffer);
+  }
+
+  CPrintF(TRANS("%d archived files, %d read whole, best of %d passes (first pass may be cold)\n"),
+    ctFiles, actFiles[0][0]+actFiles[0][1], READ_BENCHMARK_PASSES);
+  const char *astrMethods[2] = { "mapped", "fread " };
+  const char *astrTypes[2] = { "stored", "deflated" };
+  {for (INDEX iMethod=0; iMethod<2; iMethod++) {
+    for (INDEX iType=0; iType<2; iType++) {
+      const INDEX ctRead = actFiles[iMethod][iType];
+      if (ctRead==0) {
+        continue;
+      }
+      const DOUBLE dSeconds = adSeconds[iMethod][iType];
+      CPrintF(TRANS("  %s %-8s: %4d files, %7.2f MB, %8.2fms, %.2fus per file, %.1f MB/s\n"),
+        astrMethods[iMethod], astrTypes[iType], ctRead, aslBytes[iMethod][iType]/1048576.0,
+        dSeconds*1E3, dSeconds*1E6/ctRead,
+        aslBytes[iMethod][iType]/1048576.0/ClampDn(dSeconds, 1E-9));
+    }
+    if (actErrors[iMethod]>0) {
+      CPrintF(TRANS("  %s: %d files NOT READ CORRECTLY!\n"), astrMethods[iMethod], actErrors[iMethod]);
+    }
+  }}
 }
@@ -31,6 +31,8 @@ INDEX UNZIPOpen_t(const CTFileName &fnm);
 SLONG UNZIPGetSize(INDEX iHandle);
 // get CRC of a file
 ULONG UNZIPGetCRC(INDEX iHandle);
+// get data of a stored file, if it can be read without copying (NULL if not)
+const UBYTE *UNZIPGetStoredData(INDEX iHandle);
 // read a block from zip file
 void UNZIPReadBlock_t(INDEX iHandle, UBYTE *pub, SLONG slStart, SLONG slLen);
 // close a zip file entry
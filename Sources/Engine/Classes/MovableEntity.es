@@ -1992,6 +1992,14 @@ out:;
     }
   STREAMDUMP END */
 
+  // override to return TRUE if PreMoving() and PostMoving() of this class change nothing
+  // but this entity's own members (events may be sent), so they can be run in parallel
+  // NOTE: base implementations inflict damage and change references, so they don't qualify
+  export virtual BOOL IsMovingThreadSafe(void)
+  {
+    return FALSE;
+  }
+
   // clear eventual temporary variables that are not persistent
   export void ClearMovingTemp(void)
   {
@@ -18,6 +18,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <Engine/Build.h>
 #include <Engine/Base/Profiling.h>
 #include <Engine/Base/Input.h>
+#include <Engine/Base/Jobs.h>
 #include <Engine/Base/Protection.h>
 #include <Engine/Base/Console.h>
 #include <Engine/Base/Console_internal.h>
@@ -79,6 +80,7 @@ static INDEX sys_iCPUModel = 0;
 static INDEX sys_iCPUStepping = 0;
 static BOOL  sys_bCPUHasMMX = 0;
 static BOOL  sys_bCPUHasCMOV = 0;
+       BOOL  sys_bCPUHasSSE2 = 0;
 static INDEX sys_iCPUMHz = 0;
        INDEX sys_iCPUMisc = 0;
 
@@ -146,12 +148,14 @@ static void DetectCPU(void)
 
   BOOL bMMX  = ulFeatures & (1<<23);
   BOOL bCMOV = ulFeatures & (1<<15);
+  BOOL bSSE2 = ulFeatures & (1<<26);
 
   CTString strYes = TRANS("Yes");
   CTString strNo = TRANS("No");
 
   CPrintF(TRANS("  MMX : %s\n"), bMMX ?strYes:strNo);
   CPrintF(TRANS("  CMOV: %s\n"), bCMOV?strYes:strNo);
+  CPrintF(TRANS("  SSE2: %s\n"), bSSE2?strYes:strNo);
   CPrintF(TRANS("  Clock: %.0fMHz\n"), _pTimer->tm_llCPUSpeedHZ/1E6);
 
   sys_strCPUVendor = strVendor;
@@ -161,6 +165,7 @@ static void DetectCPU(void)
   sys_iCPUStepping = iStepping;
   sys_bCPUHasMMX = bMMX!=0;
   sys_bCPUHasCMOV = bCMOV!=0;
+  sys_bCPUHasSSE2 = bSSE2!=0;
   sys_iCPUMHz = INDEX(_pTimer->tm_llCPUSpeedHZ/1E6);
 
   if( !bMMX) FatalError( TRANS("MMX support required but not present!"));
@@ -356,6 +361,10 @@ ENGINE_API void SE_InitEngine(CTString strGameID)
   _pShell->DeclareSymbol("user INDEX wld_bFastObjectOptimization;", &wld_bFastObjectOptimization);
   _pShell->DeclareSymbol("user FLOAT mth_fCSGEpsilon;", &mth_fCSGEpsilon);
   _pShell->DeclareSymbol("persistent user INDEX fil_bPreferZips;", &fil_bPreferZips);
+  extern void BenchmarkArchiveLookup(void);
+  _pShell->DeclareSymbol("user void BenchmarkArchiveLookup(void);", &BenchmarkArchiveLookup);
+  extern void BenchmarkArchiveRead(void);
+  _pShell->DeclareSymbol("user void BenchmarkArchiveRead(void);", &BenchmarkArchiveRead);
   // OS info
   _pShell->DeclareSymbol("user const CTString sys_strOS    ;", &sys_strOS);
   _pShell->DeclareSymbol("user const INDEX sys_iOSMajor    ;", &sys_iOSMajor);
@@ -370,6 +379,7 @@ ENGINE_API void SE_InitEngine(CTString strGameID)
   _pShell->DeclareSymbol("user const INDEX sys_iCPUStepping   ;", &sys_iCPUStepping);
   _pShell->DeclareSymbol("user const INDEX sys_bCPUHasMMX     ;", &sys_bCPUHasMMX  );
   _pShell->DeclareSymbol("user const INDEX sys_bCPUHasCMOV    ;", &sys_bCPUHasCMOV );
+  _pShell->DeclareSymbol("user const INDEX sys_bCPUHasSSE2    ;", &sys_bCPUHasSSE2 );
   _pShell->DeclareSymbol("user const INDEX sys_iCPUMHz        ;", &sys_iCPUMHz     );
   _pShell->DeclareSymbol("     const INDEX sys_iCPUMisc       ;", &sys_iCPUMisc    );
   // RAM info
@@ -490,6 +500,9 @@ ENGINE_API void SE_EndEngine(void)
     ReleaseDC( NULL, hdc);
   }
 
+  // stop job worker threads
+  JOB_EndWorkers();
+
   // free stocks
   delete _pEntityClassStock;  _pEntityClassStock = NULL;
   delete _pModelStock;        _pModelStock       = NULL; 
@@ -61,6 +61,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <Engine/Templates/DynamicContainer.cpp>
 #include <Engine/Templates/StaticArray.cpp>
 #include <Engine/Templates/StaticStackArray.cpp>
+#include <Engine/Templates/LinearAllocator.cpp>
 
 #include <Engine/Templates/Stock_CAnimData.h>
 #include <Engine/Templates/Stock_CTextureData.h>
@@ -156,6 +157,7 @@ CEntity::~CEntity(void)
   // remove it from container in its world
   ASSERT(!en_pwoWorld->wo_cenEntities.IsMember(this));
   en_pwoWorld->wo_cenAllEntities.Remove(this);
+  en_pwoWorld->RemoveEntityFromIDTable(this);
 
   // unset spatial clasification
   en_rdSectors.Clear();
@@ -1155,6 +1157,11 @@ CPlacement3D CEntity::GetLerpedPlacement(void) const
 
 void CEntity::SetFlags(ULONG ulFlags)
 {
+  // if zoning is changed
+  if ((en_ulFlags^ulFlags)&ENF_ZONING) {
+    // world must find its zoning entities again
+    en_pwoWorld->MarkZoningBrushesChanged();
+  }
   en_ulFlags = ulFlags;
 }
 
@@ -1259,7 +1266,13 @@ void CEntity::Destroy(void)
   // remove from all sectors
   en_rdSectors.Clear();
   // remove from active entities in the world
-  en_pwoWorld->wo_cenEntities.Remove(this);
+  CDynamicContainer<CEntity> &cenEntities = en_pwoWorld->wo_cenEntities;
+  // (if this or the entity that takes its place is zoning, zoning entities change)
+  if ((en_ulFlags&ENF_ZONING)
+    ||(cenEntities.Count()>0 && (cenEntities.Pointer(cenEntities.Count()-1)->en_ulFlags&ENF_ZONING))) {
+    en_pwoWorld->MarkZoningBrushesChanged();
+  }
+  cenEntities.Remove(this);
   // remove the reference made by the entity itself (this can delete it!)
   RemReference();
 }
@@ -2032,7 +2045,32 @@ public:
   inline void Clear(void) { se_penEntity = NULL; }
 };
 
+// fixed-size piece of memory for holding copies of sent events
+class CSentEventSlot {
+public:
+  DOUBLE ses_adData[2];   // doubles just to keep the alignment
+};
+
 static CStaticStackArray<CSentEvent> _aseSentEvents;  // delayed events
+static CLinearAllocator<CSentEventSlot> _laSentEventSlots;  // memory for copies of delayed events
+
+// event sent from a parallel job, waiting to be merged with the rest
+class CDeferredEvent {
+public:
+  CEntity *de_penEntity;      // not referenced until merged, reference counting is not thread safe
+  CEntityEvent *de_peeEvent;
+};
+
+// events sent from one parallel job
+class CDeferredEventQueue {
+public:
+  CStaticStackArray<CDeferredEvent> deq_adeEvents;
+  CLinearAllocator<CSentEventSlot> deq_laSlots;
+};
+
+static CStaticArray<CDeferredEventQueue> _adeqDeferredEvents;  // one per job
+static _declspec(thread) CDeferredEventQueue *_pdeqCurrent = NULL; // queue of job on this thread
+
 /* Send an event to this entity. */
 void CEntity::SendEvent(const CEntityEvent &ee)
 {
@@ -2040,9 +2078,27 @@ void CEntity::SendEvent(const CEntityEvent &ee)
     ASSERT(FALSE);
     return;
   }
+  // get enough slots for a copy of the event
+  const INDEX ctSlots = (ee.GetSizeOf()+sizeof(CSentEventSlot)-1)/sizeof(CSentEventSlot);
+
+  // if sent from a parallel job
+  CDeferredEventQueue *pdeq = _pdeqCurrent;
+  if (pdeq!=NULL) {
+    // keep it in job's queue until merged
+    CDeferredEvent &de = pdeq->deq_adeEvents.Push();
+    de.de_penEntity = this;
+    de.de_peeEvent = ((CEntityEvent&)ee).MakeCopyAt(pdeq->deq_laSlots.New(ctSlots));
+    return;
+  }
+
+  CSentEventSlot *pses = _laSentEventSlots.New(ctSlots);
+
   CSentEvent &se = _aseSentEvents.Push();
   se.se_penEntity = this;
-  se.se_peeEvent = ((CEntityEvent&)ee).MakeCopy();  // discard const qualifier
+  se.se_peeEvent = ((CEntityEvent&)ee).MakeCopyAt(pses);  // discard const qualifier
+
+  _pfPhysicsProfile.IncrementCounter(CPhysicsProfile::PCI_SENTEVENTS);
+  _pfPhysicsProfile.IncrementCounter(CPhysicsProfile::PCI_SENTEVENTBYTES, ctSlots*sizeof(CSentEventSlot));
 }
 
 // find entities in a box (box must be around this entity)
@@ -2051,8 +2107,18 @@ void CEntity::FindEntitiesInRange(
 {
   ASSERT(GetFPUPrecision()==FPT_24BIT);
 
-  // for each entity in the world of this entity
-  FOREACHINDYNAMICCONTAINER(en_pwoWorld->wo_cenEntities, CEntity, iten) {
+  // entities already in container are marked so that they are not added twice
+  {FOREACHINDYNAMICCONTAINER(cen, CEntity, itenOld) {
+    itenOld->en_ulFlags |= ENF_FOUNDINGRIDSEARCH;
+  }}
+  #define ADD_FOUND_ENTITY(pen) \
+    if (!(pen->en_ulFlags&ENF_FOUNDINGRIDSEARCH)) { \
+      pen->en_ulFlags |= ENF_FOUNDINGRIDSEARCH; \
+      cen.Add(pen); \
+    }
+
+  // for each zoning entity in the world of this entity
+  FOREACHINDYNAMICCONTAINER(en_pwoWorld->GetZoningBrushes(), CEntity, iten) {
     // if it is zoning brush entity
     if (iten->en_RenderType == CEntity::RT_BRUSH && (iten->en_ulFlags&ENF_ZONING)) {
       // get first mip in its brush
@@ -2087,18 +2153,14 @@ void CEntity::FindEntitiesInRange(
                 // if the sphere touches the range
                 if (boxRange.HasContactWith(FLOATaabbox3D(itms->ms_vRelativeCenter0, itms->ms_fR))) {
                   // add it to container
-                  if (!cen.IsMember(pen)) {
-                    cen.Add(pen);
-                  }
+                  ADD_FOUND_ENTITY(pen);
                   goto next_entity;
                 }
               }
             // if no collision box, but non-colliding are allowed
             } else if (!bCollidingOnly) {
               // add it to container
-              if (!cen.IsMember(pen)) {
-                cen.Add(pen);
-              }
+              ADD_FOUND_ENTITY(pen);
             }
           // if the brush entity touches the box
           } else if (pen->en_RenderType==RT_BRUSH && 
@@ -2107,9 +2169,7 @@ void CEntity::FindEntitiesInRange(
             // if the brush touches the box
             if (boxRange.HasContactWith(pen->en_pbrBrush->GetFirstMip()->bm_boxBoundingBox)) {
               // add it to container
-              if (!cen.IsMember(pen)) {
-                cen.Add(pen);
-              }
+              ADD_FOUND_ENTITY(pen);
             }
           } else if ((pen->en_RenderType==RT_SKAMODEL  || pen->en_RenderType==RT_SKAEDITORMODEL)
             && boxRange.HasContactWith(
@@ -2123,18 +2183,14 @@ void CEntity::FindEntitiesInRange(
                 // if the sphere touches the range
                 if (boxRange.HasContactWith(FLOATaabbox3D(itms->ms_vRelativeCenter0, itms->ms_fR))) {
                   // add it to container
-                  if (!cen.IsMember(pen)) {
-                    cen.Add(pen);
-                  }
+                  ADD_FOUND_ENTITY(pen);
                   goto next_entity;
                 }
               }
             // if no collision box, but non-colliding are allowed
             } else if (!bCollidingOnly) {
               // add it to container
-              if (!cen.IsMember(pen)) {
-                cen.Add(pen);
-              }
+              ADD_FOUND_ENTITY(pen);
             }
           }
           next_entity:;
@@ -2142,6 +2198,12 @@ void CEntity::FindEntitiesInRange(
       }
     }
   }
+  #undef ADD_FOUND_ENTITY
+
+  // clear the marks
+  {FOREACHINDYNAMICCONTAINER(cen, CEntity, itenFound) {
+    itenFound->en_ulFlags &= ~ENF_FOUNDINGRIDSEARCH;
+  }}
 }
 
 /* Send an event to all entities in a box (box must be around this entity). */
@@ -2185,14 +2247,52 @@ void CEntity::HandleSentEvents(void)
   // for each event
   for(INDEX iee=0; iee<_aseSentEvents.Count(); iee++) {
     CSentEvent &se = _aseSentEvents[iee];
-    // release the entity and destroy the event
+    // release the entity and destroy the event (its memory is in the slots)
     se.se_penEntity = NULL;
-    delete se.se_peeEvent;
+    se.se_peeEvent->~CEntityEvent();
     se.se_peeEvent = NULL;
   }
 
-  // flush all events
+  // flush all events and reuse their memory
   _aseSentEvents.PopAll();
+  _laSentEventSlots.Reset();
+}
+
+// keep events sent from parallel jobs in per-job queues until merged in job order
+void CEntity::BeginDeferredEvents(INDEX ctJobs)
+{
+  ASSERT(_pdeqCurrent==NULL);
+  // all queues are empty here, so they can be reallocated if there are not enough
+  if (_adeqDeferredEvents.Count()<ctJobs) {
+    _adeqDeferredEvents.Clear();
+    _adeqDeferredEvents.New(ctJobs);
+  }
+}
+
+void CEntity::SetDeferredEventsJob(INDEX iJob)
+{
+  if (iJob<0) {
+    _pdeqCurrent = NULL;
+  } else {
+    _pdeqCurrent = &_adeqDeferredEvents[iJob];
+  }
+}
+
+void CEntity::EndDeferredEvents(void)
+{
+  ASSERT(_pdeqCurrent==NULL);
+  // for each job in order
+  for(INDEX ideq=0; ideq<_adeqDeferredEvents.Count(); ideq++) {
+    CDeferredEventQueue &deq = _adeqDeferredEvents[ideq];
+    // send its events as if they were sent serially
+    for(INDEX ide=0; ide<deq.deq_adeEvents.Count(); ide++) {
+      CDeferredEvent &de = deq.deq_adeEvents[ide];
+      de.de_penEntity->SendEvent(*de.de_peeEvent);
+      de.de_peeEvent->~CEntityEvent();
+    }
+    deq.deq_adeEvents.PopAll();
+    deq.deq_laSlots.Reset();
+  }
 }
 
 /////////////////////////////////////////////////////////////////////
@@ -3180,7 +3280,7 @@ void CEntity::NotifyGravityChanged(void)
     }
   } else {
     // for each zoning brush in the world of this entity
-    FOREACHINDYNAMICCONTAINER(en_pwoWorld->wo_cenEntities, CEntity, iten) {
+    FOREACHINDYNAMICCONTAINER(en_pwoWorld->GetZoningBrushes(), CEntity, iten) {
       CEntity *penBrush = &*iten;
       if (iten->en_RenderType != CEntity::RT_BRUSH || !(iten->en_ulFlags&ENF_ZONING)) {
         continue;
@@ -3309,6 +3409,9 @@ void CEntity::Read_t( CTStream *istr) // throw char *
 
   // clear flags for selection and caching info
   en_ulFlags &= ~(ENF_SELECTED|ENF_INRENDERING|ENF_VALIDSHADINGINFO);
+  if (en_ulFlags&ENF_ZONING) {
+    en_pwoWorld->MarkZoningBrushesChanged();
+  }
   en_psiShadingInfo = NULL;
   en_pciCollisionInfo = NULL;
 
@@ -3702,6 +3805,19 @@ void CLiveEntity::ReceiveDamage(CEntity *penInflictor, enum DamageType dmtType,
  */
 CRationalEntity::CRationalEntity(void)
 {
+  en_iInTimers = -1;
+  en_ulTimerSequence = 0;
+}
+
+/*
+ * Destructor.
+ */
+CRationalEntity::~CRationalEntity(void)
+{
+  // make sure it doesn't stay in the world's timer heap
+  if (IsWaitingForTimer()) {
+    en_pwoWorld->RemoveTimer(this);
+  }
 }
 
 /* Calculate physics for moving. */
@@ -3749,7 +3865,7 @@ void CRationalEntity::Copy(CEntity &enOther, ULONG ulFlags)
     CRationalEntity *prenOther = (CRationalEntity *)(&enOther);
     en_timeTimer = prenOther->en_timeTimer;
     en_stslStateStack = prenOther->en_stslStateStack;
-    if (prenOther->en_lnInTimers.IsLinked()) {
+    if (prenOther->IsWaitingForTimer()) {
       en_pwoWorld->AddTimer(this);
     }
   }
@@ -3779,7 +3895,7 @@ void CRationalEntity::Write_t( CTStream *ostr) // throw char *
 {
   CLiveEntity::Write_t(ostr);
   // if not currently waiting for thinking
-  if (!en_lnInTimers.IsLinked()) {
+  if (!IsWaitingForTimer()) {
     // set dummy thinking time as a flag for later loading
     en_timeTimer = THINKTIME_NEVER;
   }
@@ -3806,8 +3922,8 @@ void CRationalEntity::SetTimerAt(TIME timeAbsolute)
   if (en_timeTimer != THINKTIME_NEVER) {
     en_pwoWorld->AddTimer(this);
   } else {
-    if (en_lnInTimers.IsLinked()) {
-      en_lnInTimers.Remove();
+    if (IsWaitingForTimer()) {
+      en_pwoWorld->RemoveTimer(this);
     }
   }
 }
@@ -3825,8 +3941,8 @@ void CRationalEntity::SetTimerAfter(TIME timeDelta)
 void CRationalEntity::UnsetTimer(void)
 {
   en_timeTimer = THINKTIME_NEVER;
-  if (en_lnInTimers.IsLinked()) {
-    en_lnInTimers.Remove();
+  if (IsWaitingForTimer()) {
+    en_pwoWorld->RemoveTimer(this);
   }
 }
 
@@ -3942,8 +4058,8 @@ void CRationalEntity::OnInitialize(const CEntityEvent &eeInput)
 
   // do not think
   en_timeTimer = THINKTIME_NEVER;
-  if (en_lnInTimers.IsLinked()) {
-    en_lnInTimers.Remove();
+  if (IsWaitingForTimer()) {
+    en_pwoWorld->RemoveTimer(this);
   }
 
   // initialize state stack
@@ -287,6 +287,10 @@ public:
 
   /* Handle all sent events. */
   static void HandleSentEvents(void);
+  // keep events sent from parallel jobs in per-job queues until merged in job order
+  static void BeginDeferredEvents(INDEX ctJobs);
+  static void SetDeferredEventsJob(INDEX iJob); // set on job's thread (-1 when job is done)
+  static void EndDeferredEvents(void);
 
   // find entities in a box (box must be around this entity)
   void FindEntitiesInRange(const FLOATaabbox3D &boxRange, CDynamicContainer<CEntity> &cen,
@@ -750,7 +754,8 @@ public:
  */
 class ENGINE_API CRationalEntity : public CLiveEntity {
 public:
-  CListNode en_lnInTimers;    // node in list of waiting timers - sorted by wait time
+  INDEX en_iInTimers;         // index in world's heap of waiting timers (-1 if not waiting)
+  ULONG en_ulTimerSequence;   // order of scheduling, for timers due at same time
 public:
   TIME en_timeTimer;          // moment in time this entity waits for timer
 
@@ -793,6 +798,8 @@ public:
   void SetTimerAfter(TIME timeDelta);
   /* Cancel eventual pending timer. */
   void UnsetTimer(void);
+  /* Check if entity is waiting for a timer event. */
+  inline BOOL IsWaitingForTimer(void) const { return en_iInTimers>=0; };
 
   /* Called after creating and setting its properties. */
   virtual void OnInitialize(const CEntityEvent &eeInput);
@@ -801,6 +808,8 @@ public:
 public:
   /* Constructor. */
   CRationalEntity(void);
+  /* Destructor. */
+  ~CRationalEntity(void);
 
   /* Handle an event - return false if event was not handled. */
   virtual BOOL HandleEvent(const CEntityEvent &ee);
@@ -143,6 +143,10 @@ void CEntity::Copy(CEntity &enOther, ULONG ulFlags)
   } else {
     en_ulFlags = (en_ulFlags&~(ENF_PREDICTED|ENF_PREDICTABLE|ENF_PREDICTOR));
   }
+  // if copied as zoning, world must find its zoning entities again
+  if (en_ulFlags&ENF_ZONING) {
+    en_pwoWorld->MarkZoningBrushesChanged();
+  }
 
   // if this is a brush
   if ( enOther.en_RenderType == RT_BRUSH || en_RenderType == RT_FIELDBRUSH) {
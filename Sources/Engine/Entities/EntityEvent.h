@@ -19,6 +19,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
   #pragma once
 #endif
 
+#include <new>  // for placement new
+
 // a BOOL that is constructed with value of FALSE (used in some entity initializations)
 class ENGINE_API CBoolDefaultFalse {
 public:
@@ -41,6 +43,13 @@ public:
     CEntityEvent *peeCopy = new CEntityEvent(*this);
     return peeCopy;
   };
+  // used for copying events into preallocated memory (must be destroyed explicitly)
+  virtual CEntityEvent *MakeCopyAt(void *pvMemory) {
+    CEntityEvent *peeCopy = ::new(pvMemory) CEntityEvent(*this);
+    return peeCopy;
+  };
+  // size of memory needed for a copy of this event
+  virtual SLONG GetSizeOf(void) const { return sizeof(CEntityEvent); };
 };
 // a reference to a void event for use as default parameter
 ENGINE_API extern const CEntityEvent &_eeVoid;
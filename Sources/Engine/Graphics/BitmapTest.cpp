@@ -0,0 +1,205 @@
+/* Copyright (c) 2002-2012 Croteam Ltd.
+This program is free software; you can redistribute it and/or modify
+it under the terms of version 2 of the GNU General Public License as published by
+the Free Software Foundation
+
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA. */
+
+#include "stdh.h"
+
+#include <Engine/Base/Console.h>
+#include <Engine/Base/Timer.h>
+#include <Engine/Base/Memory.h>
+#include <Engine/Base/CRC.h>
+#include <Engine/Graphics/GfxLibrary.h>
+
+extern BOOL sys_bCPUHasSSE2;
+
+// bitmap routines that are checked
+enum BitmapRoutine {
+  BTR_FILTER = 0,   // FilterBitmap() with given filter
+  BTR_DITHER,       // DitherBitmap() with given dither type
+  BTR_MIPMAPS,      // MakeMipmaps() with given number of bilinear mip-maps
+  BTR_SATURATE,     // AdjustBitmapColor() with given saturation
+};
+
+// one bitmap routine check
+struct BitmapTest {
+  INDEX bt_iRoutine;
+  INDEX bt_iParam;
+  BOOL  bt_bInPlace;
+  uint32_t bt_ulCRC;   // of outputs for all test bitmaps
+};
+
+// test bitmap sizes (routines get a pseudo-random image of each size)
+static PIX _apixTestSizes[][2] = { {4,4}, {16,8}, {64,32}, {8,128} };
+
+// CRCs of outputs that the original MMX routines gave for test bitmaps
+// (C and SSE2 versions of a routine must both give exactly these)
+static BitmapTest _abtTests[] = {
+  { BTR_FILTER,   -6, 0, 0x92F03032 }, { BTR_FILTER,   -6, 1, 0xB816D00A },
+  { BTR_FILTER,   -5, 0, 0xA1DEBF42 }, { BTR_FILTER,   -5, 1, 0x77067C68 },
+  { BTR_FILTER,   -4, 0, 0x42439E1F }, { BTR_FILTER,   -4, 1, 0xD14E4E02 },
+  { BTR_FILTER,   -3, 0, 0x38AD66BD }, { BTR_FILTER,   -3, 1, 0xB3183604 },
+  { BTR_FILTER,   -2, 0, 0x2AED5933 }, { BTR_FILTER,   -2, 1, 0x9697E96A },
+  { BTR_FILTER,   -1, 0, 0x4561BDB4 }, { BTR_FILTER,   -1, 1, 0xCCA59CC3 },
+  { BTR_FILTER,    1, 0, 0x7902F505 }, { BTR_FILTER,    1, 1, 0xC26816CD },
+  { BTR_FILTER,    2, 0, 0xDB2FF9BB }, { BTR_FILTER,    2, 1, 0xF835DEED },
+  { BTR_FILTER,    3, 0, 0xAA924F23 }, { BTR_FILTER,    3, 1, 0x6B61E2A6 },
+  { BTR_FILTER,    4, 0, 0xB6289C4B }, { BTR_FILTER,    4, 1, 0xA75E6EDD },
+  { BTR_FILTER,    5, 0, 0x05085099 }, { BTR_FILTER,    5, 1, 0xAD8E5599 },
+  { BTR_FILTER,    6, 0, 0x9FD9B548 }, { BTR_FILTER,    6, 1, 0xFFF7B68F },
+  { BTR_DITHER,    1, 0, 0xE1B686AC }, { BTR_DITHER,    1, 1, 0xE1B686AC },
+  { BTR_DITHER,    2, 0, 0xC01EE841 }, { BTR_DITHER,    2, 1, 0xC01EE841 },
+  { BTR_DITHER,    3, 0, 0x5FD0A54F }, { BTR_DITHER,    3, 1, 0x5FD0A54F },
+  { BTR_DITHER,    4, 0, 0xA9A00140 }, { BTR_DITHER,    4, 1, 0xA9A00140 },
+  { BTR_DITHER,    5, 0, 0x8447E3E6 }, { BTR_DITHER,    5, 1, 0x8447E3E6 },
+  { BTR_DITHER,    6, 0, 0xD9D7A5B2 }, { BTR_DITHER,    6, 1, 0xD9D7A5B2 },
+  { BTR_DITHER,    7, 0, 0x19F8AEBE }, { BTR_DITHER,    7, 1, 0x19F8AEBE },
+  { BTR_DITHER,    8, 0, 0x1224312C }, { BTR_DITHER,    8, 1, 0x1224312C },
+  { BTR_DITHER,    9, 0, 0x62B2F5FF }, { BTR_DITHER,    9, 1, 0x62B2F5FF },
+  { BTR_DITHER,   10, 0, 0x47FA356B }, { BTR_DITHER,   10, 1, 0x47FA356B },
+  { BTR_MIPMAPS,   0, 1, 0xC3CD9303 }, { BTR_MIPMAPS,   1, 1, 0xC3CD9303 },
+  { BTR_MIPMAPS,   3, 1, 0x61EC6765 }, { BTR_MIPMAPS,  16, 1, 0x11D14CC8 },
+  // (larger saturations would clip outside pubClipByte[] in the plain routine)
+  { BTR_SATURATE,  0, 0, 0x39F7C660 }, { BTR_SATURATE,128, 0, 0xC4B6B3C8 },
+  { BTR_SATURATE,384, 0, 0x97DA1628 }, { BTR_SATURATE,768, 0, 0x3788480D },
+};
+
+static const char *_astrRoutines[] = { "FilterBitmap", "DitherBitmap", "MakeMipmaps", "AdjustBitmapColor" };
+
+
+// fill bitmap with pseudo-random pixels that are the same on each run
+static void MakeTestBitmap( uint32_t *pulBitmap, PIX pixSize, uint32_t ulSeed)
+{
+  for( PIX pix=0; pix<pixSize; pix++) {
+    ulSeed = ulSeed*1664525 + 1013904223;
+    pulBitmap[pix] = ulSeed ^ (ulSeed>>15);
+  }
+}
+
+
+// size of all mip-maps that MakeMipmaps() makes for a bitmap
+static PIX MipmapsSize( PIX pixWidth, PIX pixHeight)
+{
+  PIX pixSize = 0;
+  while( pixWidth>1 && pixHeight>1) {
+    pixSize += pixWidth*pixHeight;
+    pixWidth >>=1;
+    pixHeight>>=1;
+  }
+  return pixSize + pixWidth*pixHeight;
+}
+
+
+// run one routine on bitmap (destination must already hold the source when routine is done in-place)
+static void RunRoutine( const BitmapTest &bt, uint32_t *pulSrc, uint32_t *pulDst, PIX pixWidth, PIX pixHeight)
+{
+  if( bt.bt_bInPlace) pulSrc = pulDst;
+  switch( bt.bt_iRoutine) {
+  case BTR_FILTER:   FilterBitmap( bt.bt_iParam, pulSrc, pulDst, pixWidth, pixHeight);  break;
+  case BTR_DITHER:   DitherBitmap( bt.bt_iParam, pulSrc, pulDst, pixWidth, pixHeight);  break;
+  case BTR_MIPMAPS:  MakeMipmaps( bt.bt_iParam, pulDst, pixWidth, pixHeight);  break;
+  case BTR_SATURATE: AdjustBitmapColor( pulSrc, pulDst, pixWidth, pixHeight, 0, bt.bt_iParam);  break;
+  default: ASSERTALWAYS( "Unknown bitmap routine.");
+  }
+}
+
+
+// CRC of routine outputs for all test bitmaps
+static uint32_t TestRoutine( const BitmapTest &bt)
+{
+  uint32_t ulCRC;
+  CRC_Start(ulCRC);
+  const INDEX ctSizes = sizeof(_apixTestSizes)/sizeof(_apixTestSizes[0]);
+  for( INDEX iSize=0; iSize<ctSizes; iSize++) {
+    const PIX pixWidth  = _apixTestSizes[iSize][0];
+    const PIX pixHeight = _apixTestSizes[iSize][1];
+    const PIX pixSize   = pixWidth*pixHeight;
+    // room for mip-maps, too
+    uint32_t *pulSrc = (uint32_t*)AllocMemory( pixSize*2 *BYTES_PER_TEXEL);
+    uint32_t *pulDst = (uint32_t*)AllocMemory( pixSize*2 *BYTES_PER_TEXEL);
+    MakeTestBitmap( pulSrc, pixSize, pixSize+iSize);
+    memset( pulDst, 0, pixSize*2 *BYTES_PER_TEXEL);
+    if( bt.bt_bInPlace) memcpy( pulDst, pulSrc, pixSize *BYTES_PER_TEXEL);
+    RunRoutine( bt, pulSrc, pulDst, pixWidth, pixHeight);
+    const PIX pixResult = (bt.bt_iRoutine==BTR_MIPMAPS) ? MipmapsSize( pixWidth, pixHeight) : pixSize;
+    CRC_AddBlock( ulCRC, (uint8_t*)pulDst, pixResult *BYTES_PER_TEXEL);
+    FreeMemory(pulSrc);
+    FreeMemory(pulDst);
+  }
+  CRC_Finish(ulCRC);
+  return ulCRC;
+}
+
+
+// check that bitmap routines give the same results as they did with MMX code
+void TestBitmapRoutines(void)
+{
+  const BOOL bHasSSE2 = sys_bCPUHasSSE2;
+  INDEX ctFailed = 0;
+  const INDEX ctTests = sizeof(_abtTests)/sizeof(_abtTests[0]);
+  for( INDEX iTest=0; iTest<ctTests; iTest++) {
+    const BitmapTest &bt = _abtTests[iTest];
+    // plain version, then SSE2 one (if there)
+    for( INDEX iSSE2=0; iSSE2<=bHasSSE2; iSSE2++) {
+      sys_bCPUHasSSE2 = iSSE2;
+      const uint32_t ulCRC = TestRoutine(bt);
+      if( ulCRC==bt.bt_ulCRC) continue;
+      CPrintF( "  %s(%d)%s %s: got 0x%08X, expected 0x%08X\n", _astrRoutines[bt.bt_iRoutine], bt.bt_iParam,
+               bt.bt_bInPlace ? " in-place" : "", iSSE2 ? "SSE2" : "plain", ulCRC, bt.bt_ulCRC);
+      ctFailed++;
+    }
+  }
+  sys_bCPUHasSSE2 = bHasSSE2;
+  CPrintF( "Bitmap routines: %d of %d checks failed%s\n", ctFailed, ctTests*(1+bHasSSE2),
+           bHasSSE2 ? "" : " (no SSE2, plain versions only)");
+}
+
+
+// speed of bitmap routines on a 256x256 bitmap, plain and SSE2 versions
+void BenchmarkBitmapRoutines(void)
+{
+  const PIX pixWidth  = 256;
+  const PIX pixHeight = 256;
+  const PIX pixSize   = pixWidth*pixHeight;
+  uint32_t *pulSrc = (uint32_t*)AllocMemory( pixSize*2 *BYTES_PER_TEXEL);
+  uint32_t *pulDst = (uint32_t*)AllocMemory( pixSize*2 *BYTES_PER_TEXEL);
+  MakeTestBitmap( pulSrc, pixSize, 0);
+
+  static BitmapTest abtBenchmarks[] = {
+    { BTR_FILTER, 3, 0 }, { BTR_FILTER, -3, 0 }, { BTR_DITHER, 4, 0 },
+    { BTR_DITHER, 10, 0 }, { BTR_MIPMAPS, 16, 1 }, { BTR_SATURATE, 384, 0 },
+  };
+  const BOOL bHasSSE2 = sys_bCPUHasSSE2;
+  const INDEX ctBenchmarks = sizeof(abtBenchmarks)/sizeof(abtBenchmarks[0]);
+  for( INDEX iBenchmark=0; iBenchmark<ctBenchmarks; iBenchmark++) {
+    const BitmapTest &bt = abtBenchmarks[iBenchmark];
+    DOUBLE adMPixPerSec[2] = { 0, 0 };
+    for( INDEX iSSE2=0; iSSE2<=bHasSSE2; iSSE2++) {
+      sys_bCPUHasSSE2 = iSSE2;
+      // best of several passes
+      DOUBLE dBest = 1E10;
+      for( INDEX iPass=0; iPass<20; iPass++) {
+        memcpy( pulDst, pulSrc, pixSize *BYTES_PER_TEXEL);
+        const CTimerValue tvStart = _pTimer->GetHighPrecisionTimer();
+        RunRoutine( bt, pulSrc, pulDst, pixWidth, pixHeight);
+        dBest = Min( dBest, (_pTimer->GetHighPrecisionTimer()-tvStart).GetSeconds());
+      }
+      adMPixPerSec[iSSE2] = pixSize/Max(dBest,1E-9)/1000/1000;
+    }
+    CPrintF( "%-18s %5d: %8.1f Mpix/s plain, %8.1f Mpix/s SSE2\n", _astrRoutines[bt.bt_iRoutine], bt.bt_iParam,
+             adMPixPerSec[0], adMPixPerSec[1]);
+  }
+  sys_bCPUHasSSE2 = bHasSSE2;
+  FreeMemory(pulSrc);
+  FreeMemory(pulDst);
+}
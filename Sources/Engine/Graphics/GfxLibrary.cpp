@@ -129,6 +129,7 @@ extern INDEX tex_bProgressiveFilter = FALSE;  // filter mipmaps in creation time
 extern INDEX tex_bColorizeMipmaps   = FALSE;  // DEBUG: colorize texture's mipmap levels in various colors
 extern INDEX tex_bCompressAlphaChannel = FALSE;  // for compressed textures, compress alpha channel too   
 extern INDEX tex_bAlternateCompression = FALSE;  // basically, this is fix for GFs (compress opaque texture as translucent)
+extern INDEX tex_bMipmapCache = TRUE;            // keep processed mip-maps on disk and reuse them on next load
 
 extern INDEX shd_iStaticSize  = 8;    
 extern INDEX shd_iDynamicSize = 8;    
@@ -144,6 +145,7 @@ extern INDEX shd_bAllowFlats = TRUE;   // allow optimization of single-color sha
 extern INDEX shd_iForceFlats = 0;      // force all shadowmaps to be flat (internal!) - 0=don't, 1=w/o overbrighting, 2=w/ overbrighting
 extern INDEX shd_bShowFlats  = FALSE;  // colorize flat shadows
 extern INDEX shd_bColorize   = FALSE;  // colorize shadows by size (gradieng from red=big to green=little)
+extern INDEX shd_bParallelBaking = TRUE; // spread shadow map calculation over all processors
 
 
 // OpenGL control
@@ -791,6 +793,19 @@ extern void UncacheShadows(void)
 }
 
 
+// checks and benchmarks of bitmap and layer mixing routines
+extern void TestBitmapRoutines(void);
+extern void BenchmarkBitmapRoutines(void);
+extern void TestLayerMixing(void);
+
+// cold vs warm benchmark of mip-map cache
+extern void BenchmarkTextureCache( const CTString &strPattern);
+static void BenchmarkTextureCacheCfunc(void *pArgs)
+{
+  CTString strPattern = *NEXTARGUMENT(CTString*);
+  BenchmarkTextureCache(strPattern);
+}
+
 // refresh (uncache and eventually cache) all cached shadow maps
 extern void CacheShadows(void);
 static void RecacheShadows(void)
@@ -1067,6 +1082,10 @@ void CGfxLibrary::Init(void)
   _pShell->DeclareSymbol("user void RecacheShadows(void);",  &RecacheShadows);
   _pShell->DeclareSymbol("user void RefreshTextures(void);", &RefreshTextures);
   _pShell->DeclareSymbol("user void ReloadModels(void);",    &ReloadModels);
+  _pShell->DeclareSymbol("user void TestBitmapRoutines(void);",      &TestBitmapRoutines);
+  _pShell->DeclareSymbol("user void BenchmarkBitmapRoutines(void);", &BenchmarkBitmapRoutines);
+  _pShell->DeclareSymbol("user void TestLayerMixing(void);",         &TestLayerMixing);
+  _pShell->DeclareSymbol("user void BenchmarkTextureCache(CTString);", &BenchmarkTextureCacheCfunc);
 
   _pShell->DeclareSymbol("persistent user INDEX ogl_bUseCompiledVertexArrays;", &ogl_bUseCompiledVertexArrays);
   _pShell->DeclareSymbol("persistent user INDEX ogl_bExclusive;", &ogl_bExclusive);
@@ -1165,6 +1184,7 @@ void CGfxLibrary::Init(void)
   _pShell->DeclareSymbol("persistent user INDEX tex_iEffectFiltering;",   &tex_iEffectFiltering);
   _pShell->DeclareSymbol("persistent user INDEX tex_bProgressiveFilter;", &tex_bProgressiveFilter);
   _pShell->DeclareSymbol("           user INDEX tex_bColorizeMipmaps;",   &tex_bColorizeMipmaps);
+  _pShell->DeclareSymbol("persistent user INDEX tex_bMipmapCache;",       &tex_bMipmapCache);
 
   _pShell->DeclareSymbol("persistent user INDEX shd_iStaticSize;",   &shd_iStaticSize);
   _pShell->DeclareSymbol("persistent user INDEX shd_iDynamicSize;",  &shd_iDynamicSize);
@@ -1180,6 +1200,7 @@ void CGfxLibrary::Init(void)
   _pShell->DeclareSymbol("persistent      INDEX shd_iForceFlats;", &shd_iForceFlats);
   _pShell->DeclareSymbol("           user INDEX shd_bShowFlats;",  &shd_bShowFlats);
   _pShell->DeclareSymbol("           user INDEX shd_bColorize;",   &shd_bColorize);
+  _pShell->DeclareSymbol("persistent user INDEX shd_bParallelBaking;", &shd_bParallelBaking);
   
   _pShell->DeclareSymbol("           user INDEX gfx_bRenderParticles;", &gfx_bRenderParticles);
   _pShell->DeclareSymbol("           user INDEX gfx_bRenderFog;",       &gfx_bRenderFog);
@@ -22,12 +22,15 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <Engine/Graphics/Texture.h>
 #include <Engine/Graphics/GfxProfile.h>
 
-// asm shortcuts
-#define O offset
-#define Q qword ptr
-#define D dword ptr
-#define W  word ptr
-#define B  byte ptr
+// bitmap routines have SSE2 versions that give the same results as plain ones,
+// and are used when the CPU supports them
+#if defined(_M_IX86) || defined(_M_X64)
+  #include <emmintrin.h>
+  #define BITMAP_SSE2 1
+  extern BOOL sys_bCPUHasSSE2;
+#else
+  #define BITMAP_SSE2 0
+#endif
 
 extern INDEX tex_bProgressiveFilter; // filter mipmaps in creation time (not afterwards)
 
@@ -186,106 +189,75 @@ void FlipBitmap( uint8_t *pubSrc, uint8_t *pubDst, PIX pixWidth, PIX pixHeight,
 
 
 
+#if BITMAP_SSE2
+// MakeOneMipmap() INTERNAL: averages 2x2 source pixels for each pixel in row, returns number of pixels done
+static PIX MakeBilinearRow_SSE2( const uint32_t *pulUp, const uint32_t *pulDn, uint32_t *pulDst, PIX pixWidth)
+{
+  const __m128i mZero    = _mm_setzero_si128();
+  const __m128i mRounder = _mm_set1_epi16(2);
+  PIX pix=0;
+  for( ; pix+2<=pixWidth; pix+=2) {
+    const __m128i mUp = _mm_loadu_si128( (const __m128i*)(pulUp+pix*2));
+    const __m128i mDn = _mm_loadu_si128( (const __m128i*)(pulDn+pix*2));
+    // add vertical neighbours, then horizontal ones
+    const __m128i mLo = _mm_add_epi16( _mm_unpacklo_epi8( mUp, mZero), _mm_unpacklo_epi8( mDn, mZero));
+    const __m128i mHi = _mm_add_epi16( _mm_unpackhi_epi8( mUp, mZero), _mm_unpackhi_epi8( mDn, mZero));
+    __m128i mSum = _mm_add_epi16( _mm_unpacklo_epi64( mLo, mHi), _mm_unpackhi_epi64( mLo, mHi));
+    mSum = _mm_srli_epi16( _mm_add_epi16( mSum, mRounder), 2);
+    _mm_storel_epi64( (__m128i*)(pulDst+pix), _mm_packus_epi16( mSum, mZero));
+  }
+  return pix;
+}
+#endif
+
+
 // makes one level lower mipmap (bilinear or nearest-neighbour with border preservance)
-static __int64 mmRounder = 0x0002000200020002;
 static void MakeOneMipmap( uint32_t *pulSrcMipmap, uint32_t *pulDstMipmap, PIX pixWidth, PIX pixHeight, BOOL bBilinear)
 {
   // some safety checks
   ASSERT( pixWidth>1 && pixHeight>1);
   ASSERT( pixWidth  == 1L<<FastLog2(pixWidth));
   ASSERT( pixHeight == 1L<<FastLog2(pixHeight));
+  const PIX pixSrcWidth = pixWidth;
   pixWidth >>=1;
   pixHeight>>=1;
 
   if( bBilinear) // type of filtering?
   { // BILINEAR
-    __asm {
-      pxor    mm0,mm0
-      mov     ebx,D [pixWidth]
-      mov     esi,D [pulSrcMipmap]
-      mov     edi,D [pulDstMipmap]
-      mov     edx,D [pixHeight]
-rowLoop:
-      mov     ecx,D [pixWidth]
-pixLoopN:           
-      movd    mm1,D [esi+ 0]        // up-left
-      movd    mm2,D [esi+ 4]        // up-right
-      movd    mm3,D [esi+ ebx*8 +0] // down-left
-      movd    mm4,D [esi+ ebx*8 +4] // down-right
-      punpcklbw mm1,mm0
-      punpcklbw mm2,mm0
-      punpcklbw mm3,mm0
-      punpcklbw mm4,mm0
-      paddw   mm1,mm2
-      paddw   mm1,mm3
-      paddw   mm1,mm4
-      paddw   mm1,Q [mmRounder]
-      psrlw   mm1,2
-      packuswb mm1,mm0
-      movd    D [edi],mm1
-      // advance to next pixel
-      add     esi,4*2
-      add     edi,4
-      dec     ecx
-      jnz     pixLoopN
-      // advance to next row
-      lea     esi,[esi+ ebx*8] // skip one row in source mip-map
-      dec     edx
-      jnz     rowLoop
-      emms
+    for( PIX pixV=0; pixV<pixHeight; pixV++)
+    { // for each pixel in row
+      const uint32_t *pulUp = pulSrcMipmap + pixV*2*pixSrcWidth;
+      const uint32_t *pulDn = pulUp + pixSrcWidth;
+      uint32_t *pulDst = pulDstMipmap + pixV*pixWidth;
+      PIX pixU = 0;
+#if BITMAP_SSE2
+      if( sys_bCPUHasSSE2) pixU = MakeBilinearRow_SSE2( pulUp, pulDn, pulDst, pixWidth);
+#endif
+      for( ; pixU<pixWidth; pixU++) {
+        // average of up-left, up-right, down-left and down-right (rounded)
+        const uint8_t *pubUp  = (const uint8_t*)(pulUp + pixU*2);
+        const uint8_t *pubDn  = (const uint8_t*)(pulDn + pixU*2);
+        uint8_t *pubDst = (uint8_t*)(pulDst + pixU);
+        for( INDEX i=0; i<BYTES_PER_TEXEL; i++) {
+          pubDst[i] = (pubUp[i] + pubUp[i+BYTES_PER_TEXEL] + pubDn[i] + pubDn[i+BYTES_PER_TEXEL] +2) >>2;
+        }
+      }
     }
   }
   else
   { // NEAREST-NEIGHBOUR but with border preserving
-    uint32_t ulRowModulo = pixWidth*2 *BYTES_PER_TEXEL;
-    __asm {   
-      xor     ebx,ebx
-      mov     esi,D [pulSrcMipmap]
-      mov     edi,D [pulDstMipmap]
-      // setup upper half
-      mov     edx,D [pixHeight]
-      shr     edx,1
-halfLoop:
-      mov     ecx,D [pixWidth]
-      shr     ecx,1
-leftLoop:
-      mov     eax,D [esi+ ebx*8+ 0] // upper-left (or lower-left)
-      mov     D [edi],eax
-      // advance to next pixel
-      add     esi,4*2
-      add     edi,4
-      sub     ecx,1
-      jg      leftLoop
-      // do right row half
-      mov     ecx,D [pixWidth]
-      shr     ecx,1
-      jz      halfEnd
-rightLoop:
-      mov     eax,D [esi+ ebx*8+ 4] // upper-right (or lower-right)
-      mov     D [edi],eax
-      // advance to next pixel
-      add     esi,4*2
-      add     edi,4
-      sub     ecx,1
-      jg      rightLoop
-halfEnd:
-      // advance to next row
-      add     esi,D [ulRowModulo]  // skip one row in source mip-map
-      sub     edx,1
-      jg      halfLoop
-      // do eventual lower half loop (if not yet done)
-      mov     edx,D [pixHeight]
-      shr     edx,1
-      jz      fullEnd
-      cmp     ebx,D [pixWidth]
-      mov     ebx,D [pixWidth]
-      jne     halfLoop
-fullEnd:
+    // (left and upper half takes left and upper source pixels, right and lower half the other ones)
+    const PIX pixHalfWidth  = Max( pixWidth /2, (PIX)1);
+    const PIX pixHalfHeight = Max( pixHeight/2, (PIX)1);
+    for( PIX pixV=0; pixV<pixHeight; pixV++) {
+      const uint32_t *pulSrc = pulSrcMipmap + (pixV*2 + (pixV<pixHalfHeight ? 0 : 1)) *pixSrcWidth;
+      for( PIX pixU=0; pixU<pixWidth; pixU++) {
+        *pulDstMipmap++ = pulSrc[pixU*2 + (pixU<pixHalfWidth ? 0 : 1)];
+      }
     }
   }
 }
 
-
 // makes ALL lower mipmaps (to size of 1x1!) of a specified 32-bit bitmap
 // and returns pointer to newely created and mipmaped image
 // (only first ctFineMips number of mip-maps will be filtered with bilinear subsampling, while
@@ -422,26 +394,101 @@ static uint32_t ulDither2[4][4] = {
 };
 
 
-static __int64 mmErrDiffMask=0;
-static __int64 mmW3 = 0x0003000300030003;
-static __int64 mmW5 = 0x0005000500050005;
-static __int64 mmW7 = 0x0007000700070007;
-static __int64 mmShift = 0;
-static __int64 mmMask  = 0;
-static uint32_t *pulDitherTable;
+// adds two 32-bit pixels byte by byte, with saturation
+static inline uint32_t AddPixelsSaturated( uint32_t ul1, uint32_t ul2)
+{
+  uint32_t ulRes = 0;
+  for( INDEX iShift=0; iShift<32; iShift+=8) {
+    const uint32_t ulSum = ((ul1>>iShift)&0xFF) + ((ul2>>iShift)&0xFF);
+    ulRes |= (ulSum<0xFF ? ulSum : 0xFF) <<iShift;
+  }
+  return ulRes;
+}
+
+
+#if BITMAP_SSE2
+// DitherBitmap() INTERNAL: adds dither pattern to row of pixels, returns number of pixels done
+static PIX DitherOrderedRow_SSE2( const uint32_t *pulSrc, uint32_t *pulDst, PIX pixWidth, const uint32_t *pulPattern)
+{
+  const __m128i mPattern = _mm_loadu_si128( (const __m128i*)pulPattern);
+  PIX pix=0;
+  for( ; pix+4<=pixWidth; pix+=4) {
+    const __m128i mSrc = _mm_loadu_si128( (const __m128i*)(pulSrc+pix));
+    _mm_storeu_si128( (__m128i*)(pulDst+pix), _mm_adds_epu8( mSrc, mPattern));
+  }
+  return pix;
+}
+#endif
+
+
+// DitherBitmap() INTERNAL: ordered matrix dithering
+static void DitherOrdered( const uint32_t *pulDitherTable, INDEX iShift, const uint32_t *pulSrc, uint32_t *pulDst,
+                           PIX pixWidth, PIX pixHeight, PIX pixCanvasWidth)
+{
+  const uint32_t ulMask = (0xFFUL>>iShift) *0x01010101UL;
+  for( PIX pixV=0; pixV<pixHeight; pixV++)
+  { // get horizontal dither patterns
+    uint32_t aulPattern[4];
+    for( INDEX i=0; i<4; i++) aulPattern[i] = (pulDitherTable[(pixV&3)*4+i]>>iShift) & ulMask;
+    // process row
+    const uint32_t *pulSrcRow = pulSrc + pixV*pixCanvasWidth;
+    uint32_t *pulDstRow = pulDst + pixV*pixCanvasWidth;
+    PIX pixU = 0;
+#if BITMAP_SSE2
+    if( sys_bCPUHasSSE2) pixU = DitherOrderedRow_SSE2( pulSrcRow, pulDstRow, pixWidth, aulPattern);
+#endif
+    for( ; pixU<pixWidth; pixU++) pulDstRow[pixU] = AddPixelsSaturated( pulSrcRow[pixU], aulPattern[pixU&3]);
+  }
+}
+
+
+// DitherBitmap() INTERNAL: adds error to one pixel (if inside canvas)
+static inline void SpreadError( uint32_t *pulBitmap, PIX pix, PIX pixCanvasSize, uint32_t ulError)
+{
+  if( pix<pixCanvasSize) pulBitmap[pix] = AddPixelsSaturated( pulBitmap[pix], ulError);
+}
+
+// DitherBitmap() INTERNAL: serpentine error diffusion dithering (in-place)
+static void DitherErrorDiffusion( uint32_t ulErrMask, uint32_t *pulBitmap, PIX pixWidth, PIX pixHeight,
+                                  PIX pixCanvasWidth, PIX pixCanvasHeight)
+{
+  const PIX pixCanvasSize = pixCanvasWidth*pixCanvasHeight;
+  // need not to dither last row
+  for( PIX pixV=0; pixV<pixHeight-1; pixV++)
+  { // go left to right in even rows, and right to left in odd ones
+    const PIX pixStep = (pixV&1) ? -1 : +1;
+    PIX pix = pixV*pixCanvasWidth + ((pixV&1) ? pixWidth-1 : 0);
+    for( PIX pixU=0; pixU<pixWidth-1; pixU++, pix+=pixStep)
+    { // determine errors (each is at most 15, so all bytes can be done at once)
+      const uint32_t ulErr  = pulBitmap[pix] & ulErrMask;
+      const uint32_t ulErr3 = ((ulErr*3)>>4) & 0x0F0F0F0F;  // *3/16
+      const uint32_t ulErr5 = ((ulErr*5)>>4) & 0x0F0F0F0F;  // *5/16
+      const uint32_t ulErr7 = ((ulErr*7)>>4) & 0x0F0F0F0F;  // *7/16
+      const uint32_t ulErr1 = ulErr -ulErr3 -ulErr5 -ulErr7; // *rest/16
+      // spread errors ahead, and behind, below and ahead in next row
+      // (pixels beyond row ends belong to neighbouring rows)
+      SpreadError( pulBitmap, pix                +pixStep, pixCanvasSize, ulErr7);
+      SpreadError( pulBitmap, pix +pixCanvasWidth -pixStep, pixCanvasSize, ulErr3);
+      SpreadError( pulBitmap, pix +pixCanvasWidth         , pixCanvasSize, ulErr5);
+      SpreadError( pulBitmap, pix +pixCanvasWidth +pixStep, pixCanvasSize, ulErr1);
+    }
+  }
+}
+
 
 // performs dithering of a 32-bit bipmap (can be in-place)
 void DitherBitmap( INDEX iDitherType, uint32_t *pulSrc, uint32_t *pulDst, PIX pixWidth, PIX pixHeight,
                    PIX pixCanvasWidth, PIX pixCanvasHeight)
 {
   _pfGfxProfile.StartTimer( CGfxProfile::PTI_DITHERBITMAP);
+  uint32_t *pulDitherTable = NULL;
+  INDEX iShift = 0;
+  uint32_t ulErrDiffMask = 0;
 
-  // determine row modulo
+  // determine canvas size
   if( pixCanvasWidth ==0) pixCanvasWidth  = pixWidth;
   if( pixCanvasHeight==0) pixCanvasHeight = pixHeight;
   ASSERT( pixCanvasWidth>=pixWidth && pixCanvasHeight>=pixHeight);
-  SLONG slModulo      = (pixCanvasWidth-pixWidth) *BYTES_PER_TEXEL;
-  SLONG slWidthModulo = pixWidth*BYTES_PER_TEXEL +slModulo;
 
   // if bitmap is smaller than 4x2 pixels
   if( pixWidth<4 || pixHeight<2)
@@ -455,49 +502,42 @@ void DitherBitmap( INDEX iDitherType, uint32_t *pulSrc, uint32_t *pulDst, PIX pi
   { // low dithers
   case 1:
     pulDitherTable = &ulDither2[0][0];
-    mmShift = 2;
-    mmMask  = 0x3F3F3F3F3F3F3F3F;
+    iShift = 2;
     goto ditherOrder;
   case 2:
     pulDitherTable = &ulDither2[0][0];
-    mmShift = 1;
-    mmMask  = 0x7F7F7F7F7F7F7F7F;
+    iShift = 1;
     goto ditherOrder;
   case 3:
-    mmErrDiffMask = 0x0003000300030003;
+    ulErrDiffMask = 0x03030303;
     goto ditherError;
   // medium dithers
   case 4:
     pulDitherTable = &ulDither2[0][0];
-    mmShift = 0;
-    mmMask  = 0xFFFFFFFFFFFFFFFF;
+    iShift = 0;
     goto ditherOrder;
   case 5:
     pulDitherTable = &ulDither3[0][0];
-    mmShift = 1;
-    mmMask  = 0x7F7F7F7F7F7F7F7F;
+    iShift = 1;
     goto ditherOrder;
   case 6:
     pulDitherTable = &ulDither4[0][0];
-    mmShift = 1;
-    mmMask  = 0x7F7F7F7F7F7F7F7F;
+    iShift = 1;
     goto ditherOrder;
   case 7:
-    mmErrDiffMask = 0x0007000700070007;
+    ulErrDiffMask = 0x07070707;
     goto ditherError;
   // high dithers
   case 8:
     pulDitherTable = &ulDither3[0][0];
-    mmShift = 0;
-    mmMask  = 0xFFFFFFFFFFFFFFFF;
+    iShift = 0;
     goto ditherOrder;
   case 9:
     pulDitherTable = &ulDither4[0][0];
-    mmShift = 0;
-    mmMask  = 0xFFFFFFFFFFFFFFFF;
+    iShift = 0;
     goto ditherOrder;
   case 10:
-    mmErrDiffMask = 0x000F000F000F000F;
+    ulErrDiffMask = 0x0F0F0F0F;
     goto ditherError;
   default:
     // improper dither type
@@ -510,50 +550,7 @@ void DitherBitmap( INDEX iDitherType, uint32_t *pulSrc, uint32_t *pulDst, PIX pi
 // ------------------------------- ordered matrix dithering routine
 
 ditherOrder:
-  __asm {
-    mov     esi,D [pulSrc]
-    mov     edi,D [pulDst]
-    mov     ebx,D [pulDitherTable]
-    // reset dither line offset
-    xor     eax,eax
-    mov     edx,D [pixHeight]
-rowLoopO:
-    // get horizontal dither patterns
-    movq    mm4,Q [ebx+ eax*4 +0]
-    movq    mm5,Q [ebx+ eax*4 +8]
-    psrlw   mm4,Q [mmShift]
-    psrlw   mm5,Q [mmShift]
-    pand    mm4,Q [mmMask]
-    pand    mm5,Q [mmMask]
-    // process row
-    mov     ecx,D [pixWidth]
-pixLoopO:
-    movq    mm1,Q [esi +0]
-    movq    mm2,Q [esi +8]
-    paddusb mm1,mm4
-    paddusb mm2,mm5
-    movq    Q [edi +0],mm1
-    movq    Q [edi +8],mm2
-    // advance to next pixel
-    add     esi,4*4
-    add     edi,4*4
-    sub     ecx,4
-    jg      pixLoopO  // !!!! possible memory leak?
-    je      nextRowO
-    // backup couple of pixels
-    lea     esi,[esi+ ecx*4]
-    lea     edi,[edi+ ecx*4]
-nextRowO:
-    // get next dither line patterns
-    add     esi,D [slModulo]
-    add     edi,D [slModulo]
-    add     eax,1*4
-    and     eax,4*4-1
-    // advance to next row
-    dec     edx
-    jnz     rowLoopO
-    emms;
-  }
+  DitherOrdered( pulDitherTable, iShift, pulSrc, pulDst, pixWidth, pixHeight, pixCanvasWidth);
   goto theEnd;
 
 // ------------------------------- error diffusion dithering routine
@@ -561,101 +558,8 @@ nextRowO:
 ditherError:
   // since error diffusion algorithm requires in-place dithering, original bitmap must be copied if needed
   if( pulDst!=pulSrc) memcpy( pulDst, pulSrc, pixCanvasWidth*pixCanvasHeight *BYTES_PER_TEXEL);
-  // slModulo+=4;
   // now, dither destination
-  __asm {
-    pxor    mm0,mm0
-    mov     esi,D [pulDst]
-    mov     ebx,D [pixCanvasWidth]
-    mov     edx,D [pixHeight]
-    dec     edx // need not to dither last row
-rowLoopE:
-    // left to right
-    mov     ecx,D [pixWidth]
-    dec     ecx
-pixLoopEL:
-    movd    mm1,D [esi]
-    punpcklbw mm1,mm0
-    pand    mm1,Q [mmErrDiffMask] 
-    // determine errors
-    movq    mm3,mm1
-    movq    mm5,mm1
-    movq    mm7,mm1
-    pmullw  mm3,Q [mmW3]
-    pmullw  mm5,Q [mmW5]
-    pmullw  mm7,Q [mmW7]
-    psrlw   mm3,4     // *3/16
-    psrlw   mm5,4     // *5/16
-    psrlw   mm7,4     // *7/16
-    psubw   mm1,mm3
-    psubw   mm1,mm5
-    psubw   mm1,mm7   // *rest/16
-    packuswb mm1,mm0
-    packuswb mm3,mm0
-    packuswb mm5,mm0
-    packuswb mm7,mm0
-    // spread errors
-    paddusb mm7,Q [esi+       +4]
-    paddusb mm3,Q [esi+ ebx*4 -4]
-    paddusb mm5,Q [esi+ ebx*4 +0]
-    paddusb mm1,Q [esi+ ebx*4 +4]  // !!!! possible memory leak?
-    movd    D [esi+       +4],mm7
-    movd    D [esi+ ebx*4 -4],mm3
-    movd    D [esi+ ebx*4 +0],mm5
-    movd    D [esi+ ebx*4 +4],mm1
-    // advance to next pixel
-    add     esi,4
-    dec     ecx
-    jnz     pixLoopEL
-    // advance to next row
-    add     esi,D [slWidthModulo]
-    dec     edx
-    jz      allDoneE
-
-    // right to left
-    mov     ecx,D [pixWidth]
-    dec     ecx
-pixLoopER:
-    movd    mm1,D [esi]
-    punpcklbw mm1,mm0
-    pand    mm1,Q [mmErrDiffMask] 
-    // determine errors
-    movq    mm3,mm1
-    movq    mm5,mm1
-    movq    mm7,mm1
-    pmullw  mm3,Q [mmW3]
-    pmullw  mm5,Q [mmW5]
-    pmullw  mm7,Q [mmW7]
-    psrlw   mm3,4     // *3/16
-    psrlw   mm5,4     // *5/16
-    psrlw   mm7,4     // *7/16
-    psubw   mm1,mm3
-    psubw   mm1,mm5
-    psubw   mm1,mm7   // *rest/16
-    packuswb mm1,mm0
-    packuswb mm3,mm0
-    packuswb mm5,mm0
-    packuswb mm7,mm0
-    // spread errors
-    paddusb mm7,Q [esi+       -4]
-    paddusb mm1,Q [esi+ ebx*4 -4]
-    paddusb mm5,Q [esi+ ebx*4 +0]
-    paddusb mm3,Q [esi+ ebx*4 +4]   // !!!! possible memory leak?
-    movd    D [esi+       -4],mm7
-    movd    D [esi+ ebx*4 -4],mm1
-    movd    D [esi+ ebx*4 +0],mm5
-    movd    D [esi+ ebx*4 +4],mm3
-    // revert to previous pixel
-    sub     esi,4
-    dec     ecx
-    jnz     pixLoopER
-    // advance to next row
-    lea     esi,[esi+ ebx*4]
-    dec     edx
-    jnz     rowLoopE
-allDoneE:
-    emms;
-  }
+  DitherErrorDiffusion( ulErrDiffMask, pulDst, pixWidth, pixHeight, pixCanvasWidth, pixCanvasHeight);
   goto theEnd;
 
   // all done
@@ -663,8 +567,6 @@ theEnd:
   _pfGfxProfile.StopTimer( CGfxProfile::PTI_DITHERBITMAP);
 }
 
-
-
 // performs dithering of a 32-bit mipmaps (can be in-place)
 void DitherMipmaps( INDEX iDitherType, uint32_t *pulSrc, uint32_t *pulDst, PIX pixWidth, PIX pixHeight)
 {
@@ -695,31 +597,18 @@ static INDEX aiFilters[6][3] = {
   {  3,  4,  5 },  // maximum
   {  1,  1,  1 }}; // 
 
-// temp for middle pixels, vertical/horizontal edges, and corners
-static __int64 mmMc,  mmMe,  mmMm;  // corner, edge, middle
-static __int64 mmEch, mmEm;  // corner-high, middle
-#define mmEcl mmMc  // corner-low
-#define mmEe  mmMe  // edge
-static __int64 mmCm;  // middle
-#define mmCc mmMc  // corner
-#define mmCe mmEch // edge
-static __int64 mmInvDiv;
-static __int64 mmAdd = 0x0007000700070007;
-
-// temp rows for in-place filtering support
-static uint32_t aulRows[2048];
-
+// FilterBitmap() INTERNAL: convolution filter matrix (edges and corners repeat edge pixels)
+struct ConvolutionMatrix {
+  SLONG cm_slCorner;
+  SLONG cm_slEdge;
+  SLONG cm_slMiddle;
+  SLONG cm_slInvDiv;  // 1/sum of weights, as 16-bit fixed point
+};
 
-// FilterBitmap() INTERNAL: generates convolution filter matrix if needed
-static INDEX iLastFilter;
-static void GenerateConvolutionMatrix( INDEX iFilter)
+// FilterBitmap() INTERNAL: generates convolution filter matrix
+static void GenerateConvolutionMatrix( INDEX iFilter, ConvolutionMatrix &cm)
 {
-  // same as last?
-  if( iLastFilter==iFilter) return;
-  // update filter
-  iLastFilter = iFilter;
   INDEX iFilterAbs = Abs(iFilter) -1;
-  // convert convolution values to MMX format
   INDEX iMc = aiFilters[iFilterAbs][0];  // corner
   INDEX iMe = aiFilters[iFilterAbs][1];  // edge
   INDEX iMm = aiFilters[iFilterAbs][2];  // middle
@@ -729,22 +618,92 @@ static void GenerateConvolutionMatrix( INDEX iFilter)
     iMe  = -iMe;
     iMc  = -iMc;
   }
-  // find values for edge and corner cases
-  INDEX iEch = iMc  + iMe;
-  INDEX iEm  = iMm  + iMe;
-  INDEX iCm  = iEch + iEm;
-  // prepare divider
-  __int64 mm = ((__int64)ceil(65536.0f/(iMc*4+iMe*4+iMm))) & 0xFFFF;
-  mmInvDiv   = (mm<<48) | (mm<<32) | (mm<<16) | mm;
-  // prepare filter values
-  mm = iMc  & 0xFFFF;  mmMc = (mm<<48) | (mm<<32) | (mm<<16) | mm;
-  mm = iMe  & 0xFFFF;  mmMe = (mm<<48) | (mm<<32) | (mm<<16) | mm;
-  mm = iMm  & 0xFFFF;  mmMm = (mm<<48) | (mm<<32) | (mm<<16) | mm;
-  mm = iEch & 0xFFFF;  mmEch= (mm<<48) | (mm<<32) | (mm<<16) | mm;
-  mm = iEm  & 0xFFFF;  mmEm = (mm<<48) | (mm<<32) | (mm<<16) | mm;
-  mm = iCm  & 0xFFFF;  mmCm = (mm<<48) | (mm<<32) | (mm<<16) | mm;
+  cm.cm_slCorner = iMc;
+  cm.cm_slEdge   = iMe;
+  cm.cm_slMiddle = iMm;
+  cm.cm_slInvDiv = (SWORD)ceil(65536.0f/(iMc*4+iMe*4+iMm));
 }
 
+
+// FilterBitmap() INTERNAL: copies row of pixels with its edge pixels repeated at both sides
+static void CopyPaddedRow( uint32_t *pulRow, const uint32_t *pulSrc, PIX pixWidth)
+{
+  memcpy( pulRow+1, pulSrc, pixWidth*BYTES_PER_TEXEL);
+  pulRow[0] = pulSrc[0];
+  pulRow[pixWidth+1] = pulSrc[pixWidth-1];
+}
+
+
+// FilterBitmap() INTERNAL: padded rows around the one being filtered
+// (left neighbours are taken from separate rows, because when filtering in-place
+//  some of them have already been filtered by the time they are read)
+struct FilterRows {
+  const uint32_t *fr_pulUp,   *fr_pulUpLeft;
+  const uint32_t *fr_pulMid,  *fr_pulMidLeft;
+  const uint32_t *fr_pulDown, *fr_pulDownLeft;
+};
+
+// FilterBitmap() INTERNAL: filters pixels of a row (from given one to the end of row)
+static void FilterRow( const ConvolutionMatrix &cm, const FilterRows &fr, uint32_t *pulDst, PIX pixFirst, PIX pixWidth)
+{
+  const uint8_t *pubU  = (const uint8_t*)fr.fr_pulUp;
+  const uint8_t *pubM  = (const uint8_t*)fr.fr_pulMid;
+  const uint8_t *pubD  = (const uint8_t*)fr.fr_pulDown;
+  const uint8_t *pubUL = (const uint8_t*)fr.fr_pulUpLeft;
+  const uint8_t *pubML = (const uint8_t*)fr.fr_pulMidLeft;
+  const uint8_t *pubDL = (const uint8_t*)fr.fr_pulDownLeft;
+  uint8_t *pubDst = (uint8_t*)pulDst;
+  for( INDEX iL=pixFirst*BYTES_PER_TEXEL; iL<pixWidth*BYTES_PER_TEXEL; iL++) {
+    const INDEX iC = iL +BYTES_PER_TEXEL;
+    const INDEX iR = iC +BYTES_PER_TEXEL;
+    // (sum always fits in 16 bits, so this is the same as with 16-bit arithmetic)
+    const SLONG slSum = cm.cm_slCorner * (pubUL[iL] + pubU[iR] + pubDL[iL] + pubD[iR])
+                      + cm.cm_slEdge   * (pubU[iC]  + pubML[iL] + pubM[iR] + pubD[iC])
+                      + cm.cm_slMiddle *  pubM[iC];
+    const SLONG slRes = ((slSum+7) *cm.cm_slInvDiv) >>16;
+    pubDst[iL] = (uint8_t)Clamp( slRes, 0L, 255L);
+  }
+}
+
+
+#if BITMAP_SSE2
+// FilterBitmap() INTERNAL: loads two pixels as 16-bit words
+static inline __m128i LoadTwoPixels_SSE2( const uint32_t *pul)
+{
+  return _mm_unpacklo_epi8( _mm_loadl_epi64( (const __m128i*)pul), _mm_setzero_si128());
+}
+
+// FilterBitmap() INTERNAL: filters two pixels, returns them as 16-bit words
+static inline __m128i FilterTwoPixels_SSE2( const __m128i *pmMatrix, const FilterRows &fr, PIX pix)
+{
+  const __m128i mCorners = _mm_add_epi16( _mm_add_epi16( LoadTwoPixels_SSE2( fr.fr_pulUpLeft  +pix), LoadTwoPixels_SSE2( fr.fr_pulUp  +pix+2)),
+                                          _mm_add_epi16( LoadTwoPixels_SSE2( fr.fr_pulDownLeft+pix), LoadTwoPixels_SSE2( fr.fr_pulDown+pix+2)));
+  const __m128i mEdges   = _mm_add_epi16( _mm_add_epi16( LoadTwoPixels_SSE2( fr.fr_pulUp     +pix+1), LoadTwoPixels_SSE2( fr.fr_pulMidLeft+pix)),
+                                          _mm_add_epi16( LoadTwoPixels_SSE2( fr.fr_pulMid    +pix+2), LoadTwoPixels_SSE2( fr.fr_pulDown   +pix+1)));
+  __m128i mSum = _mm_add_epi16( _mm_mullo_epi16( mCorners, pmMatrix[0]), _mm_mullo_epi16( mEdges, pmMatrix[1]));
+  mSum = _mm_add_epi16( mSum, _mm_mullo_epi16( LoadTwoPixels_SSE2( fr.fr_pulMid+pix+1), pmMatrix[2]));
+  mSum = _mm_adds_epi16( mSum, _mm_set1_epi16(7));
+  return _mm_mulhi_epi16( mSum, pmMatrix[3]);
+}
+
+// FilterBitmap() INTERNAL: filters pixels of a row, returns number of pixels done
+static PIX FilterRow_SSE2( const ConvolutionMatrix &cm, const FilterRows &fr, uint32_t *pulDst, PIX pixWidth)
+{
+  __m128i amMatrix[4];
+  amMatrix[0] = _mm_set1_epi16( (SWORD)cm.cm_slCorner);
+  amMatrix[1] = _mm_set1_epi16( (SWORD)cm.cm_slEdge);
+  amMatrix[2] = _mm_set1_epi16( (SWORD)cm.cm_slMiddle);
+  amMatrix[3] = _mm_set1_epi16( (SWORD)cm.cm_slInvDiv);
+  PIX pix=0;
+  for( ; pix+4<=pixWidth; pix+=4) {
+    const __m128i mLo = FilterTwoPixels_SSE2( amMatrix, fr, pix);
+    const __m128i mHi = FilterTwoPixels_SSE2( amMatrix, fr, pix+2);
+    _mm_storeu_si128( (__m128i*)(pulDst+pix), _mm_packus_epi16( mLo, mHi));
+  }
+  return pix;
+}
+#endif
+
  
 // applies filter to bitmap
 void FilterBitmap( INDEX iFilter, uint32_t *pulSrc, uint32_t *pulDst, PIX pixWidth, PIX pixHeight,
@@ -766,324 +725,65 @@ void FilterBitmap( INDEX iFilter, uint32_t *pulSrc, uint32_t *pulDst, PIX pixWid
     return;
   }
 
-  // prepare convolution matrix and row modulo
+  // prepare convolution matrix
   iFilter = Clamp( iFilter, -6L, +6L);
-  GenerateConvolutionMatrix( iFilter);
-  SLONG slModulo1 = (pixCanvasWidth-pixWidth+1) *BYTES_PER_TEXEL;
-  SLONG slCanvasWidth = pixCanvasWidth *BYTES_PER_TEXEL;
-
-  // lets roll ...
-  __asm {
-    cld
-    mov     eax,D [pixCanvasWidth] // EAX = positive row offset
-    mov     edx,eax
-    neg     edx                    // EDX = negative row offset
-    pxor    mm0,mm0
-    mov     esi,D [pulSrc]
-    mov     edi,D [pulDst]
-    xor     ebx,ebx
-
-// ----------------------- process upper left corner
-
-    movd    mm1,D [esi+       +0]
-    movd    mm2,D [esi+       +4]
-    movd    mm3,D [esi+ eax*4 +0]
-    movd    mm4,D [esi+ eax*4 +4]
-    punpcklbw mm1,mm0
-    punpcklbw mm2,mm0
-    punpcklbw mm3,mm0
-    punpcklbw mm4,mm0
-    paddw   mm2,mm3
-    pmullw  mm1,Q [mmCm]
-    pmullw  mm2,Q [mmCe]
-    pmullw  mm4,Q [mmCc]
-    paddw   mm1,mm2
-    paddw   mm1,mm4
-    paddsw  mm1,Q [mmAdd]
-    pmulhw  mm1,Q [mmInvDiv]
-    packuswb mm1,mm0
-    movd    D [ebx+ aulRows],mm1
-    add     esi,4
-    add     ebx,4
-
-// ----------------------- process upper edge pixels
-
-    mov     ecx,D [pixWidth]
-    sub     ecx,2
-    // for each pixel
-upperLoop:      
-    movd    mm1,D [esi+       -4]
-    movd    mm2,D [esi+       +0]
-    movd    mm3,D [esi+       +4]
-    movd    mm4,D [esi+ eax*4 -4]
-    movd    mm5,D [esi+ eax*4 +0]
-    movd    mm6,D [esi+ eax*4 +4]
-    punpcklbw mm1,mm0
-    punpcklbw mm2,mm0
-    punpcklbw mm3,mm0
-    punpcklbw mm4,mm0
-    punpcklbw mm5,mm0
-    punpcklbw mm6,mm0
-    paddw   mm1,mm3
-    paddw   mm4,mm6
-    pmullw  mm1,Q [mmEch]
-    pmullw  mm2,Q [mmEm]
-    pmullw  mm4,Q [mmEcl]
-    pmullw  mm5,Q [mmEe]
-    paddw   mm1,mm2
-    paddw   mm1,mm4
-    paddw   mm1,mm5
-    paddsw  mm1,Q [mmAdd]
-    pmulhw  mm1,Q [mmInvDiv]
-    packuswb mm1,mm0
-    movd    D [ebx+ aulRows],mm1
-    // advance to next pixel
-    add     esi,4
-    add     ebx,4
-    dec     ecx
-    jnz     upperLoop
-
-// ----------------------- process upper right corner
-
-    movd    mm1,D [esi+       -4]
-    movd    mm2,D [esi+       +0]
-    movd    mm3,D [esi+ eax*4 -4]
-    movd    mm4,D [esi+ eax*4 +0]
-    punpcklbw mm1,mm0
-    punpcklbw mm2,mm0
-    punpcklbw mm3,mm0
-    punpcklbw mm4,mm0
-    paddw   mm1,mm4
-    pmullw  mm1,Q [mmCe]
-    pmullw  mm2,Q [mmCm]
-    pmullw  mm3,Q [mmCc]
-    paddw   mm1,mm2
-    paddw   mm1,mm3
-    paddsw  mm1,Q [mmAdd]
-    pmulhw  mm1,Q [mmInvDiv]
-    packuswb mm1,mm0
-    movd    D [ebx+ aulRows],mm1
-
-// ----------------------- process bitmap middle pixels
-
-    add     esi,D [slModulo1]
-    add     edi,D [slCanvasWidth]
-    mov     ebx,D [pixHeight]
-    sub     ebx,2
-    // for each row
-rowLoop:      
-    push    ebx
-    xor     ebx,ebx
-    // process left edge pixel
-    movd    mm1,D [esi+ edx*4 +0]
-    movd    mm2,D [esi+ edx*4 +4]
-    movd    mm3,D [esi+       +0]
-    movd    mm4,D [esi+       +4]
-    movd    mm5,D [esi+ eax*4 +0]
-    movd    mm6,D [esi+ eax*4 +4]
-    punpcklbw mm1,mm0
-    punpcklbw mm2,mm0
-    punpcklbw mm3,mm0
-    punpcklbw mm4,mm0
-    punpcklbw mm5,mm0
-    punpcklbw mm6,mm0
-    paddw   mm1,mm5
-    paddw   mm2,mm6
-    pmullw  mm1,Q [mmEch]
-    pmullw  mm2,Q [mmEcl]
-    pmullw  mm3,Q [mmEm]
-    pmullw  mm4,Q [mmEe]
-    paddw   mm1,mm2
-    paddw   mm1,mm3
-    paddw   mm1,mm4
-    paddsw  mm1,Q [mmAdd]
-    pmulhw  mm1,Q [mmInvDiv]
-    packuswb mm1,mm0
-    movd    mm2,D [ebx+ aulRows]
-    movd    D [ebx+ aulRows],mm1
-    movd    D [edi+ edx*4],mm2
-    add     esi,4
-    add     edi,4
-    add     ebx,4
-
-    // for each pixel in current row
-    mov     ecx,D [pixWidth]
-    sub     ecx,2
-pixLoop:
-    // prepare upper convolution row
-    movd    mm1,D [esi+ edx*4 -4]
-    movd    mm2,D [esi+ edx*4 +0]
-    movd    mm3,D [esi+ edx*4 +4]
-    punpcklbw mm1,mm0
-    punpcklbw mm2,mm0
-    punpcklbw mm3,mm0
-    // prepare middle convolution row
-    movd    mm4,D [esi+ -4]
-    movd    mm5,D [esi+ +0]
-    movd    mm6,D [esi+ +4]
-    punpcklbw mm4,mm0
-    punpcklbw mm5,mm0
-    punpcklbw mm6,mm0
-    // free some registers
-    paddw   mm1,mm3
-    paddw   mm2,mm4
-    pmullw  mm5,Q [mmMm]
-    // prepare lower convolution row
-    movd    mm3,D [esi+ eax*4 -4]
-    movd    mm4,D [esi+ eax*4 +0]
-    movd    mm7,D [esi+ eax*4 +4]
-    punpcklbw mm3,mm0
-    punpcklbw mm4,mm0
-    punpcklbw mm7,mm0
-    // calc weightened value
-    paddw   mm2,mm6
-    paddw   mm1,mm3
-    paddw   mm2,mm4
-    paddw   mm1,mm7
-    pmullw  mm2,Q [mmMe]
-    pmullw  mm1,Q [mmMc]
-    paddw   mm2,mm5
-    paddw   mm1,mm2
-    // calc and store wightened value
-    paddsw  mm1,Q [mmAdd]
-    pmulhw  mm1,Q [mmInvDiv]
-    packuswb mm1,mm0
-    movd    mm2,D [ebx+ aulRows]
-    movd    D [ebx+ aulRows],mm1
-    movd    D [edi+ edx*4],mm2
-    // advance to next pixel
-    add     esi,4
-    add     edi,4
-    add     ebx,4
-    dec     ecx
-    jnz     pixLoop
-
-    // process right edge pixel
-    movd    mm1,D [esi+ edx*4 -4]
-    movd    mm2,D [esi+ edx*4 +0]
-    movd    mm3,D [esi+       -4]
-    movd    mm4,D [esi+       +0]
-    movd    mm5,D [esi+ eax*4 -4]
-    movd    mm6,D [esi+ eax*4 +0]
-    punpcklbw mm1,mm0
-    punpcklbw mm2,mm0
-    punpcklbw mm3,mm0
-    punpcklbw mm4,mm0
-    punpcklbw mm5,mm0
-    punpcklbw mm6,mm0
-    paddw   mm1,mm5
-    paddw   mm2,mm6
-    pmullw  mm1,Q [mmEcl]
-    pmullw  mm2,Q [mmEch]
-    pmullw  mm3,Q [mmEe]
-    pmullw  mm4,Q [mmEm]
-    paddw   mm1,mm2
-    paddw   mm1,mm3
-    paddw   mm1,mm4
-    paddsw  mm1,Q [mmAdd]
-    pmulhw  mm1,Q [mmInvDiv]
-    packuswb mm1,mm0
-    movd    mm2,D [ebx+ aulRows]
-    movd    D [ebx+ aulRows],mm1
-    movd    D [edi+ edx*4],mm2
+  ConvolutionMatrix cm;
+  GenerateConvolutionMatrix( iFilter, cm);
+
+  // source rows are copied with edge pixels repeated at both sides, and each filtered
+  // row is stored only after the next one has been filtered (except the last one)
+  const BOOL bInPlace = (pulSrc==pulDst);
+  const PIX pixRow = pixWidth+2;
+  uint32_t *pulRows = (uint32_t*)AllocMemory( pixRow*5 *BYTES_PER_TEXEL);
+  uint32_t *pulUp   = pulRows +pixRow*0;
+  uint32_t *pulMid  = pulRows +pixRow*1;
+  uint32_t *pulDn   = pulRows +pixRow*2;
+  uint32_t *pulLast = pulRows +pixRow*3;  // previous filtered row
+  uint32_t *pulCurr = pulRows +pixRow*4;  // current filtered row
+  CopyPaddedRow( pulMid, pulSrc, pixWidth);
+  CopyPaddedRow( pulDn,  pulSrc+pixCanvasWidth, pixWidth);
+
+  // for each row
+  for( PIX pixV=0; pixV<pixHeight; pixV++)
+  { // first and last row use themselves instead of missing neighbour rows
+    const BOOL bLastRow = (pixV==pixHeight-1);
+    FilterRows fr;
+    fr.fr_pulUp   = (pixV>0)   ? pulUp : pulMid;
+    fr.fr_pulMid  = pulMid;
+    fr.fr_pulDown = !bLastRow ? pulDn : pulMid;
+    fr.fr_pulUpLeft   = fr.fr_pulUp;
+    fr.fr_pulMidLeft  = fr.fr_pulMid;
+    fr.fr_pulDownLeft = fr.fr_pulDown;
+    // in-place filtering always did store the row above while filtering this one, and the
+    // last row directly, so left neighbours there (except at the left edge) are filtered ones
+    if( bInPlace && pixV>0) {
+      pulLast[0] = pulUp[0];
+      fr.fr_pulUpLeft = pulLast;
+    }
+    if( bInPlace && bLastRow) {
+      pulCurr[0] = pulMid[0];
+      fr.fr_pulMidLeft  = pulCurr;
+      fr.fr_pulDownLeft = pulCurr;
+    }
+    // (last row of in-place filtering depends on itself, so it can't be done in parallel)
+    PIX pixU = 0;
+#if BITMAP_SSE2
+    if( sys_bCPUHasSSE2 && fr.fr_pulMidLeft!=pulCurr) pixU = FilterRow_SSE2( cm, fr, pulCurr+1, pixWidth);
+#endif
+    FilterRow( cm, fr, pulCurr+1, pixU, pixWidth);
+    // store previous row
+    if( pixV>0) memcpy( pulDst+(pixV-1)*pixCanvasWidth, pulLast+1, pixWidth*BYTES_PER_TEXEL);
+    Swap( pulLast, pulCurr);
     // advance to next row
-    add     esi,D [slModulo1]
-    add     edi,D [slModulo1]
-    pop     ebx
-    dec     ebx
-    jnz     rowLoop
-
-// ----------------------- process lower left corner
-
-    xor     ebx,ebx
-    movd    mm1,D [esi+ edx*4 +0]
-    movd    mm2,D [esi+ edx*4 +4]
-    movd    mm3,D [esi+       +0]
-    movd    mm4,D [esi+       +4]
-    punpcklbw mm1,mm0
-    punpcklbw mm2,mm0
-    punpcklbw mm3,mm0
-    punpcklbw mm4,mm0
-    paddw   mm1,mm4
-    pmullw  mm1,Q [mmCe]
-    pmullw  mm2,Q [mmCc]
-    pmullw  mm3,Q [mmCm]
-    paddw   mm1,mm2
-    paddw   mm1,mm3
-    paddsw  mm1,Q [mmAdd]
-    pmulhw  mm1,Q [mmInvDiv]
-    packuswb mm1,mm0
-    movd    mm2,D [ebx+ aulRows]
-    movd    D [edi],mm1
-    movd    D [edi+ edx*4],mm2
-    add     esi,4
-    add     edi,4
-    add     ebx,4
-
-// ----------------------- process lower edge pixels
-
-    mov     ecx,D [pixWidth]
-    sub     ecx,2
-    // for each pixel
-lowerLoop:      
-    movd    mm1,D [esi+ edx*4 -4]
-    movd    mm2,D [esi+ edx*4 +0]
-    movd    mm3,D [esi+ edx*4 +4]
-    movd    mm4,D [esi+       -4]
-    movd    mm5,D [esi+       +0]
-    movd    mm6,D [esi+       +4]
-    punpcklbw mm1,mm0
-    punpcklbw mm2,mm0
-    punpcklbw mm3,mm0
-    punpcklbw mm4,mm0
-    punpcklbw mm5,mm0
-    punpcklbw mm6,mm0
-    paddw   mm1,mm3
-    paddw   mm4,mm6
-    pmullw  mm1,Q [mmEcl]
-    pmullw  mm2,Q [mmEe]
-    pmullw  mm4,Q [mmEch]
-    pmullw  mm5,Q [mmEm]
-    paddw   mm1,mm2
-    paddw   mm1,mm4
-    paddw   mm1,mm5
-    paddsw  mm1,Q [mmAdd]
-    pmulhw  mm1,Q [mmInvDiv]
-    packuswb mm1,mm0
-    movd    mm2,D [ebx+ aulRows]
-    movd    D [edi],mm1
-    movd    D [edi+ edx*4],mm2
-    // advance to next pixel
-    add     esi,4
-    add     edi,4
-    add     ebx,4
-    dec     ecx
-    jnz     lowerLoop
-
-// ----------------------- lower right corners
-
-    movd    mm1,D [esi+ edx*4 -4]
-    movd    mm2,D [esi+ edx*4 +0]
-    movd    mm3,D [esi+       -4]
-    movd    mm4,D [esi+       +0]
-    punpcklbw mm1,mm0
-    punpcklbw mm2,mm0
-    punpcklbw mm3,mm0
-    punpcklbw mm4,mm0
-    paddw   mm2,mm3
-    pmullw  mm1,Q [mmCc]
-    pmullw  mm2,Q [mmCe]
-    pmullw  mm4,Q [mmCm]
-    paddw   mm1,mm2
-    paddw   mm1,mm4
-    paddsw  mm1,Q [mmAdd]
-    pmulhw  mm1,Q [mmInvDiv]
-    packuswb mm1,mm0
-    movd    mm2,D [ebx+ aulRows]
-    movd    D [edi],mm1
-    movd    D [edi+ edx*4],mm2
-    emms
+    uint32_t *pulFree = pulUp;
+    pulUp  = pulMid;
+    pulMid = pulDn;
+    pulDn  = pulFree;
+    if( pixV+2<pixHeight) CopyPaddedRow( pulDn, pulSrc+(pixV+2)*pixCanvasWidth, pixWidth);
   }
+  // store last row
+  memcpy( pulDst+(pixHeight-1)*pixCanvasWidth, pulLast+1, pixWidth*BYTES_PER_TEXEL);
+  FreeMemory( pulRows);
 
   // all done (finally)
   _pfGfxProfile.StopTimer( CGfxProfile::PTI_FILTERBITMAP);
@@ -1091,12 +791,60 @@ lowerLoop:
  
 
 
+#if BITMAP_SSE2
+// AdjustBitmapColor() INTERNAL: saturates two pixels given as 16-bit words
+static inline __m128i SaturateTwoPixels_SSE2( __m128i mPixels, __m128i mGrayWeights, __m128i mSaturation)
+{
+  // gray factor of each pixel, in all of its words
+  __m128i mGray = _mm_mullo_epi16( mPixels, mGrayWeights);
+  mGray = _mm_add_epi16( mGray, _mm_shufflehi_epi16( _mm_shufflelo_epi16( mGray, _MM_SHUFFLE(1,0,3,2)), _MM_SHUFFLE(1,0,3,2)));
+  mGray = _mm_add_epi16( mGray, _mm_shufflehi_epi16( _mm_shufflelo_epi16( mGray, _MM_SHUFFLE(2,3,0,1)), _MM_SHUFFLE(2,3,0,1)));
+  mGray = _mm_srli_epi16( mGray, 8);
+  // gray + (color-gray)*saturation/256, with products in 32 bits
+  const __m128i mDiff   = _mm_sub_epi16( mPixels, mGray);
+  const __m128i mProdLo = _mm_mullo_epi16( mDiff, mSaturation);
+  const __m128i mProdHi = _mm_mulhi_epi16( mDiff, mSaturation);
+  const __m128i mZero   = _mm_setzero_si128();
+  const __m128i mRes0 = _mm_add_epi32( _mm_srai_epi32( _mm_unpacklo_epi16( mProdLo, mProdHi), 8), _mm_unpacklo_epi16( mGray, mZero));
+  const __m128i mRes1 = _mm_add_epi32( _mm_srai_epi32( _mm_unpackhi_epi16( mProdLo, mProdHi), 8), _mm_unpackhi_epi16( mGray, mZero));
+  return _mm_packs_epi32( mRes0, mRes1);
+}
+
+// AdjustBitmapColor() INTERNAL: changes saturation of pixels, returns number of pixels done
+static PIX SaturateBitmap_SSE2( const uint32_t *pulSrc, uint32_t *pulDst, PIX pixSize, SLONG slSaturation)
+{
+  const __m128i mZero        = _mm_setzero_si128();
+  const __m128i mGrayWeights = _mm_setr_epi16( 72,152,32,0, 72,152,32,0);
+  const __m128i mSaturation  = _mm_set1_epi16( (SWORD)slSaturation);
+  const __m128i mAlphaMask   = _mm_set1_epi32( (int)0xFF000000);
+  PIX pix=0;
+  for( ; pix+4<=pixSize; pix+=4) {
+    const __m128i mSrc = _mm_loadu_si128( (const __m128i*)(pulSrc+pix));
+    const __m128i mLo  = SaturateTwoPixels_SSE2( _mm_unpacklo_epi8( mSrc, mZero), mGrayWeights, mSaturation);
+    const __m128i mHi  = SaturateTwoPixels_SSE2( _mm_unpackhi_epi8( mSrc, mZero), mGrayWeights, mSaturation);
+    // keep original alpha
+    const __m128i mRes = _mm_andnot_si128( mAlphaMask, _mm_packus_epi16( mLo, mHi));
+    _mm_storeu_si128( (__m128i*)(pulDst+pix), _mm_or_si128( mRes, _mm_and_si128( mSrc, mAlphaMask)));
+  }
+  return pix;
+}
+#endif
+
+
 // saturate color of bitmap
 void AdjustBitmapColor( uint32_t *pulSrc, uint32_t *pulDst, PIX pixWidth, PIX pixHeight, 
                         SLONG const slHueShift, SLONG const slSaturation)
 {
-  for( INDEX i=0; i<(pixWidth*pixHeight); i++) {
-    pulDst[i] = ByteSwap( AdjustColor( ByteSwap(pulSrc[i]), slHueShift, slSaturation));
+  const PIX pixSize = pixWidth*pixHeight;
+  PIX pix = 0;
+#if BITMAP_SSE2
+  // saturation alone can be done on several pixels at once
+  if( sys_bCPUHasSSE2 && slHueShift==0 && slSaturation!=256 && slSaturation<=MAX_SWORD) {
+    pix = SaturateBitmap_SSE2( pulSrc, pulDst, pixSize, slSaturation);
+  }
+#endif
+  for( ; pix<pixSize; pix++) {
+    pulDst[pix] = ByteSwap( AdjustColor( ByteSwap(pulSrc[pix]), slHueShift, slSaturation));
   }
 }
 
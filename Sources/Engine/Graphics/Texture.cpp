@@ -20,6 +20,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <Engine/Base/Stream.h>
 #include <Engine/Base/Timer.h>
 #include <Engine/Base/Console.h>
+#include <Engine/Base/CRC.h>
+#include <Engine/Base/Jobs.h>
 #include <Engine/Math/Functions.h>
 #include <Engine/Graphics/GfxLibrary.h>
 #include <Engine/Graphics/ImageInfo.h>
@@ -27,8 +29,10 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include <Engine/Templates/DynamicArray.h>
 #include <Engine/Templates/DynamicArray.cpp>
+#include <Engine/Templates/DynamicStackArray.cpp>
 #include <Engine/Templates/Stock_CtextureData.h>
 #include <Engine/Templates/StaticArray.cpp>
+#include <Engine/Templates/StaticStackArray.cpp>
 
 #include <Engine/Base/Statistics_internal.h>
 
@@ -41,6 +45,7 @@ extern INDEX tex_iEffectSize;
 
 extern INDEX tex_iDithering;
 extern INDEX tex_iFiltering;       
+extern INDEX tex_bMipmapCache;
 
 extern INDEX gap_bAllowSingleMipmap;
 extern float gfx_tmProbeDecay;
@@ -215,6 +220,8 @@ CTextureData::CTextureData()
   td_ptegEffect      = NULL; // no effect data
 
   td_iRenderFrame = -1;
+  td_bPending = FALSE;
+  td_tmLoad = 0.0;
   CAnimData::DefaultAnimation();
   _bExport = FALSE;
 }
@@ -715,11 +722,233 @@ static bool IsGray( uint32_t *pulMipmap, INDEX pixMipSize)
 
 
 
+// cache of processed mip-maps
+// (mip-maps are made, filtered, saturated and dithered on each load, so the final result of that is
+// kept on disk and reused if neither the texture file nor any of the settings that affect it changed)
+
+#define MIPCACHE_VERSION 1
+
+// processed texture as read from cache
+struct MipCache {
+  uint32_t mc_ulFlags;
+  uint32_t mc_ulInternalFormat;
+  INDEX    mc_iFirstMipLevel;
+  INDEX    mc_ctFineMipLevels;
+  int32_t  mc_slFrameSize;
+  INDEX    mc_ctFrames;
+  uint32_t *mc_pulFrames;  // owned until taken by texture
+  MipCache(void) { mc_pulFrames = NULL; }
+  ~MipCache(void) { if( mc_pulFrames!=NULL) FreeMemory( mc_pulFrames); }
+};
+
+
+// cache file for given texture
+static CTFileName MipCacheFileName( const CTFileName &fnmTexture)
+{
+  CTString strName = fnmTexture;
+  strName.ToLower();
+  uint32_t ulNameCRC;
+  CRC_Start( ulNameCRC);
+  CRC_AddBlock( ulNameCRC, (uint8_t*)(const char*)strName, strlen(strName));
+  CRC_Finish( ulNameCRC);
+  return CTString( 0, "Temp\\Textures\\%08X.tch", ulNameCRC);
+}
+
+
+// key of all settings that affect processing of texture with given flags read from given source
+static uint32_t MipCacheKey( uint32_t ulSourceCRC, uint32_t ulFlags, GfxAPIType eAPI)
+{
+  extern INDEX tex_bColorizeMipmaps;
+  extern INDEX tex_bProgressiveFilter;
+  extern INDEX gap_bAllowGrayTextures;
+  uint32_t ulKey;
+  CRC_Start( ulKey);
+  CRC_AddLONG( ulKey, MIPCACHE_VERSION);
+  CRC_AddLONG( ulKey, ulSourceCRC);
+  CRC_AddLONG( ulKey, ulFlags);
+  CRC_AddLONG( ulKey, eAPI);
+  CRC_AddLONG( ulKey, Clamp( tex_iFiltering, -6L, +6L));
+  CRC_AddLONG( ulKey, Clamp( tex_iDithering,  0L, 10L));
+  CRC_AddLONG( ulKey, tex_bProgressiveFilter);
+  CRC_AddLONG( ulKey, tex_bColorizeMipmaps);
+  CRC_AddLONG( ulKey, _slTexSaturation);
+  CRC_AddLONG( ulKey, _slTexHueShift);
+  CRC_AddLONG( ulKey, gap_bAllowGrayTextures);
+  CRC_AddLONG( ulKey, gap_bAllowSingleMipmap);
+  CRC_AddLONG( ulKey, _iTexForcedQuality);
+  CRC_AddLONG( ulKey, _pGfx->gl_pixMaxTextureDimension);
+  CRC_AddBlock( ulKey, (uint8_t*)&TS, sizeof(TS));
+  CRC_Finish( ulKey);
+  return ulKey;
+}
+
+
+// read processed texture from cache (returns false if not there or not valid for given key)
+static bool ReadMipCache( const CTFileName &fnmCache, uint32_t ulSourceCRC, uint32_t ulKey, MipCache &mc)
+{
+  ASSERT( mc.mc_pulFrames==NULL);
+  if( !FileExists(fnmCache)) return false;
+  try {
+    CTFileStream strm;
+    strm.Open_t( fnmCache);
+    strm.ExpectID_t( "TCCH");
+    INDEX iVersion;
+    uint32_t ulCachedCRC, ulCachedKey;
+    strm >> iVersion >> ulCachedCRC >> ulCachedKey;
+    if( iVersion!=MIPCACHE_VERSION || ulCachedCRC!=ulSourceCRC || ulCachedKey!=ulKey) return false;
+    strm >> mc.mc_ulFlags >> mc.mc_ulInternalFormat >> mc.mc_iFirstMipLevel >> mc.mc_ctFineMipLevels;
+    strm >> mc.mc_slFrameSize >> mc.mc_ctFrames;
+    const int32_t slSize = mc.mc_slFrameSize*mc.mc_ctFrames;
+    if( mc.mc_slFrameSize<=0 || mc.mc_ctFrames<=0 || slSize!=strm.GetStreamSize()-strm.GetPos_t()) return false;
+    // frames are read in one block, directly where texture will keep them
+    // (cache files are not mapped like archives are - texture owns and frees its frames, so a copy
+    // out of a view would still be needed, and one read into the final buffer is the same copy)
+    mc.mc_pulFrames = (uint32_t*)AllocMemory( slSize);
+    strm.Read_t( mc.mc_pulFrames, slSize);
+  }
+  catch( char *strError) {
+    (void)strError;
+    if( mc.mc_pulFrames!=NULL) FreeMemory( mc.mc_pulFrames);
+    mc.mc_pulFrames = NULL;
+    return false;
+  }
+  return true;
+}
+
+
+// write processed texture to cache
+static void WriteMipCache( const CTFileName &fnmCache, uint32_t ulSourceCRC, uint32_t ulKey, CTextureData *pTD)
+{
+  try {
+    CTFileStream strm;
+    strm.Create_t( fnmCache);
+    strm.WriteID_t( "TCCH");
+    strm << (INDEX)MIPCACHE_VERSION << ulSourceCRC << ulKey;
+    strm << pTD->td_ulFlags << pTD->td_ulInternalFormat << pTD->td_iFirstMipLevel << pTD->td_ctFineMipLevels;
+    strm << pTD->td_slFrameSize << pTD->td_ctFrames;
+    strm.Write_t( pTD->td_pulFrames, pTD->td_slFrameSize*pTD->td_ctFrames);
+  }
+  catch( char *strError) {
+    // report only once, as it would probably fail for all textures
+    static bool bReported = false;
+    if( !bReported) CPrintF( TRANS("Cannot write texture cache: %s\n"), strError);
+    bReported = true;
+  }
+}
+
+
+// textures loaded in batch (frames are read, but mip-maps are not made yet)
+// (reading is done on main thread as streams and stocks aren't thread safe, and all the rest is
+// done when batch ends, or when one of the textures is needed, on all threads at once)
+
+struct PendingTexture {
+  CTextureData *pt_ptd;
+  bool pt_bUseCache;
+  CTFileName pt_fnmCache;
+  uint32_t pt_ulSourceCRC;
+  uint32_t pt_ulCacheKey;
+};
+
+static INDEX _ctBatchLevels = 0;
+static CStaticStackArray<PendingTexture> _aptPending;
+
+
+// start postponing processing of loaded textures (batches can be nested)
+void BeginTextureBatch(void)
+{
+  _ctBatchLevels++;
+}
+
+// stop postponing, and process all textures loaded since outermost batch began
+void EndTextureBatch(void)
+{
+  ASSERT( _ctBatchLevels>0);
+  _ctBatchLevels--;
+  if( _ctBatchLevels==0) FinishPendingTextures();
+}
+
+
+// larger textures first, so that threads are done at about same time
+static int qsort_CompareTextureSize( const void *pv0, const void *pv1)
+{
+  const CTextureData &td0 = *((const PendingTexture*)pv0)->pt_ptd;
+  const CTextureData &td1 = *((const PendingTexture*)pv1)->pt_ptd;
+  const int32_t slSize0 = td0.td_slFrameSize*td0.td_ctFrames;
+  const int32_t slSize1 = td1.td_slFrameSize*td1.td_ctFrames;
+  if( slSize0>slSize1) return -1;
+  if( slSize0<slSize1) return +1;
+  return 0;
+}
+
+static void ProcessPendingTexture( INDEX iJob, void *pvData)
+{
+  CTextureData &td = *((PendingTexture*)pvData)[iJob].pt_ptd;
+  const CTimerValue tvStart = _pTimer->GetHighPrecisionTimer();
+  td.ProcessFrames();
+  td.td_tmLoad += (_pTimer->GetHighPrecisionTimer()-tvStart).GetSeconds();
+}
+
+// textures processed in current batch so far, and how long it took
+static INDEX  _ctBatchProcessed = 0;
+static double _dBatchSeconds = 0.0;
+
+// process textures that are pending now
+static void ProcessPendingTextures(void)
+{
+  const INDEX ctPending = _aptPending.Count();
+  const CTimerValue tvStart = _pTimer->GetHighPrecisionTimer();
+
+  qsort( &_aptPending[0], ctPending, sizeof(PendingTexture), qsort_CompareTextureSize);
+  JOB_Run( ctPending, ProcessPendingTexture, &_aptPending[0]);
+
+  // what's left must be done on main thread
+  for( INDEX iPending=0; iPending<ctPending; iPending++) {
+    PendingTexture &pt = _aptPending[iPending];
+    pt.pt_ptd->td_bPending = FALSE;
+    if( pt.pt_bUseCache) WriteMipCache( pt.pt_fnmCache, pt.pt_ulSourceCRC, pt.pt_ulCacheKey, pt.pt_ptd);
+  }
+  _aptPending.PopAll();
+
+  _ctBatchProcessed += ctPending;
+  _dBatchSeconds += (_pTimer->GetHighPrecisionTimer()-tvStart).GetSeconds();
+}
+
+// process all textures whose processing has been postponed
+void FinishPendingTextures(void)
+{
+  const INDEX ctPending = _aptPending.Count();
+  if( ctPending>0) {
+    ProcessPendingTextures();
+  }
+  // report once when batch ends, even if some textures were needed earlier
+  if( _ctBatchLevels==0 && _ctBatchProcessed>0) {
+    CPrintF( TRANS("Processed %d textures in %.2f seconds on %d threads\n"), _ctBatchProcessed, _dBatchSeconds, JOB_GetThreadCount());
+    _ctBatchProcessed = 0;
+    _dBatchSeconds = 0.0;
+  }
+}
+
+// remove texture that is being cleared from pending ones
+static void RemovePendingTexture( CTextureData *ptd)
+{
+  const INDEX ctPending = _aptPending.Count();
+  for( INDEX iPending=0; iPending<ctPending; iPending++) {
+    if( _aptPending[iPending].pt_ptd!=ptd) continue;
+    // move last one here
+    _aptPending[iPending] = _aptPending[ctPending-1];
+    _aptPending.Pop();
+    break;
+  }
+  ptd->td_bPending = FALSE;
+}
+
 // reads 32/24-bit texture from file and eventually converts it to 8-bit pixel format
 void CTextureData::Read_t( CTStream *inFile)
 {
   //assert( inFile->GetDescription() != "Textures\\Test\\BetterQuality\\FloorWS08.tex");
 
+  const CTimerValue tvStart = _pTimer->GetHighPrecisionTimer();
+
   // reset texture (blank all except some flags)
   Clear();
 
@@ -744,6 +973,21 @@ void CTextureData::Read_t( CTStream *inFile)
   
   // mark if this texture was loaded form the old format
   if( iVersion==3) td_ulFlags |= TEX_WASOLD;
+
+  // see if processed mip-maps can be taken from cache (only for texture files)
+  const CTFileName fnmTexture = inFile->GetDescription();
+  bool bUseCache = !_bExport && tex_bMipmapCache && (bHasContext || (td_ulFlags&TEX_STATIC))
+                && fnmTexture.FileExt()==".tex";
+  uint32_t ulSourceCRC=0, ulCacheKey=0;
+  CTFileName fnmCache;
+  MipCache mc;  // frames from cache are freed if not taken, even if reading throws
+  if( bUseCache) {
+    ulSourceCRC = inFile->GetStreamCRC32_t();
+    ulCacheKey  = MipCacheKey( ulSourceCRC, td_ulFlags, eAPI);
+    fnmCache    = MipCacheFileName(fnmTexture);
+    ReadMipCache( fnmCache, ulSourceCRC, ulCacheKey, mc);
+  }
+
   bool bResetEffectBuffers = FALSE;
   bool bFramesLoaded = FALSE;
   bool bAlphaChannel = FALSE;
@@ -781,8 +1025,8 @@ void CTextureData::Read_t( CTStream *inFile)
     // if this is chunk containing raw frames
     else if( idChunk == CChunkID("FRMS")) 
     { 
-      // if no driver is present and texture is not static
-      if( !(bHasContext || td_ulFlags&TEX_STATIC))
+      // if no driver is present and texture is not static, or processed frames are in cache
+      if( !(bHasContext || td_ulFlags&TEX_STATIC) || mc.mc_pulFrames!=NULL)
       { // determine frames' size
         int32_t slSkipSize = td_slFrameSize;
         if( iVersion==4) {
@@ -792,6 +1036,7 @@ void CTextureData::Read_t( CTStream *inFile)
         } 
         // just seek over frames (skip it)
         inFile->Seek_t( slSkipSize*td_ctFrames, CTStream::SD_CUR);
+        if( mc.mc_pulFrames!=NULL) bFramesLoaded = TRUE;
         continue;
       }
       // calculate texture size for corresponding texture format and allocate memory
@@ -936,10 +1181,64 @@ void CTextureData::Read_t( CTStream *inFile)
   }
 
   // were done if frames weren't loaded or effect texture has been read
-  if( !bFramesLoaded || td_ptegEffect!=NULL) return;
+  if( !bFramesLoaded || td_ptegEffect!=NULL) {
+    return;
+  }
+
+  // if processed frames are in cache
+  if( mc.mc_pulFrames!=NULL) {
+    // just take them as they are
+    td_ulFlags          = mc.mc_ulFlags;
+    td_ulInternalFormat = mc.mc_ulInternalFormat;
+    td_iFirstMipLevel   = mc.mc_iFirstMipLevel;
+    td_ctFineMipLevels  = mc.mc_ctFineMipLevels;
+    td_slFrameSize      = mc.mc_slFrameSize;
+    td_ctFrames         = mc.mc_ctFrames;
+    td_pulFrames        = mc.mc_pulFrames;
+    mc.mc_pulFrames     = NULL;
+    td_tmLoad = (_pTimer->GetHighPrecisionTimer()-tvStart).GetSeconds();
+    if( bHasContext && !(td_ulFlags&TEX_STATIC)) SetAsCurrent();
+    return;
+  }
 
   // if texture is in old format, convert it to current format
   if( iVersion==3) Convert(this);
+
+  // clamp settings here, as processing might be done on other threads
+  tex_iFiltering = Clamp( tex_iFiltering, -6L, +6L);
+  tex_iDithering = Clamp( tex_iDithering,  0L, 10L);
+
+  // if in batch, postpone processing until the batch ends or texture is needed
+  if( _ctBatchLevels>0 && !_bExport) {
+    PendingTexture &pt = _aptPending.Push();
+    pt.pt_ptd = this;
+    pt.pt_bUseCache   = bUseCache;
+    pt.pt_fnmCache    = fnmCache;
+    pt.pt_ulSourceCRC = ulSourceCRC;
+    pt.pt_ulCacheKey  = ulCacheKey;
+    td_bPending = TRUE;
+    td_tmLoad = (_pTimer->GetHighPrecisionTimer()-tvStart).GetSeconds();
+    return;
+  }
+
+  // generate mip-maps and adjust them
+  ProcessFrames();
+  // keep processed frames for next time
+  if( bUseCache) WriteMipCache( fnmCache, ulSourceCRC, ulCacheKey, this);
+  td_tmLoad = (_pTimer->GetHighPrecisionTimer()-tvStart).GetSeconds();
+
+  // upload texture if not static and API is active
+  // (or, in the other hand, better not - this could cause reloading due to force() after obtain())
+  if( !_bExport && bHasContext && !(td_ulFlags&TEX_STATIC)) SetAsCurrent();
+}
+
+
+// generate mip-maps for read frames and eventually adjust them (might be called on worker thread)
+void CTextureData::ProcessFrames(void)
+{
+  const GfxAPIType eAPI = _pGfx->gl_eCurrentAPI;
+  const bool bAlphaChannel = td_ulFlags&TEX_ALPHACHANNEL;
+
   PIX pixWidth  = GetPixWidth();
   PIX pixHeight = GetPixHeight();
   PIX pixTexSize = pixWidth*pixHeight;
@@ -961,7 +1260,6 @@ void CTextureData::Read_t( CTStream *inFile)
   }
   // generate texture mip-maps for each frame (in version 4 they're no longer kept in file)
   // and eventually adjust texture saturation, do filtering and/or dithering
-  tex_iFiltering = Clamp( tex_iFiltering, -6L, +6L);
   INDEX iTexFilter = tex_iFiltering;
   if( _bExport || (td_ulFlags&TEX_CONSTANT)) iTexFilter = 0; // don't filter constants and textures for exporting
   if( iTexFilter) td_ulFlags |= TEX_FILTERED;
@@ -1018,7 +1316,6 @@ void CTextureData::Read_t( CTStream *inFile)
 
   // prepare dithering type
   td_ulInternalFormat = DetermineInternalFormat(this);
-  tex_iDithering = Clamp( tex_iDithering, 0L, 10L); 
   INDEX iDitherType = 0;
   if( !(td_ulFlags&TEX_STATIC) || !(td_ulFlags&TEX_CONSTANT)) { // only non-static-constant textures can be dithered
     extern INDEX AdjustDitheringType_OGL(    GLenum eFormat, INDEX iDitheringType);
@@ -1036,9 +1333,6 @@ void CTextureData::Read_t( CTStream *inFile)
       DitherMipmaps( iDitherType, pulCurrentFrame, pulCurrentFrame, pixWidth, pixHeight);
     }
   }
-  // upload texture if not static and API is active
-  // (or, in the other hand, better not - this could cause reloading due to force() after obtain())
-  if( !_bExport && bHasContext && !(td_ulFlags&TEX_STATIC)) SetAsCurrent();
 }
 
 
@@ -1046,6 +1340,7 @@ void CTextureData::Read_t( CTStream *inFile)
 // writes texutre to file
 void CTextureData::Write_t( CTStream *outFile)   // throw char *
 {
+  Finish();
   // cannot write textures that have been mangled somehow
   _bExport = FALSE;
   if( td_ptegEffect==NULL && IsModified()) throw( TRANS("Cannot write texture that has modified frames."));
@@ -1163,6 +1458,8 @@ void CTextureData::Export_t( class CImageInfo &iiExportedImage, INDEX iFrame)
   // reload without modifications
   _bExport = TRUE;
   Reload();
+  // frames are needed right away
+  Finish();
   assert( td_pulFrames!=NULL);
 
   // prepare miplevel and mipmap offset
@@ -1195,12 +1492,17 @@ void CTextureData::Export_t( class CImageInfo &iiExportedImage, INDEX iFrame)
 // force texture to be re-loaded (if needed) in corresponding manner
 void CTextureData::Force( uint32_t ulTexFlags) 
 {
+  Finish();
   assert( td_ctFrames>0);
   const bool bReload = (td_pulFrames==NULL        && (ulTexFlags&TEX_STATIC))
                    || ((td_ulFlags&TEX_DISPOSED)  && (ulTexFlags&TEX_CONSTANT))
                    || ((td_ulFlags&TEX_SATURATED) && (ulTexFlags&TEX_KEEPCOLOR));
   td_ulFlags |= ulTexFlags & (TEX_CONSTANT|TEX_STATIC|TEX_KEEPCOLOR);
-  if( bReload) Reload();
+  if( bReload) {
+    Reload();
+    // caller needs the frames right away
+    Finish();
+  }
 }
 
 
@@ -1208,6 +1510,9 @@ void CTextureData::Force( uint32_t ulTexFlags)
 // set texture to be as current for accelerator and eventually upload it to accelerator's memory
 void CTextureData::SetAsCurrent( INDEX iFrameNo/*=0*/, bool bForceUpload/*=FALSE*/)
 {
+  // make sure texture is processed (this will process all postponed textures)
+  Finish();
+
   // check API
   const GfxAPIType eAPI = _pGfx->gl_eCurrentAPI;
 #ifdef SE1_D3D
@@ -1502,6 +1807,8 @@ void CTextureData::Clear(void)
 {
   // unbind texture from OpenGL or Direct3D memory
   Unbind();
+  // don't process it anymore if it was postponed
+  if( td_bPending) RemovePendingTexture(this);
 
   // free allocated memory and reset pointer
   if( td_pulFrames!=NULL && td_slFrameSize!=0) {
@@ -1764,6 +2071,8 @@ bool CTextureData::IsAutoFreed(void)
 // get amount of memory used by this object
 int32_t CTextureData::GetUsedMemory(void)
 {
+  // frame size is known only after processing
+  Finish();
   // readout texture object
   uint32_t ulTexObject = td_ulObject;
   if( td_ctFrames>1) ulTexObject = td_pulObjects[0];
@@ -1786,6 +2095,8 @@ int32_t CTextureData::GetUsedMemory(void)
 // get texel from texture's largest mip-map
 COLOR CTextureData::GetTexel( MEX mexU, MEX mexV)
 {
+  // make sure frames are processed
+  Finish();
   // if the texture is not static
   if (!(td_ulFlags&TEX_STATIC) && !(td_ulFlags&TEX_CONSTANT)) {
     // print warning
@@ -1810,6 +2121,7 @@ COLOR CTextureData::GetTexel( MEX mexU, MEX mexV)
 // copy (and eventually convert to floats) one row from texture to an array (iChannel is 1=R,2=G,3=B,4=A)
 void CTextureData::FetchRow( PIX pixRow, void *pvDst, INDEX iChannel/*=4*/, bool bConvertToFloat/*=TRUE*/)
 {
+  Finish();
   // if the texture is not static
   if (!(td_ulFlags&TEX_STATIC) && !(td_ulFlags&TEX_CONSTANT)) {
     // print warning
@@ -1832,6 +2144,7 @@ void CTextureData::FetchRow( PIX pixRow, void *pvDst, INDEX iChannel/*=4*/, bool
 // get pointer to one row of texture
 uint32_t *CTextureData::GetRowPointer( PIX pixRow)
 {
+  Finish();
   // if the texture is not static
   if (!(td_ulFlags&TEX_STATIC) && !(td_ulFlags&TEX_CONSTANT)) {
     // print warning
@@ -1847,6 +2160,7 @@ uint32_t *CTextureData::GetRowPointer( PIX pixRow)
 // get string description of texture size, mips and parameters
 CTString CTextureData::GetDescription(void)
 {
+  Finish();
   // get all parameters
   MEX mexSizeU = GetWidth();
   MEX mexSizeV = GetHeight();
@@ -1883,6 +2197,84 @@ CTString CTextureData::GetDescription(void)
     strAnims.PrintF(" %d(%d)anim", ad_NumberOfAnims, aiInfo.ai_NumberOfFrames);
   }
 
+  // add time it took to load
+  CTString strLoad = "";
+  if( td_tmLoad>0) strLoad.PrintF(" %.1fms", td_tmLoad*1000.0);
+
   // return combined string
-  return str+strFlags+strAnims;
+  return str+strFlags+strAnims+strLoad;
+}
+
+
+// max number of textures loaded in mip-map cache benchmark
+#define CACHE_BENCHMARK_TEXTURES 500
+
+// load textures with given pattern three times: with cache disabled, with cache enabled but
+// emptied first (cold), and with cache filled by the previous load (warm)
+void BenchmarkTextureCache( const CTString &strPattern)
+{
+  CTFileName fnmPattern = strPattern;
+  if( fnmPattern=="") fnmPattern = CTString("Textures\\*.tex");
+  CDynamicStackArray<CTFileName> afnmFiles;
+  MakeDirList( afnmFiles, fnmPattern.FileDir(), fnmPattern.FileName()+fnmPattern.FileExt(), DLI_RECURSIVE);
+  const INDEX ctTextures = Min( afnmFiles.Count(), INDEX(CACHE_BENCHMARK_TEXTURES));
+  if( ctTextures==0) {
+    CPrintF( TRANS("No textures matching '%s'.\n"), (const char*)fnmPattern);
+    return;
+  }
+
+  const INDEX bOldCache = tex_bMipmapCache;
+  CStaticArray<uint32_t> aulFrameCRCs[3];
+  double adSeconds[3];
+  INDEX ctErrors = 0;
+  INDEX ctCached = 0;
+  for( INDEX iRun=0; iRun<3; iRun++)
+  {
+    tex_bMipmapCache = iRun>0;
+    aulFrameCRCs[iRun].New( ctTextures);
+    // cold run starts with no cache files
+    if( iRun==1) {
+      for( INDEX iTex=0; iTex<ctTextures; iTex++) RemoveFile( MipCacheFileName(afnmFiles[iTex]));
+    }
+    adSeconds[iRun] = 0.0;
+    for( INDEX iTex=0; iTex<ctTextures; iTex++)
+    {
+      uint32_t &ulCRC = aulFrameCRCs[iRun][iTex];
+      ulCRC = 0;
+      CTextureData td;
+      const CTimerValue tvStart = _pTimer->GetHighPrecisionTimer();
+      try {
+        td.Load_t( afnmFiles[iTex]);
+      } catch( char *strError) {
+        if( iRun==0) {
+          CPrintF( "%s\n", strError);
+          ctErrors++;
+        }
+        continue;
+      }
+      adSeconds[iRun] += (_pTimer->GetHighPrecisionTimer()-tvStart).GetSeconds();
+      // remember what was loaded, to check that cache gives the same
+      if( td.td_pulFrames!=NULL) {
+        CRC_Start( ulCRC);
+        CRC_AddLONG( ulCRC, td.td_ulFlags);
+        CRC_AddBlock( ulCRC, (uint8_t*)td.td_pulFrames, td.td_slFrameSize*td.td_ctFrames);
+        CRC_Finish( ulCRC);
+      }
+      if( iRun==1 && FileExists( MipCacheFileName(afnmFiles[iTex]))) ctCached++;
+    }
+  }
+  tex_bMipmapCache = bOldCache;
+
+  INDEX ctMismatches = 0;
+  for( INDEX iTex=0; iTex<ctTextures; iTex++) {
+    if( aulFrameCRCs[1][iTex]!=aulFrameCRCs[0][iTex] || aulFrameCRCs[2][iTex]!=aulFrameCRCs[0][iTex]) ctMismatches++;
+  }
+
+  CPrintF( TRANS("%d textures loaded, %d of them cached\n"), ctTextures, ctCached);
+  CPrintF( TRANS("  no cache:   %8.2fms, %.2fms per texture\n"), adSeconds[0]*1E3, adSeconds[0]*1E3/ctTextures);
+  CPrintF( TRANS("  cold cache: %8.2fms, %.2fms per texture\n"), adSeconds[1]*1E3, adSeconds[1]*1E3/ctTextures);
+  CPrintF( TRANS("  warm cache: %8.2fms, %.2fms per texture\n"), adSeconds[2]*1E3, adSeconds[2]*1E3/ctTextures);
+  if( ctErrors>0)     CPrintF( TRANS("  %d textures could not be loaded\n"), ctErrors);
+  if( ctMismatches>0) CPrintF( TRANS("  %d textures loaded DIFFERENTLY from cache!\n"), ctMismatches);
+  else CPrintF( TRANS("  cache gave the same frames\n"));
 }
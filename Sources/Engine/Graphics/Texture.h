@@ -48,6 +48,20 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #define TEX_WASOLD       (1UL<<30)  // loaded from old format (version 3)
 
 
+// textures loaded while batch is open are processed (mip-maps made, etc.) in parallel when it ends
+ENGINE_API extern void BeginTextureBatch(void);
+ENGINE_API extern void EndTextureBatch(void);
+// process all textures loaded in batch so far
+ENGINE_API extern void FinishPendingTextures(void);
+
+// keeps texture batch open while in scope
+class CTextureBatch {
+public:
+  inline CTextureBatch(void)  { BeginTextureBatch(); };
+  inline ~CTextureBatch(void) { EndTextureBatch(); };
+};
+
+
 /*
  * Bitmap data for a class of texture objects
  */
@@ -76,6 +90,8 @@ public:
   class CTextureEffectGlobal *td_ptegEffect;  // all data for effect textures
 
   INDEX td_iRenderFrame; // frame number currently rendering (for profiling)
+  bool td_bPending;      // frames are read, but not processed yet (see BeginTextureBatch())
+  double td_tmLoad;      // time spent loading this texture (in seconds)
 
   // constructor and destructor
 	CTextureData();
@@ -87,6 +103,11 @@ public:
   // converts global mip level to the corresponding one of texture
   INDEX ClampMipLevel( FLOAT fMipFactor) const;
 
+  // make sure that texture has been processed if it was loaded in batch
+  inline void Finish(void) { if( td_bPending) FinishPendingTextures(); };
+  // generate mip-maps for read frames and eventually adjust them
+  void ProcessFrames(void);
+
   // gets values from some of texture data members
   inline MEX GetWidth(void)     const { return td_mexWidth;  };
   inline MEX GetHeight(void)    const { return td_mexHeight; };
@@ -25,8 +25,11 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <Engine/World/World.h>
 #include <Engine/Entities/Entity.h>
 #include <Engine/Templates/StaticArray.cpp>
+#include <Engine/Templates/StaticStackArray.cpp>
 #include <Engine/Graphics/GfxLibrary.h>
 #include <Engine/Math/Clipping.inl>
+#include <Engine/Base/Jobs.h>
+#include <Engine/Base/ProgressHook.h>
 
 #include <Engine/Light/Shadows_internal.h>
 #include <Engine/World/WorldEditingProfile.h>
@@ -36,6 +39,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 extern INDEX _ctShadowLayers=0;
 extern INDEX _ctShadowClusters=0;
+extern INDEX shd_bParallelBaking;
 
 
 // class used for making shadow layers (used only locally)
@@ -94,6 +98,8 @@ public:
   // make shadow mask for the light
   ULONG MakeShadowMask(CBrushShadowLayer *pbsl);
   ULONG MakeOneShadowMaskMip(INDEX iMip);
+  // make mip-maps, spread and pack rendered shadow mask (doesn't render, so can run on any thread)
+  void FinishShadowMask(void);
   // flip shadow mask around V axis (for parallel lights)
   void FlipShadowMask(INDEX iMip);
 
@@ -110,6 +116,14 @@ public:
   bool CreateLayers(CBrushPolygon &bpo, CWorld &woWorld, bool bDoDirectionalLights);
 };
 
+// layers that are rendered, but not finished yet (when baking in parallel)
+static BOOL _bBakingInParallel = FALSE;
+static CStaticStackArray<CLayerMaker> _almPendingLayers;
+static CStaticStackArray<uint8_t *> _apubPendingPolygonMasks;
+static SLONG _slPendingSize = 0;  // pixels in pending layers
+// finish pending layers when there are this many pixels in them
+#define PENDING_PIXELS_MAX (16*1024*1024)
+
 /* Make mip-maps of the shadow mask. */
 static void MakeMipmapsForMask(uint8_t *pubMask, PIX pixSizeU, PIX pixSizeV, SLONG slTotalSize)
 {
@@ -644,7 +658,31 @@ ULONG CLayerMaker::MakeShadowMask(CBrushShadowLayer *pbsl)
   } else {
     // make first mip-map of mask
     ulLighted&=MakeOneShadowMaskMip(0);
-    // make other shadow mask mips from the first one
+  }
+  pbsl->bsl_pubLayer = lm_pubLayer;
+
+  // update statistics
+  _ctShadowLayers++;
+  _ctShadowClusters+=lm_mmtLayer.mmt_slTotalSize;
+
+  // if baking on all processors
+  if( _bBakingInParallel) {
+    // postpone the rest, unless the layer will be freed anyway
+    if( ulLighted==0) {
+      _almPendingLayers.Push() = *this;
+      _slPendingSize += lm_mmtLayer.mmt_slTotalSize;
+    }
+  } else {
+    FinishShadowMask();
+  }
+  return ulLighted;
+}
+
+// make mip-maps, spread and pack rendered shadow mask (doesn't render, so can run on any thread)
+void CLayerMaker::FinishShadowMask(void)
+{
+  // if mips weren't rendered, make other shadow mask mips from the first one
+  if( !(lm_pbpoPolygon->bpo_ulFlags & BPOF_ACCURATESHADOWS)) {
     MakeMipmapsForMask( lm_pubLayer, lm_mmtLayer.mmt_pixU, lm_mmtLayer.mmt_pixV,
                         lm_mmtLayer.mmt_slTotalSize);
   }
@@ -660,13 +698,7 @@ ULONG CLayerMaker::MakeShadowMask(CBrushShadowLayer *pbsl)
   // convert the shadow mask from byte-packed into bit-packed mask
   ConvertBytesToBits(lm_pubLayer, lm_pubLayer, lm_mmtLayer.mmt_slTotalSize);
   ShrinkMemory((void **)&lm_pubLayer, (lm_mmtLayer.mmt_slTotalSize+7)/8);
-  pbsl->bsl_pubLayer = lm_pubLayer;
-
-  // update statistics
-  _ctShadowLayers++;
-  _ctShadowClusters+=lm_mmtLayer.mmt_slTotalSize;
-
-  return ulLighted;
+  lm_pbslLayer->bsl_pubLayer = lm_pubLayer;
 }
 
 ULONG CLayerMaker::MakeOneShadowMaskMip(INDEX iMip)
@@ -861,8 +893,12 @@ bool CLayerMaker::CreateLayers(CBrushPolygon &bpo, CWorld &woWorld, bool bDoDire
 
   // if was intialized
   if( bInitialized) {
-    // free bit-packed polygon mask
-    FreeMemory( lm_pubPolygonMask);
+    // free bit-packed polygon mask (postponed layers still need it)
+    if( _bBakingInParallel) {
+      _apubPendingPolygonMasks.Push() = lm_pubPolygonMask;
+    } else {
+      FreeMemory( lm_pubPolygonMask);
+    }
   }
 
   // if some new layers have been calculated
@@ -889,3 +925,127 @@ void CBrushPolygon::MakeShadowMap(CWorld *pwoWorld, bool bDoDirectionalLights)
   }
   _pfWorldEditingProfile.StopTimer(CWorldEditingProfile::PTI_MAKESHADOWMAP);
 }
+
+
+// check if a polygon has some layers that CreateLayers() would calculate
+static bool HasLayersToCalculate(CBrushPolygon &bpo, bool bDoDirectionalLights)
+{
+  FOREACHINLIST(CBrushShadowLayer, bsl_lnInShadowMap, bpo.bpo_smShadowMap.bsm_lhLayers, itbsl) {
+    const ULONG ulLightFlags = itbsl->bsl_plsLightSource->ls_ulFlags;
+    if( (itbsl->bsl_ulFlags&BSLF_CALCULATED) || (ulLightFlags&LSF_DYNAMIC)) continue;
+    if( !bDoDirectionalLights && (ulLightFlags&LSF_DIRECTIONAL)) continue;
+    return true;
+  }
+  return false;
+}
+
+// polygons whose shadow maps are being made
+struct ShadowBakeBatch {
+  CWorld *sbb_pwoWorld;
+  CBrushPolygon **sbb_apbpoPolygons;
+  bool sbb_bDoDirectionalLights;
+};
+
+// make bit-packed polygon mask for one polygon in batch, if it is going to be needed
+static void MakeQueuedPolygonMask( INDEX iJob, void *pvData)
+{
+  const ShadowBakeBatch &sbb = *(const ShadowBakeBatch*)pvData;
+  CBrushPolygon &bpo = *sbb.sbb_apbpoPolygons[iJob];
+  if( bpo.bpo_smShadowMap.bsm_pubPolygonMask!=NULL) return;
+  if( !HasLayersToCalculate( bpo, sbb.sbb_bDoDirectionalLights)) return;
+
+  // polygon mask doesn't depend on rendering, so it is made exactly as CreateLayers() would
+  CLayerMaker lmMaker;
+  lmMaker.lm_pwoWorld = sbb.sbb_pwoWorld;
+  lmMaker.lm_pbsmShadowMap = &bpo.bpo_smShadowMap;
+  lmMaker.lm_pbpoPolygon = &bpo;
+  lmMaker.CalculateData();
+  lmMaker.MakePolygonMask();
+  FreeMemory( lmMaker.lm_pubPolygonMask);
+}
+
+// larger layers first, so that threads are done at about same time
+static int qsort_CompareLayerSize( const void *pv0, const void *pv1)
+{
+  const SLONG slSize0 = ((const CLayerMaker*)pv0)->lm_mmtLayer.mmt_slTotalSize;
+  const SLONG slSize1 = ((const CLayerMaker*)pv1)->lm_mmtLayer.mmt_slTotalSize;
+  if( slSize0>slSize1) return -1;
+  if( slSize0<slSize1) return +1;
+  return 0;
+}
+
+static void FinishPendingLayer( INDEX iJob, void *pvData)
+{
+  ((CLayerMaker*)pvData)[iJob].FinishShadowMask();
+}
+
+// finish all layers whose finishing has been postponed
+static void FinishPendingLayers(void)
+{
+  const INDEX ctPending = _almPendingLayers.Count();
+  if( ctPending>0) {
+    qsort( &_almPendingLayers[0], ctPending, sizeof(CLayerMaker), qsort_CompareLayerSize);
+    JOB_Run( ctPending, FinishPendingLayer, &_almPendingLayers[0]);
+    _almPendingLayers.PopAll();
+  }
+  // polygon masks of those layers are not needed anymore
+  for( INDEX iMask=0; iMask<_apubPendingPolygonMasks.Count(); iMask++) {
+    FreeMemory( _apubPendingPolygonMasks[iMask]);
+  }
+  _apubPendingPolygonMasks.PopAll();
+  _slPendingSize = 0;
+}
+
+/*
+ * Create shadow maps for all polygons queued for calculation in the world,
+ * return number of threads that were used.
+ * (progress hook may throw to stop calculation, then the rest remain queued)
+ */
+INDEX MakeQueuedShadowMaps(CWorld *pwoWorld, bool bDoDirectionalLights, bool bReportProgress)
+{
+  // gather queued polygons (making a shadow map unqueues it)
+  CStaticStackArray<CBrushPolygon *> apbpoPolygons;
+  FOREACHINLIST(CBrushShadowMap, bsm_lnInUncalculatedShadowMaps,
+    pwoWorld->wo_baBrushes.ba_lhUncalculatedShadowMaps, itbsm) {
+    apbpoPolygons.Push() = itbsm->GetBrushPolygon();
+  }
+  const INDEX ctPolygons = apbpoPolygons.Count();
+  if( ctPolygons==0) return 1;
+
+  // shadows are rendered one by one, since renderer can't run on more threads;
+  // polygon masks and finishing of rendered layers don't need it, so they are spread over all
+  const INDEX ctThreads = shd_bParallelBaking ? JOB_GetThreadCount() : 1;
+  if( ctThreads>1) {
+    ShadowBakeBatch sbb;
+    sbb.sbb_pwoWorld = pwoWorld;
+    sbb.sbb_apbpoPolygons = &apbpoPolygons[0];
+    sbb.sbb_bDoDirectionalLights = bDoDirectionalLights;
+    JOB_Run( ctPolygons, MakeQueuedPolygonMask, &sbb);
+    _bBakingInParallel = TRUE;
+  }
+
+  try {
+    INDEX iLastPercent = 0;
+    for( INDEX iPolygon=0; iPolygon<ctPolygons; iPolygon++) {
+      apbpoPolygons[iPolygon]->MakeShadowMap(pwoWorld, bDoDirectionalLights);
+      // don't let too many unfinished layers pile up
+      if( _slPendingSize>PENDING_PIXELS_MAX) FinishPendingLayers();
+
+      // report progress (only when it changes visibly)
+      if( !bReportProgress) continue;
+      const INDEX iPercent = (iPolygon+1)*100/ctPolygons;
+      if( iPercent==iLastPercent) continue;
+      iLastPercent = iPercent;
+      CallProgressHook_t( FLOAT(iPolygon+1)/ctPolygons);
+    }
+  } catch( char *) {
+    // layers rendered so far must still be finished, as their shadow maps are not queued anymore
+    FinishPendingLayers();
+    _bBakingInParallel = FALSE;
+    throw;
+  }
+
+  FinishPendingLayers();
+  _bBakingInParallel = FALSE;
+  return ctThreads;
+}
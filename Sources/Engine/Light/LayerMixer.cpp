@@ -20,7 +20,11 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <Engine/Light/LightSource.h>
 #include <Engine/Light/Gradient.h>
 #include <Engine/Base/ListIterator.inl>
+#include <Engine/Base/Console.h>
 #include <Engine/Base/Statistics_internal.h>
+#include <Engine/Base/Timer.h>
+#include <Engine/Base/Memory.h>
+#include <Engine/Base/CRC.h>
 #include <Engine/Graphics/Color.h>
 #include <Engine/Math/FixInt.h>
 #include <Engine/Entities/Entity.h>
@@ -31,14 +35,18 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <Engine/World/WorldEditingProfile.h>
 
 #include <Engine/Templates/StaticArray.cpp>
+#include <Engine/Templates/StaticStackArray.cpp>
 #include <Engine/Templates/DynamicArray.cpp>
 
-// asm shortcuts
-#define O offset
-#define Q qword ptr
-#define D dword ptr
-#define W  word ptr
-#define B  byte ptr
+// mixing routines have SSE2 versions that give the same results as plain ones,
+// and are used when the CPU supports them
+#if defined(_M_IX86) || defined(_M_X64)
+  #include <emmintrin.h>
+  #define MIXER_SSE2 1
+#else
+  #define MIXER_SSE2 0
+#endif
+extern BOOL sys_bCPUHasSSE2;
 
 extern INDEX shd_bFineQuality;
 extern INDEX shd_iFiltering;
@@ -254,93 +262,136 @@ static int32_t _slL2Row, _slDDL2oDU, _slDDL2oDV, _slDDL2oDUoDV, _slDL2oDURow, _s
 static int32_t _slLightMax, _slHotSpot, _slLightStep;
 static uint32_t *_pulLayer;
 
+// per-pixel values for the row being mixed
+static CStaticStackArray<SWORD> _aswRow;
+static CStaticStackArray<FLOAT> _afRow;
+
+static SWORD *GetRowBuffer( INDEX ctValues)
+{
+  _aswRow.PopAll();
+  return _aswRow.Push(ctValues);
+}
+static FLOAT *GetFloatRowBuffer( INDEX ctValues)
+{
+  _afRow.PopAll();
+  return _afRow.Push(ctValues);
+}
+
+
+// adds light of 1:7 fixed point intensity to pixel (light is in memory byte order, as pixels are)
+static inline uint32_t AddLightToPixel( uint32_t ulPixel, SWORD swIntensity, uint32_t ulLight)
+{
+  uint32_t ulRes = 0;
+  for( INDEX iShift=0; iShift<32; iShift+=8) {
+    const SLONG slLight = ((ulLight>>iShift)&0xFF) <<1;
+    const SLONG slSum   = ((ulPixel>>iShift)&0xFF) + ((swIntensity*slLight)>>16);
+    ulRes |= (uint32_t)Clamp( slSum, 0L, 255L) <<iShift;
+  }
+  return ulRes;
+}
+
+
+#if MIXER_SSE2
+// adds light of per-pixel 1:7 fixed point intensities to row of pixels, returns number of pixels done
+static PIX AddLightRow_SSE2( uint32_t *pulRow, const SWORD *aswIntensity, PIX pixWidth, uint32_t ulLight)
+{
+  const __m128i mZero  = _mm_setzero_si128();
+  const __m128i mLight = _mm_slli_epi16( _mm_unpacklo_epi8( _mm_set1_epi32(ulLight), mZero), 1);
+  PIX pix=0;
+  for( ; pix+4<=pixWidth; pix+=4) {
+    // spread each intensity over its pixel's channels
+    __m128i mIntensity = _mm_loadl_epi64( (const __m128i*)(aswIntensity+pix));
+    mIntensity = _mm_unpacklo_epi16( mIntensity, mIntensity);
+    const __m128i mIntensityLo = _mm_unpacklo_epi32( mIntensity, mIntensity);
+    const __m128i mIntensityHi = _mm_unpackhi_epi32( mIntensity, mIntensity);
+    const __m128i mPixels = _mm_loadu_si128( (const __m128i*)(pulRow+pix));
+    const __m128i mLo = _mm_add_epi16( _mm_unpacklo_epi8( mPixels, mZero), _mm_mulhi_epi16( mIntensityLo, mLight));
+    const __m128i mHi = _mm_add_epi16( _mm_unpackhi_epi8( mPixels, mZero), _mm_mulhi_epi16( mIntensityHi, mLight));
+    _mm_storeu_si128( (__m128i*)(pulRow+pix), _mm_packus_epi16( mLo, mHi));
+  }
+  return pix;
+}
+
+// adds light color scaled by per-pixel factors to row of pixels, returns number of pixels done
+// (same single precision math as AddToCluster(), so results match)
+static PIX AddScaledLightRow_SSE2( uint32_t *pulRow, const FLOAT *afIntensity, PIX pixWidth, COLOR colLight)
+{
+  const __m128i mZero = _mm_setzero_si128();
+  const __m128 mR = _mm_set1_ps( (FLOAT)((uint8_t*)&colLight)[3]);
+  const __m128 mG = _mm_set1_ps( (FLOAT)((uint8_t*)&colLight)[2]);
+  const __m128 mB = _mm_set1_ps( (FLOAT)((uint8_t*)&colLight)[1]);
+  PIX pix=0;
+  for( ; pix+4<=pixWidth; pix+=4) {
+    const __m128 mIntensity = _mm_loadu_ps( afIntensity+pix);
+    const __m128i mAddR = _mm_cvttps_epi32( _mm_mul_ps( mR, mIntensity));
+    const __m128i mAddG = _mm_cvttps_epi32( _mm_mul_ps( mG, mIntensity));
+    const __m128i mAddB = _mm_cvttps_epi32( _mm_mul_ps( mB, mIntensity));
+    // interleave channels into R,G,B,0 words of each pixel
+    const __m128i mRG = _mm_unpacklo_epi16( _mm_packs_epi32( mAddR, mAddR), _mm_packs_epi32( mAddG, mAddG));
+    const __m128i mB0 = _mm_unpacklo_epi16( _mm_packs_epi32( mAddB, mAddB), mZero);
+    const __m128i mPixels = _mm_loadu_si128( (const __m128i*)(pulRow+pix));
+    const __m128i mLo = _mm_add_epi16( _mm_unpacklo_epi8( mPixels, mZero), _mm_unpacklo_epi32( mRG, mB0));
+    const __m128i mHi = _mm_add_epi16( _mm_unpackhi_epi8( mPixels, mZero), _mm_unpackhi_epi32( mRG, mB0));
+    _mm_storeu_si128( (__m128i*)(pulRow+pix), _mm_packus_epi16( mLo, mHi));
+  }
+  return pix;
+}
+#endif
+
+
+// adds light of per-pixel 1:7 fixed point intensities to row of pixels
+static void AddLightRow( uint32_t *pulRow, const SWORD *aswIntensity, PIX pixWidth, uint32_t ulLight)
+{
+  PIX pixU = 0;
+#if MIXER_SSE2
+  if( sys_bCPUHasSSE2) pixU = AddLightRow_SSE2( pulRow, aswIntensity, pixWidth, ulLight);
+#endif
+  for( ; pixU<pixWidth; pixU++) pulRow[pixU] = AddLightToPixel( pulRow[pixU], aswIntensity[pixU], ulLight);
+}
+
 
 // add one layer point light without diffusion and mask
 void CLayerMixer::AddAmbientPoint(void)
 {
-  // prepare some local variables
-  __int64 mmDDL2oDU = _slDDL2oDU;
-  __int64 mmDDL2oDV = _slDDL2oDV;
-  uint32_t ulLightRGB = ByteSwap(lm_colLight);
-  _slLightMax<<=7;
-  _slLightStep>>=1;
-
-  __asm {
-    // prepare interpolants
-    movd    mm0,D [_slL2Row]
-    movd    mm1,D [_slDL2oDURow]
-    psllq   mm1,32
-    por     mm1,mm0         // MM1 = slDL2oDURow | slL2Row
-    movd    mm0,D [_slDL2oDV]
-    movd    mm2,D [_slDDL2oDUoDV]
-    psllq   mm2,32
-    por     mm2,mm0         // MM2 = slDDL2oDUoDV | slDL2oDV
-    // prepare color
-    pxor    mm0,mm0
-    movd    mm7,D [ulLightRGB]
-    punpcklbw mm7,mm0
-    psllw   mm7,1
-    // loop thru rows
-    mov     edi,D [_pulLayer]
-    mov     ebx,D [_iRowCt]
-rowLoop:
-    push    ebx
-    movd    ebx,mm1         // EBX = slL2Point
-    movq    mm3,mm1
-    psrlq   mm3,32          // MM3 = 0 | slDL2oDU
-    // loop thru pixels in current row
-    mov     ecx,D [_iPixCt]
-pixLoop:
-    // check if pixel need to be drawn
-    cmp     ebx,FTOX
-    jge     skipPixel
-    // calculate intensities and do actual drawing of shadow pixel ARGB
-    movd    mm4,ecx
-    mov     eax,ebx
-    sar     eax,SHIFTX
-    and     eax,(SQRTTABLESIZE-1)
-    movzx   eax,B aubSqrt[eax]
-    mov     ecx,D [_slLightMax]
-    cmp     eax,D [_slHotSpot]
-    jle     skipInterpolation
-    mov     ecx,255
-    sub     ecx,eax
-    imul    ecx,D [_slLightStep]
-skipInterpolation:
-    // calculate rgb pixel to add
-    movd    mm6,ecx    
-    punpcklwd mm6,mm6
-    punpckldq mm6,mm6
-    pmulhw  mm6,mm7
-    // add dynamic light pixel to underlying pixel
-    movd    mm5,D [edi]
-    punpcklbw mm5,mm0
-    paddw   mm5,mm6
-    packuswb mm5,mm0
-    movd    D [edi],mm5
-    movd    ecx,mm4
-skipPixel:
-    // advance to next pixel
-    add     edi,4
-    movd    eax,mm3
-    add     ebx,eax
-    paddd   mm3,Q [mmDDL2oDU]
-    dec     ecx
-    jnz     pixLoop
-    // advance to the next row
-    pop     ebx
-    add     edi,D [_slModulo]
-    paddd   mm1,mm2
-    paddd   mm2,Q [mmDDL2oDV]
-    dec     ebx
-    jnz     rowLoop
-    emms
+  // intensity is 1:7 fixed point (to be multiplied with doubled light color)
+  const int32_t slLightMax  = _slLightMax<<7;
+  const int32_t slLightStep = _slLightStep>>1;
+  const uint32_t ulLight = ByteSwap(lm_colLight);
+  SWORD *aswIntensity = GetRowBuffer(_iPixCt);
+
+  uint32_t *pulRow = _pulLayer;
+  int32_t slL2Row     = _slL2Row;
+  int32_t slDL2oDURow = _slDL2oDURow;
+  int32_t slDL2oDV    = _slDL2oDV;
+  for( PIX pixV=0; pixV<_iRowCt; pixV++)
+  {
+    int32_t slL2Point = slL2Row;
+    int32_t slDL2oDU  = slDL2oDURow;
+    for( PIX pixU=0; pixU<_iPixCt; pixU++)
+    {
+      // find intensity if pixel is within light range
+      SWORD swIntensity = 0;
+      if( slL2Point<FTOX) {
+        const int32_t slL = aubSqrt[(slL2Point>>SHIFTX)&(SQRTTABLESIZE-1)];  // and is just for degenerate cases
+        swIntensity = (SWORD)(slL>_slHotSpot ? (255-slL)*slLightStep : slLightMax);
+      }
+      aswIntensity[pixU] = swIntensity;
+      slL2Point += slDL2oDU;
+      slDL2oDU  += _slDDL2oDU;
+    }
+    AddLightRow( pulRow, aswIntensity, _iPixCt, ulLight);
+    // go to the next row
+    pulRow      += _iPixCt + _slModulo/BYTES_PER_TEXEL;
+    slL2Row     += slDL2oDV;
+    slDL2oDURow += _slDDL2oDUoDV;
+    slDL2oDV    += _slDDL2oDV;
   }
 }
 
 // add one layer point light without diffusion and with mask
 void CLayerMixer::AddAmbientMaskPoint( uint8_t *pubMask, uint8_t ubMask)
 {
+  FLOAT *afIntensity = GetFloatRowBuffer(_iPixCt);
   for( PIX pixV=0; pixV<_iRowCt; pixV++)
   {
     int32_t slL2Point = _slL2Row;
@@ -348,26 +399,32 @@ void CLayerMixer::AddAmbientMaskPoint( uint8_t *pubMask, uint8_t ubMask)
     for( PIX pixU=0; pixU<_iPixCt; pixU++)
     {
       // if the point is not masked
-      if( *pubPoint&ubMask && (slL2Point<FTOX)) {
+      FLOAT fIntensity = 0.0f;
+      if( *pubMask&ubMask && (slL2Point<FTOX)) {
         int32_t slL = (slL2Point>>SHIFTX)&(SQRTTABLESIZE-1);  // and is just for degenerate cases
         int32_t slIntensity = _slLightMax;
         slL = aubSqrt[slL];
         if( slL>_slHotSpot) slIntensity = ((255-slL)*_slLightStep)>>8;
-        // add the intensity to the pixel
-        AddToCluster( (uint8_t*)_pulLayer, slIntensity/255.0f);
-      } 
+        fIntensity = slIntensity/255.0f;
+      }
+      afIntensity[pixU] = fIntensity;
       // go to the next pixel
-      _pulLayer++;
-      slL2Point += _slDL2oDU;
+      slL2Point += slDL2oDU;
       slDL2oDU  += _slDDL2oDU;
       ubMask<<=1;
       if( ubMask==0) {
-        pubPoint++;
+        pubMask++;
         ubMask = 1;
       }
     }
+    // add the intensities to the pixels
+    PIX pixU = 0;
+#if MIXER_SSE2
+    if( sys_bCPUHasSSE2) pixU = AddScaledLightRow_SSE2( _pulLayer, afIntensity, _iPixCt, lm_colLight);
+#endif
+    for( ; pixU<_iPixCt; pixU++) AddToCluster( (uint8_t*)(_pulLayer+pixU), afIntensity[pixU]);
     // go to the next row
-    _pulLayer    += _slModulo/BYTES_PER_TEXEL;
+    _pulLayer    += _iPixCt + _slModulo/BYTES_PER_TEXEL;
     _slL2Row     += _slDL2oDV;
     _slDL2oDV    += _slDDL2oDV;
     _slDL2oDURow += _slDDL2oDUoDV;
@@ -378,86 +435,42 @@ void CLayerMixer::AddAmbientMaskPoint( uint8_t *pubMask, uint8_t ubMask)
 void CLayerMixer::AddDiffusionPoint(void)
 {
   // adjust params for diffusion lighting
-  int32_t slMax1oL = MAX_int32_t;
+  int32_t slMax1oL = MAX_SLONG;
   _slLightStep = FloatToInt(_slLightStep * _fMinLightDistance * _f1oFallOff);
   if( _slLightStep!=0) slMax1oL = (256<<8) / _slLightStep +256;
 
-  // prepare some local variables
-  __int64 mmDDL2oDU = _slDDL2oDU;
-  __int64 mmDDL2oDV = _slDDL2oDV;
-  uint32_t ulLightRGB = ByteSwap(lm_colLight);
-  _slLightMax<<=7;
-  _slLightStep>>=1;
-
-  __asm {
-    // prepare interpolants
-    movd    mm0,D [_slL2Row]
-    movd    mm1,D [_slDL2oDURow]
-    psllq   mm1,32
-    por     mm1,mm0         // MM1 = slDL2oDURow | slL2Row
-    movd    mm0,D [_slDL2oDV]
-    movd    mm2,D [_slDDL2oDUoDV]
-    psllq   mm2,32
-    por     mm2,mm0         // MM2 = slDDL2oDUoDV | slDL2oDV
-    // prepare color
-    pxor    mm0,mm0
-    movd    mm7,D [ulLightRGB]
-    punpcklbw mm7,mm0
-    psllw   mm7,1
-    // loop thru rows
-    mov     edi,D [_pulLayer]
-    mov     ebx,D [_iRowCt]
-rowLoop:
-    push    ebx
-    movd    ebx,mm1         // EBX = slL2Point
-    movq    mm3,mm1
-    psrlq   mm3,32          // MM3 = 0 | slDL2oDU
-    // loop thru pixels in current row
-    mov     ecx,D [_iPixCt]
-pixLoop:
-    // check if pixel need to be drawn
-    cmp     ebx,FTOX
-    jge     skipPixel
-    // calculate intensities and do actual drawing of shadow pixel ARGB
-    movd    mm4,ecx
-    mov     eax,ebx
-    sar     eax,SHIFTX
-    and     eax,(SQRTTABLESIZE-1)
-    movzx   eax,W auw1oSqrt[eax*2]
-    mov     ecx,D [_slLightMax]
-    cmp     eax,D [slMax1oL]
-    jge     skipInterpolation
-    lea     ecx,[eax-256]
-    imul    ecx,D [_slLightStep]
-skipInterpolation:
-    // calculate rgb pixel to add
-    movd    mm6,ecx    
-    punpcklwd mm6,mm6
-    punpckldq mm6,mm6
-    pmulhw  mm6,mm7
-    // add dynamic light pixel to underlying pixel
-    movd    mm5,D [edi]
-    punpcklbw mm5,mm0
-    paddw   mm5,mm6
-    packuswb mm5,mm0
-    movd    D [edi],mm5
-    movd    ecx,mm4
-skipPixel:
-    // advance to next pixel
-    add     edi,4
-    movd    eax,mm3
-    add     ebx,eax
-    paddd   mm3,Q [mmDDL2oDU]
-    dec     ecx
-    jnz     pixLoop
+  // intensity is 1:7 fixed point (to be multiplied with doubled light color)
+  const int32_t slLightMax  = _slLightMax<<7;
+  const int32_t slLightStep = _slLightStep>>1;
+  const uint32_t ulLight = ByteSwap(lm_colLight);
+  SWORD *aswIntensity = GetRowBuffer(_iPixCt);
+
+  uint32_t *pulRow = _pulLayer;
+  int32_t slL2Row     = _slL2Row;
+  int32_t slDL2oDURow = _slDL2oDURow;
+  int32_t slDL2oDV    = _slDL2oDV;
+  for( PIX pixV=0; pixV<_iRowCt; pixV++)
+  {
+    int32_t slL2Point = slL2Row;
+    int32_t slDL2oDU  = slDL2oDURow;
+    for( PIX pixU=0; pixU<_iPixCt; pixU++)
+    {
+      // find intensity if pixel is within light range
+      SWORD swIntensity = 0;
+      if( slL2Point<FTOX) {
+        const int32_t sl1oL = auw1oSqrt[(slL2Point>>SHIFTX)&(SQRTTABLESIZE-1)];  // and is just for degenerate cases
+        swIntensity = (SWORD)(sl1oL<slMax1oL ? (sl1oL-256)*slLightStep : slLightMax);
+      }
+      aswIntensity[pixU] = swIntensity;
+      slL2Point += slDL2oDU;
+      slDL2oDU  += _slDDL2oDU;
+    }
+    AddLightRow( pulRow, aswIntensity, _iPixCt, ulLight);
     // advance to the next row
-    pop     ebx
-    add     edi,D [_slModulo]
-    paddd   mm1,mm2
-    paddd   mm2,Q [mmDDL2oDV]
-    dec     ebx
-    jnz     rowLoop
-    emms
+    pulRow      += _iPixCt + _slModulo/BYTES_PER_TEXEL;
+    slL2Row     += slDL2oDV;
+    slDL2oDURow += _slDDL2oDUoDV;
+    slDL2oDV    += _slDDL2oDV;
   }
 }
 
@@ -465,11 +478,12 @@ skipPixel:
 void CLayerMixer::AddDiffusionMaskPoint( uint8_t *pubMask, uint8_t ubMask)
 {
   // adjust params for diffusion lighting
-  int32_t slMax1oL = MAX_int32_t;
+  int32_t slMax1oL = MAX_SLONG;
   _slLightStep = FloatToInt(_slLightStep * _fMinLightDistance * _f1oFallOff);
   if( _slLightStep!=0) slMax1oL = (256<<8) / _slLightStep +256;
 
   // for each pixel in the shadow map
+  FLOAT *afIntensity = GetFloatRowBuffer(_iPixCt);
   for( PIX pixV=0; pixV<_iRowCt; pixV++)
   {
     int32_t slL2Point = _slL2Row;
@@ -477,16 +491,16 @@ void CLayerMixer::AddDiffusionMaskPoint( uint8_t *pubMask, uint8_t ubMask)
     for( PIX pixU=0; pixU<_iPixCt; pixU++)
     {
       // if the point is not masked
+      FLOAT fIntensity = 0.0f;
       if( *pubMask&ubMask && (slL2Point<FTOX)) {
         int32_t sl1oL = (slL2Point>>SHIFTX)&(SQRTTABLESIZE-1);  // and is just for degenerate cases
         sl1oL = auw1oSqrt[sl1oL];
         int32_t slIntensity = _slLightMax;
         if( sl1oL<slMax1oL) slIntensity = ((sl1oL-256)*_slLightStep)>>16;
-        // add the intensity to the pixel
-        AddToCluster( (uint8_t*)_pulLayer, slIntensity/255.0f);
-      } 
+        fIntensity = slIntensity/255.0f;
+      }
+      afIntensity[pixU] = fIntensity;
       // advance to next pixel
-      _pulLayer++;
       slL2Point +=  slDL2oDU;
       slDL2oDU  += _slDDL2oDU;
       ubMask<<=1;
@@ -495,8 +509,14 @@ void CLayerMixer::AddDiffusionMaskPoint( uint8_t *pubMask, uint8_t ubMask)
         ubMask = 1;
       }
     }
+    // add the intensities to the pixels
+    PIX pixU = 0;
+#if MIXER_SSE2
+    if( sys_bCPUHasSSE2) pixU = AddScaledLightRow_SSE2( _pulLayer, afIntensity, _iPixCt, lm_colLight);
+#endif
+    for( ; pixU<_iPixCt; pixU++) AddToCluster( (uint8_t*)(_pulLayer+pixU), afIntensity[pixU]);
     // advance to next row
-    _pulLayer    += _slModulo/BYTES_PER_TEXEL;
+    _pulLayer    += _iPixCt + _slModulo/BYTES_PER_TEXEL;
     _slL2Row     += _slDL2oDV;
     _slDL2oDV    += _slDDL2oDV;
     _slDL2oDURow += _slDDL2oDUoDV;
@@ -633,9 +653,27 @@ void CLayerMixer::AddOneLayerPoint( CBrushShadowLayer *pbsl, uint8_t *pubMask, u
 
 
 
+#if MIXER_SSE2
+// adds per-pixel signed R,G,B,0 words to row of pixels (with clipping), returns number of pixels done
+static PIX AddDeltaRow_SSE2( uint32_t *pulRow, const SWORD *aswDelta, PIX pixWidth)
+{
+  const __m128i mZero = _mm_setzero_si128();
+  PIX pix=0;
+  for( ; pix+4<=pixWidth; pix+=4) {
+    const __m128i mPixels = _mm_loadu_si128( (const __m128i*)(pulRow+pix));
+    const __m128i mLo = _mm_add_epi16( _mm_unpacklo_epi8( mPixels, mZero), _mm_loadu_si128( (const __m128i*)(aswDelta+pix*4)));
+    const __m128i mHi = _mm_add_epi16( _mm_unpackhi_epi8( mPixels, mZero), _mm_loadu_si128( (const __m128i*)(aswDelta+pix*4+8)));
+    _mm_storeu_si128( (__m128i*)(pulRow+pix), _mm_packus_epi16( mLo, mHi));
+  }
+  return pix;
+}
+#endif
+
+
 // apply gradient to layer
 void CLayerMixer::AddOneLayerGradient( CGradientParameters &gp)
 {
+  _pfWorldEditingProfile.StartTimer(CWorldEditingProfile::PTI_ADDONELAYERGRADIENT);
   // convert gradient parameters for plane
   assert( Abs(gp.gp_fH1-gp.gp_fH0)>0.0001f);
   float f1oDH = 1.0f / (gp.gp_fH1-gp.gp_fH0);
@@ -674,8 +712,8 @@ void CLayerMixer::AddOneLayerGradient( CGradientParameters &gp)
 
   // loop it, baby
   float fGrRow = fGr00 - (fDGroDJ+fDGroDI)*0.5f;
-  PIX   pixOffset = 0;
-  PIX   pixModulo = lm_pixCanvasSizeU-lm_pixPolygonSizeU;
+  uint32_t *pulRow = _pulLayer;
+  SWORD *aswDelta = GetRowBuffer(lm_pixPolygonSizeU*4);
   for( INDEX j=0; j<lm_pixPolygonSizeV; j++)
   { // prepare row
     float fGrCol  = fGrRow;
@@ -684,15 +722,12 @@ void CLayerMixer::AddOneLayerGradient( CGradientParameters &gp)
     SWORD fixBcol = fixBrow;
     for( INDEX i=0; i<lm_pixPolygonSizeU; i++)
     { // loop pixels
-      int32_t slR = Clamp( fixRcol>>6, -255, +255);
-      int32_t slG = Clamp( fixGcol>>6, -255, +255);
-      int32_t slB = Clamp( fixBcol>>6, -255, +255);
-      IncrementByteWithClip( ((uint8_t*)&_pulLayer[pixOffset])[0], slR);
-      IncrementByteWithClip( ((uint8_t*)&_pulLayer[pixOffset])[1], slG);
-      IncrementByteWithClip( ((uint8_t*)&_pulLayer[pixOffset])[2], slB);
+      aswDelta[i*4+0] = Clamp( fixRcol>>6, -255, +255);
+      aswDelta[i*4+1] = Clamp( fixGcol>>6, -255, +255);
+      aswDelta[i*4+2] = Clamp( fixBcol>>6, -255, +255);
+      aswDelta[i*4+3] = 0;
       // advance to next pixel
       fGrCol += fDGroDI;
-      pixOffset++;
       if( fGrCol<0) {
         fixRcol = slR0<<6;
         fixGcol = slG0<<6;
@@ -707,9 +742,19 @@ void CLayerMixer::AddOneLayerGradient( CGradientParameters &gp)
         fixBcol += fixDBoDI;
       }
     }
+    // add the row
+    PIX pixU = 0;
+#if MIXER_SSE2
+    if( sys_bCPUHasSSE2) pixU = AddDeltaRow_SSE2( pulRow, aswDelta, lm_pixPolygonSizeU);
+#endif
+    for( ; pixU<lm_pixPolygonSizeU; pixU++) {
+      IncrementByteWithClip( ((uint8_t*)&pulRow[pixU])[0], aswDelta[pixU*4+0]);
+      IncrementByteWithClip( ((uint8_t*)&pulRow[pixU])[1], aswDelta[pixU*4+1]);
+      IncrementByteWithClip( ((uint8_t*)&pulRow[pixU])[2], aswDelta[pixU*4+2]);
+    }
     // advance to next row
     fGrRow += fDGroDJ;
-    pixOffset += pixModulo;
+    pulRow += lm_pixCanvasSizeU;
     if( fGrRow<0) {
       fixRrow = slR0<<6;
       fixGrow = slG0<<6;
@@ -724,46 +769,75 @@ void CLayerMixer::AddOneLayerGradient( CGradientParameters &gp)
       fixBrow += fixDBoDJ;
     }
   }
-
+  _pfWorldEditingProfile.StopTimer(CWorldEditingProfile::PTI_ADDONELAYERGRADIENT);
 }
 
 
 
+#if MIXER_SSE2
+// adds color to row of pixels (with clipping) where mask isn't zero (NULL for no mask), returns number of pixels done
+static PIX AddColorRow_SSE2( uint32_t *pulRow, const SWORD *aswMask, PIX pixWidth, uint32_t ulColor)
+{
+  const __m128i mColor = _mm_set1_epi32(ulColor);
+  PIX pix=0;
+  for( ; pix+4<=pixWidth; pix+=4) {
+    __m128i mAdd = mColor;
+    if( aswMask!=NULL) {
+      const __m128i mMask = _mm_loadl_epi64( (const __m128i*)(aswMask+pix));
+      mAdd = _mm_and_si128( mAdd, _mm_unpacklo_epi16( mMask, mMask));
+    }
+    const __m128i mPixels = _mm_loadu_si128( (const __m128i*)(pulRow+pix));
+    _mm_storeu_si128( (__m128i*)(pulRow+pix), _mm_adds_epu8( mPixels, mAdd));
+  }
+  return pix;
+}
+#endif
+
+
 // apply directional light or ambient to layer
 void CLayerMixer::AddDirectional(void)
 {
-
+  // light color in memory byte order, without alpha
+  const uint32_t ulColor = ByteSwap(lm_colLight) & 0x00FFFFFFUL;
   // for each pixel in the shadow map
   for( PIX pixV=0; pixV<_iRowCt; pixV++) {
-    for( PIX pixU=0; pixU<_iPixCt; pixU++) {
+    PIX pixU = 0;
+#if MIXER_SSE2
+    if( sys_bCPUHasSSE2) pixU = AddColorRow_SSE2( _pulLayer, NULL, _iPixCt, ulColor);
+#endif
+    for( ; pixU<_iPixCt; pixU++) {
       // add the intensity to the pixel
-      AddToCluster( (uint8_t*)_pulLayer);
-      _pulLayer++; // go to the next pixel
+      AddToCluster( (uint8_t*)(_pulLayer+pixU));
     } // go to the next row
-    _pulLayer += slModulo;
+    _pulLayer += _iPixCt + _slModulo/BYTES_PER_TEXEL;
   }
-
 }
 
 // apply directional light thru mask to layer
 void CLayerMixer::AddMaskDirectional( uint8_t *pubMask, uint8_t ubMask)
 {
+  const uint32_t ulColor = ByteSwap(lm_colLight) & 0x00FFFFFFUL;
+  SWORD *aswMask = GetRowBuffer(_iPixCt);
   // for each pixel in the shadow map
   for( PIX pixV=0; pixV<_iRowCt; pixV++) {
     for( PIX pixU=0; pixU<_iPixCt; pixU++) {
-      // if the point is not masked
-      if( *pubMask&ubMask) {
-        // add the intensity to the pixel
-        AddToCluster( (uint8_t*)_pulLayer);
-      } // go to the next pixel
-      _pulLayer++;
+      // remember if the point is not masked
+      aswMask[pixU] = (*pubMask&ubMask) ? -1 : 0;
       ubMask<<=1;
       if( ubMask==0) {
         pubMask ++;
         ubMask = 1;
       }
+    }
+    PIX pixU = 0;
+#if MIXER_SSE2
+    if( sys_bCPUHasSSE2) pixU = AddColorRow_SSE2( _pulLayer, aswMask, _iPixCt, ulColor);
+#endif
+    for( ; pixU<_iPixCt; pixU++) {
+      // add the intensity to the pixel
+      if( aswMask[pixU]) AddToCluster( (uint8_t*)(_pulLayer+pixU));
     } // go to the next row
-    _pulLayer += slModulo;
+    _pulLayer += _iPixCt + _slModulo/BYTES_PER_TEXEL;
   }
 }
 
@@ -864,16 +938,7 @@ void CLayerMixer::MixOneMipmap(CBrushShadowMap *pbsm, INDEX iMipmap)
       }}
     }
   } // set initial color
-  __asm {
-    cld
-    mov     ebx,D [this]
-    mov     ecx,D [ebx].lm_pixCanvasSizeU
-    imul    ecx,D [ebx].lm_pixCanvasSizeV
-    mov     edi,D [ebx].lm_pulShadowMap
-    mov     eax,D [colAmbient]
-    bswap   eax
-    rep     stosd
-  }
+  FillShadowLayer( colAmbient);
   _pfWorldEditingProfile.StopTimer(CWorldEditingProfile::PTI_AMBIENTFILL);
 
   // find gradient layer
@@ -949,31 +1014,16 @@ void CLayerMixer::MixOneMipmap(CBrushShadowMap *pbsm, INDEX iMipmap)
 // copy from static shadow map to dynamic layer
 __forceinline void CLayerMixer::CopyShadowLayer(void)
 {
-  __asm {
-    cld
-    mov     ebx,D [this]
-    mov     ecx,D [ebx].lm_pixCanvasSizeU
-    imul    ecx,D [ebx].lm_pixCanvasSizeV
-    mov     esi,D [ebx].lm_pulStaticShadowMap
-    mov     edi,D [ebx].lm_pulShadowMap
-    rep     movsd
-  }
+  memcpy( lm_pulShadowMap, lm_pulStaticShadowMap, lm_pixCanvasSizeU*lm_pixCanvasSizeV*BYTES_PER_TEXEL);
 }
 
 
-// copy from static shadow map to dynamic layer
+// fill shadow layer with a color
 __forceinline void CLayerMixer::FillShadowLayer( COLOR col)
 {
-  __asm {
-    cld
-    mov     ebx,D [this]
-    mov     ecx,D [ebx].lm_pixCanvasSizeU
-    imul    ecx,D [ebx].lm_pixCanvasSizeV
-    mov     edi,D [ebx].lm_pulShadowMap
-    mov     eax,D [col]
-    bswap   eax   // convert to R,G,B,A memory format!
-    rep     stosd
-  }
+  const uint32_t ulPixel = ByteSwap(col);  // convert to R,G,B,A memory format!
+  const PIX pixSize = lm_pixCanvasSizeU*lm_pixCanvasSizeV;
+  for( PIX pix=0; pix<pixSize; pix++) lm_pulShadowMap[pix] = ulPixel;
 }
 
 
@@ -982,6 +1032,7 @@ void CLayerMixer::MixOneMipmapDynamic( CBrushShadowMap *pbsm, INDEX iMipmap)
 {
   // remember general data
   CalculateData( pbsm, iMipmap);
+  _pfWorldEditingProfile.StartTimer(CWorldEditingProfile::PTI_AMBIENTFILL);
   // if static shadow map is all flat
   if( pbsm->sm_pulCachedShadowMap==&pbsm->sm_colFlat) {
     // just fill dynamic shadow map with flat color
@@ -991,6 +1042,7 @@ void CLayerMixer::MixOneMipmapDynamic( CBrushShadowMap *pbsm, INDEX iMipmap)
     // copy static layer
     CopyShadowLayer();
   }
+  _pfWorldEditingProfile.StopTimer(CWorldEditingProfile::PTI_AMBIENTFILL);
 
   // for each shadow layer
   {FORDELETELIST( CBrushShadowLayer, bsl_lnInShadowMap, lm_pbsmShadowMap->bsm_lhLayers, itbsl)
@@ -1049,3 +1101,166 @@ void CBrushShadowMap::MixLayers( INDEX iFirstMip, INDEX iLastMip, bool bDynamic/
   _pfWorldEditingProfile.StopTimer( CWorldEditingProfile::PTI_MIXLAYERS);
   _sfStats.StopTimer( CStatForm::STI_SHADOWUPDATE);
 }
+
+
+
+// ---------------------------------------- mixing checks
+
+// pseudo-random numbers that are the same on each run
+static uint32_t _ulTestSeed = 0;
+static inline uint32_t TestRandom(void)
+{
+  _ulTestSeed = _ulTestSeed*1664525 + 1013904223;
+  return _ulTestSeed ^ (_ulTestSeed>>15);
+}
+
+// adds point light to pixel the way the old MMX code did (intensity word times doubled light color
+// words with high halves kept, added to unpacked pixel and packed back with unsigned saturation)
+static uint32_t AddLightToPixel_MMX( uint32_t ulPixel, SWORD swIntensity, uint32_t ulLight)
+{
+  uint32_t ulRes = 0;
+  for( INDEX iShift=0; iShift<32; iShift+=8) {
+    const SWORD swLight = (SWORD)(((ulLight>>iShift)&0xFF) <<1);        // punpcklbw, psllw
+    const SWORD swAdd   = (SWORD)(((SLONG)swIntensity*swLight) >>16);   // pmulhw
+    const SWORD swSum   = (SWORD)(((ulPixel>>iShift)&0xFF) + swAdd);     // paddw
+    ulRes |= (uint32_t)Clamp( (SLONG)swSum, 0L, 255L) <<iShift;          // packuswb
+  }
+  return ulRes;
+}
+
+// adds scaled light color to pixel the way the per-pixel loops of masked point lights did
+static void AddScaledLightToPixel( uint8_t *pub, COLOR colLight, FLOAT fIntensity)
+{
+  IncrementByteWithClip( pub[0], ((uint8_t*)&colLight)[3] *fIntensity);
+  IncrementByteWithClip( pub[1], ((uint8_t*)&colLight)[2] *fIntensity);
+  IncrementByteWithClip( pub[2], ((uint8_t*)&colLight)[1] *fIntensity);
+}
+
+
+// checks row routines against per-pixel ones on pseudo-random rows of all widths up to 36
+// (returns number of rows that differ)
+static INDEX TestMixingRows(void)
+{
+  INDEX ctFailed = 0;
+  uint32_t aulRow[36], aulRef[36], aulSrc[36];
+  SWORD aswIntensity[36], aswMask[36], aswDelta[36*4];
+  FLOAT afIntensity[36];
+  const BOOL bHasSSE2 = sys_bCPUHasSSE2;
+  _ulTestSeed = 0;
+  for( INDEX iRow=0; iRow<10000; iRow++)
+  {
+    // make row and its per-pixel values
+    const PIX pixWidth = iRow%37;
+    const uint32_t ulLight = TestRandom();
+    const COLOR colLight = TestRandom();
+    for( PIX pix=0; pix<pixWidth; pix++) {
+      aulSrc[pix] = TestRandom();
+      aswIntensity[pix] = (SWORD)TestRandom();
+      afIntensity[pix]  = (TestRandom()%3==0) ? 0.0f : ((SLONG)(TestRandom()%512)-256) /255.0f;
+      aswMask[pix] = (TestRandom()&1) ? -1 : 0;
+      aswDelta[pix*4+0] = (SWORD)((SLONG)(TestRandom()%511)-255);
+      aswDelta[pix*4+1] = (SWORD)((SLONG)(TestRandom()%511)-255);
+      aswDelta[pix*4+2] = (SWORD)((SLONG)(TestRandom()%511)-255);
+      aswDelta[pix*4+3] = 0;
+    }
+
+    // point lights without mask (plain and SSE2) against old MMX code
+    PIX pix;
+    for( pix=0; pix<pixWidth; pix++) aulRef[pix] = AddLightToPixel_MMX( aulSrc[pix], aswIntensity[pix], ulLight);
+    for( INDEX iSSE2=0; iSSE2<=bHasSSE2; iSSE2++) {
+      sys_bCPUHasSSE2 = iSSE2;
+      memcpy( aulRow, aulSrc, pixWidth*BYTES_PER_TEXEL);
+      AddLightRow( aulRow, aswIntensity, pixWidth, ulLight);
+      if( memcmp( aulRow, aulRef, pixWidth*BYTES_PER_TEXEL)) ctFailed++;
+    }
+    sys_bCPUHasSSE2 = bHasSSE2;
+
+#if MIXER_SSE2
+    if( !bHasSSE2) continue;
+    // point lights with mask
+    memcpy( aulRow, aulSrc, pixWidth*BYTES_PER_TEXEL);
+    memcpy( aulRef, aulSrc, pixWidth*BYTES_PER_TEXEL);
+    PIX pixDone = AddScaledLightRow_SSE2( aulRow, afIntensity, pixWidth, colLight);
+    for( pix=0; pix<pixDone; pix++) AddScaledLightToPixel( (uint8_t*)&aulRef[pix], colLight, afIntensity[pix]);
+    if( memcmp( aulRow, aulRef, pixDone*BYTES_PER_TEXEL)) ctFailed++;
+
+    // directional lights with and without mask
+    const uint32_t ulColor = ByteSwap(colLight) & 0x00FFFFFFUL;
+    for( INDEX iMask=0; iMask<2; iMask++) {
+      memcpy( aulRow, aulSrc, pixWidth*BYTES_PER_TEXEL);
+      memcpy( aulRef, aulSrc, pixWidth*BYTES_PER_TEXEL);
+      pixDone = AddColorRow_SSE2( aulRow, iMask ? aswMask : NULL, pixWidth, ulColor);
+      for( pix=0; pix<pixDone; pix++) {
+        if( !iMask || aswMask[pix]) AddScaledLightToPixel( (uint8_t*)&aulRef[pix], colLight, 1.0f);
+      }
+      if( memcmp( aulRow, aulRef, pixDone*BYTES_PER_TEXEL)) ctFailed++;
+    }
+
+    // gradients
+    memcpy( aulRow, aulSrc, pixWidth*BYTES_PER_TEXEL);
+    memcpy( aulRef, aulSrc, pixWidth*BYTES_PER_TEXEL);
+    pixDone = AddDeltaRow_SSE2( aulRow, aswDelta, pixWidth);
+    for( pix=0; pix<pixDone; pix++) {
+      IncrementByteWithClip( ((uint8_t*)&aulRef[pix])[0], aswDelta[pix*4+0]);
+      IncrementByteWithClip( ((uint8_t*)&aulRef[pix])[1], aswDelta[pix*4+1]);
+      IncrementByteWithClip( ((uint8_t*)&aulRef[pix])[2], aswDelta[pix*4+2]);
+    }
+    if( memcmp( aulRow, aulRef, pixDone*BYTES_PER_TEXEL)) ctFailed++;
+#endif
+  }
+  return ctFailed;
+}
+
+
+// check that mixing routines give the same results as per-pixel ones and old MMX code,
+// and that cached shadow maps of current world mix the same with plain and SSE2 routines
+void TestLayerMixing(void)
+{
+  const INDEX ctRowsFailed = TestMixingRows();
+  CPrintF( "Layer mixing rows: %d checks failed%s\n", ctRowsFailed,
+           sys_bCPUHasSSE2 ? "" : " (no SSE2, plain versions only)");
+  if( !sys_bCPUHasSSE2) return;
+
+  // for each cached shadow map that isn't flat
+  INDEX ctShadowMaps = 0;
+  INDEX ctFailed = 0;
+  DOUBLE adSeconds[2] = { 0, 0 };
+  uint32_t ulCRC;
+  CRC_Start(ulCRC);
+  {FOREACHINLIST( CShadowMap, sm_lnInGfx, _pGfx->gl_lhCachedShadows, itsm) {
+    CShadowMap &sm = *itsm;
+    if( sm.sm_pulCachedShadowMap==&sm.sm_colFlat) continue;
+    ctShadowMaps++;
+    const SLONG slSize = sm.sm_slMemoryUsed;
+    const ULONG ulFlags = sm.sm_ulFlags;
+    UBYTE *pubOriginal = (UBYTE*)AllocMemory(slSize);
+    UBYTE *apubMixed[2] = { (UBYTE*)AllocMemory(slSize), (UBYTE*)AllocMemory(slSize) };
+    // static layers, then dynamic ones (if any) over them
+    for( INDEX iDynamic=0; iDynamic<2; iDynamic++) {
+      UBYTE *pubShadowMap = (UBYTE*)(iDynamic ? sm.sm_pulDynamicShadowMap : sm.sm_pulCachedShadowMap);
+      if( pubShadowMap==NULL) continue;
+      memcpy( pubOriginal, pubShadowMap, slSize);
+      // mix with plain routines and SSE2 ones, and keep shadow map as it was
+      for( INDEX iSSE2=0; iSSE2<2; iSSE2++) {
+        sys_bCPUHasSSE2 = iSSE2;
+        memcpy( pubShadowMap, pubOriginal, slSize);
+        const CTimerValue tvStart = _pTimer->GetHighPrecisionTimer();
+        sm.MixLayers( sm.sm_iFirstCachedMipLevel, sm.sm_iLastMipLevel, iDynamic);
+        adSeconds[iSSE2] += (_pTimer->GetHighPrecisionTimer()-tvStart).GetSeconds();
+        memcpy( apubMixed[iSSE2], pubShadowMap, slSize);
+      }
+      sys_bCPUHasSSE2 = TRUE;
+      if( memcmp( apubMixed[0], apubMixed[1], slSize)) ctFailed++;
+      CRC_AddBlock( ulCRC, apubMixed[0], slSize);
+      memcpy( pubShadowMap, pubOriginal, slSize);
+      sm.sm_ulFlags = ulFlags;
+    }
+    FreeMemory(pubOriginal);
+    FreeMemory(apubMixed[0]);
+    FreeMemory(apubMixed[1]);
+  }}
+  CRC_Finish(ulCRC);
+  CPrintF( "Cached shadow maps: %d of %d differ between plain and SSE2 mixing (CRC 0x%08X)\n",
+           ctFailed, ctShadowMaps, ulCRC);
+  CPrintF( "  mixing took %.3fs plain, %.3fs SSE2\n", adSeconds[0], adSeconds[1]);
+}
@@ -23,6 +23,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <Engine/Network/CPacket.h>
 
 #include <Engine/Base/Listiterator.inl>
+#include <Engine/Templates/StaticArray.cpp>
 
 // should the packet transfers in/out of the buffer be reported to the console
 extern INDEX net_bReportPackets;
@@ -32,6 +33,14 @@ extern FLOAT net_fSendRetryWait;
 #define MAX_RETRIES 10
 #define RETRY_INTERVAL 3.0f
 
+#define PACKET_POOLSIZE 256   // max number of freed packets kept for reuse
+#define PB_MININDEX 64        // initial number of sequence index slots in a packet buffer
+
+// freed packets, linked through their first bytes
+// NOTE: packets are made and freed only on the main thread
+static void *_pvFreePackets = NULL;
+static INDEX _ctFreePackets = 0;
+
 // make the address broadcast
 void CAddress::MakeBroadcast(void)
 {
@@ -65,6 +74,8 @@ CPacket::CPacket(CPacket &paOriginal)
 	pa_adrAddress.adr_ulAddress = paOriginal.pa_adrAddress.adr_ulAddress;
 	pa_adrAddress.adr_uwPort = paOriginal.pa_adrAddress.adr_uwPort;
 	pa_adrAddress.adr_uwID = paOriginal.pa_adrAddress.adr_uwID;
+	pa_ppaNextInIndex = NULL;
+	pa_ppbBuffer = NULL;
 
 	memcpy(pa_pubPacketData,paOriginal.pa_pubPacketData,pa_slSize);
 
@@ -80,7 +91,7 @@ void CPacket::Clear()
 	pa_ubRetryNumber = 0;
 
 	pa_tvSendWhen = CTimerValue(0.0f);
-	if(pa_lnListNode.IsLinked()) pa_lnListNode.Remove();
+	Drop();
 
 };
 
@@ -165,8 +176,10 @@ BOOL CPacket::WriteToPacketRaw(void* pv,SLONG slSize)
 
 	pa_slSize = slSize;
 
-	// transfer the data to the packet
-	memcpy(pa_pubPacketData,pv,pa_slSize);
+	// transfer the data to the packet (unless it was received directly into it)
+	if (pv != pa_pubPacketData) {
+		memcpy(pa_pubPacketData,pv,pa_slSize);
+	}
 
 	return TRUE;
 
@@ -245,6 +258,9 @@ UBYTE CPacket::CanRetry()
 //drop the packet from a list (buffer)
 void CPacket::Drop()
 {
+	if (pa_ppbBuffer != NULL) {
+		pa_ppbBuffer->UnindexPacket(*this);
+	}
 	if (pa_lnListNode.IsLinked()) {
 		pa_lnListNode.Remove();
 	}
@@ -265,6 +281,34 @@ BOOL CPacket::IsBroadcast()
 
 };
 
+// get memory for a packet, reusing a freed one if possible
+void *CPacket::operator new(size_t sz)
+{
+	ASSERT(sz == sizeof(CPacket));
+	if (_pvFreePackets != NULL) {
+		void *pv = _pvFreePackets;
+		_pvFreePackets = *(void**)pv;
+		_ctFreePackets--;
+		return pv;
+	}
+	return AllocMemory((SLONG)sz);
+};
+
+// keep the packet memory for reuse, unless there are enough already
+void CPacket::operator delete(void *pv)
+{
+	if (pv == NULL) {
+		return;
+	}
+	if (_ctFreePackets < PACKET_POOLSIZE) {
+		*(void**)pv = _pvFreePackets;
+		_pvFreePackets = pv;
+		_ctFreePackets++;
+		return;
+	}
+	FreeMemory(pv);
+};
+
 
 /*
 *
@@ -331,7 +375,15 @@ CTimerValue CPacketBufferStats::GetPacketSendTime(SLONG slSize)
 void CPacketBuffer::Clear() 
 {
 
+	// packets in storage belong to the buffer
+	FORDELETELIST(CPacket,pa_lnListNode,pb_lhPacketStorage,litPacketIter) {
+		litPacketIter->pa_ppbBuffer = NULL;
+		litPacketIter->pa_lnListNode.Remove();
+		delete litPacketIter;
+	}
 	pb_lhPacketStorage.Clear();
+	pb_appaIndex.Clear();
+	pb_bSorted = TRUE;
 	
 	pb_ulNumOfPackets = 0;
 	pb_ulNumOfReliablePackets = 0;
@@ -388,8 +440,14 @@ BOOL CPacketBuffer::AppendPacket(CPacket &paPacket,BOOL bDelay)
 		paPacket.pa_tvSendWhen = _pTimer->GetHighPrecisionTimer();
 	}
 
+	// if it breaks the sequence order, remember that
+	if (pb_ulNumOfPackets > 0 && paPacket.pa_ulSequence < GetLastSequence()) {
+		pb_bSorted = FALSE;
+	}
+
 	// Add the packet to the end of the list
 	pb_lhPacketStorage.AddTail(paPacket.pa_lnListNode);
+	IndexPacket(paPacket);
 	pb_ulNumOfPackets++;
 
 	// if the packet is reliable, bump up the number of reliable packets
@@ -406,42 +464,53 @@ BOOL CPacketBuffer::AppendPacket(CPacket &paPacket,BOOL bDelay)
 // Inserts the packet in the buffer, according to it's sequence number
 BOOL CPacketBuffer::InsertPacket(CPacket &paPacket,BOOL bDelay) 
 {
-	
-	// find the right place to insert this packet (this is if this packet is out of sequence)
-	FOREACHINLIST(CPacket,pa_lnListNode,pb_lhPacketStorage,litPacketIter) {
-		// if there is a packet in the buffer with greater sequence number, insert this one before it
-		if (paPacket.pa_ulSequence < litPacketIter->pa_ulSequence) {
-
-			// bDelay regulates if the packet should be delayed because of the bandwidth limits or not
-			// internal buffers (reliable, waitack and master buffers) do not pay attention to bandwidth limits
-			if (bDelay) {
-				paPacket.pa_tvSendWhen = GetPacketSendTime(paPacket.pa_slSize);
-			} else {
-				paPacket.pa_tvSendWhen = _pTimer->GetHighPrecisionTimer();
-			}
 
-			litPacketIter.InsertBeforeCurrent(paPacket.pa_lnListNode);
-			pb_ulNumOfPackets++;
-
-			// if the packet is reliable, bump up the number of reliable packets
-			if (paPacket.pa_ubReliable & UDP_PACKET_RELIABLE) {
-				pb_ulNumOfReliablePackets++;
-			}
-
-			// update the total size of data stored in the buffer
-			pb_ulTotalSize += paPacket.pa_slSize - MAX_HEADER_SIZE;
+	// if there already is a packet in the buffer with the same sequence, do nothing
+	if (FindPacket(paPacket.pa_ulSequence) != NULL) {
+		return FALSE;
+	}
 
-      
-			return TRUE;
+	// bDelay regulates if the packet should be delayed because of the bandwidth limits or not
+	// internal buffers (reliable, waitack and master buffers) do not pay attention to bandwidth limits
+	if (bDelay) {
+		paPacket.pa_tvSendWhen = GetPacketSendTime(paPacket.pa_slSize);
+	} else {
+		paPacket.pa_tvSendWhen = _pTimer->GetHighPrecisionTimer();
+	}
 
-		// if there already is a packet in the buffer with the same sequence, do nothing
-		} else if (paPacket.pa_ulSequence == litPacketIter->pa_ulSequence) {
-			return FALSE;
+	// find the right place to insert this packet - before first packet with a greater sequence number
+	CListNode *plnBefore = NULL;
+	if (pb_bSorted) {
+		// packets mostly come in order, so search from the end
+		if (!pb_lhPacketStorage.IsEmpty()) {
+			CPacket *ppa = LIST_TAIL(pb_lhPacketStorage,CPacket,pa_lnListNode);
+			for (;;) {
+				if (ppa->pa_ulSequence < paPacket.pa_ulSequence) {
+					break;
+				}
+				plnBefore = &ppa->pa_lnListNode;
+				if (ppa->pa_lnListNode.IsHead()) {
+					break;
+				}
+				ppa = LIST_PRED(*ppa,CPacket,pa_lnListNode);
+			}
+		}
+	} else {
+		FOREACHINLIST(CPacket,pa_lnListNode,pb_lhPacketStorage,litPacketIter) {
+			if (paPacket.pa_ulSequence < litPacketIter->pa_ulSequence) {
+				plnBefore = &litPacketIter->pa_lnListNode;
+				break;
+			}
 		}
 	}
 
 	// if this packet has the greatest sequence number so far, add it to the end of the list
-	pb_lhPacketStorage.AddTail(paPacket.pa_lnListNode);
+	if (plnBefore == NULL) {
+		pb_lhPacketStorage.AddTail(paPacket.pa_lnListNode);
+	} else {
+		plnBefore->AddBefore(paPacket.pa_lnListNode);
+	}
+	IndexPacket(paPacket);
 	pb_ulNumOfPackets++;
 
   
@@ -458,6 +527,7 @@ BOOL CPacketBuffer::InsertPacket(CPacket &paPacket,BOOL bDelay)
 
 
 // Bumps up the retry count and time, and appends the packet to the buffer
+// (outgoing buffers are ordered by send time, not by sequence)
 BOOL CPacketBuffer::Retry(CPacket &paPacket) 
 {
 	paPacket.pa_ubRetryNumber++;
@@ -484,14 +554,7 @@ CPacket* CPacketBuffer::GetFirstPacket()
 	CPacket* ppaHead = LIST_HEAD(pb_lhPacketStorage,CPacket,pa_lnListNode);
 
 	// remove the first packet from the start of the list
-	pb_lhPacketStorage.RemHead();
-	pb_ulNumOfPackets--;
-	if (ppaHead->pa_ubReliable & UDP_PACKET_RELIABLE) {
-		pb_ulNumOfReliablePackets--;
-	}
-
-	// update the total size of data stored in the buffer
-	pb_ulTotalSize -= (ppaHead->pa_slSize - MAX_HEADER_SIZE);
+	UnlinkPacket(*ppaHead);
 
 	// mark the last packet sequence that was output from the buffer - helps to prevent problems wit duplicated packets	
 	if (pb_ulLastSequenceOut < ppaHead->pa_ulSequence) {
@@ -505,49 +568,25 @@ CPacket* CPacketBuffer::GetFirstPacket()
 // Reads the data from the packet with the requested sequence, but does not remove it
 CPacket* CPacketBuffer::PeekPacket(ULONG ulSequence)
 {
-	FOREACHINLIST(CPacket,pa_lnListNode,pb_lhPacketStorage,litPacketIter) {
-		if (litPacketIter->pa_ulSequence == ulSequence) {
-			return litPacketIter;
-		}
-	}
-	return NULL;
+	return FindPacket(ulSequence);
 };
 
 // Returns te packet with the matching sequence from the buffer
 CPacket* CPacketBuffer::GetPacket(ULONG ulSequence)
 {
-	
-	FOREACHINLIST(CPacket,pa_lnListNode,pb_lhPacketStorage,litPacketIter) {
-		if (litPacketIter->pa_ulSequence == ulSequence) {
-			litPacketIter->pa_lnListNode.Remove();
-
-			pb_ulNumOfPackets--;
-			if (litPacketIter->pa_ubReliable & UDP_PACKET_RELIABLE) {
-				pb_ulNumOfReliablePackets--;
-			}
-
-			// update the total size of data stored in the buffer
-			pb_ulTotalSize -= (litPacketIter->pa_slSize - MAX_HEADER_SIZE);
-
-			return litPacketIter;
-		}
+	CPacket *ppaPacket = FindPacket(ulSequence);
+	if (ppaPacket != NULL) {
+		UnlinkPacket(*ppaPacket);
 	}
-	return NULL;
+	return ppaPacket;
 };
 
 // Reads the first connection request packet from the buffer
 CPacket* CPacketBuffer::GetConnectRequestPacket() {
 		FOREACHINLIST(CPacket,pa_lnListNode,pb_lhPacketStorage,litPacketIter) {
 		if (litPacketIter->pa_ubReliable & UDP_PACKET_CONNECT_REQUEST) {
-			litPacketIter->pa_lnListNode.Remove();
-
-			pb_ulNumOfPackets--;
 			// connect request packets are allways reliable
-			pb_ulNumOfReliablePackets--;
-
-			// update the total size of data stored in the buffer
-			pb_ulTotalSize -= (litPacketIter->pa_slSize - MAX_HEADER_SIZE);
-
+			UnlinkPacket(*litPacketIter);
 			return litPacketIter;
 		}
 	}
@@ -559,19 +598,11 @@ BOOL CPacketBuffer::RemoveFirstPacket(BOOL bDelete) {
 	ASSERT(pb_ulNumOfPackets > 0);
 	CPacket *lnHead = LIST_HEAD(pb_lhPacketStorage,CPacket,pa_lnListNode);
 
-	pb_ulNumOfPackets--;
-	if (lnHead->pa_ubReliable & UDP_PACKET_RELIABLE) {
-		pb_ulNumOfReliablePackets--;
-	}
-
-	// update the total size of data stored in the buffer
-	pb_ulTotalSize -= (lnHead->pa_slSize - MAX_HEADER_SIZE);
-
 	if (pb_ulLastSequenceOut < lnHead->pa_ulSequence) {
 		pb_ulLastSequenceOut = lnHead->pa_ulSequence;		
 	}
 
-	pb_lhPacketStorage.RemHead();
+	UnlinkPacket(*lnHead);
 	if (bDelete) {
 		delete lnHead;
 	}
@@ -582,40 +613,54 @@ BOOL CPacketBuffer::RemoveFirstPacket(BOOL bDelete) {
 BOOL CPacketBuffer::RemovePacket(ULONG ulSequence,BOOL bDelete)
 {
 //	ASSERT(pb_ulNumOfPackets > 0);
-	FORDELETELIST(CPacket,pa_lnListNode,pb_lhPacketStorage,litPacketIter) {
-		if (litPacketIter->pa_ulSequence == ulSequence) {
-			litPacketIter->pa_lnListNode.Remove();
-			
-			pb_ulNumOfPackets--;
-			if (litPacketIter->pa_ubReliable & UDP_PACKET_RELIABLE) {
-				pb_ulNumOfReliablePackets--;
-			}
+	BOOL bRemoved = FALSE;
+	// (master buffers can hold same sequences from different clients, so remove all of them)
+	CPacket *ppaPacket;
+	while ((ppaPacket = FindPacket(ulSequence)) != NULL) {
+		UnlinkPacket(*ppaPacket);
+		if (bDelete) {
+			delete ppaPacket;
+		}
+		bRemoved = TRUE;
+	}
+	return bRemoved;
+};
 
-			// update the total size of data stored in the buffer
-			pb_ulTotalSize -= (litPacketIter->pa_slSize - MAX_HEADER_SIZE);
+// Removes all packets with sequences in the given range from the buffer
+BOOL CPacketBuffer::RemovePacketRange(ULONG ulFirst,ULONG ulLast,BOOL bDelete)
+{
+	if (ulLast < ulFirst) {
+		return FALSE;
+	}
+	// if the range is short, look up each sequence in it
+	if (ulLast-ulFirst < pb_ulNumOfPackets) {
+		BOOL bRemoved = FALSE;
+		for (ULONG ulSequence=ulFirst; ulSequence<=ulLast; ulSequence++) {
+			bRemoved |= RemovePacket(ulSequence,bDelete);
+		}
+		return bRemoved;
+	}
 
+	// otherwise check each packet in the buffer
+	BOOL bRemoved = FALSE;
+	FORDELETELIST(CPacket,pa_lnListNode,pb_lhPacketStorage,litPacketIter) {
+		if (litPacketIter->pa_ulSequence >= ulFirst && litPacketIter->pa_ulSequence <= ulLast) {
+			UnlinkPacket(*litPacketIter);
 			if (bDelete) {
 				delete litPacketIter;
 			}
+			bRemoved = TRUE;
 		}
 	}
-	return FALSE;
+	return bRemoved;
 };
 
 // Remove connect response packets from the buffer
 BOOL CPacketBuffer::RemoveConnectResponsePackets() {
 		FORDELETELIST(CPacket,pa_lnListNode,pb_lhPacketStorage,litPacketIter) {
 		if (litPacketIter->pa_ubReliable & UDP_PACKET_CONNECT_RESPONSE) {
-			litPacketIter->pa_lnListNode.Remove();
-
-			pb_ulNumOfPackets--;
-			
 			// connect request packets are allways reliable
-			pb_ulNumOfReliablePackets--;
-
-			// update the total size of data stored in the buffer
-			pb_ulTotalSize -= (litPacketIter->pa_slSize - MAX_HEADER_SIZE);
-
+			UnlinkPacket(*litPacketIter);
 			delete litPacketIter;
 		}
 	}
@@ -641,15 +686,10 @@ ULONG CPacketBuffer::GetLastSequence()
 
 };
 
-// Removes the packet with the requested sequence from the buffer
+// Is the packet with the given sequence in the buffer?
 BOOL CPacketBuffer::IsSequenceInBuffer(ULONG ulSequence)
 {
-	FOREACHINLIST(CPacket,pa_lnListNode,pb_lhPacketStorage,litPacketIter) {
-		if (litPacketIter->pa_ulSequence == ulSequence) {
-			return TRUE;
-		}
-	}
-	return FALSE;
+	return FindPacket(ulSequence) != NULL;
 };
 
 
@@ -696,4 +736,89 @@ BOOL CPacketBuffer::CheckSequence(SLONG &slSize)
 };
 
 
+// Find the packet with the requested sequence through the index
+CPacket* CPacketBuffer::FindPacket(ULONG ulSequence)
+{
+	const INDEX ctSlots = pb_appaIndex.Count();
+	if (ctSlots == 0) {
+		return NULL;
+	}
+	for (CPacket *ppa = pb_appaIndex[ulSequence&(ctSlots-1)]; ppa != NULL; ppa = ppa->pa_ppaNextInIndex) {
+		if (ppa->pa_ulSequence == ulSequence) {
+			return ppa;
+		}
+	}
+	return NULL;
+};
+
+// Add the packet to the sequence index
+void CPacketBuffer::IndexPacket(CPacket &paPacket)
+{
+	ASSERT(paPacket.pa_ppbBuffer == NULL);
+
+	// keep at least as many slots as there are packets (slot count is a power of two, so sequence can be masked)
+	INDEX ctSlots = pb_appaIndex.Count();
+	if (ctSlots <= (INDEX)pb_ulNumOfPackets) {
+		INDEX ctNewSlots = Max(ctSlots*2, INDEX(PB_MININDEX));
+		CStaticArray<CPacket*> appaIndex;
+		appaIndex.New(ctNewSlots);
+		for (INDEX iSlot=0; iSlot<ctNewSlots; iSlot++) {
+			appaIndex[iSlot] = NULL;
+		}
+		// rehash all packets
+		for (INDEX iOld=0; iOld<ctSlots; iOld++) {
+			CPacket *ppa = pb_appaIndex[iOld];
+			while (ppa != NULL) {
+				CPacket *ppaNext = ppa->pa_ppaNextInIndex;
+				CPacket *&ppaSlot = appaIndex[ppa->pa_ulSequence&(ctNewSlots-1)];
+				ppa->pa_ppaNextInIndex = ppaSlot;
+				ppaSlot = ppa;
+				ppa = ppaNext;
+			}
+		}
+		pb_appaIndex.MoveArray(appaIndex);
+		ctSlots = ctNewSlots;
+	}
+
+	CPacket *&ppaSlot = pb_appaIndex[paPacket.pa_ulSequence&(ctSlots-1)];
+	paPacket.pa_ppaNextInIndex = ppaSlot;
+	ppaSlot = &paPacket;
+	paPacket.pa_ppbBuffer = this;
+};
+
+// Remove the packet from the sequence index
+void CPacketBuffer::UnindexPacket(CPacket &paPacket)
+{
+	ASSERT(paPacket.pa_ppbBuffer == this);
+	const INDEX ctSlots = pb_appaIndex.Count();
+	CPacket **pppa = &pb_appaIndex[paPacket.pa_ulSequence&(ctSlots-1)];
+	while (*pppa != NULL) {
+		if (*pppa == &paPacket) {
+			*pppa = paPacket.pa_ppaNextInIndex;
+			break;
+		}
+		pppa = &(*pppa)->pa_ppaNextInIndex;
+	}
+	paPacket.pa_ppaNextInIndex = NULL;
+	paPacket.pa_ppbBuffer = NULL;
+};
 
+// Take the packet out of storage, updating the counters
+void CPacketBuffer::UnlinkPacket(CPacket &paPacket)
+{
+	UnindexPacket(paPacket);
+	paPacket.pa_lnListNode.Remove();
+
+	pb_ulNumOfPackets--;
+	if (paPacket.pa_ubReliable & UDP_PACKET_RELIABLE) {
+		pb_ulNumOfReliablePackets--;
+	}
+
+	// update the total size of data stored in the buffer
+	pb_ulTotalSize -= (paPacket.pa_slSize - MAX_HEADER_SIZE);
+
+	// an empty buffer is trivially in order again
+	if (pb_ulNumOfPackets == 0) {
+		pb_bSorted = TRUE;
+	}
+};
@@ -21,6 +21,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include <Engine/Base/Lists.h>
 #include <Engine/Base/Timer.h>
+#include <Engine/Templates/StaticArray.h>
 
 
 // The total size of the UDP packet should be below 1450 bytes, to reduce the 
@@ -44,6 +45,9 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #define RS_NOTNOW		1		// the packet should be resent at a later time
 #define RS_NOTATALL 2		// the packet has reached the maximum number of retries - give up
 
+// acknowledge packets can hold ranges of sequences - first sequence with this bit set, followed by the last one
+#define ACK_RANGE 0x80000000
+
 
 class CAddress {
 public:
@@ -75,11 +79,13 @@ public:
 	UBYTE pa_pubPacketData[MAX_PACKET_SIZE];		// Packet header + actual data contained in the packet
 
 	CListNode pa_lnListNode;					// used to create a linked list of packets - buffer
+	CPacket *pa_ppaNextInIndex;				// next packet in the same sequence index slot of the buffer
+	class CPacketBuffer *pa_ppbBuffer;	// buffer whose sequence index this packet is in (NULL if none)
 
   CAddress pa_adrAddress;				// packet address, port and client ID
   																
 	// Constructors/destructors
-	CPacket() { Clear(); }					// Default Constructor
+	CPacket() { pa_ppaNextInIndex = NULL; pa_ppbBuffer = NULL; Clear(); }	// Default Constructor
 	CPacket(CPacket &paOriginal);		// Copy constructor
 	~CPacket() { Clear(); }
 
@@ -114,6 +120,10 @@ public:
 
 	// Copy operator
 	void operator=(const CPacket &paOriginal);
+
+	// packets are pooled, since one is made and freed for each datagram
+	void *operator new(size_t sz);
+	void operator delete(void *pv);
 	
 };
 
@@ -133,12 +143,25 @@ public:
 };
 
 
+// socket traffic done in one update of the master buffers
+class CSocketStats {
+public:
+  INDEX ss_ctCalls;     // number of socket calls made
+  INDEX ss_ctPackets;   // number of packets transferred
+  INDEX ss_ctBytes;     // number of bytes transferred
+
+  void Clear(void) { ss_ctCalls = 0; ss_ctPackets = 0; ss_ctBytes = 0; };
+};
+
+
 class CPacketBuffer {
 public:
 	ULONG pb_ulTotalSize;						// Total size of data in packets stored in this buffer (no headers)
 	ULONG pb_ulLastSequenceOut;			// Sequence number of the last packet taken out of the buffer
 	
 	CListHead pb_lhPacketStorage;
+	BOOL pb_bSorted;											// are packets in storage ordered by sequence
+	CStaticArray<CPacket*> pb_appaIndex;	// packets hashed by sequence, chained through pa_ppaNextInIndex
 	
 	ULONG pb_ulNumOfPackets;					// Total number of packets currently in storage
 	ULONG pb_ulNumOfReliablePackets;	// Number of reliable packets in storage (0 if no reliable stream in progress)
@@ -146,7 +169,7 @@ public:
 	CPacketBufferStats *pb_ppbsStats; // for bandwidth/latency emulation stats and limits
 	CPacketBufferStats pb_pbsLimits;	// maximum output BPS for the buffer, to prevent client flooding
 
-	CPacketBuffer() { Clear(); };
+	CPacketBuffer() { pb_ppbsStats = NULL; Clear(); };
 	~CPacketBuffer() { Clear(); };
 
 	// Empty the packet buffer
@@ -186,8 +209,19 @@ public:
 	ULONG GetLastSequence();
 	// Is the packet with the given sequence in the buffer?
 	BOOL IsSequenceInBuffer(ULONG ulSequence);
+	// Removes all packets with sequences in the given range from the buffer
+	BOOL RemovePacketRange(ULONG ulFirst,ULONG ulLast,BOOL bDelete);
 	// Check if the buffer contains a complete sequence of reliable packets	at the start of the buffer
 	BOOL CheckSequence(SLONG &slSize);
+
+	// Find the packet with the requested sequence through the index
+	CPacket* FindPacket(ULONG ulSequence);
+	// Add the packet to the sequence index
+	void IndexPacket(CPacket &paPacket);
+	// Remove the packet from the sequence index
+	void UnindexPacket(CPacket &paPacket);
+	// Take the packet out of storage, updating the counters
+	void UnlinkPacket(CPacket &paPacket);
 		
 };
 
@@ -34,6 +34,32 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 extern FLOAT net_fDropPackets;
 extern INDEX net_bReportPackets;
 
+// pack runs of consecutive sequences in a list of acknowledges into ranges, return new count
+static ULONG PackAcknowledges(ULONG *pulAcks, ULONG ctAcks)
+{
+  ULONG ctPacked = 0;
+  ULONG iAck = 0;
+  while (iAck<ctAcks) {
+    // find the end of the run
+    ULONG iLast = iAck;
+    while (iLast+1<ctAcks && pulAcks[iLast+1]==pulAcks[iLast]+1) {
+      iLast++;
+    }
+    // a range takes two entries, so it pays off only for three or more sequences
+    if (iLast-iAck>=2 && !(pulAcks[iAck]&ACK_RANGE)) {
+      const ULONG ulLast = pulAcks[iLast];
+      pulAcks[ctPacked++] = pulAcks[iAck]|ACK_RANGE;
+      pulAcks[ctPacked++] = ulLast;
+    } else {
+      for (ULONG i=iAck; i<=iLast; i++) {
+        pulAcks[ctPacked++] = pulAcks[i];
+      }
+    }
+    iAck = iLast+1;
+  }
+  return ctPacked;
+}
+
 CClientInterface::CClientInterface(void)
 {
  Clear();
@@ -389,6 +415,40 @@ void CClientInterface::ExchangeBuffers(void)
 };
 
 
+// remove packets acknowledged by an acknowledge packet from the output buffers
+void CClientInterface::ReceiveAcknowledge(CPacket &paAcknowledge)
+{
+	CTimerValue tvNow;
+	SLONG slSize = paAcknowledge.pa_slSize - MAX_HEADER_SIZE;
+	// if slSize isn't rounded to the size of ulSequence, abort 
+	ASSERT (slSize % sizeof(ULONG) == 0);
+
+	// get the pointer to the start of acknowledged sequences
+	ULONG *pulAck = (ULONG*) (paAcknowledge.pa_pubPacketData + MAX_HEADER_SIZE);
+	ULONG ctAcks = slSize/sizeof(ULONG);
+	// for each acknowledged sequence number or range of them
+	for (ULONG iAck=0; iAck<ctAcks; iAck++) {
+		ULONG ulFirst = pulAck[iAck];
+		ULONG ulLast = ulFirst;
+		if ((ulFirst&ACK_RANGE) && iAck+1<ctAcks) {
+			ulFirst &= ~ACK_RANGE;
+			ulLast = pulAck[++iAck];
+		}
+
+		// report the packet info to the console
+		if (net_bReportPackets == TRUE) {
+			tvNow = _pTimer->GetHighPrecisionTimer();
+			CPrintF("%lu: Received acknowledge for packet sequences %d-%d\n",(ULONG) tvNow.GetMilliseconds(),ulFirst,ulLast);
+		}
+
+		// remove the matching packets from the wait acknowledge buffer
+		ci_pbWaitAckBuffer.RemovePacketRange(ulFirst,ulLast,TRUE);
+		// if a packet is waiting to be resent it's in the outgoing buffer, so remove it
+		ci_pbOutputBuffer.RemovePacketRange(ulFirst,ulLast,TRUE);
+	}
+};
+
+
 // update interface's input buffer (transfer from input buffer to the reliable buffer...),
 // for incoming acknowledge packets, remove acknowledged packets from the output buffers,
 // and generate acknowledge messages for incoming reliable packets
@@ -405,33 +465,7 @@ BOOL CClientInterface::UpdateInputBuffers(void)
 		
 			// if it's an acknowledge packet, remove the acknowledged packets from the wait acknowledge buffer
 			if (ppaPacket->pa_ubReliable & UDP_PACKET_ACKNOWLEDGE) {
-				ULONG *pulAck;
-				SLONG slSize;
-				ULONG ulSequence;
-
-				slSize = ppaPacket->pa_slSize - MAX_HEADER_SIZE;
-				// if slSize isn't rounded to the size of ulSequence, abort 
-				ASSERT (slSize % sizeof(ULONG) == 0);
-
-				// get the pointer to the start of acknowledged sequences
-				pulAck = (ULONG*) (ppaPacket->pa_pubPacketData + MAX_HEADER_SIZE);
-				// for each acknowledged sequence number
-				while (slSize>0) {
-					ulSequence = *pulAck;
-					
-					// report the packet info to the console
-					if (net_bReportPackets == TRUE) {
-						tvNow = _pTimer->GetHighPrecisionTimer();
-						CPrintF("%lu: Received acknowledge for packet sequence %d\n",(ULONG) tvNow.GetMilliseconds(),ulSequence);
-					}
-					
-					// remove the matching packet from the wait acknowledge buffer
-					ci_pbWaitAckBuffer.RemovePacket(ulSequence,TRUE);
-					// if the packet is waiting to be resent it's in the outgoing buffer, so remove it
-					ci_pbOutputBuffer.RemovePacket(ulSequence,TRUE);
-					pulAck++;
-					slSize -= sizeof(ULONG);
-				}
+				ReceiveAcknowledge(*ppaPacket);
 
 				// take this packet out of the input buffer and kill it
 				ci_pbInputBuffer.RemovePacket(ppaPacket->pa_ulSequence,FALSE);
@@ -460,6 +494,7 @@ BOOL CClientInterface::UpdateInputBuffers(void)
 						CPacket *ppaAckPacket = new CPacket;
 						ppaAckPacket->pa_adrAddress.adr_ulAddress = ci_adrAddress.adr_ulAddress;
 						ppaAckPacket->pa_adrAddress.adr_uwPort = ci_adrAddress.adr_uwPort;
+						ulAckCount = PackAcknowledges(pulGenAck,ulAckCount);
 						ppaAckPacket->WriteToPacket(pulGenAck,ulAckCount*sizeof(ULONG),UDP_PACKET_ACKNOWLEDGE,++ci_ulSequence,ci_adrAddress.adr_uwID,ulAckCount*sizeof(ULONG));
 						ci_pbOutputBuffer.AppendPacket(*ppaAckPacket,TRUE);
 						ulAckCount = 0;
@@ -531,6 +566,7 @@ BOOL CClientInterface::UpdateInputBuffers(void)
 		CPacket *ppaAckPacket = new CPacket;
 		ppaAckPacket->pa_adrAddress.adr_ulAddress = ci_adrAddress.adr_ulAddress;
 		ppaAckPacket->pa_adrAddress.adr_uwPort = ci_adrAddress.adr_uwPort;
+		ulAckCount = PackAcknowledges(pulGenAck,ulAckCount);
 		ppaAckPacket->WriteToPacket(pulGenAck,ulAckCount*sizeof(ULONG),UDP_PACKET_ACKNOWLEDGE,++ci_ulSequence,ci_adrAddress.adr_uwID,ulAckCount*sizeof(ULONG));
 		ci_pbOutputBuffer.AppendPacket(*ppaAckPacket,TRUE);
 	}	
@@ -555,33 +591,7 @@ BOOL CClientInterface::UpdateInputBuffersBroadcast(void)
 
 			// if it's an acknowledge packet, remove the acknowledged packets from the wait acknowledge buffer
 			if (ppaPacket->pa_ubReliable & UDP_PACKET_ACKNOWLEDGE) {
-				ULONG *pulAck;
-				SLONG slSize;
-				ULONG ulSequence;
-
-				slSize = ppaPacket->pa_slSize - MAX_HEADER_SIZE;
-				// if slSize isn't rounded to the size of ulSequence, abort 
-				ASSERT (slSize % sizeof(ULONG) == 0);
-
-				// get the pointer to the start of acknowledged sequences
-				pulAck = (ULONG*) (ppaPacket->pa_pubPacketData + MAX_HEADER_SIZE);
-				// for each acknowledged sequence number
-				while (slSize>0) {
-					ulSequence = *pulAck;
-
-					// report the packet info to the console
-					if (net_bReportPackets == TRUE) {
-						tvNow = _pTimer->GetHighPrecisionTimer();
-						CPrintF("%lu: Received acknowledge for broadcast packet sequence %d\n",(ULONG) tvNow.GetMilliseconds(),ulSequence);
-					}
-
-					// remove the matching packet from the wait acknowledge buffer
-					ci_pbWaitAckBuffer.RemovePacket(ulSequence,TRUE);
-					// if the packet is waiting to be resent it's in the outgoing buffer, so remove it
-					ci_pbOutputBuffer.RemovePacket(ulSequence,TRUE);
-					pulAck++;
-					slSize -= sizeof(ULONG);
-				}
+				ReceiveAcknowledge(*ppaPacket);
 
 				ci_pbInputBuffer.RemovePacket(ppaPacket->pa_ulSequence,FALSE);
 				bSomethingDone = TRUE;
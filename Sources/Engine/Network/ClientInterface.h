@@ -57,6 +57,9 @@ public:
 	// from output of this buffet to the input of the other and vice versa
 	void ExchangeBuffers(void);
 
+	// remove packets acknowledged by an acknowledge packet from the output buffers
+	void ReceiveAcknowledge(CPacket &paAcknowledge);
+
   // update socket buffers (transfer from input buffer to the reliable buffer...) - grouped acknowledges
   BOOL UpdateInputBuffers(void);
 
@@ -19,6 +19,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <Engine/Base/CTString.h>
 #include <Engine/Base/ErrorReporting.h>
 #include <Engine/Base/ErrorTable.h>
+#include <Engine/Base/ListIterator.inl>
 #include <Engine/Base/ProgressHook.h>
 #include <Engine/Base/Synchronization.h>
 #include <Engine/Base/Translation.h>
@@ -40,6 +41,8 @@ extern CTString net_strLocalHost;
 extern INDEX net_bLookupHostNames;
 extern INDEX net_bReportICMPErrors;
 extern FLOAT net_fDropPackets;
+extern INDEX net_iSocketBufferSize;
+extern INDEX net_iMaxDatagramsPerUpdate;
 extern FLOAT net_tmConnectionTimeout;
 extern INDEX net_bReportPackets;
 
@@ -96,6 +99,9 @@ static struct ErrorTable SocketErrors = ERRORTABLE(ErrorCodes);
 //structures used to emulate bandwidth and latency parameters - shared by all client interfaces
 CPacketBufferStats _pbsSend;
 CPacketBufferStats _pbsRecv;
+// socket traffic counters for the last update of master buffers
+CSocketStats _ssSend;
+CSocketStats _ssRecv;
 
 ULONG cm_ulLocalHost;			// configured local host address
 CTString cm_strAddress;   // local address
@@ -261,6 +267,8 @@ void CCommunicationInterface::PrepareForUse(BOOL bUseNetwork, BOOL bClient)
 	// clear the network conditions emulation data
   _pbsSend.Clear();
   _pbsRecv.Clear();
+  _ssSend.Clear();
+  _ssRecv.Clear();
 
 	// if the network is already initialized, shut it down before proceeding
   if (cm_bNetworkInitialized) {
@@ -436,6 +444,24 @@ void CCommunicationInterface::SetNonBlocking_t(void)
 };
 
 
+// enlarge socket buffers, so that all traffic between two updates can be queued
+void CCommunicationInterface::SetBufferSizes(void)
+{
+  if (cci_hSocket==INVALID_SOCKET) {
+    ASSERT(FALSE);
+    return;
+  }
+
+  int iSize = Clamp(net_iSocketBufferSize, INDEX(8*1024), INDEX(8*1024*1024));
+  // not fatal if it fails, the default buffers just drop more packets under load
+  if (setsockopt(cci_hSocket, SOL_SOCKET, SO_RCVBUF, (const char*)&iSize, sizeof(iSize)) == SOCKET_ERROR
+    ||setsockopt(cci_hSocket, SOL_SOCKET, SO_SNDBUF, (const char*)&iSize, sizeof(iSize)) == SOCKET_ERROR) {
+    CPrintF(TRANS("Cannot set socket buffer size. %s\n"), 
+      (const char*)GetSocketError(WSAGetLastError()));
+  }
+};
+
+
 // get generic socket error info string about last error
 CTString CCommunicationInterface::GetSocketError(INDEX iError)
 {
@@ -457,6 +483,8 @@ void CCommunicationInterface::OpenSocket_t(ULONG ulLocalHost, ULONG ulLocalPort)
   }
   // go non-blocking
   SetNonBlocking_t();
+  // with room for a whole update of traffic
+  SetBufferSizes();
 
   // mark as open
   cci_bSocketOpen = TRUE;
@@ -464,6 +492,30 @@ void CCommunicationInterface::OpenSocket_t(ULONG ulLocalHost, ULONG ulLocalPort)
 
 };
 
+// wait until there is data to read on the socket, or the timeout passes (returns TRUE if data arrived)
+BOOL CCommunicationInterface::WaitForData(TIME tmTimeout)
+{
+  tmTimeout = ClampDn(tmTimeout, TIME(0));
+  // if no socket to wait on
+  if (!cci_bSocketOpen || cci_hSocket==INVALID_SOCKET) {
+    // just wait
+    Sleep(DWORD(tmTimeout*1000.0f));
+    return FALSE;
+  }
+
+  fd_set fdsRead;
+  FD_ZERO(&fdsRead);
+  FD_SET(cci_hSocket, &fdsRead);
+  timeval tv;
+  tv.tv_sec  = long(tmTimeout);
+  tv.tv_usec = long((tmTimeout-tv.tv_sec)*1000000.0f);
+  int iResult = select(0, &fdsRead, NULL, NULL, &tv);
+  if (iResult==SOCKET_ERROR) {
+    return FALSE;
+  }
+  return iResult>0;
+};
+
 // get address of this host
 void CCommunicationInterface::GetLocalAddress_t(ULONG &ulHost, ULONG &ulPort)
 {
@@ -560,12 +612,12 @@ void CCommunicationInterface::Broadcast_Update_t() {
 					// we have an empty slot, so fill it for the client
 					cm_aciClients[iClient].ci_adrAddress.adr_ulAddress = ppaConnectionRequest->pa_adrAddress.adr_ulAddress;
 					cm_aciClients[iClient].ci_adrAddress.adr_uwPort = ppaConnectionRequest->pa_adrAddress.adr_uwPort;
-					// generate the ID
-					UWORD uwID = _pTimer->GetHighPrecisionTimer().tv_llValue&0x0FFF;
-					if (uwID==0 || uwID=='//') {
+					// generate the ID, with client index in low bits so packets can be dispatched directly
+					UWORD uwID = _pTimer->GetHighPrecisionTimer().tv_llValue&(0xFFFF>>SERVER_CLIENTBITS);
+					if (UWORD((uwID<<SERVER_CLIENTBITS)+iClient)=='//') {
 						uwID+=1;
 					}										
-					cm_aciClients[iClient].ci_adrAddress.adr_uwID = (uwID<<4)+iClient;
+					cm_aciClients[iClient].ci_adrAddress.adr_uwID = (uwID<<SERVER_CLIENTBITS)+iClient;
 					// form the connection response packet
 					ppaConnectionRequest->pa_adrAddress.adr_uwID = '//';
 					ppaConnectionRequest->pa_ubReliable = UDP_PACKET_RELIABLE | UDP_PACKET_RELIABLE_HEAD | UDP_PACKET_RELIABLE_TAIL | UDP_PACKET_CONNECT_RESPONSE;
@@ -676,6 +728,17 @@ BOOL CCommunicationInterface::Server_IsClientUsed(INDEX iClient)
   return cm_aciClients[iClient].ci_bUsed;
 };
 
+BOOL CCommunicationInterface::Server_IsReliableQueued(INDEX iClient)
+{
+  CTSingleLock slComm(&cm_csComm, TRUE);
+
+  ASSERT(iClient>=0 && iClient<SERVER_CLIENTS);
+  CClientInterface &ci = cm_aciClients[iClient];
+  // reliable packets are either waiting to be sent or waiting to be acknowledged
+  return ci.ci_pbOutputBuffer.pb_ulNumOfReliablePackets>0
+      || ci.ci_pbWaitAckBuffer.pb_ulNumOfReliablePackets>0;
+};
+
 CTString CCommunicationInterface::Server_GetClientName(INDEX iClient)
 {
   CTSingleLock slComm(&cm_csComm, TRUE);
@@ -752,6 +815,11 @@ BOOL CCommunicationInterface::Server_Update()
 				// skip it
 				continue;
 			}
+			// simulated clients of a load test are linked directly, as the local client is
+			if (ci.ci_bClientLocal && ci.ci_pciOther != NULL) {
+				ci.ExchangeBuffers();
+				continue;
+			}
 			// update its buffers, if a reliable packet is overdue (has not been delivered too long)
 			// disconnect the client
 			if (ci.UpdateOutputBuffers() != FALSE) {
@@ -804,12 +872,11 @@ BOOL CCommunicationInterface::Server_Update()
 				cm_ciBroadcast.ci_pbInputBuffer.AppendPacket(*ppaPacket,FALSE);
 				bClientFound = TRUE;
 			} else {
-				for (iClient=0; iClient<SERVER_CLIENTS; iClient++) {
-					if (ppaPacket->pa_adrAddress.adr_uwID == cm_aciClients[iClient].ci_adrAddress.adr_uwID) {
-						cm_aciClients[iClient].ci_pbInputBuffer.AppendPacket(*ppaPacket,FALSE);
-						bClientFound = TRUE;
-						break;
-					}
+				// client index is in low bits of the ID
+				iClient = ppaPacket->pa_adrAddress.adr_uwID&(SERVER_CLIENTS-1);
+				if (ppaPacket->pa_adrAddress.adr_uwID == cm_aciClients[iClient].ci_adrAddress.adr_uwID) {
+					cm_aciClients[iClient].ci_pbInputBuffer.AppendPacket(*ppaPacket,FALSE);
+					bClientFound = TRUE;
 				}
 			}
 			if (!bClientFound) {
@@ -1168,87 +1235,105 @@ BOOL CCommunicationInterface::Client_Update(void)
 
 
 // update master UDP socket and route its messages
+// (all datagrams waiting in the socket are read in one pass, straight into packets)
 void CCommunicationInterface::UpdateMasterBuffers() 
 {
 
-	UBYTE aub[MAX_PACKET_SIZE];
 	CAddress adrIncomingAddress;
 	SOCKADDR_IN sa;
-	int size = sizeof(sa);
+	int size;
 	SLONG slSizeReceived;
 	SLONG slSizeSent;
-	BOOL bSomethingDone;
 	CPacket* ppaNewPacket;
 	CTimerValue tvNow;
 
+	_ssRecv.Clear();
+	_ssSend.Clear();
+
 	if (cci_bBound) {
-		// read from the socket while there is incoming data
-		do {
+		// all packets read in this pass get the same time
+		tvNow = _pTimer->GetHighPrecisionTimer();
+		// packet to receive into - kept for next datagram if this one is not accepted
+		ppaNewPacket = NULL;
 
-			// initially, nothing is done
-			bSomethingDone = FALSE;
-			slSizeReceived = recvfrom(cci_hSocket,(char*)aub,MAX_PACKET_SIZE,0,(SOCKADDR *)&sa,&size);
-			tvNow = _pTimer->GetHighPrecisionTimer();
+		// read from the socket until there is no more incoming data, but not too much in one pass,
+		// so that a flood doesn't starve the game - the rest is read on next update
+		for (;;) {
+			if (_ssRecv.ss_ctCalls >= ClampDn(net_iMaxDatagramsPerUpdate, INDEX(1))) {
+				break;
+			}
 
-			adrIncomingAddress.adr_ulAddress = ntohl(sa.sin_addr.s_addr);
-			adrIncomingAddress.adr_uwPort = ntohs(sa.sin_port);
+			if (ppaNewPacket == NULL) {
+				ppaNewPacket = new CPacket;
+			}
+			size = sizeof(sa);
+			slSizeReceived = recvfrom(cci_hSocket,(char*)ppaNewPacket->pa_pubPacketData,MAX_PACKET_SIZE,0,(SOCKADDR *)&sa,&size);
+			_ssRecv.ss_ctCalls++;
 
 			//On error, report it to the console (if error is not a no data to read message)
 			if (slSizeReceived == SOCKET_ERROR) {
 				int iResult = WSAGetLastError();
-				if (iResult!=WSAEWOULDBLOCK) {
-					// report it
-					if (iResult!=WSAECONNRESET || net_bReportICMPErrors) {
-						CPrintF(TRANS("Socket error during UDP receive. %s\n"), 
-							(const char*)GetSocketError(iResult));
-						return;
-					}
+				// if no more data, this pass is done
+				if (iResult==WSAEWOULDBLOCK) {
+					break;
 				}
+				// an ICMP error for one client shouldn't keep datagrams from others waiting until next update
+				if (iResult==WSAECONNRESET && !net_bReportICMPErrors) {
+					continue;
+				}
+				// report it
+				CPrintF(TRANS("Socket error during UDP receive. %s\n"), 
+					(const char*)GetSocketError(iResult));
+				break;
+			}
 
-			// if block received
-			} else {
-				// if there is not at least one byte more in the packet than the header size
-				if (slSizeReceived <= MAX_HEADER_SIZE) {
-					// the packet is in error
-          extern INDEX net_bReportMiscErrors;          
-          if (net_bReportMiscErrors) {
-					  CPrintF(TRANS("WARNING: Bad UDP packet from '%s'\n"), AddressToString(adrIncomingAddress.adr_ulAddress));
-          }
-					// there might be more to do
-					bSomethingDone = TRUE;
-				} else if (net_fDropPackets <= 0  || (FLOAT(rand())/RAND_MAX) > net_fDropPackets) {
-					// if no packet drop emulation (or the packet is not dropped), form the packet 
-					// and add it to the end of the UDP Master's input buffer
-					ppaNewPacket = new CPacket;
-					ppaNewPacket->WriteToPacketRaw(aub,slSizeReceived);
-					ppaNewPacket->pa_adrAddress.adr_ulAddress = adrIncomingAddress.adr_ulAddress;
-					ppaNewPacket->pa_adrAddress.adr_uwPort = adrIncomingAddress.adr_uwPort;						
-
-					if (net_bReportPackets == TRUE) {
-						CPrintF("%lu: Received sequence: %d from ID: %d, reliable flag: %d\n",(ULONG) tvNow.GetMilliseconds(),ppaNewPacket->pa_ulSequence,ppaNewPacket->pa_adrAddress.adr_uwID,ppaNewPacket->pa_ubReliable);
-					}
+			adrIncomingAddress.adr_ulAddress = ntohl(sa.sin_addr.s_addr);
+			adrIncomingAddress.adr_uwPort = ntohs(sa.sin_port);
 
-					cci_pbMasterInput.AppendPacket(*ppaNewPacket,FALSE);
-					// there might be more to do
-					bSomethingDone = TRUE;
-				
+			// if there is not at least one byte more in the packet than the header size
+			if (slSizeReceived <= MAX_HEADER_SIZE) {
+				// the packet is in error
+        extern INDEX net_bReportMiscErrors;          
+        if (net_bReportMiscErrors) {
+				  CPrintF(TRANS("WARNING: Bad UDP packet from '%s'\n"), AddressToString(adrIncomingAddress.adr_ulAddress));
+        }
+			} else if (net_fDropPackets <= 0  || (FLOAT(rand())/RAND_MAX) > net_fDropPackets) {
+				// if no packet drop emulation (or the packet is not dropped), form the packet 
+				// and add it to the end of the UDP Master's input buffer
+				ppaNewPacket->WriteToPacketRaw(ppaNewPacket->pa_pubPacketData,slSizeReceived);
+				ppaNewPacket->pa_adrAddress.adr_ulAddress = adrIncomingAddress.adr_ulAddress;
+				ppaNewPacket->pa_adrAddress.adr_uwPort = adrIncomingAddress.adr_uwPort;						
+
+				if (net_bReportPackets == TRUE) {
+					CPrintF("%lu: Received sequence: %d from ID: %d, reliable flag: %d\n",(ULONG) tvNow.GetMilliseconds(),ppaNewPacket->pa_ulSequence,ppaNewPacket->pa_adrAddress.adr_uwID,ppaNewPacket->pa_ubReliable);
 				}
-			}	
 
-		} while (bSomethingDone);
+				cci_pbMasterInput.AppendPacket(*ppaNewPacket,FALSE);
+				ppaNewPacket = NULL;
+				_ssRecv.ss_ctPackets++;
+				_ssRecv.ss_ctBytes += slSizeReceived;
+			}
+		}
+
+		if (ppaNewPacket != NULL) {
+			delete ppaNewPacket;
+		}
 	}
 
+	// all packets written in this pass get the same time
+	tvNow = _pTimer->GetHighPrecisionTimer();
+	sa.sin_family = AF_INET;
+
 	// write from the output buffer to the socket
 	while (cci_pbMasterOutput.pb_ulNumOfPackets > 0) {
 		ppaNewPacket = cci_pbMasterOutput.PeekFirstPacket();
 
-		sa.sin_family = AF_INET;
     sa.sin_addr.s_addr = htonl(ppaNewPacket->pa_adrAddress.adr_ulAddress);
     sa.sin_port = htons(ppaNewPacket->pa_adrAddress.adr_uwPort);
 		
     slSizeSent = sendto(cci_hSocket, (char*) ppaNewPacket->pa_pubPacketData, (int) ppaNewPacket->pa_slSize, 0, (SOCKADDR *)&sa, sizeof(sa));
     cci_bBound = TRUE;   // UDP socket that did a send is considered bound
-		tvNow = _pTimer->GetHighPrecisionTimer();
+		_ssSend.ss_ctCalls++;
 
     // if some error
     if (slSizeSent == SOCKET_ERROR) {
@@ -1269,15 +1354,114 @@ void CCommunicationInterface::UpdateMasterBuffers()
 				CPrintF("%lu: Sent sequence: %d to ID: %d, reliable flag: %d\n",(ULONG)tvNow.GetMilliseconds(),ppaNewPacket->pa_ulSequence,ppaNewPacket->pa_adrAddress.adr_uwID,ppaNewPacket->pa_ubReliable);
 			}
 
+			_ssSend.ss_ctPackets++;
+			_ssSend.ss_ctBytes += slSizeSent;
 			cci_pbMasterOutput.RemoveFirstPacket(TRUE);
-      bSomethingDone=TRUE;
     }
 
 	}
 
+};
 
 
 
-};
 
+// send given number of datagrams to the server socket from another loopback socket, then do
+// master buffer updates until they are all read, and report socket counters of the updates
+void FloodServerSocket(INDEX ctDatagrams)
+{
+  if (!_cmiComm.cci_bServerInitialized || !_cmiComm.cci_bSocketOpen) {
+    CPrintF(TRANS("Flood test needs a running server with network enabled.\n"));
+    return;
+  }
+  ctDatagrams = Clamp(ctDatagrams, INDEX(1), INDEX(1000000));
+  const INDEX ctDatagramSize = 512;
+
+  CTSingleLock slNetwork(&_pNetwork->ga_csNetwork, TRUE);
+  CTSingleLock slComm(&cm_csComm, TRUE);
+
+  // open a socket for flooding on loopback
+  ULONG ulServerHost, ulServerPort;
+  SOCKET hFlood = INVALID_SOCKET;
+  sockaddr_in sin;
+  int iSize = sizeof(sin);
+  try {
+    _cmiComm.GetLocalAddress_t(ulServerHost, ulServerPort);
+    hFlood = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (hFlood==INVALID_SOCKET) {
+      ThrowF_t(TRANS("Cannot open socket. %s"), (const char*)_cmiComm.GetSocketError(WSAGetLastError()));
+    }
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    sin.sin_port = 0;
+    if (bind(hFlood, (sockaddr*)&sin, sizeof(sin))==SOCKET_ERROR
+      ||getsockname(hFlood, (sockaddr*)&sin, &iSize)==SOCKET_ERROR) {
+      ThrowF_t(TRANS("Cannot bind socket. %s"), (const char*)_cmiComm.GetSocketError(WSAGetLastError()));
+    }
+  } catch (char *strError) {
+    if (hFlood!=INVALID_SOCKET) {
+      closesocket(hFlood);
+    }
+    CPrintF(TRANS("Flood test failed: %s\n"), strError);
+    return;
+  }
+  const UWORD uwFloodPort = ntohs(sin.sin_port);
+
+  // send all datagrams at once, those that don't fit in socket buffer are dropped
+  UBYTE aubDatagram[ctDatagramSize];
+  memset(aubDatagram, 0, sizeof(aubDatagram));
+  sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  sin.sin_port = htons(UWORD(ulServerPort));
+  INDEX ctSent = 0;
+  for (INDEX iDatagram=0; iDatagram<ctDatagrams; iDatagram++) {
+    if (sendto(hFlood, (const char*)aubDatagram, sizeof(aubDatagram), 0, (sockaddr*)&sin, sizeof(sin))!=SOCKET_ERROR) {
+      ctSent++;
+    }
+  }
 
+  // read them back in as many updates as needed
+  INDEX ctUpdates = 0;
+  INDEX ctReceived = 0;
+  CSocketStats ssFirst, ssLast;
+  ssFirst.Clear();
+  ssLast.Clear();
+  DOUBLE dFirstUpdate = 0.0, dLongestUpdate = 0.0, dAllUpdates = 0.0;
+  for (;;) {
+    const CTimerValue tvStart = _pTimer->GetHighPrecisionTimer();
+    _cmiComm.UpdateMasterBuffers();
+    const DOUBLE dUpdate = (_pTimer->GetHighPrecisionTimer()-tvStart).GetSeconds();
+
+    // take the flood datagrams out, so that the server doesn't see them
+    INDEX ctFlood = 0;
+    {FORDELETELIST(CPacket, pa_lnListNode, _cmiComm.cci_pbMasterInput.pb_lhPacketStorage, itpa) {
+      CPacket &pa = *itpa;
+      if (pa.pa_adrAddress.adr_ulAddress==INADDR_LOOPBACK && pa.pa_adrAddress.adr_uwPort==uwFloodPort) {
+        _cmiComm.cci_pbMasterInput.UnlinkPacket(pa);
+        delete &pa;
+        ctFlood++;
+      }
+    }}
+    if (ctFlood==0) {
+      break;
+    }
+    if (ctUpdates==0) {
+      ssFirst = _ssRecv;
+      dFirstUpdate = dUpdate;
+    }
+    ssLast = _ssRecv;
+    ctUpdates++;
+    ctReceived += ctFlood;
+    dLongestUpdate = Max(dLongestUpdate, dUpdate);
+    dAllUpdates += dUpdate;
+  }
+  closesocket(hFlood);
+
+  CPrintF(TRANS("Flooded server socket with %d datagrams of %d bytes, %d sent, %d received\n"),
+    ctDatagrams, ctDatagramSize, ctSent, ctReceived);
+  CPrintF(TRANS("  %d updates with net_iMaxDatagramsPerUpdate=%d, %.3fms in all, longest %.3fms\n"),
+    ctUpdates, net_iMaxDatagramsPerUpdate, dAllUpdates*1000.0, dLongestUpdate*1000.0);
+  CPrintF(TRANS("  first update: net_ctRecvCalls=%d net_ctRecvPackets=%d net_ctRecvBytes=%d, %.3fms\n"),
+    ssFirst.ss_ctCalls, ssFirst.ss_ctPackets, ssFirst.ss_ctBytes, dFirstUpdate*1000.0);
+  CPrintF(TRANS("  last update: net_ctRecvCalls=%d net_ctRecvPackets=%d net_ctRecvBytes=%d\n"),
+    ssLast.ss_ctCalls, ssLast.ss_ctPackets, ssLast.ss_ctBytes);
+}
@@ -21,7 +21,9 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 
 
-#define SERVER_CLIENTS 16
+// max number of client slots on a server (client index is kept in low bits of client ID)
+#define SERVER_CLIENTBITS 7
+#define SERVER_CLIENTS (1<<SERVER_CLIENTBITS)
 
 #include <Engine/Network/CPacket.h>
 
@@ -69,10 +71,14 @@ public:
   void Bind_t(ULONG ulLocalHost, ULONG ulLocalPort);
   // set socket to non-blocking mode
   void SetNonBlocking_t(void);
+  // enlarge socket buffers, so that all traffic between two updates can be queued
+  void SetBufferSizes(void);
   // get generic socket error info string and last error
   CTString GetSocketError(INDEX iError);
 	// open an UDP socket at given port 
   void OpenSocket_t(ULONG ulLocalHost, ULONG ulLocalPort);
+  // wait until there is data to read on the socket, or the timeout passes (returns TRUE if data arrived)
+  BOOL WaitForData(TIME tmTimeout);
 
 	// get address of this host
   void GetLocalAddress_t(ULONG &ulHost, ULONG &ulPort);
@@ -92,6 +98,7 @@ public:
   void Server_ClearClient(INDEX iClient);
   BOOL Server_IsClientLocal(INDEX iClient);
   BOOL Server_IsClientUsed(INDEX iClient);
+  BOOL Server_IsReliableQueued(INDEX iClient);
   CTString Server_GetClientName(INDEX iClient);
 
   void Server_Send_Reliable(INDEX iClient, const void *pvSend, SLONG slSendSize);
@@ -122,5 +129,7 @@ public:
 extern ENGINE_API CCommunicationInterface _cmiComm;
 extern CPacketBufferStats _pbsSend;
 extern CPacketBufferStats _pbsRecv;
+extern CSocketStats _ssSend;
+extern CSocketStats _ssRecv;
 
 #endif  /* include-once check. */
@@ -458,3 +458,258 @@ int ZEXPORT uncompress (dest, destLen, source, sourceLen)
     return FALSE;
   }
 }
+
+/////////////////////////////////////////////////////////////////////
+// Dictionary compressor
+
+/*
+Packed format is a sequence of byte-aligned sections, each made of:
+  TOKEN [LITERAL LENGTH...] LITERALS OFFSET(UWORD) [MATCH LENGTH...]
+High 4 bits of token hold the count of literals that are copied as-is, low 4 bits
+the length of a match that follows them, minus DICT_MINMATCH. If either value is 15,
+bytes that follow add to it, as long as they are 255. Match is copied from given
+offset back in the output, where the dictionary is considered to lie just before
+the start of the output, so small messages can match against typical contents
+even though they have no history of their own. The last section has only literals,
+and it ends the data.
+No entropy coding is done, so this is much faster than zlib on small network
+messages, where zlib doesn't get much out of them anyway.
+*/
+
+#define DICT_MINMATCH  4
+#define DICT_MAXOFFSET 65535
+#define DICT_WORKSIZE  8192   // packing small messages doesn't allocate memory
+
+static inline INDEX DictHash(ULONG ulSequence)
+{
+  return ULONG(ulSequence*2654435761U)>>(32-DICT_HASHBITS);
+}
+
+CCompressionDictionary::CCompressionDictionary(void)
+{
+  cd_pubData = NULL;
+  cd_slSize = 0;
+  for (INDEX i=0; i<(1<<DICT_HASHBITS); i++) {
+    cd_aslHash[i] = -1;
+  }
+}
+CCompressionDictionary::~CCompressionDictionary(void)
+{
+  Clear();
+}
+void CCompressionDictionary::Clear(void)
+{
+  if (cd_pubData!=NULL) {
+    FreeMemory(cd_pubData);
+    cd_pubData = NULL;
+  }
+  cd_slSize = 0;
+  for (INDEX i=0; i<(1<<DICT_HASHBITS); i++) {
+    cd_aslHash[i] = -1;
+  }
+}
+
+/* Set dictionary contents (only the last 64k are used). */
+void CCompressionDictionary::Set(const void *pvData, SLONG slSize)
+{
+  Clear();
+  // older data couldn't be reached with a match anyway
+  if (slSize>DICT_MAXOFFSET) {
+    pvData = (const UBYTE*)pvData+slSize-DICT_MAXOFFSET;
+    slSize = DICT_MAXOFFSET;
+  }
+  if (slSize<=0) {
+    return;
+  }
+  cd_pubData = (UBYTE*)AllocMemory(slSize);
+  memcpy(cd_pubData, pvData, slSize);
+  cd_slSize = slSize;
+  // hash all its positions, so that packing can start from there
+  for (SLONG sl=0; sl+DICT_MINMATCH<=slSize; sl++) {
+    cd_aslHash[DictHash(*(ULONG*)(cd_pubData+sl))] = sl;
+  }
+}
+
+CDictCompressor::CDictCompressor(CCompressionDictionary *pcdDictionary)
+{
+  dc_pcdDictionary = pcdDictionary;
+}
+
+/* Calculate needed size for destination buffer when packing memory. */
+SLONG CDictCompressor::NeededDestinationSize(SLONG slSourceSize)
+{
+  // worst case is all literals, with a length byte for each 255 of them
+  return slSourceSize+slSourceSize/255+16;
+}
+
+// write extra length bytes for a token field
+static inline UBYTE *WriteDictLength(UBYTE *pub, SLONG slLength)
+{
+  while (slLength>=255) {
+    *pub++ = 255;
+    slLength -= 255;
+  }
+  *pub++ = UBYTE(slLength);
+  return pub;
+}
+
+// read extra length bytes of a token field
+static inline BOOL ReadDictLength(const UBYTE *&pub, const UBYTE *pubEnd, SLONG &slLength)
+{
+  for (;;) {
+    if (pub>=pubEnd) {
+      return FALSE;
+    }
+    const UBYTE ub = *pub++;
+    slLength += ub;
+    if (ub!=255) {
+      return TRUE;
+    }
+  }
+}
+
+// write one section, without the match if slMatch is 0
+static UBYTE *WriteDictSection(UBYTE *pubOut, const UBYTE *pubLiterals, SLONG slLiterals, SLONG slOffset, SLONG slMatch)
+{
+  const SLONG slMatchCode = slMatch>0 ? slMatch-DICT_MINMATCH : 0;
+  UBYTE *pubToken = pubOut++;
+  *pubToken = UBYTE((Min(slLiterals, SLONG(15))<<4) | Min(slMatchCode, SLONG(15)));
+  if (slLiterals>=15) {
+    pubOut = WriteDictLength(pubOut, slLiterals-15);
+  }
+  memcpy(pubOut, pubLiterals, slLiterals);
+  pubOut += slLiterals;
+  if (slMatch>0) {
+    *pubOut++ = UBYTE(slOffset);
+    *pubOut++ = UBYTE(slOffset>>8);
+    if (slMatchCode>=15) {
+      pubOut = WriteDictLength(pubOut, slMatchCode-15);
+    }
+  }
+  return pubOut;
+}
+
+// on entry, slDstSize holds maximum size of output buffer,
+// on exit, it is filled with resulting size
+/* Pack a chunk of data using given compression. */
+BOOL CDictCompressor::Pack(const void *pvSrc, SLONG slSrcSize, void *pvDst, SLONG &slDstSize)
+{
+  if (slDstSize<NeededDestinationSize(slSrcSize)) {
+    return FALSE;
+  }
+  const SLONG slDict = dc_pcdDictionary!=NULL ? dc_pcdDictionary->cd_slSize : 0;
+
+  // put the data just after the dictionary, so both can be matched in the same way
+  UBYTE aubWork[DICT_WORKSIZE];
+  UBYTE *pubWork = aubWork;
+  if (slDict+slSrcSize>DICT_WORKSIZE) {
+    pubWork = (UBYTE*)AllocMemory(slDict+slSrcSize);
+  }
+  SLONG aslHash[1<<DICT_HASHBITS];
+  if (slDict>0) {
+    memcpy(pubWork, dc_pcdDictionary->cd_pubData, slDict);
+    memcpy(aslHash, dc_pcdDictionary->cd_aslHash, sizeof(aslHash));
+  } else {
+    for (INDEX i=0; i<(1<<DICT_HASHBITS); i++) {
+      aslHash[i] = -1;
+    }
+  }
+  memcpy(pubWork+slDict, pvSrc, slSrcSize);
+
+  UBYTE *pubOut = (UBYTE*)pvDst;
+  const SLONG slEnd = slDict+slSrcSize;
+  SLONG slLiterals = slDict;  // start of literals not written yet
+  SLONG slPos = slDict;
+  while (slPos+DICT_MINMATCH<=slEnd) {
+    const ULONG ulSequence = *(ULONG*)(pubWork+slPos);
+    const INDEX iHash = DictHash(ulSequence);
+    const SLONG slCandidate = aslHash[iHash];
+    aslHash[iHash] = slPos;
+    // if no match here
+    if (slCandidate<0 || slPos-slCandidate>DICT_MAXOFFSET
+      || *(ULONG*)(pubWork+slCandidate)!=ulSequence) {
+      slPos++;
+      continue;
+    }
+    // extend the match as far as it goes (it may overlap the current position)
+    SLONG slMatch = DICT_MINMATCH;
+    while (slPos+slMatch<slEnd && pubWork[slCandidate+slMatch]==pubWork[slPos+slMatch]) {
+      slMatch++;
+    }
+    pubOut = WriteDictSection(pubOut, pubWork+slLiterals, slPos-slLiterals, slPos-slCandidate, slMatch);
+    slPos += slMatch;
+    slLiterals = slPos;
+  }
+  // write the rest as literals
+  pubOut = WriteDictSection(pubOut, pubWork+slLiterals, slEnd-slLiterals, 0, 0);
+
+  if (pubWork!=aubWork) {
+    FreeMemory(pubWork);
+  }
+  slDstSize = pubOut-(UBYTE*)pvDst;
+  return TRUE;
+}
+
+// on entry, slDstSize holds maximum size of output buffer,
+// on exit, it is filled with resulting size
+/* Unpack a chunk of data using given compression. */
+BOOL CDictCompressor::Unpack(const void *pvSrc, SLONG slSrcSize, void *pvDst, SLONG &slDstSize)
+{
+  const SLONG slDict = dc_pcdDictionary!=NULL ? dc_pcdDictionary->cd_slSize : 0;
+  const UBYTE *pubDict = slDict>0 ? dc_pcdDictionary->cd_pubData : NULL;
+  const UBYTE *pubIn = (const UBYTE*)pvSrc;
+  const UBYTE *pubInEnd = pubIn+slSrcSize;
+  UBYTE *pubOut0 = (UBYTE*)pvDst;
+  UBYTE *pubOut = pubOut0;
+  UBYTE *pubOutEnd = pubOut0+slDstSize;
+
+  while (pubIn<pubInEnd) {
+    const UBYTE ubToken = *pubIn++;
+    // copy literals
+    SLONG slLiterals = ubToken>>4;
+    if (slLiterals==15 && !ReadDictLength(pubIn, pubInEnd, slLiterals)) {
+      return FALSE;
+    }
+    if (slLiterals>pubInEnd-pubIn || slLiterals>pubOutEnd-pubOut) {
+      return FALSE;
+    }
+    memcpy(pubOut, pubIn, slLiterals);
+    pubIn += slLiterals;
+    pubOut += slLiterals;
+    // last section has no match
+    if (pubIn>=pubInEnd) {
+      break;
+    }
+
+    // copy the match
+    if (pubInEnd-pubIn<2) {
+      return FALSE;
+    }
+    const SLONG slOffset = pubIn[0] | (SLONG(pubIn[1])<<8);
+    pubIn += 2;
+    SLONG slMatch = ubToken&15;
+    if (slMatch==15 && !ReadDictLength(pubIn, pubInEnd, slMatch)) {
+      return FALSE;
+    }
+    slMatch += DICT_MINMATCH;
+    if (slOffset==0 || slOffset>(pubOut-pubOut0)+slDict || slMatch>pubOutEnd-pubOut) {
+      return FALSE;
+    }
+    // part of the match that is in the dictionary
+    SLONG slFrom = (pubOut-pubOut0)-slOffset;
+    while (slFrom<0 && slMatch>0) {
+      *pubOut++ = pubDict[slDict+slFrom];
+      slFrom++;
+      slMatch--;
+    }
+    // part in the output, byte by byte as it may overlap
+    const UBYTE *pubFrom = pubOut0+slFrom;
+    while (slMatch>0) {
+      *pubOut++ = *pubFrom++;
+      slMatch--;
+    }
+  }
+
+  slDstSize = pubOut-pubOut0;
+  return TRUE;
+}
@@ -91,5 +91,44 @@ public:
 };
 
 
+/*
+ * Preset dictionary for CDictCompressor, used as match history before the data.
+ * Both sides must use the same dictionary contents.
+ */
+#define DICT_HASHBITS 10
+class CCompressionDictionary {
+public:
+  UBYTE *cd_pubData;
+  SLONG cd_slSize;
+  SLONG cd_aslHash[1<<DICT_HASHBITS];  // last dictionary position for each hash (-1 if none)
+
+  CCompressionDictionary(void);
+  ~CCompressionDictionary(void);
+  void Clear(void);
+  /* Set dictionary contents (only the last 64k are used). */
+  void Set(const void *pvData, SLONG slSize);
+  BOOL IsSet(void) { return cd_pubData!=NULL; };
+};
+
+/*
+ * Compressor for compressing memory blocks using fast byte-aligned LZ compression
+ * with an optional preset dictionary (similar to LZ4)
+ */
+class CDictCompressor : public CCompressor {
+public:
+  CCompressionDictionary *dc_pcdDictionary;   // NULL if no dictionary
+
+  CDictCompressor(CCompressionDictionary *pcdDictionary=NULL);
+  /* Calculate needed size for destination buffer when packing memory. */
+  SLONG NeededDestinationSize(SLONG slSourceSize);
+
+  // on entry, slDstSize holds maximum size of output buffer,
+  // on exit, it is filled with resulting size
+  /* Pack a chunk of data using given compression. */
+  BOOL   Pack(const void *pvSrc, SLONG slSrcSize, void *pvDst, SLONG &slDstSize);
+  /* Unpack a chunk of data using given compression. */
+  BOOL Unpack(const void *pvSrc, SLONG slSrcSize, void *pvDst, SLONG &slDstSize);
+};
+
 #endif  /* include-once check. */
 
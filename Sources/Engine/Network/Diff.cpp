@@ -19,66 +19,146 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <Engine/Base/Timer.h>
 #include <Engine/Base/Console.h>
 #include <Engine/Base/CRC.h>
+#include <Engine/Base/Synchronization.h>
 #include <Engine/Math/Functions.h>
+#include <Engine/Network/Compression.h>
 #include <Engine/Network/Diff.h>
+#include <Engine/Network/Network.h>
+#include <Engine/Network/SessionState.h>
 
+#include <Engine/Templates/StaticArray.cpp>
 #include <Engine/Templates/StaticStackArray.cpp>
 
 #define DIFF_OLD  0   // copy from old file
 #define DIFF_NEW  1   // copy from new file
 #define DIFF_XOR  2   // xor between an old block and a new block
 
-UBYTE *_pubOld = NULL;
-SLONG _slSizeOld = 0;
-UBYTE *_pubNew = NULL;
-SLONG _slSizeNew = 0;
-ULONG _ulCRC;
+struct EntityBlockInfo {
+  ULONG ebi_ulID;
+  SLONG ebi_slOffset;
+  SLONG ebi_slSize;
+};
+
+// state of one diff or undiff, kept together so that it can run on any thread
+class CDiffContext {
+public:
+  UBYTE *dc_pubOld;
+  SLONG dc_slSizeOld;
+  UBYTE *dc_pubNew;       // diff file when undiffing
+  SLONG dc_slSizeNew;
+  ULONG dc_ulCRC;
+  CTStream *dc_pstrmOut;
+  BOOL dc_bByEntities;    // set to make diffs the old way, by matching whole entities only (for benchmarking)
+
+  CStaticStackArray<EntityBlockInfo> dc_aebiOld;
+  CStaticStackArray<EntityBlockInfo> dc_aebiNew;
+  // hash table of offsets of blocks in old file, by hash of their contents (-1 for empty)
+  CStaticArray<SLONG> dc_aslOldBlocks;
+  ULONG dc_ulOldBlocksMask;
+  // DIFF_HASHMUL^DIFF_BLOCK, for removing bytes from rolling hash
+  ULONG dc_ulHashOut;
+  // hash table of indices in dc_aebiOld, by entity id (-1 for empty)
+  CStaticArray<INDEX> dc_aiOldEntities;
+  ULONG dc_ulOldEntitiesMask;
+  // copy from old file that is not emitted yet, so that it can be joined with next one
+  SLONG dc_slPendingOldOffset;
+  SLONG dc_slPendingOldSize;
+
+  CDiffContext(void);
+  ~CDiffContext(void);
+  void Clear(void);
+
+  void EmitOld_t(SLONG slOffsetOld, SLONG slSizeOld);
+  void EmitNew_t(SLONG slOffsetNew, SLONG slSizeNew);
+  void EmitXor_t(SLONG slOffsetOld, SLONG slSizeOld, SLONG slOffsetNew, SLONG slSizeNew);
+  void FlushOld_t(void);
+  void CopyOld_t(SLONG slOffsetOld, SLONG slSizeOld);
+  void CopyNew_t(SLONG slOffsetNew, SLONG slSizeNew);
+  void CopyXor_t(SLONG slOffsetOld, SLONG slSizeOld, SLONG slOffsetNew, SLONG slSizeNew);
+  void IndexOldBlocks(void);
+  void IndexOldEntities(void);
+  INDEX FindOldEntity(ULONG ulID);
+  void DiffSameSize_t(SLONG slOffsetOld, SLONG slOffsetNew, SLONG slSize);
+  void DiffByBlocks_t(SLONG slOffsetNew, SLONG slSizeNew);
+  void DiffRegion_t(SLONG slOffsetOld, SLONG slSizeOld, SLONG slOffsetNew, SLONG slSizeNew);
+  void MakeDiffByEntities_t(void);
+  void MakeDiff_t(void);
+  void ApplyDiff_t(void);
+
+  // make a difference file from two saved games
+  void Diff_t(CTStream *pstrmOld, CTStream *pstrmNew, CTStream *pstrmDiff);
+  // make a new saved game from difference file and old saved game
+  void Undiff_t(CTStream *pstrmOld, CTStream *pstrmDiff, CTStream *pstrmNew);
+};
+
+CDiffContext::CDiffContext(void)
+{
+  dc_pubOld = NULL;
+  dc_slSizeOld = 0;
+  dc_pubNew = NULL;
+  dc_slSizeNew = 0;
+  dc_ulCRC = 0;
+  dc_pstrmOut = NULL;
+  dc_bByEntities = FALSE;
+  dc_ulOldBlocksMask = 0;
+  dc_ulHashOut = 0;
+  dc_ulOldEntitiesMask = 0;
+  dc_slPendingOldOffset = 0;
+  dc_slPendingOldSize = 0;
+}
 
-CTStream *_pstrmOut;
+CDiffContext::~CDiffContext(void)
+{
+  Clear();
+}
+
+void CDiffContext::Clear(void)
+{
+  if (dc_pubOld!=NULL) {
+    FreeMemory(dc_pubOld);
+  }
+
+  if (dc_pubNew!=NULL) {
+    FreeMemory(dc_pubNew);
+  }
+  dc_pubOld = NULL;
+  dc_pubNew = NULL;
+}
 
 // emit one block copied from old file
-void EmitOld_t(SLONG slOffsetOld, SLONG slSizeOld)
+void CDiffContext::EmitOld_t(SLONG slOffsetOld, SLONG slSizeOld)
 {
-  (*_pstrmOut)<<UBYTE(DIFF_OLD);
-  (*_pstrmOut)<<slOffsetOld;
-  (*_pstrmOut)<<slSizeOld;
+  (*dc_pstrmOut)<<UBYTE(DIFF_OLD);
+  (*dc_pstrmOut)<<slOffsetOld;
+  (*dc_pstrmOut)<<slSizeOld;
 }
 // emit one block copied from new file
-void EmitNew_t(SLONG slOffsetNew, SLONG slSizeNew)
+void CDiffContext::EmitNew_t(SLONG slOffsetNew, SLONG slSizeNew)
 {
-  (*_pstrmOut)<<UBYTE(DIFF_NEW);
-  (*_pstrmOut)<<slSizeNew;
-  (*_pstrmOut).Write_t(_pubNew+slOffsetNew, slSizeNew);
+  (*dc_pstrmOut)<<UBYTE(DIFF_NEW);
+  (*dc_pstrmOut)<<slSizeNew;
+  (*dc_pstrmOut).Write_t(dc_pubNew+slOffsetNew, slSizeNew);
 }
 
 // emit one block xor-ed between new and old file
-void EmitXor_t(SLONG slOffsetOld, SLONG slSizeOld, SLONG slOffsetNew, SLONG slSizeNew)
+void CDiffContext::EmitXor_t(SLONG slOffsetOld, SLONG slSizeOld, SLONG slOffsetNew, SLONG slSizeNew)
 {
   // xor it
   SLONG slSizeXor = Min(slSizeOld, slSizeNew);
-  UBYTE *pub0 = _pubOld+slOffsetOld;
-  UBYTE *pub1 = _pubNew+slOffsetNew;
+  UBYTE *pub0 = dc_pubOld+slOffsetOld;
+  UBYTE *pub1 = dc_pubNew+slOffsetNew;
   for (INDEX i=0; i<slSizeXor; i++) {
     *pub1++ ^= *pub0++;
   }
 
   // emit it
-  (*_pstrmOut)<<UBYTE(DIFF_XOR);
-  (*_pstrmOut)<<slOffsetOld;
-  (*_pstrmOut)<<slSizeOld;
-  (*_pstrmOut)<<slSizeNew;
-  (*_pstrmOut).Write_t(_pubNew+slOffsetNew, slSizeNew);
+  (*dc_pstrmOut)<<UBYTE(DIFF_XOR);
+  (*dc_pstrmOut)<<slOffsetOld;
+  (*dc_pstrmOut)<<slSizeOld;
+  (*dc_pstrmOut)<<slSizeNew;
+  (*dc_pstrmOut).Write_t(dc_pubNew+slOffsetNew, slSizeNew);
 }
 
-struct EntityBlockInfo {
-  ULONG ebi_ulID;
-  SLONG ebi_slOffset;
-  SLONG ebi_slSize;
-};
-
-CStaticStackArray<EntityBlockInfo> _aebiOld;
-CStaticStackArray<EntityBlockInfo> _aebiNew;
-
 // make array of entity offsets in a block
 void MakeInfos(CStaticStackArray<EntityBlockInfo> &aebi, 
                UBYTE *pubBlock, SLONG slSize, UBYTE *pubFirst, UBYTE *&pubEnd)
@@ -134,89 +214,347 @@ UBYTE *FindFirstEntity(UBYTE *pubBlock, SLONG slSize)
   return NULL;
 }
 
-void MakeDiff_t(void)
+// size of blocks that old file is indexed by, and minimal length of a match
+#define DIFF_BLOCK 32
+// minimal run of same bytes worth splitting a xor block for
+#define DIFF_MINRUN 64
+// multiplier for rolling hash
+#define DIFF_HASHMUL 0x01000193UL
+
+static ULONG BlockHash(const UBYTE *pub)
 {
-  // write header with size of files
-  (*_pstrmOut).WriteID_t("DIFF");
-  (*_pstrmOut)<<_slSizeOld<<_slSizeNew<<_ulCRC;
+  ULONG ulHash = 0;
+  for (INDEX i=0; i<DIFF_BLOCK; i++) {
+    ulHash = ulHash*DIFF_HASHMUL+pub[i];
+  }
+  return ulHash;
+}
+
+static ULONG IDHash(ULONG ulID)
+{
+  return ulID*0x9E3779B1UL;
+}
+
+// emit pending copy from old file
+void CDiffContext::FlushOld_t(void)
+{
+  if (dc_slPendingOldSize>0) {
+    EmitOld_t(dc_slPendingOldOffset, dc_slPendingOldSize);
+  }
+  dc_slPendingOldSize = 0;
+}
+
+// copy block from old file, joining it with previous one if they are adjacent
+void CDiffContext::CopyOld_t(SLONG slOffsetOld, SLONG slSizeOld)
+{
+  if (slSizeOld<=0) {
+    return;
+  }
+  if (dc_slPendingOldSize>0 && dc_slPendingOldOffset+dc_slPendingOldSize==slOffsetOld) {
+    dc_slPendingOldSize += slSizeOld;
+    return;
+  }
+  FlushOld_t();
+  dc_slPendingOldOffset = slOffsetOld;
+  dc_slPendingOldSize = slSizeOld;
+}
+
+void CDiffContext::CopyNew_t(SLONG slOffsetNew, SLONG slSizeNew)
+{
+  if (slSizeNew<=0) {
+    return;
+  }
+  FlushOld_t();
+  EmitNew_t(slOffsetNew, slSizeNew);
+}
+
+void CDiffContext::CopyXor_t(SLONG slOffsetOld, SLONG slSizeOld, SLONG slOffsetNew, SLONG slSizeNew)
+{
+  FlushOld_t();
+  EmitXor_t(slOffsetOld, slSizeOld, slOffsetNew, slSizeNew);
+}
+
+// index blocks of old file by their contents
+void CDiffContext::IndexOldBlocks(void)
+{
+  const INDEX ctBlocks = dc_slSizeOld/DIFF_BLOCK;
+  INDEX ctSlots = 1024;
+  while (ctSlots<ctBlocks*2) {
+    ctSlots*=2;
+  }
+  dc_aslOldBlocks.Clear();
+  dc_aslOldBlocks.New(ctSlots);
+  dc_ulOldBlocksMask = ctSlots-1;
+  for (INDEX iSlot=0; iSlot<ctSlots; iSlot++) {
+    dc_aslOldBlocks[iSlot] = -1;
+  }
+  // first block with same hash wins
+  for (INDEX iBlock=0; iBlock<ctBlocks; iBlock++) {
+    ULONG ulSlot = BlockHash(dc_pubOld+iBlock*DIFF_BLOCK)&dc_ulOldBlocksMask;
+    if (dc_aslOldBlocks[ulSlot]<0) {
+      dc_aslOldBlocks[ulSlot] = iBlock*DIFF_BLOCK;
+    }
+  }
+
+  dc_ulHashOut = 1;
+  for (INDEX i=0; i<DIFF_BLOCK; i++) {
+    dc_ulHashOut *= DIFF_HASHMUL;
+  }
+}
+
+// index old entities by their ids
+void CDiffContext::IndexOldEntities(void)
+{
+  INDEX ctSlots = 256;
+  while (ctSlots<dc_aebiOld.Count()*2) {
+    ctSlots*=2;
+  }
+  dc_aiOldEntities.Clear();
+  dc_aiOldEntities.New(ctSlots);
+  dc_ulOldEntitiesMask = ctSlots-1;
+  for (INDEX iSlot=0; iSlot<ctSlots; iSlot++) {
+    dc_aiOldEntities[iSlot] = -1;
+  }
+  for (INDEX iebi=0; iebi<dc_aebiOld.Count(); iebi++) {
+    ULONG ulSlot = IDHash(dc_aebiOld[iebi].ebi_ulID)&dc_ulOldEntitiesMask;
+    while (dc_aiOldEntities[ulSlot]>=0) {
+      // keep the first one with same id
+      if (dc_aebiOld[dc_aiOldEntities[ulSlot]].ebi_ulID==dc_aebiOld[iebi].ebi_ulID) {
+        break;
+      }
+      ulSlot = (ulSlot+1)&dc_ulOldEntitiesMask;
+    }
+    if (dc_aiOldEntities[ulSlot]<0) {
+      dc_aiOldEntities[ulSlot] = iebi;
+    }
+  }
+}
+
+// find old entity with given id (-1 if none)
+INDEX CDiffContext::FindOldEntity(ULONG ulID)
+{
+  ULONG ulSlot = IDHash(ulID)&dc_ulOldEntitiesMask;
+  while (dc_aiOldEntities[ulSlot]>=0) {
+    if (dc_aebiOld[dc_aiOldEntities[ulSlot]].ebi_ulID==ulID) {
+      return dc_aiOldEntities[ulSlot];
+    }
+    ulSlot = (ulSlot+1)&dc_ulOldEntitiesMask;
+  }
+  return -1;
+}
+
+// diff two regions of same size, using copies for long runs of same bytes and xor for the rest
+void CDiffContext::DiffSameSize_t(SLONG slOffsetOld, SLONG slOffsetNew, SLONG slSize)
+{
+  const UBYTE *pubOld = dc_pubOld+slOffsetOld;
+  const UBYTE *pubNew = dc_pubNew+slOffsetNew;
+  SLONG slXorStart = 0;   // start of bytes not emitted yet
+  SLONG sl = 0;
+  while (sl<slSize) {
+    // skip different bytes
+    if (pubOld[sl]!=pubNew[sl]) {
+      sl++;
+      continue;
+    }
+    // measure run of same bytes
+    SLONG slRun = 1;
+    while (sl+slRun<slSize && pubOld[sl+slRun]==pubNew[sl+slRun]) {
+      slRun++;
+    }
+    // if long enough
+    if (slRun>=DIFF_MINRUN || (sl+slRun==slSize && slXorStart==sl)) {
+      // emit what is before it as xor, and the run as copy
+      if (sl>slXorStart) {
+        CopyXor_t(slOffsetOld+slXorStart, sl-slXorStart, slOffsetNew+slXorStart, sl-slXorStart);
+      }
+      CopyOld_t(slOffsetOld+sl, slRun);
+      slXorStart = sl+slRun;
+    }
+    sl += slRun;
+  }
+  // emit the rest as xor
+  if (slSize>slXorStart) {
+    CopyXor_t(slOffsetOld+slXorStart, slSize-slXorStart, slOffsetNew+slXorStart, slSize-slXorStart);
+  }
+}
 
+// diff a region of new file against whole old file, by matching blocks with rolling hash
+void CDiffContext::DiffByBlocks_t(SLONG slOffsetNew, SLONG slSizeNew)
+{
+  const UBYTE *pubNew = dc_pubNew;
+  const SLONG slEnd = slOffsetNew+slSizeNew;
+  SLONG slLiteral = slOffsetNew;  // start of bytes not emitted yet
+  SLONG sl = slOffsetNew;
+  BOOL bHashValid = FALSE;
+  ULONG ulHash = 0;
+
+  while (sl+DIFF_BLOCK<=slEnd) {
+    // get hash of block at current position
+    if (!bHashValid) {
+      ulHash = BlockHash(pubNew+sl);
+      bHashValid = TRUE;
+    }
+    // if some old block has same hash and same contents
+    SLONG slOld = dc_aslOldBlocks[ulHash&dc_ulOldBlocksMask];
+    if (slOld>=0 && memcmp(dc_pubOld+slOld, pubNew+sl, DIFF_BLOCK)==0) {
+      // extend the match back and forth
+      SLONG slStart = sl;
+      while (slStart>slLiteral && slOld>0 && dc_pubOld[slOld-1]==pubNew[slStart-1]) {
+        slStart--;
+        slOld--;
+      }
+      SLONG slMatchEnd = sl+DIFF_BLOCK;
+      SLONG slOldEnd = slOld+(slMatchEnd-slStart);
+      while (slMatchEnd<slEnd && slOldEnd<dc_slSizeOld && dc_pubOld[slOldEnd]==pubNew[slMatchEnd]) {
+        slMatchEnd++;
+        slOldEnd++;
+      }
+      // emit what was before it as is, and the match as copy
+      CopyNew_t(slLiteral, slStart-slLiteral);
+      CopyOld_t(slOld, slMatchEnd-slStart);
+      slLiteral = sl = slMatchEnd;
+      bHashValid = FALSE;
+      continue;
+    }
+    // roll the hash by one byte
+    if (sl+DIFF_BLOCK<slEnd) {
+      ulHash = ulHash*DIFF_HASHMUL+pubNew[sl+DIFF_BLOCK]-dc_ulHashOut*pubNew[sl];
+    }
+    sl++;
+  }
+  // emit the rest as is
+  CopyNew_t(slLiteral, slEnd-slLiteral);
+}
+
+// diff a region of new file, using the old region that it most probably came from
+void CDiffContext::DiffRegion_t(SLONG slOffsetOld, SLONG slSizeOld, SLONG slOffsetNew, SLONG slSizeNew)
+{
+  if (slSizeNew<=0) {
+    return;
+  }
+  if (slSizeOld==slSizeNew) {
+    DiffSameSize_t(slOffsetOld, slOffsetNew, slSizeNew);
+  } else {
+    DiffByBlocks_t(slOffsetNew, slSizeNew);
+  }
+}
+
+// make diff the old way, xor-ing whole entities of same id, for comparison in benchmark
+void CDiffContext::MakeDiffByEntities_t(void)
+{
   // find first entities in blocks
-  UBYTE *pubOldEnts = FindFirstEntity(_pubOld, _slSizeOld);
-  UBYTE *pubNewEnts = FindFirstEntity(_pubNew, _slSizeNew);
+  UBYTE *pubOldEnts = FindFirstEntity(dc_pubOld, dc_slSizeOld);
+  UBYTE *pubNewEnts = FindFirstEntity(dc_pubNew, dc_slSizeNew);
   if (pubOldEnts==NULL || pubNewEnts==NULL) {
     ThrowF_t(TRANS("Invalid stream for Diff!"));
   }
 
   // make arrays of entity offsets
   UBYTE *pubEntEndOld;
-  MakeInfos(_aebiOld, _pubOld, _slSizeOld, pubOldEnts, pubEntEndOld);
+  MakeInfos(dc_aebiOld, dc_pubOld, dc_slSizeOld, pubOldEnts, pubEntEndOld);
   UBYTE *pubEntEndNew;
-  MakeInfos(_aebiNew, _pubNew, _slSizeNew, pubNewEnts, pubEntEndNew);
+  MakeInfos(dc_aebiNew, dc_pubNew, dc_slSizeNew, pubNewEnts, pubEntEndNew);
 
   // emit chunk before entities by xor
-  EmitXor_t(0, pubOldEnts-_pubOld, 0, pubNewEnts-_pubNew);
+  EmitXor_t(0, pubOldEnts-dc_pubOld, 0, pubNewEnts-dc_pubNew);
 
   // for each entity in new
-  for(INDEX ieibNew = 0; ieibNew<_aebiNew.Count(); ieibNew++) {
-    EntityBlockInfo &ebiNew = _aebiNew[ieibNew];
+  for(INDEX ieibNew = 0; ieibNew<dc_aebiNew.Count(); ieibNew++) {
+    EntityBlockInfo &ebiNew = dc_aebiNew[ieibNew];
     // find same in old file
     INDEX ieibOld = -1;
-    for(INDEX i=0; i<_aebiOld.Count(); i++) {
-      if (_aebiOld[i].ebi_ulID==ebiNew.ebi_ulID) {
+    for(INDEX i=0; i<dc_aebiOld.Count(); i++) {
+      if (dc_aebiOld[i].ebi_ulID==ebiNew.ebi_ulID) {
         ieibOld = i;
         break;
       }
     }
-    BOOL bDone = FALSE;
+    // if not found, emit from new
+    if (ieibOld<0) {
+      EmitNew_t(ebiNew.ebi_slOffset, ebiNew.ebi_slSize);
+      continue;
+    }
+    EntityBlockInfo &ebiOld = dc_aebiOld[ieibOld];
+    // if same, emit copy from old, else emit xor
+    if (ebiOld.ebi_slSize==ebiNew.ebi_slSize
+      && memcmp(dc_pubOld+ebiOld.ebi_slOffset, dc_pubNew+ebiNew.ebi_slOffset, ebiNew.ebi_slSize)==0) {
+      EmitOld_t(ebiOld.ebi_slOffset, ebiOld.ebi_slSize);
+    } else {
+      EmitXor_t(
+        ebiOld.ebi_slOffset, ebiOld.ebi_slSize,
+        ebiNew.ebi_slOffset, ebiNew.ebi_slSize);
+    }
+  }
+
+  // emit chunk after entities by xor
+  EmitXor_t(
+    pubEntEndOld-dc_pubOld, dc_pubOld+dc_slSizeOld-pubEntEndOld,
+    pubEntEndNew-dc_pubNew, dc_pubNew+dc_slSizeNew-pubEntEndNew);
+}
+
+void CDiffContext::MakeDiff_t(void)
+{
+  // write header with size of files
+  (*dc_pstrmOut).WriteID_t("DIFF");
+  (*dc_pstrmOut)<<dc_slSizeOld<<dc_slSizeNew<<dc_ulCRC;
+
+  if (dc_bByEntities) {
+    MakeDiffByEntities_t();
+    return;
+  }
+
+  // find first entities in blocks
+  UBYTE *pubOldEnts = FindFirstEntity(dc_pubOld, dc_slSizeOld);
+  UBYTE *pubNewEnts = FindFirstEntity(dc_pubNew, dc_slSizeNew);
+  if (pubOldEnts==NULL || pubNewEnts==NULL) {
+    ThrowF_t(TRANS("Invalid stream for Diff!"));
+  }
 
+  // make arrays of entity offsets
+  UBYTE *pubEntEndOld;
+  MakeInfos(dc_aebiOld, dc_pubOld, dc_slSizeOld, pubOldEnts, pubEntEndOld);
+  UBYTE *pubEntEndNew;
+  MakeInfos(dc_aebiNew, dc_pubNew, dc_slSizeNew, pubNewEnts, pubEntEndNew);
+  IndexOldEntities();
+  IndexOldBlocks();
+  dc_slPendingOldSize = 0;
+
+  // emit chunk before entities
+  DiffRegion_t(0, pubOldEnts-dc_pubOld, 0, pubNewEnts-dc_pubNew);
+
+  // for each entity in new
+  for(INDEX ieibNew = 0; ieibNew<dc_aebiNew.Count(); ieibNew++) {
+    EntityBlockInfo &ebiNew = dc_aebiNew[ieibNew];
+    // find same in old file
+    INDEX ieibOld = FindOldEntity(ebiNew.ebi_ulID);
     // if found
     if (ieibOld>=0) {
-      EntityBlockInfo &ebiOld = _aebiOld[ieibOld];
-
-      // if same
-      if ( ebiOld.ebi_slSize==ebiNew.ebi_slSize) {
-        if (memcmp(_pubOld+ebiOld.ebi_slOffset, 
-        _pubNew+ebiNew.ebi_slOffset, ebiNew.ebi_slSize)==0) {
-          //CPrintF("Same blocks\n");
-          // emit copy from old
-          EmitOld_t(ebiOld.ebi_slOffset, ebiOld.ebi_slSize);
-          bDone = TRUE;
-        } else {
-          //CPrintF("Different blocks\n");
-        }
-      } else {
-        //CPrintF("Different sizes\n");
-      }
-
-      if (!bDone) {
-        // emit xor
-        EmitXor_t(
-          ebiOld.ebi_slOffset, ebiOld.ebi_slSize,
-          ebiNew.ebi_slOffset, ebiNew.ebi_slSize);
-        bDone = TRUE;
-      }
+      EntityBlockInfo &ebiOld = dc_aebiOld[ieibOld];
+      // diff against it
+      DiffRegion_t(ebiOld.ebi_slOffset, ebiOld.ebi_slSize, ebiNew.ebi_slOffset, ebiNew.ebi_slSize);
+    // if not found
     } else {
-      //CPrintF("Not found\n");
-    }
-    if (!bDone) 
-    {
-      // emit from new
-      EmitNew_t(ebiNew.ebi_slOffset, ebiNew.ebi_slSize);
-      bDone = TRUE;
+      // find whatever parts of it are in old file
+      DiffByBlocks_t(ebiNew.ebi_slOffset, ebiNew.ebi_slSize);
     }
   }
 
-  // emit chunk after entities by xor
-  EmitXor_t(
-    pubEntEndOld-_pubOld, _pubOld+_slSizeOld-pubEntEndOld,
-    pubEntEndNew-_pubNew, _pubNew+_slSizeNew-pubEntEndNew);
+  // emit chunk after entities
+  DiffRegion_t(
+    pubEntEndOld-dc_pubOld, dc_pubOld+dc_slSizeOld-pubEntEndOld,
+    pubEntEndNew-dc_pubNew, dc_pubNew+dc_slSizeNew-pubEntEndNew);
+  FlushOld_t();
+
+  // free temporary data
+  dc_aslOldBlocks.Clear();
+  dc_aiOldEntities.Clear();
 }
 
-void UnDiff_t(void)
+void CDiffContext::ApplyDiff_t(void)
 {
   // start at beginning
-  UBYTE *pubOld = _pubOld;
-  UBYTE *pubNew = _pubNew;
+  UBYTE *pubOld = dc_pubOld;
+  UBYTE *pubNew = dc_pubNew;
   SLONG slSizeOldStream = 0;
   SLONG slSizeOutStream = 0;
   // get header with size of files
@@ -228,13 +566,13 @@ void UnDiff_t(void)
   slSizeOutStream = *(SLONG*)pubNew; pubNew+=sizeof(SLONG);
   ULONG ulCRC =  *(ULONG*)pubNew; pubNew+=sizeof(ULONG);
 
-  CRC_Start(_ulCRC);
+  CRC_Start(dc_ulCRC);
 
-  if (slSizeOldStream!=_slSizeOld) {
+  if (slSizeOldStream!=dc_slSizeOld) {
     ThrowF_t(TRANS("Invalid DIFF stream!"));
   }
   // while not end of diff file
-  while (pubNew<_pubNew+_slSizeNew) {
+  while (pubNew<dc_pubNew+dc_slSizeNew) {
     // read block type
     UBYTE ubType = *pubNew++;
     switch(ubType) {
@@ -244,16 +582,16 @@ void UnDiff_t(void)
       SLONG slOffsetOld = *(SLONG*)pubNew;  pubNew+=sizeof(SLONG);
       SLONG slSizeOld = *(SLONG*)pubNew;    pubNew+=sizeof(SLONG);
       // copy it from there
-      (*_pstrmOut).Write_t(_pubOld+slOffsetOld, slSizeOld);
-      CRC_AddBlock(_ulCRC, _pubOld+slOffsetOld, slSizeOld);
+      (*dc_pstrmOut).Write_t(dc_pubOld+slOffsetOld, slSizeOld);
+      CRC_AddBlock(dc_ulCRC, dc_pubOld+slOffsetOld, slSizeOld);
                    } break;
     // if block type is 'copy from new file'
     case DIFF_NEW: {
       // get data size
       SLONG slSizeNew = *(SLONG*)pubNew;    pubNew+=sizeof(SLONG);
       // copy it from there
-      (*_pstrmOut).Write_t(pubNew, slSizeNew);
-      CRC_AddBlock(_ulCRC, pubNew, slSizeNew);
+      (*dc_pstrmOut).Write_t(pubNew, slSizeNew);
+      CRC_AddBlock(dc_ulCRC, pubNew, slSizeNew);
       pubNew+=slSizeNew;
                    } break;
     // if block type is 'xor between an old block and a new block'
@@ -265,15 +603,15 @@ void UnDiff_t(void)
 
       // xor it
       SLONG slSizeXor = Min(slSizeOld, slSizeNew);
-      UBYTE *pub0 = _pubOld+slOffsetOld;
+      UBYTE *pub0 = dc_pubOld+slOffsetOld;
       UBYTE *pub1 = pubNew;
       for (INDEX i=0; i<slSizeXor; i++) {
         *pub1++ ^= *pub0++;
       }
 
       // copy the xor-ed data
-      (*_pstrmOut).Write_t(pubNew, slSizeNew);
-      CRC_AddBlock(_ulCRC, pubNew, slSizeNew);
+      (*dc_pstrmOut).Write_t(pubNew, slSizeNew);
+      CRC_AddBlock(dc_ulCRC, pubNew, slSizeNew);
       pubNew+=slSizeNew;
                    } break;
     default:
@@ -281,83 +619,236 @@ void UnDiff_t(void)
     }
   }
 
-  CRC_Finish(_ulCRC);
-  if (_ulCRC!=ulCRC) {
+  CRC_Finish(dc_ulCRC);
+  if (dc_ulCRC!=ulCRC) {
     ThrowF_t(TRANS("CRC error in DIFF!"));
   }
 }
 
-static void Cleanup(void)
-{
-  if (_pubOld!=NULL) {
-    FreeMemory(_pubOld);
-  }
-
-  if (_pubNew!=NULL) {
-    FreeMemory(_pubNew);
-  }
-  _pubOld = NULL;
-  _pubNew = NULL;
-}
-
 // make a difference file from two saved games
-void DIFF_Diff_t(CTStream *pstrmOld, CTStream *pstrmNew, CTStream *pstrmDiff)
+void CDiffContext::Diff_t(CTStream *pstrmOld, CTStream *pstrmNew, CTStream *pstrmDiff)
 {
   try {
     CTimerValue tv0 = _pTimer->GetHighPrecisionTimer();
 
-    _slSizeOld = pstrmOld->GetStreamSize()-pstrmOld->GetPos_t();
-    _pubOld = (UBYTE*)AllocMemory(_slSizeOld);
-    pstrmOld->Read_t(_pubOld, _slSizeOld);
+    dc_slSizeOld = pstrmOld->GetStreamSize()-pstrmOld->GetPos_t();
+    dc_pubOld = (UBYTE*)AllocMemory(dc_slSizeOld);
+    pstrmOld->Read_t(dc_pubOld, dc_slSizeOld);
 
-    _slSizeNew = pstrmNew->GetStreamSize()-pstrmNew->GetPos_t();
-    _pubNew = (UBYTE*)AllocMemory(_slSizeNew);
-    pstrmNew->Read_t(_pubNew, _slSizeNew);
+    dc_slSizeNew = pstrmNew->GetStreamSize()-pstrmNew->GetPos_t();
+    dc_pubNew = (UBYTE*)AllocMemory(dc_slSizeNew);
+    pstrmNew->Read_t(dc_pubNew, dc_slSizeNew);
 
-    CRC_Start(_ulCRC);
-    CRC_AddBlock(_ulCRC, _pubNew, _slSizeNew);
-    CRC_Finish(_ulCRC);
+    CRC_Start(dc_ulCRC);
+    CRC_AddBlock(dc_ulCRC, dc_pubNew, dc_slSizeNew);
+    CRC_Finish(dc_ulCRC);
 
-    _pstrmOut = pstrmDiff;
+    dc_pstrmOut = pstrmDiff;
 
     MakeDiff_t();
 
     CTimerValue tv1 = _pTimer->GetHighPrecisionTimer();
     //CPrintF("diff encoded in %.2gs\n", (tv1-tv0).GetSeconds());
 
-    Cleanup();
+    Clear();
 
   } catch (char *) {
-    Cleanup();
+    Clear();
     throw;
   }
 }
 
 // make a new saved game from difference file and old saved game
-void DIFF_Undiff_t(CTStream *pstrmOld, CTStream *pstrmDiff, CTStream *pstrmNew)
+void CDiffContext::Undiff_t(CTStream *pstrmOld, CTStream *pstrmDiff, CTStream *pstrmNew)
 {
   try {
     CTimerValue tv0 = _pTimer->GetHighPrecisionTimer();
 
-    _slSizeOld = pstrmOld->GetStreamSize()-pstrmOld->GetPos_t();
-    _pubOld = (UBYTE*)AllocMemory(_slSizeOld);
-    pstrmOld->Read_t(_pubOld, _slSizeOld);
+    dc_slSizeOld = pstrmOld->GetStreamSize()-pstrmOld->GetPos_t();
+    dc_pubOld = (UBYTE*)AllocMemory(dc_slSizeOld);
+    pstrmOld->Read_t(dc_pubOld, dc_slSizeOld);
 
-    _slSizeNew = pstrmDiff->GetStreamSize()-pstrmDiff->GetPos_t();
-    _pubNew = (UBYTE*)AllocMemory(_slSizeNew);
-    pstrmDiff->Read_t(_pubNew, _slSizeNew);
+    dc_slSizeNew = pstrmDiff->GetStreamSize()-pstrmDiff->GetPos_t();
+    dc_pubNew = (UBYTE*)AllocMemory(dc_slSizeNew);
+    pstrmDiff->Read_t(dc_pubNew, dc_slSizeNew);
 
-    _pstrmOut = pstrmNew;
+    dc_pstrmOut = pstrmNew;
 
-    UnDiff_t();
+    ApplyDiff_t();
 
     CTimerValue tv1 = _pTimer->GetHighPrecisionTimer();
     //CPrintF("diff decoded in %.2gs\n", (tv1-tv0).GetSeconds());
 
-    Cleanup();
+    Clear();
 
   } catch (char *) {
-    Cleanup();
+    Clear();
     throw;
   }
 }
+
+// make a difference file from two saved games
+void DIFF_Diff_t(CTStream *pstrmOld, CTStream *pstrmNew, CTStream *pstrmDiff)
+{
+  CDiffContext dc;
+  dc.Diff_t(pstrmOld, pstrmNew, pstrmDiff);
+}
+
+// make a new saved game from difference file and old saved game
+void DIFF_Undiff_t(CTStream *pstrmOld, CTStream *pstrmDiff, CTStream *pstrmNew)
+{
+  CDiffContext dc;
+  dc.Undiff_t(pstrmOld, pstrmDiff, pstrmNew);
+}
+
+#define DIFF_BENCHMARK_PASSES 3
+
+// diff one pair of states the old and the new way, undiff both and check them,
+// and report sizes and times (returns FALSE if any check failed)
+static BOOL BenchmarkDiffPair(const CTString &strName, CTMemoryStream &strmOld, CTMemoryStream &strmNew)
+{
+  const SLONG slSizeNew = strmNew.GetStreamSize();
+  BOOL bAllOK = TRUE;
+  CPrintF("%s: %d -> %d bytes\n", (const char*)strName, strmOld.GetStreamSize(), slSizeNew);
+
+  const char *astrNames[2] = { "by entities", "by blocks" };
+  for (INDEX iMethod=0; iMethod<2; iMethod++) {
+    DOUBLE dDiffSeconds = 1E10, dUndiffSeconds = 1E10;
+    SLONG slDelta = 0, slPacked = 0;
+    BOOL bOK = TRUE;
+    try {
+      for (INDEX iPass=0; iPass<DIFF_BENCHMARK_PASSES; iPass++) {
+        CTMemoryStream strmDelta, strmOut;
+        strmOld.SetPos_t(0);
+        strmNew.SetPos_t(0);
+        CTimerValue tvStart = _pTimer->GetHighPrecisionTimer();
+        CDiffContext dc;
+        dc.dc_bByEntities = iMethod==0;
+        dc.Diff_t(&strmOld, &strmNew, &strmDelta);
+        dDiffSeconds = Min(dDiffSeconds, (_pTimer->GetHighPrecisionTimer()-tvStart).GetSeconds());
+        slDelta = strmDelta.GetStreamSize();
+
+        strmOld.SetPos_t(0);
+        strmDelta.SetPos_t(0);
+        tvStart = _pTimer->GetHighPrecisionTimer();
+        DIFF_Undiff_t(&strmOld, &strmDelta, &strmOut);
+        dUndiffSeconds = Min(dUndiffSeconds, (_pTimer->GetHighPrecisionTimer()-tvStart).GetSeconds());
+
+        // compare the result with the new state
+        UBYTE *pubOut, *pubNew;
+        SLONG slOut, slNew;
+        strmOut.LockBuffer((void**)&pubOut, &slOut);
+        strmNew.LockBuffer((void**)&pubNew, &slNew);
+        if (slOut!=slNew || memcmp(pubOut, pubNew, slNew)!=0) {
+          bOK = FALSE;
+        }
+        strmOut.UnlockBuffer();
+        strmNew.UnlockBuffer();
+
+        // delta is sent packed
+        if (iPass==0) {
+          CTMemoryStream strmPacked;
+          strmDelta.SetPos_t(0);
+          CzlibCompressor comp;
+          comp.PackStream_t(strmDelta, strmPacked);
+          slPacked = strmPacked.GetStreamSize();
+        }
+      }
+    } catch (char *strError) {
+      CPrintF(TRANS("  %-11s FAILED: %s\n"), astrNames[iMethod], strError);
+      bAllOK = FALSE;
+      continue;
+    }
+    CPrintF(TRANS("  %-11s delta %8d bytes (%5.1f%%), zlib %7d bytes, diff %7.2fms, undiff %6.2fms%s\n"),
+      astrNames[iMethod], slDelta, slDelta*100.0/ClampDn(slSizeNew, 1L), slPacked,
+      dDiffSeconds*1000.0, dUndiffSeconds*1000.0, bOK ? "" : TRANS(", MISMATCH"));
+    bAllOK = bAllOK && bOK;
+  }
+  return bAllOK;
+}
+
+// read whole file into a memory stream
+static void ReadFileToStream_t(const CTFileName &fnm, CTMemoryStream &strm)
+{
+  CTFileStream strmFile;
+  strmFile.Open_t(fnm);
+  const SLONG slSize = strmFile.GetStreamSize();
+  UBYTE *pub = (UBYTE*)AllocMemory(ClampDn(slSize, 1L));
+  try {
+    strmFile.Read_t(pub, slSize);
+    strm.Write_t(pub, slSize);
+  } catch (char *) {
+    FreeMemory(pub);
+    throw;
+  }
+  FreeMemory(pub);
+  strm.SetPos_t(0);
+}
+
+// diff saved games matching given pattern against the first one of them in name order,
+// or current state against default state of the running game if no pattern is given,
+// with old and new diff, and check that they undiff to the same bytes
+extern void BenchmarkDiff(const CTString &strPattern)
+{
+  // if no pattern
+  if (strPattern=="") {
+    // use states that a joining client would get
+    if (!_pNetwork->IsServer() || _pNetwork->ga_pubDefaultState==NULL) {
+      CPrintF(TRANS("Start a game as server, or give saved games to diff (e.g. \"SaveGame\\\\Player0\\\\*.sav\").\n"));
+      return;
+    }
+    CTMemoryStream strmOld, strmNew;
+    try {
+      CTSingleLock slNetwork(&_pNetwork->ga_csNetwork, TRUE);
+      strmOld.Write_t(_pNetwork->ga_pubDefaultState, _pNetwork->ga_slDefaultStateSize);
+      _pNetwork->ga_sesSessionState.Write_t(&strmNew);
+    } catch (char *strError) {
+      CPrintF(TRANS("Cannot write session state: %s\n"), strError);
+      return;
+    }
+    BenchmarkDiffPair(TRANS("default state -> current state"), strmOld, strmNew);
+    return;
+  }
+
+  // list the saved games, first one is the base
+  CTFileName fnmPattern = strPattern;
+  CDynamicStackArray<CTFileName> afnmFiles;
+  MakeDirList(afnmFiles, fnmPattern.FileDir(), strPattern, 0);
+  const INDEX ctFiles = afnmFiles.Count();
+  if (ctFiles<2) {
+    CPrintF(TRANS("Need at least two saved games matching '%s'.\n"), (const char*)strPattern);
+    return;
+  }
+  INDEX iBase = 0;
+  {for (INDEX iFile=1; iFile<ctFiles; iFile++) {
+    if (strcmp(afnmFiles[iFile], afnmFiles[iBase])<0) {
+      iBase = iFile;
+    }
+  }}
+
+  INDEX ctFailed = 0;
+  try {
+    CTMemoryStream strmOld;
+    ReadFileToStream_t(afnmFiles[iBase], strmOld);
+    for (INDEX iFile=0; iFile<ctFiles; iFile++) {
+      if (iFile==iBase) {
+        continue;
+      }
+      CTMemoryStream strmNew;
+      ReadFileToStream_t(afnmFiles[iFile], strmNew);
+      CTString strName;
+      strName.PrintF("%s -> %s", (const char*)afnmFiles[iBase].FileName(), (const char*)afnmFiles[iFile].FileName());
+      if (!BenchmarkDiffPair(strName, strmOld, strmNew)) {
+        ctFailed++;
+      }
+    }
+  } catch (char *strError) {
+    CPrintF(TRANS("Cannot read saved game: %s\n"), strError);
+    return;
+  }
+  if (ctFailed>0) {
+    CPrintF(TRANS("%d of %d diffs FAILED\n"), ctFailed, ctFiles-1);
+  } else {
+    CPrintF(TRANS("all %d diffs undiff to the same bytes\n"), ctFiles-1);
+  }
+}
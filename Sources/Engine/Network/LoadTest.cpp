@@ -0,0 +1,628 @@
+/* Copyright (c) 2002-2012 Croteam Ltd.
+This program is free software; you can redistribute it and/or modify
+it under the terms of version 2 of the GNU General Public License as published by
+the Free Software Foundation
+
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA. */
+
+#include "stdh.h"
+
+#include <Engine/Build.h>
+#include <Engine/Network/Network.h>
+#include <Engine/Network/Server.h>
+#include <Engine/Network/SessionState.h>
+#include <Engine/Network/ClientInterface.h>
+#include <Engine/Network/CommunicationInterface.h>
+#include <Engine/Network/NetworkMessage.h>
+#include <Engine/Entities/PlayerCharacter.h>
+#include <Engine/Base/Console.h>
+#include <Engine/Base/Stream.h>
+#include <Engine/Base/CRC.h>
+#include <Engine/Base/Translation.h>
+
+#include <Engine/Templates/StaticArray.cpp>
+
+extern CTCriticalSection cm_csComm;
+extern CClientInterface cm_aciClients[SERVER_CLIENTS];
+extern FLOAT ser_tmLoadTestDuration;
+
+// time after which missing game stream blocks are requested again
+#define LTC_RESENDTIMEOUT 0.1f
+
+// states of a simulated client
+enum LoadTestState {
+  LTS_IDLE = 0,     // not connected yet
+  LTS_CONNECTING,   // waiting for session info
+  LTS_STATE,        // receiving session state
+  LTS_CRC,          // waiting for crc challenge
+  LTS_PLAYER,       // waiting for its player to be added
+  LTS_PLAYING,      // receiving game stream
+  LTS_FAILED,       // disconnected
+};
+
+// a client that joins the server through a loopback link, and talks to it as a remote client would
+class CLoadTestClient {
+public:
+  INDEX ltc_iState;
+  INDEX ltc_iClient;                // server slot it is connected to (0 if none)
+  BOOL ltc_bPlayer;                 // set if it adds a player
+  INDEX ltc_iPlayer;                // index of its player on server
+  CClientInterface ltc_ciInterface; // client side of the loopback link
+  CNetworkStream ltc_nsStream;      // game stream blocks received after a missing one
+  INDEX ltc_iLastSequence;          // last game stream sequence received in order
+  INDEX ltc_iNextChunk;             // next chunk of session state expected
+  TIME ltc_tmLastSync;              // tick of last sync check sent
+  CTimerValue ltc_tvConnected;      // when it started connecting
+  CTimerValue ltc_tvMissing;        // when missing blocks were last noticed or requested
+  CPlayerAction ltc_paAction;       // action sent for its player
+  FLOAT ltc_fTurn;                  // how fast its player turns
+  SLONG ltc_slBytesIn;              // bytes received
+  SLONG ltc_slStreamBytesIn;        // bytes of game stream messages received
+  SLONG ltc_slBytesOut;             // bytes sent
+
+  CLoadTestClient(void) {
+    ltc_iState = LTS_IDLE;
+    ltc_iClient = 0;
+    ltc_bPlayer = FALSE;
+    ltc_iPlayer = -1;
+    ltc_iLastSequence = -1;
+    ltc_iNextChunk = 0;
+    ltc_tmLastSync = -1.0f;
+    ltc_tvConnected.Clear();
+    ltc_tvMissing.Clear();
+    ltc_paAction.Clear();
+    ltc_fTurn = 0.0f;
+    ltc_slBytesIn = 0;
+    ltc_slStreamBytesIn = 0;
+    ltc_slBytesOut = 0;
+  };
+};
+
+static CStaticArray<CLoadTestClient> _altcClients;  // clients of current load test (none if not started)
+static BOOL _bLoadTestRunning = FALSE;  // set when its clients have started connecting
+static CTimerValue _tvLoadTestStarted;
+static INDEX _ctLoadTestTicks = 0;
+static INDEX _ctJoined = 0;
+static INDEX _ctFailed = 0;
+static INDEX _ctResendRequests = 0;
+static DOUBLE _tmJoinTotal = 0.0;
+static DOUBLE _tmJoinMax = 0.0;
+static DOUBLE _tmServerTotal = 0.0;   // time spent by server in ticks
+static DOUBLE _tmServerMax = 0.0;
+static DOUBLE _tmClientsTotal = 0.0;  // time spent by simulated clients
+
+
+// send a message from a simulated client to server
+static void SendFromClient(CLoadTestClient &ltc, const CNetworkMessage &nm, BOOL bReliable)
+{
+  ltc.ltc_ciInterface.Send(nm.nm_pubMessage, nm.nm_slSize, bReliable);
+  ltc.ltc_slBytesOut += nm.nm_slSize;
+}
+
+// receive a message that server sent to a simulated client
+static BOOL ReceiveAtClient(CLoadTestClient &ltc, CNetworkMessage &nm, BOOL bReliable)
+{
+  nm.nm_slSize = nm.nm_slMaxSize;
+  if (!ltc.ltc_ciInterface.Receive(nm.nm_pubMessage, nm.nm_slSize, bReliable)) {
+    return FALSE;
+  }
+  nm.nm_pubPointer = nm.nm_pubMessage;
+  nm.nm_iBit = 0;
+  UBYTE ubType;
+  nm.Read(&ubType, sizeof(ubType));
+  nm.nm_mtType = (MESSAGETYPE)ubType;
+  ltc.ltc_slBytesIn += nm.nm_slSize;
+  return TRUE;
+}
+
+// stop a simulated client
+static void FailClient(CLoadTestClient &ltc, const CTString &strReason)
+{
+  // if server still has it, tell that it is going away
+  if (ltc.ltc_iClient>0 && cm_aciClients[ltc.ltc_iClient].ci_pciOther==&ltc.ltc_ciInterface) {
+    CNetworkMessage nmConfirmDisconnect(MSG_REP_DISCONNECTED);
+    SendFromClient(ltc, nmConfirmDisconnect, TRUE);
+  }
+  CPrintF(TRANS("Load test: client %d disconnected: %s\n"), INDEX(&ltc-&_altcClients[0]), (const char*)strReason);
+  ltc.ltc_iState = LTS_FAILED;
+  _ctFailed++;
+}
+
+// mark that a simulated client has joined the game
+static void ClientJoined(CLoadTestClient &ltc)
+{
+  ltc.ltc_iState = LTS_PLAYING;
+  const DOUBLE tmJoin = (_pTimer->GetHighPrecisionTimer()-ltc.ltc_tvConnected).GetSeconds();
+  _tmJoinTotal += tmJoin;
+  _tmJoinMax = Max(_tmJoinMax, tmJoin);
+  _ctJoined++;
+}
+
+// connect a simulated client to a free server slot
+static void ConnectClient(CLoadTestClient &ltc)
+{
+  CServer &srv = _pNetwork->ga_srvServer;
+  ltc.ltc_tvConnected = _pTimer->GetHighPrecisionTimer();
+
+  // find a free slot
+  INDEX iClient;
+  for (iClient=1; iClient<SERVER_CLIENTS; iClient++) {
+    if (!cm_aciClients[iClient].ci_bUsed && !srv.srv_assoSessions[iClient].IsActive()) {
+      break;
+    }
+  }
+  if (iClient>=SERVER_CLIENTS) {
+    FailClient(ltc, TRANS("All server slots are used"));
+    return;
+  }
+
+  // link it to the slot as the local client is
+  CClientInterface &ci = ltc.ltc_ciInterface;
+  CClientInterface &ciServer = cm_aciClients[iClient];
+  ci.SetLocal(&ciServer);
+  ciServer.SetLocal(&ci);
+  // but give the link an id, so that its packets are sequenced and acknowledged as those of remote clients
+  UWORD uwID = (UWORD(INDEX(&ltc-&_altcClients[0])+1)<<SERVER_CLIENTBITS)+iClient;
+  if (uwID=='//') {
+    uwID += 1<<SERVER_CLIENTBITS;
+  }
+  ci.ci_adrAddress.adr_uwID = uwID;
+  ciServer.ci_adrAddress.adr_uwID = uwID;
+  ltc.ltc_iClient = iClient;
+
+  // ask for registration, as CSessionState::Start_AtClient_t() does
+  CNetworkMessage nmKeepAlive(MSG_KEEPALIVE);
+  SendFromClient(ltc, nmKeepAlive, FALSE);
+  CNetworkMessage nmRegisterSessionState(MSG_REQ_CONNECTREMOTESESSIONSTATE);
+  nmRegisterSessionState<<INDEX('VTAG')<<INDEX(_SE_BUILD_MAJOR)<<INDEX(_SE_BUILD_MINOR);
+  nmRegisterSessionState<<_strModName;
+  extern CTString net_strConnectPassword;
+  extern CTString net_strVIPPassword;
+  CTString strPasw = net_strConnectPassword;
+  if (strPasw=="") {
+    strPasw = net_strVIPPassword;
+  }
+  nmRegisterSessionState<<strPasw;
+  nmRegisterSessionState<<INDEX(ltc.ltc_bPlayer ? 1 : 0);
+  CSessionSocketParams sspParams;
+  sspParams.Update();
+  nmRegisterSessionState<<sspParams;
+  extern ULONG GetGameStreamDictionaryCRC(void);
+  nmRegisterSessionState<<INDEX('DICT')<<INDEX(NET_DICTIONARY_VERSION)<<GetGameStreamDictionaryCRC();
+  SendFromClient(ltc, nmRegisterSessionState, TRUE);
+  ltc.ltc_iState = LTS_CONNECTING;
+}
+
+// acknowledge chunks of session state received so far, or ask to resend from there
+static void SendStateChunkAck(CLoadTestClient &ltc, BOOL bResend)
+{
+  CNetworkMessage nmAck(MSG_REQ_STATEDELTACHUNK);
+  nmAck<<ltc.ltc_iNextChunk<<UBYTE(bResend);
+  SendFromClient(ltc, nmAck, TRUE);
+}
+
+// all of session state is received, go on with crc check
+static void StateReceived(CLoadTestClient &ltc)
+{
+  CNetworkMessage nmKeepAlive(MSG_KEEPALIVE);
+  SendFromClient(ltc, nmKeepAlive, FALSE);
+  CNetworkMessage nmRequestCRC(MSG_REQ_CRCLIST);
+  SendFromClient(ltc, nmRequestCRC, TRUE);
+  ltc.ltc_iState = LTS_CRC;
+}
+
+// handle a reliable stream that a simulated client received while joining
+static void HandleJoinStream(CLoadTestClient &ltc, CTMemoryStream &strmMessage) // throw char *
+{
+  const SLONG slMessageSize = strmMessage.GetPos_t();
+  ltc.ltc_slBytesIn += slMessageSize;
+  strmMessage.SetPos_t(0);
+  INDEX iID;
+  strmMessage>>iID;
+
+  // if disconnected
+  if (iID==MSG_INF_DISCONNECTED) {
+    CTString strReason;
+    strmMessage>>strReason;
+    FailClient(ltc, strReason);
+
+  // if session info received
+  } else if (iID==MSG_REP_CONNECTREMOTESESSIONSTATE && ltc.ltc_iState==LTS_CONNECTING) {
+    // ask for session state, in chunks
+    CNetworkMessage nmKeepAlive(MSG_KEEPALIVE);
+    SendFromClient(ltc, nmKeepAlive, FALSE);
+    CNetworkMessage nmRequestDelta(MSG_REQ_STATEDELTA);
+    nmRequestDelta<<INDEX('CHNK');
+    SendFromClient(ltc, nmRequestDelta, TRUE);
+    ltc.ltc_iState = LTS_STATE;
+
+  // if whole session state received
+  } else if (iID==MSG_REP_STATEDELTA && ltc.ltc_iState==LTS_STATE) {
+    StateReceived(ltc);
+
+  // if a chunk of it received
+  } else if (iID==MSG_REP_STATEDELTACHUNK && ltc.ltc_iState==LTS_STATE) {
+    INDEX iChunk, ctChunks;
+    SLONG slTotal;
+    ULONG ulCRCInMsg;
+    strmMessage>>iChunk>>ctChunks>>slTotal>>ulCRCInMsg;
+    // if not the one that is expected next
+    if (iChunk!=ltc.ltc_iNextChunk) {
+      // ignore it
+      return;
+    }
+    // check it
+    const SLONG slChunk = slMessageSize-strmMessage.GetPos_t();
+    ULONG ulCRC;
+    CRC_Start(ulCRC);
+    CRC_AddBlock(ulCRC, strmMessage.mstrm_pubBuffer+strmMessage.mstrm_slLocation, slChunk);
+    CRC_Finish(ulCRC);
+    if (ulCRC!=ulCRCInMsg || slChunk<=0) {
+      // ask to resend it and all after it
+      SendStateChunkAck(ltc, TRUE);
+      return;
+    }
+    // accept it
+    ltc.ltc_iNextChunk++;
+    SendStateChunkAck(ltc, FALSE);
+    if (ltc.ltc_iNextChunk>=ctChunks) {
+      StateReceived(ltc);
+    }
+
+  // if crc challenge received
+  } else if (iID==MSG_REQ_CRCCHECK && ltc.ltc_iState==LTS_CRC) {
+    // files are same as on server, and game stream starts from now
+    ltc.ltc_iLastSequence = _pNetwork->ga_srvServer.srv_iLastProcessedSequence;
+    CNetworkMessage nmCRC(MSG_REP_CRCCHECK);
+    nmCRC<<_pNetwork->ga_ulCRC<<ltc.ltc_iLastSequence;
+    SendFromClient(ltc, nmCRC, TRUE);
+
+    // if it has a player
+    if (ltc.ltc_bPlayer) {
+      // ask for it
+      CTString strName;
+      strName.PrintF("LoadTest %d", INDEX(&ltc-&_altcClients[0]));
+      CPlayerCharacter pcCharacter(strName);
+      CNetworkMessage nmRegisterPlayer(MSG_REQ_CONNECTPLAYER);
+      nmRegisterPlayer<<pcCharacter;
+      SendFromClient(ltc, nmRegisterPlayer, TRUE);
+      ltc.ltc_iState = LTS_PLAYER;
+    } else {
+      ClientJoined(ltc);
+    }
+
+  } else {
+    FailClient(ltc, TRANS("Invalid stream while waiting for session state"));
+  }
+}
+
+// handle a reliable message that a simulated client received after joining
+static void HandleMessage(CLoadTestClient &ltc, CNetworkMessage &nm)
+{
+  // if disconnected
+  if (nm.GetType()==MSG_INF_DISCONNECTED) {
+    CTString strReason;
+    nm>>strReason;
+    FailClient(ltc, strReason);
+
+  // if player added
+  } else if (nm.GetType()==MSG_REP_CONNECTPLAYER && ltc.ltc_iState==LTS_PLAYER) {
+    nm>>ltc.ltc_iPlayer;
+    ClientJoined(ltc);
+  }
+}
+
+// put received game stream blocks in order, and ask for those that are missing
+static void ReceiveGameStream(CLoadTestClient &ltc, CNetworkMessage &nm)
+{
+  ltc.ltc_slStreamBytesIn += nm.nm_slSize;
+  if (ltc.ltc_iState!=LTS_PLAYING) {
+    return;
+  }
+
+  // read all blocks from it
+  CNetworkMessage nmUnpackedBlocks(MSG_GAMESTREAMBLOCKS);
+  nm.UnpackDefault(nmUnpackedBlocks);
+  while (!nmUnpackedBlocks.EndOfMessage()) {
+    ltc.ltc_nsStream.ReadBlock(nmUnpackedBlocks);
+  }
+
+  // skip those that came in order
+  CNetworkStreamBlock *pnsb;
+  while (ltc.ltc_nsStream.GetBlockBySequence(ltc.ltc_iLastSequence+1, pnsb)==CNetworkStream::R_OK) {
+    ltc.ltc_iLastSequence++;
+  }
+  ltc.ltc_nsStream.RemoveOlderBlocksBySequence(ltc.ltc_iLastSequence+1);
+}
+
+// send what a client sends each tick
+static void SendClientTick(CLoadTestClient &ltc)
+{
+  CTimerValue tvNow = _pTimer->GetHighPrecisionTimer();
+
+  // if some blocks are missing
+  if (ltc.ltc_nsStream.ns_ctBlocks>0) {
+    // if just noticed
+    if (ltc.ltc_tvMissing.tv_llValue==0) {
+      ltc.ltc_tvMissing = tvNow;
+    // if waited long enough for them
+    } else if ((tvNow-ltc.ltc_tvMissing).GetSeconds()>LTC_RESENDTIMEOUT) {
+      // ask for them
+      INDEX iSequence = ltc.ltc_iLastSequence+1;
+      INDEX ctSequences = Max(ltc.ltc_nsStream.GetOldestSequenceAfter(iSequence)-iSequence, INDEX(1));
+      CNetworkMessage nmResendRequest(MSG_REQUESTGAMESTREAMRESEND);
+      nmResendRequest<<iSequence<<ctSequences;
+      SendFromClient(ltc, nmResendRequest, FALSE);
+      ltc.ltc_tvMissing = tvNow;
+      _ctResendRequests++;
+    }
+  } else {
+    ltc.ltc_tvMissing.Clear();
+  }
+
+  // send actions, as CNetworkLibrary::SendActionsToServer() does (even if there are no players)
+  CNetworkMessage nmAction(MSG_ACTION);
+  for (INDEX ipls=0; ipls<NET_MAXLOCALPLAYERS; ipls++) {
+    BOOL bActive = ipls==0 && ltc.ltc_iPlayer>=0;
+    nmAction.WriteBits(&bActive, 1);
+    if (!bActive) {
+      continue;
+    }
+    // keep running, and turn now and then
+    CPlayerAction &pa = ltc.ltc_paAction;
+    if (rand()%20==0) {
+      ltc.ltc_fTurn = (rand()%11-5)*1.0f;
+    }
+    pa.pa_vTranslation = FLOAT3D(0.0f, 0.0f, -10.0f);
+    pa.pa_aRotation = ANGLE3D(ltc.ltc_fTurn, 0.0f, 0.0f);
+    pa.pa_aViewRotation = ANGLE3D(0.0f, 0.0f, 0.0f);
+    pa.pa_llCreated = tvNow.GetMilliseconds();
+    pa.QuantizeAngles();
+    pa.Normalize();
+    INDEX iPing = 0;
+    INDEX iSendBehind = 0;
+    nmAction.WriteBits(&ltc.ltc_iPlayer, 4);
+    nmAction.WriteBits(&iPing, 10);
+    nmAction<<pa;
+    nmAction.WriteBits(&iSendBehind, 2);
+  }
+  SendFromClient(ltc, nmAction, FALSE);
+
+  // if server has made a sync check since last one sent
+  CServer &srv = _pNetwork->ga_srvServer;
+  INDEX iNewest = -1;
+  for (INDEX i=0; i<srv.srv_ascChecks.Count(); i++) {
+    if (srv.srv_ascChecks[i].sc_tmTick>ltc.ltc_tmLastSync
+      &&(iNewest<0 || srv.srv_ascChecks[i].sc_tmTick>srv.srv_ascChecks[iNewest].sc_tmTick)) {
+      iNewest = i;
+    }
+  }
+  if (iNewest>=0) {
+    // send the same one, with sequence received here (so that server flushes the buffer up to that)
+    const CSyncCheck &sc = srv.srv_ascChecks[iNewest];
+    CNetworkMessage nmSyncCheck(MSG_SYNCCHECK);
+    nmSyncCheck<<sc.sc_tmTick<<ltc.ltc_iLastSequence<<sc.sc_ulCRC<<sc.sc_iLevel;
+    if (_pNetwork->ga_sesSessionState.ses_iExtensiveSyncCheck>1) {
+      nmSyncCheck.Write(sc.sc_aulBranchCRCs, sizeof(sc.sc_aulBranchCRCs));
+    }
+    SendFromClient(ltc, nmSyncCheck, FALSE);
+    ltc.ltc_tmLastSync = sc.sc_tmTick;
+  }
+}
+
+// do one tick of a simulated client
+static void UpdateClient(CLoadTestClient &ltc)
+{
+  if (ltc.ltc_iState==LTS_IDLE) {
+    ConnectClient(ltc);
+    return;
+  }
+
+  // if server has dropped it
+  CClientInterface &ci = ltc.ltc_ciInterface;
+  if (ltc.ltc_iClient>0 && cm_aciClients[ltc.ltc_iClient].ci_pciOther!=&ci) {
+    if (ltc.ltc_iState!=LTS_FAILED) {
+      FailClient(ltc, TRANS("Link or server is down"));
+    }
+    // release the slot
+    if (cm_aciClients[ltc.ltc_iClient].ci_pciOther==NULL) {
+      cm_aciClients[ltc.ltc_iClient].ci_bClientLocal = FALSE;
+    }
+    ci.Clear();
+    ltc.ltc_iClient = 0;
+  }
+  if (ltc.ltc_iState==LTS_FAILED) {
+    return;
+  }
+
+  ci.UpdateInputBuffers();
+  try {
+    // handle all reliable messages
+    for (;;) {
+      // session state and crc challenge come as streams
+      if (ltc.ltc_iState<LTS_PLAYER) {
+        CTMemoryStream strmMessage;
+        if (!ci.Receive(strmMessage, TRUE)) {
+          break;
+        }
+        HandleJoinStream(ltc, strmMessage);
+      } else {
+        CNetworkMessage nmReliable;
+        if (!ReceiveAtClient(ltc, nmReliable, TRUE)) {
+          break;
+        }
+        HandleMessage(ltc, nmReliable);
+      }
+      if (ltc.ltc_iState==LTS_FAILED) {
+        return;
+      }
+    }
+  } catch (char *strError) {
+    FailClient(ltc, strError);
+    return;
+  }
+
+  // handle all unreliable messages
+  CNetworkMessage nmMessage;
+  while (ReceiveAtClient(ltc, nmMessage, FALSE)) {
+    if (nmMessage.GetType()==MSG_GAMESTREAMBLOCKS) {
+      ReceiveGameStream(ltc, nmMessage);
+    }
+  }
+
+  if (ltc.ltc_iState==LTS_PLAYING) {
+    SendClientTick(ltc);
+  }
+}
+
+// disconnect all simulated clients and report what was measured
+static void FinishLoadTest(void)
+{
+  const INDEX ctClients = _altcClients.Count();
+  if (ctClients==0) {
+    return;
+  }
+
+  // drop them from server as clients that are gone
+  SLONG slBytesIn = 0;
+  SLONG slStreamBytesIn = 0;
+  SLONG slBytesOut = 0;
+  INDEX ctPlayers = 0;
+  {
+    CTSingleLock slComm(&cm_csComm, TRUE);
+    for (INDEX iltc=0; iltc<ctClients; iltc++) {
+      CLoadTestClient &ltc = _altcClients[iltc];
+      slBytesIn += ltc.ltc_slBytesIn;
+      slStreamBytesIn += ltc.ltc_slStreamBytesIn;
+      slBytesOut += ltc.ltc_slBytesOut;
+      if (ltc.ltc_bPlayer) {
+        ctPlayers++;
+      }
+      if (ltc.ltc_iClient>0) {
+        CClientInterface &ciServer = cm_aciClients[ltc.ltc_iClient];
+        if (ciServer.ci_pciOther==&ltc.ltc_ciInterface) {
+          _cmiComm.Server_ClearClient(ltc.ltc_iClient);
+          _pNetwork->ga_srvServer.HandleClientDisconected(ltc.ltc_iClient);
+        }
+        if (ciServer.ci_pciOther==NULL) {
+          ciServer.ci_bClientLocal = FALSE;
+        }
+        ltc.ltc_ciInterface.Clear();
+      }
+    }
+  }
+
+  // report
+  if (_bLoadTestRunning) {
+    const DOUBLE tmRun = ClampDn((_pTimer->GetHighPrecisionTimer()-_tvLoadTestStarted).GetSeconds(), 0.001);
+    const INDEX ctTicks = ClampDn(_ctLoadTestTicks, INDEX(1));
+    const INDEX ctJoined = ClampDn(_ctJoined, INDEX(1));
+    CPrintF(TRANS("Load test: %d clients (%d with a player) for %.1f s, %d server ticks\n"),
+      ctClients, ctPlayers, tmRun, _ctLoadTestTicks);
+    CPrintF(TRANS("  joined: %d, disconnected: %d, join time: %.0f ms avg, %.0f ms max\n"),
+      _ctJoined, _ctFailed, _tmJoinTotal*1000.0/ctJoined, _tmJoinMax*1000.0);
+    CPrintF(TRANS("  server: %.2f ms per tick avg, %.2f ms max (tick is %.0f ms)\n"),
+      _tmServerTotal*1000.0/ctTicks, _tmServerMax*1000.0, _pTimer->TickQuantum*1000.0f);
+    CPrintF(TRANS("  simulated clients: %.2f ms per tick (not counted above)\n"),
+      _tmClientsTotal*1000.0/ctTicks);
+    CPrintF(TRANS("  per client: %.2f KB/s down (%.2f KB/s game stream), %.2f KB/s up\n"),
+      slBytesIn/1024.0/tmRun/ctJoined, slStreamBytesIn/1024.0/tmRun/ctJoined, slBytesOut/1024.0/tmRun/ctJoined);
+    CPrintF(TRANS("  all clients: %.1f KB/s down, %.1f KB/s up, %d resend requests\n"),
+      slBytesIn/1024.0/tmRun, slBytesOut/1024.0/tmRun, _ctResendRequests);
+  }
+
+  _altcClients.Clear();
+  _bLoadTestRunning = FALSE;
+}
+
+/* Start a load test with simulated clients, that join when server runs. */
+extern void StartLoadTest(INDEX ctClients, INDEX ctPlayers)
+{
+  CTSingleLock slNetwork(&_pNetwork->ga_csNetwork, TRUE);
+
+  // finish previous one
+  FinishLoadTest();
+
+  ctClients = Clamp(ctClients, INDEX(0), INDEX(SERVER_CLIENTS-1));
+  ctPlayers = Clamp(ctPlayers, INDEX(0), ctClients);
+  if (ctClients==0) {
+    return;
+  }
+  _altcClients.New(ctClients);
+  // first ones add a player each, others are observers
+  for (INDEX iltc=0; iltc<ctPlayers; iltc++) {
+    _altcClients[iltc].ltc_bPlayer = TRUE;
+  }
+  CPrintF(TRANS("Load test: %d clients (%d with a player) will join when server runs\n"), ctClients, ctPlayers);
+}
+
+/* Stop current load test and report its results. */
+extern void StopLoadTest(void)
+{
+  CTSingleLock slNetwork(&_pNetwork->ga_csNetwork, TRUE);
+  FinishLoadTest();
+}
+
+/* Stop current load test when server stops, if its clients have joined. */
+extern void CloseLoadTest(void)
+{
+  if (_bLoadTestRunning) {
+    FinishLoadTest();
+  }
+}
+
+/* Let simulated clients of a load test talk to server, once per server tick. */
+extern void UpdateLoadTest(void)
+{
+  if (_altcClients.Count()==0 || !_pNetwork->ga_srvServer.srv_bActive) {
+    return;
+  }
+  CTimerValue tvStart = _pTimer->GetHighPrecisionTimer();
+
+  // if just starting
+  if (!_bLoadTestRunning) {
+    _bLoadTestRunning = TRUE;
+    _tvLoadTestStarted = tvStart;
+    _ctLoadTestTicks = 0;
+    _ctJoined = 0;
+    _ctFailed = 0;
+    _ctResendRequests = 0;
+    _tmJoinTotal = 0.0;
+    _tmJoinMax = 0.0;
+    _tmServerTotal = 0.0;
+    _tmServerMax = 0.0;
+    _tmClientsTotal = 0.0;
+  // if it has run long enough
+  } else if (ser_tmLoadTestDuration>0 && (tvStart-_tvLoadTestStarted).GetSeconds()>ser_tmLoadTestDuration) {
+    FinishLoadTest();
+    return;
+  }
+
+  {
+    CTSingleLock slComm(&cm_csComm, TRUE);
+    for (INDEX iltc=0; iltc<_altcClients.Count(); iltc++) {
+      UpdateClient(_altcClients[iltc]);
+    }
+  }
+  _tmClientsTotal += (_pTimer->GetHighPrecisionTimer()-tvStart).GetSeconds();
+}
+
+/* Count time that server has spent in one tick, while a load test is running. */
+extern void AddLoadTestServerTime(CTimerValue tvTime)
+{
+  if (!_bLoadTestRunning) {
+    return;
+  }
+  const DOUBLE tmServer = tvTime.GetSeconds();
+  _tmServerTotal += tmServer;
+  _tmServerMax = Max(_tmServerMax, tmServer);
+  _ctLoadTestTicks++;
+}
@@ -303,6 +303,15 @@ void CMessageDispatcher::SendToClientReliable(INDEX iClient, CTMemoryStream &str
   UpdateSentStreamStats(slSize);
   _pfNetworkProfile.StopTimer(CNetworkProfile::PTI_SENDMESSAGE);
 }
+void CMessageDispatcher::SendToClientReliable(INDEX iClient, const void *pvMessage, SLONG slSize)
+{
+  _pfNetworkProfile.StartTimer(CNetworkProfile::PTI_SENDMESSAGE);
+
+  // send the message (stream formatted by the caller)
+  _cmiComm.Server_Send_Reliable(iClient, pvMessage, slSize);
+  UpdateSentStreamStats(slSize);
+  _pfNetworkProfile.StopTimer(CNetworkProfile::PTI_SENDMESSAGE);
+}
 
 /* Send a message from client to server. */
 void CMessageDispatcher::SendToServer(const CNetworkMessage &nmMessage)
@@ -71,6 +71,7 @@ public:
   void SendToClient(INDEX iClient, const CNetworkMessage &nmMessage);
   void SendToClientReliable(INDEX iClient, const CNetworkMessage &nmMessage);
   void SendToClientReliable(INDEX iClient, CTMemoryStream &strmMessage);
+  void SendToClientReliable(INDEX iClient, const void *pvMessage, SLONG slSize);
   /* Send a message from client to server. */
   void SendToServer(const CNetworkMessage &nmMessage);
   void SendToServerReliable(const CNetworkMessage &nmMessage);
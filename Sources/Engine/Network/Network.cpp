@@ -20,6 +20,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <Engine/Base/CRCTable.h>
 #include <Engine/Base/Shell.h>
 #include <Engine/Base/ProgressHook.h>
+#include <Engine/Base/Jobs.h>
 #include <Engine/Network/Server.h>
 #include <Engine/Network/SessionState.h>
 #include <Engine/Network/Network.h>
@@ -101,6 +102,10 @@ extern INDEX ser_bPauseOnSyncBad = FALSE;
 extern INDEX ser_iKickOnSyncBad = 10;
 extern INDEX ser_bKickOnSyncLate = 1;
 extern INDEX ser_iRememberBehind = 3000;
+extern FLOAT ser_tmJoinSnapshotReuse = 1.0f;
+extern INDEX ser_iStateChunkSize = 16384;
+extern INDEX ser_iStateChunkWindow = 4;
+extern FLOAT ser_tmLoadTestDuration = 0.0f;
 extern INDEX ser_iExtensiveSyncCheck = 0;
 extern INDEX ser_bClientsMayPause = TRUE;
 extern FLOAT ser_tmSyncCheckFrequency = 1.0f;
@@ -136,7 +141,7 @@ extern INDEX cli_iBufferActions = 1;
 extern INDEX cli_iMaxBPS = 4000;
 extern INDEX cli_iMinBPS = 0;
 
-extern INDEX net_iCompression = 1;
+extern INDEX net_iCompression = 3;  // 0=none, 1=LZ, 2=zlib, 3=dictionary (LZ for older clients)
 extern INDEX net_bLookupHostNames = FALSE;
 extern INDEX net_bReportPackets = FALSE;
 extern INDEX net_iMaxSendRetries = 10;
@@ -158,12 +163,14 @@ extern CTString net_strVIPPassword = "";
 extern CTString net_strObserverPassword = "";
 extern INDEX net_iVIPReserve = 0;
 extern INDEX net_iMaxObservers = 16;
-extern INDEX net_iMaxClients = 0;
+extern INDEX net_iMaxClients = 0;   // 0 = as many as players, max. NET_MAXGAMECOMPUTERS
 extern FLOAT net_tmConnectionTimeout = 30.0f;
 extern FLOAT net_tmProblemsTimeout = 5.0f;
 extern FLOAT net_tmDisconnectTimeout = 300.0f;  // must be higher for level changing
 extern INDEX net_bReportCRC = FALSE;
 extern FLOAT net_fDropPackets = 0.0f;
+extern INDEX net_iSocketBufferSize = 256*1024;  // size of UDP socket send/receive buffers in bytes
+extern INDEX net_iMaxDatagramsPerUpdate = 1024; // datagrams read from the socket in one update at most
 extern FLOAT net_tmLatency = 0.0f;
 
 extern INDEX ent_bReportSpawnInWall = FALSE;
@@ -177,6 +184,8 @@ extern INDEX net_ctChatMessages = 0;  // counter for incoming chat messages
 
 extern CPacketBufferStats _pbsSend;
 extern CPacketBufferStats _pbsRecv;
+extern CSocketStats _ssSend;
+extern CSocketStats _ssRecv;
 
 extern BOOL _bPredictionActive = FALSE;
 
@@ -207,6 +216,7 @@ extern INDEX gam_bPretouch = FALSE;
 
 extern FLOAT phy_fCollisionCacheAhead  = 5.0f;
 extern FLOAT phy_fCollisionCacheAround = 1.5f;
+extern INDEX phy_bParallelMovers = FALSE;
 extern FLOAT cli_fPredictionFilter = 0.5f;
 
 extern INDEX shd_bCacheAll;
@@ -264,6 +274,174 @@ extern void CacheShadows(void)
   _bNeedPretouch = TRUE;
 }
 
+// recalculate all shadows of current world serially and on all threads, and report times
+static void BenchmarkShadows(void)
+{
+  CWorld *pwo = (CWorld*)_pShell->GetINDEX("pwoCurrentWorld");
+  if( pwo==NULL) {
+    CPrintF( TRANS("No world to calculate shadows in.\n"));
+    return;
+  }
+  // mute all sounds
+  _pSound->Mute();
+
+  extern INDEX shd_bParallelBaking;
+  const INDEX bParallelBaking = shd_bParallelBaking;
+  DOUBLE adSeconds[2];
+  try {
+    for( INDEX iPass=0; iPass<2; iPass++) {
+      shd_bParallelBaking = iPass;
+      pwo->DiscardAllShadows();
+      const CTimerValue tvStart = _pTimer->GetHighPrecisionTimer();
+      pwo->CalculateDirectionalShadows();
+      pwo->CalculateNonDirectionalShadows();
+      adSeconds[iPass] = (_pTimer->GetHighPrecisionTimer()-tvStart).GetSeconds();
+    }
+  } catch( char *strError) {
+    shd_bParallelBaking = bParallelBaking;
+    CPrintF( TRANS("Shadow benchmark interrupted: %s\n"), strError);
+    return;
+  }
+  shd_bParallelBaking = bParallelBaking;
+
+  CPrintF( TRANS("Shadow calculation for '%s': %.2fs serial, %.2fs on %d threads (%.2fx)\n"),
+    (const char*)pwo->wo_fnmFileName.FileName(), adSeconds[0], adSeconds[1], JOB_GetThreadCount(),
+    adSeconds[0]/ClampDn(adSeconds[1], 0.001));
+  // mark that we need pretouching
+  _bNeedPretouch = TRUE;
+}
+
+// play a demo through with serial and with parallel movers, and compare sync crcs of each step
+static void CheckParallelMoversCfunc(void* pArgs)
+{
+  CTString strDemo = *NEXTARGUMENT(CTString*);
+  if( _pShell->GetINDEX("pwoCurrentWorld")!=NULL) {
+    CPrintF( TRANS("Stop the game before checking parallel movers.\n"));
+    return;
+  }
+
+  const INDEX bParallelMovers = phy_bParallelMovers;
+  CStaticStackArray<ULONG> aaulCRCs[2];
+  DOUBLE adSeconds[2];
+  for( INDEX iPass=0; iPass<2; iPass++) {
+    phy_bParallelMovers = iPass;
+    try {
+      _pNetwork->StartDemoPlay_t(strDemo);
+    } catch( char *strError) {
+      phy_bParallelMovers = bParallelMovers;
+      CPrintF( TRANS("Cannot play demo '%s': %s\n"), (const char*)strDemo, strError);
+      return;
+    }
+    {
+      CTSingleLock slHooks(&_pTimer->tm_csHooks, TRUE);
+      CTSingleLock slNetwork(&_pNetwork->ga_csNetwork, TRUE);
+      CSessionState &ses = _pNetwork->ga_sesSessionState;
+      adSeconds[iPass] = 0.0;
+      // step the demo one tick at a time, as fast as it can go
+      while( !_pNetwork->ga_bDemoPlayFinished) {
+        _pNetwork->ga_fDemoTimer += _pTimer->TickQuantum;
+        const CTimerValue tvStart = _pTimer->GetHighPrecisionTimer();
+        ses.ProcessGameStream();
+        adSeconds[iPass] += (_pTimer->GetHighPrecisionTimer()-tvStart).GetSeconds();
+        // stop on read errors
+        if( !_pNetwork->ga_bDemoPlayFinished && ses.ses_tmLastDemoSequence<_pNetwork->ga_fDemoTimer) {
+          break;
+        }
+        ULONG &ulCRC = aaulCRCs[iPass].Push();
+        CRC_Start(ulCRC);
+        ses.ChecksumForSync(ulCRC, 2);
+        CRC_Finish(ulCRC);
+      }
+    }
+    _pNetwork->StopGame();
+  }
+  phy_bParallelMovers = bParallelMovers;
+
+  const INDEX ctSteps = Min(aaulCRCs[0].Count(), aaulCRCs[1].Count());
+  INDEX iMismatch = -1;
+  for( INDEX iStep=0; iStep<ctSteps; iStep++) {
+    if( aaulCRCs[0][iStep]!=aaulCRCs[1][iStep]) {
+      iMismatch = iStep;
+      break;
+    }
+  }
+  if( iMismatch<0 && aaulCRCs[0].Count()!=aaulCRCs[1].Count()) {
+    iMismatch = ctSteps;
+  }
+  CPrintF( TRANS("Demo '%s': %d steps, game stream processing %.2fs serial, %.2fs on %d threads\n"),
+    (const char*)strDemo, aaulCRCs[0].Count(), adSeconds[0], adSeconds[1], JOB_GetThreadCount());
+  if( iMismatch<0) {
+    CPrintF( TRANS("  all sync crcs match\n"));
+  } else {
+    CPrintF( TRANS("  sync crcs differ from step %d (%.2fs into the demo)\n"),
+      iMismatch, (iMismatch+1)*_pTimer->TickQuantum);
+  }
+}
+
+// play a demo through and compare sizes of all-actions blocks in the old and the new layout
+static void MeasureActionBlocksCfunc(void* pArgs)
+{
+  CTString strDemo = *NEXTARGUMENT(CTString*);
+  extern void MeasureActionBlocks(const CTString &strDemo);
+  MeasureActionBlocks(strDemo);
+}
+
+// schedule given number of timers and compare old sorted list against the heap
+static void BenchmarkTimersCfunc(void* pArgs)
+{
+  INDEX ctTimers = NEXTARGUMENT(INDEX);
+  extern void BenchmarkTimers(INDEX ctTimers);
+  BenchmarkTimers(ctTimers);
+}
+
+// diff saved games (or current state if no pattern) the old and the new way, and check them
+static void BenchmarkDiffCfunc(void* pArgs)
+{
+  CTString strPattern = *NEXTARGUMENT(CTString*);
+  extern void BenchmarkDiff(const CTString &strPattern);
+  BenchmarkDiff(strPattern);
+}
+
+// train the game stream dictionary on a game stream dump (empty name for the last dump)
+static void TrainGameStreamDictionaryCfunc(void* pArgs)
+{
+  CTString strDumpFile = *NEXTARGUMENT(CTString*);
+  extern void TrainGameStreamDictionary(const CTString &strDumpFile);
+  TrainGameStreamDictionary(strDumpFile);
+}
+
+// pack and unpack a game stream dump with each codec (empty name for the last dump)
+static void BenchmarkCompressionCfunc(void* pArgs)
+{
+  CTString strDumpFile = *NEXTARGUMENT(CTString*);
+  extern void BenchmarkCompression(const CTString &strDumpFile);
+  BenchmarkCompression(strDumpFile);
+}
+
+// flood the server socket with given number of datagrams from loopback and report reading them
+static void FloodServerSocketCfunc(void* pArgs)
+{
+  INDEX ctDatagrams = NEXTARGUMENT(INDEX);
+  extern void FloodServerSocket(INDEX ctDatagrams);
+  FloodServerSocket(ctDatagrams);
+}
+
+// let given number of simulated clients join the server, with a player on given number of them
+static void StartLoadTestCfunc(void* pArgs)
+{
+  INDEX ctClients = NEXTARGUMENT(INDEX);
+  INDEX ctPlayers = NEXTARGUMENT(INDEX);
+  extern void StartLoadTest(INDEX ctClients, INDEX ctPlayers);
+  StartLoadTest(ctClients, ctPlayers);
+}
+
+// disconnect simulated clients and report the load test
+static void StopLoadTestCfunc(void)
+{
+  extern void StopLoadTest(void);
+  StopLoadTest();
+}
+
 // check if a name or IP matches a mask
 extern BOOL MatchesBanMask(const CTString &strString, const CTString &strMask)
 {
@@ -521,6 +699,7 @@ static void StockInfo(void)
   INDEX ctEntities=0, ctShadowLayers=0, ctPolys=0,    ctPlanes=0,   ctEdges=0,    ctVertices=0, ctSectors=0;
   SLONG slEntBytes=0, slLyrBytes=0,     slPlyBytes=0, slPlnBytes=0, slEdgBytes=0, slVtxBytes=0, slSecBytes=0;
   SLONG slCgrBytes=0;
+  INDEX ctCgrCells=0, ctCgrSlots=0, ctCgrLoose=0;
   CWorld *pwo = (CWorld*)_pShell->GetINDEX("pwoCurrentWorld");
 
   if( pwo!=NULL)
@@ -576,7 +755,9 @@ static void StockInfo(void)
       }
     } // add in memory used by collision grid
     extern SLONG  GetCollisionGridMemory( CCollisionGrid *pcg);
+    extern void GetCollisionGridOccupancy( CCollisionGrid *pcg, INDEX &ctCells, INDEX &ctSlots, INDEX &ctLooseEntries);
     slCgrBytes += GetCollisionGridMemory( pwo->wo_pcgCollisionGrid);
+    GetCollisionGridOccupancy( pwo->wo_pcgCollisionGrid, ctCgrCells, ctCgrSlots, ctCgrLoose);
   }
 
   // stock info
@@ -608,7 +789,7 @@ static void StockInfo(void)
   CPrintF("     AnimSets: %5d (%5.2f MB)\n", _pAnimSetStock->GetTotalCount(),  fAstBytes);
   CPrintF("      Shaders: %5d (%5.2f MB)\n", _pShaderStock->GetTotalCount(),   fShaBytes);
   CPrintF("\n");
-  CPrintF("CollisionGrid: %.2f MB\n", slCgrBytes*dToMB);
+  CPrintF("CollisionGrid: %.2f MB (%d cells in %d slots, %d loose entries)\n", slCgrBytes*dToMB, ctCgrCells, ctCgrSlots, ctCgrLoose);
   CPrintF("--------------\n");
   CPrintF("        Total: %.2f MB\n", fTexBytes+fSndBytes+fMdlBytes+fMshBytes+fSkaBytes+fAstBytes+fShaBytes
   + (slShdBytes+slEntBytes+slSecBytes+slPlnBytes+slEdgBytes+slPlyBytes+slVtxBytes+slLyrBytes+slCgrBytes)*dToMB);
@@ -738,6 +919,16 @@ void CNetworkLibrary::Init(const CTString &strGameID)
   _pShell->DeclareSymbol("user void RendererInfo(void);", &RendererInfo);
   _pShell->DeclareSymbol("user void ClearRenderer(void);",   &ClearRenderer);
   _pShell->DeclareSymbol("user void CacheShadows(void);",    &CacheShadows);
+  _pShell->DeclareSymbol("user void BenchmarkShadows(void);", &BenchmarkShadows);
+  _pShell->DeclareSymbol("user void CheckParallelMovers(CTString);", &CheckParallelMoversCfunc);
+  _pShell->DeclareSymbol("user void MeasureActionBlocks(CTString);", &MeasureActionBlocksCfunc);
+  _pShell->DeclareSymbol("user void BenchmarkTimers(INDEX);", &BenchmarkTimersCfunc);
+  _pShell->DeclareSymbol("user void BenchmarkDiff(CTString);", &BenchmarkDiffCfunc);
+  _pShell->DeclareSymbol("user void BenchmarkCompression(CTString);", &BenchmarkCompressionCfunc);
+  _pShell->DeclareSymbol("user void TrainGameStreamDictionary(CTString);", &TrainGameStreamDictionaryCfunc);
+  _pShell->DeclareSymbol("user void StartLoadTest(INDEX, INDEX);", &StartLoadTestCfunc);
+  _pShell->DeclareSymbol("user void StopLoadTest(void);", &StopLoadTestCfunc);
+  _pShell->DeclareSymbol("user void FloodServerSocket(INDEX);", &FloodServerSocketCfunc);
   _pShell->DeclareSymbol("user void KickClient(INDEX, CTString);", &KickClientCfunc);
   _pShell->DeclareSymbol("user void KickByName(CTString, CTString);", &KickByNameCfunc);
   _pShell->DeclareSymbol("user void ListPlayers(void);", &ListPlayers);
@@ -794,6 +985,10 @@ void CNetworkLibrary::Init(const CTString &strGameID)
   _pShell->DeclareSymbol("user FLOAT net_tmDisconnectTimeout;", &net_tmDisconnectTimeout);
   _pShell->DeclareSymbol("user INDEX net_bReportCRC;", &net_bReportCRC);
   _pShell->DeclareSymbol("user INDEX ser_iRememberBehind;", &ser_iRememberBehind);
+  _pShell->DeclareSymbol("persistent user FLOAT ser_tmJoinSnapshotReuse;", &ser_tmJoinSnapshotReuse);
+  _pShell->DeclareSymbol("persistent user INDEX ser_iStateChunkSize;", &ser_iStateChunkSize);
+  _pShell->DeclareSymbol("persistent user INDEX ser_iStateChunkWindow;", &ser_iStateChunkWindow);
+  _pShell->DeclareSymbol("user FLOAT ser_tmLoadTestDuration;", &ser_tmLoadTestDuration);
   _pShell->DeclareSymbol("user INDEX cli_bEmulateDesync;",  &cli_bEmulateDesync);
   _pShell->DeclareSymbol("user INDEX cli_bDumpSync;",       &cli_bDumpSync);
   _pShell->DeclareSymbol("user INDEX cli_bDumpSyncEachTick;",&cli_bDumpSyncEachTick);
@@ -843,6 +1038,14 @@ void CNetworkLibrary::Init(const CTString &strGameID)
   _pShell->DeclareSymbol("user FLOAT net_fLimitBandwidthSend;", &_pbsSend.pbs_fBandwidthLimit);
   _pShell->DeclareSymbol("user FLOAT net_fLimitBandwidthRecv;", &_pbsRecv.pbs_fBandwidthLimit);
   _pShell->DeclareSymbol("user FLOAT net_fDropPackets;", &net_fDropPackets);
+  _pShell->DeclareSymbol("persistent user INDEX net_iSocketBufferSize;", &net_iSocketBufferSize);
+  _pShell->DeclareSymbol("persistent user INDEX net_iMaxDatagramsPerUpdate;", &net_iMaxDatagramsPerUpdate);
+  _pShell->DeclareSymbol("user const INDEX net_ctSendCalls;",   &_ssSend.ss_ctCalls);
+  _pShell->DeclareSymbol("user const INDEX net_ctRecvCalls;",   &_ssRecv.ss_ctCalls);
+  _pShell->DeclareSymbol("user const INDEX net_ctSendPackets;", &_ssSend.ss_ctPackets);
+  _pShell->DeclareSymbol("user const INDEX net_ctRecvPackets;", &_ssRecv.ss_ctPackets);
+  _pShell->DeclareSymbol("user const INDEX net_ctSendBytes;",   &_ssSend.ss_ctBytes);
+  _pShell->DeclareSymbol("user const INDEX net_ctRecvBytes;",   &_ssRecv.ss_ctBytes);
 
   _pShell->DeclareSymbol("persistent user INDEX net_iGraphBuffer;", &net_iGraphBuffer);
 
@@ -854,6 +1057,7 @@ void CNetworkLibrary::Init(const CTString &strGameID)
 
   _pShell->DeclareSymbol("user FLOAT phy_fCollisionCacheAhead;",  &phy_fCollisionCacheAhead);
   _pShell->DeclareSymbol("user FLOAT phy_fCollisionCacheAround;", &phy_fCollisionCacheAround);
+  _pShell->DeclareSymbol("user INDEX phy_bParallelMovers;", &phy_bParallelMovers);
   
   _pShell->DeclareSymbol("persistent user INDEX inp_iKeyboardReadingMethod;",   &inp_iKeyboardReadingMethod);
   _pShell->DeclareSymbol("persistent user INDEX inp_bAllowMouseAcceleration;",  &inp_bAllowMouseAcceleration);
@@ -2006,6 +2210,12 @@ void CNetworkLibrary::MainLoop(void)
   _sfStats.StopTimer(CStatForm::STI_MAINLOOP);
 }
 
+// wait until network data arrives, or the timeout passes (returns TRUE if data arrived)
+BOOL CNetworkLibrary::WaitForIncomingData(TIME tmTimeout)
+{
+  return _cmiComm.WaitForData(tmTimeout);
+}
+
 // make actions packet for local players and send to server
 void CNetworkLibrary::SendActionsToServer(void)
 {
@@ -2076,10 +2286,16 @@ void CNetworkLibrary::TimerLoop(void)
 
     // if this is server computer
     if (ga_IsServer) {
+      // let simulated clients of a load test send and receive, if any
+      extern void UpdateLoadTest(void);
+      extern void AddLoadTestServerTime(CTimerValue tvTime);
+      UpdateLoadTest();
+      CTimerValue tvServerStart = _pTimer->GetHighPrecisionTimer();
       // handle server messages
       _cmiComm.Server_Update();
       ga_srvServer.ServerLoop();
       _cmiComm.Server_Update();
+      AddLoadTestServerTime(_pTimer->GetHighPrecisionTimer()-tvServerStart);
     }
   }
 
@@ -2511,6 +2727,8 @@ void CNetworkLibrary::MakeDefaultState(const CTFileName &fnmWorld,
   } else {
     pstrmState = &strmStateMem;
   }
+  // state shared with connecting clients was made against the old default state
+  ga_srvServer.InvalidateJoinSnapshot();
   // make default state for a network game
   NET_MakeDefaultState_t(fnmWorld, ulSpawnFlags, pvSessionProperties, *pstrmState);
   pstrmState->SetPos_t(0);
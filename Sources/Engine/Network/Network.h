@@ -271,6 +271,8 @@ public:
 
   /* Loop executed in main application thread. */
   void MainLoop(void);
+  // wait until network data arrives, or the timeout passes (returns TRUE if data arrived)
+  BOOL WaitForIncomingData(TIME tmTimeout);
 
   /* Get player entity for a given local player. */
   CEntity *GetLocalPlayerEntity(CPlayerSource *ppls);
@@ -21,6 +21,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <Engine/Math/Functions.h>
 #include <Engine/Base/CRC.h>
 #include <Engine/Base/Console.h>
+#include <Engine/Base/Shell.h>
+#include <Engine/Base/Timer.h>
 #include <Engine/Base/CTString.h>
 #include <Engine/Base/Stream.h>
 #include <Engine/Base/ErrorTable.h>
@@ -28,6 +30,9 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include <Engine/Base/ListIterator.inl>
 
+#include <Engine/Templates/StaticArray.cpp>
+#include <Engine/Templates/StaticStackArray.cpp>
+
 static struct ErrorCode ErrorCodes[] = {
 // message types
   ERRORCODE(MSG_REQ_ENUMSERVERS, "MSG_REQ_ENUMSERVERS"),
@@ -48,6 +53,8 @@ static struct ErrorCode ErrorCodes[] = {
   ERRORCODE(MSG_SEQ_REMPLAYER, "MSG_SEQ_REMPLAYER"),    
   ERRORCODE(MSG_GAMESTREAMBLOCKS, "MSG_GAMESTREAMBLOCKS"), 
   ERRORCODE(MSG_REQUESTGAMESTREAMRESEND, "MSG_REQUESTGAMESTREAMRESEND"),
+  ERRORCODE(MSG_REP_STATEDELTACHUNK, "MSG_REP_STATEDELTACHUNK"),
+  ERRORCODE(MSG_REQ_STATEDELTACHUNK, "MSG_REQ_STATEDELTACHUNK"),
 };
 extern struct ErrorTable MessageTypes = ERRORTABLE(ErrorCodes);
 
@@ -330,18 +337,143 @@ void CNetworkMessage::Unpack(CNetworkMessage &nmUnpacked, CCompressor &comp)
 }
 
 
+// preset dictionary for the dictionary compression of game stream messages
+static CCompressionDictionary _cdGameStream;
+static ULONG _ulGameStreamDictionaryCRC = 0;
+
+// dictionary trained on game stream dumps (see TrainGameStreamDictionary())
+#define GAMESTREAMDICT_FILE "Data\\GameStream.dct"
+#define GAMESTREAMDICT_SIZE 4096    // size of trained dictionary
+#define GAMESTREAMDICT_SEGMENT 32   // size of pieces of messages it is made of
+
+// make the dictionary out of blocks that are most common in the game stream
+// (used when there is no trained dictionary)
+static void MakeSampleGameStreamDictionary(void)
+{
+  CNetworkMessage nmSamples(MSG_GAMESTREAMBLOCKS);
+
+  // delta actions as they are sent for a player that moves and fires,
+  // and for the player owned by the receiving client (with ping time delta)
+  CPlayerAction paIdle;
+  paIdle.Clear();
+  CPlayerAction paMoving;
+  paMoving.Clear();
+  paMoving.pa_vTranslation = FLOAT3D(0.0f, 0.0f, -10.0f);
+  paMoving.pa_aRotation = ANGLE3D(2.5f, 0.0f, 0.0f);
+  paMoving.pa_ulButtons = 1;
+  CPlayerAction paOwned;
+  paOwned.Clear();
+  paOwned.pa_llCreated = 50;
+
+  TIME tmTick = 0.0f;
+  INDEX iSequence = 0;
+  // rarer combinations first, as the most common ones should be closest to the data
+  for (INDEX ctPlayers=4; ctPlayers>=1; ctPlayers--) {
+    for (INDEX iVariant=0; iVariant<3; iVariant++) {
+      tmTick += CTimer::TickQuantum;
+      iSequence++;
+      CNetworkStreamBlock nsbAllActions(MSG_SEQ_ALLACTIONS, iSequence);
+      nsbAllActions<<tmTick;
+      // first player may do something, the rest are idle (as written by CServer)
+      INDEX ctIdle = ctPlayers;
+      if (iVariant>0) {
+        UBYTE ubAction = 1;
+        nsbAllActions.WriteBits(&ubAction, 1);
+        if (iVariant==1) {
+          paMoving.WriteDelta(nsbAllActions, paIdle, FALSE);
+        } else {
+          paOwned.WriteDelta(nsbAllActions, paIdle, TRUE);
+        }
+        ctIdle--;
+      }
+      if (ctIdle>0) {
+        UBYTE ubAction = 0;
+        nsbAllActions.WriteBits(&ubAction, 1);
+        nsbAllActions.WriteCode(ctIdle-1);
+      }
+      nsbAllActions.WriteToMessage(nmSamples);
+    }
+  }
+
+  _cdGameStream.Set(nmSamples.nm_pubMessage+sizeof(UBYTE), nmSamples.nm_slSize-sizeof(UBYTE));
+}
+
+// set the dictionary from the trained one if there is one, or else from sample blocks
+// NOTE: server and client use the dictionary only if they announce same NET_DICTIONARY_VERSION
+// and same dictionary crc
+static void MakeGameStreamDictionary(void)
+{
+  if (FileExists(CTString(GAMESTREAMDICT_FILE))) {
+    try {
+      CTFileStream strm;
+      strm.Open_t(CTString(GAMESTREAMDICT_FILE));
+      strm.ExpectID_t("GSDC");
+      SLONG slSize;
+      strm>>slSize;
+      if (slSize<=0 || slSize>GAMESTREAMDICT_SIZE) {
+        ThrowF_t(TRANS("Invalid dictionary size %d"), slSize);
+      }
+      CStaticStackArray<UBYTE> aubDictionary;
+      aubDictionary.Push(slSize);
+      strm.Read_t(&aubDictionary[0], slSize);
+      _cdGameStream.Set(&aubDictionary[0], slSize);
+    } catch (char *strError) {
+      CPrintF(TRANS("Cannot read game stream dictionary '%s': %s\n"), GAMESTREAMDICT_FILE, strError);
+      _cdGameStream.Clear();
+    }
+  }
+  if (!_cdGameStream.IsSet()) {
+    MakeSampleGameStreamDictionary();
+  }
+  CRC_Start(_ulGameStreamDictionaryCRC);
+  CRC_AddBlock(_ulGameStreamDictionaryCRC, _cdGameStream.cd_pubData, _cdGameStream.cd_slSize);
+  CRC_Finish(_ulGameStreamDictionaryCRC);
+}
+
+// get crc of the game stream dictionary, that is announced along with NET_DICTIONARY_VERSION
+extern ULONG GetGameStreamDictionaryCRC(void)
+{
+  if (!_cdGameStream.IsSet()) {
+    MakeGameStreamDictionary();
+  }
+  return _ulGameStreamDictionaryCRC;
+}
+
 // NOTE:
 // compression type bits in the messages are different than compression type cvar values
 // this is to keep backward compatibility with old demos saved with full compression
-void CNetworkMessage::PackDefault(CNetworkMessage &nmPacked)
+void CNetworkMessage::PackDefault(CNetworkMessage &nmPacked, BOOL bAllowDictionary/*=FALSE*/)
 {
+  // packed message may be reused, so clear compression bits of previous packing
+  (int&)nmPacked.nm_mtType&=0x3F;
+
   extern INDEX net_iCompression;
-  if (net_iCompression==2) {
+  if (net_iCompression==3 && bAllowDictionary) {
+    // pack with preset dictionary
+    if (!_cdGameStream.IsSet()) {
+      MakeGameStreamDictionary();
+    }
+    CDictCompressor compDict(&_cdGameStream);
+    SLONG slUnpackedSize = nm_slSize-sizeof(UBYTE);
+    void *pvUnpacked     = nm_pubMessage+sizeof(UBYTE);
+    SLONG slPackedSize   = nmPacked.nm_slMaxSize-sizeof(UBYTE);
+    void *pvPacked       = nmPacked.nm_pubMessage+sizeof(UBYTE);
+    // if it doesn't get any smaller, there's no need to unpack it either
+    if (!compDict.Pack(pvUnpacked, slUnpackedSize, pvPacked, slPackedSize)
+      || slPackedSize>=slUnpackedSize) {
+      nmPacked.nm_slSize = slUnpackedSize+sizeof(UBYTE);
+      memcpy(pvPacked, pvUnpacked, slUnpackedSize);
+      (int&)nmPacked.nm_mtType|=2<<6;
+    } else {
+      nmPacked.nm_slSize = slPackedSize+sizeof(UBYTE);
+      (int&)nmPacked.nm_mtType|=3<<6;
+    }
+  } else if (net_iCompression==2) {
     // pack with zlib only
     CzlibCompressor compzlib;
     Pack(nmPacked, compzlib);
     (int&)nmPacked.nm_mtType|=0<<6;
-  } else if (net_iCompression==1) {
+  } else if (net_iCompression==1 || net_iCompression==3) {
     // pack with LZ only
     CLZCompressor compLZ;
     Pack(nmPacked, compLZ);
@@ -379,6 +511,14 @@ void CNetworkMessage::UnpackDefault(CNetworkMessage &nmUnpacked)
     CLZCompressor compLZ;
     Unpack(nmUnpacked,compLZ);
           } break;
+  case 3: {
+    // unpack with preset dictionary
+    if (!_cdGameStream.IsSet()) {
+      MakeGameStreamDictionary();
+    }
+    CDictCompressor compDict(&_cdGameStream);
+    Unpack(nmUnpacked,compDict);
+          } break;
   default:
   case 2: {
     // no unpacking
@@ -400,6 +540,380 @@ void CNetworkMessage::UnpackDefault(CNetworkMessage &nmUnpacked)
   //*/
 }
 
+// file that game stream messages are dumped to when net_bDumpStreamBlocks is on
+#define STREAMDUMP_FILE "Temp\\StreamBlocks.dmp"
+static CTFileStream _strmStreamDump;
+static BOOL _bStreamDumpOpen = FALSE;
+
+// close the game stream dump, if open
+extern void CloseGameStreamDump(void)
+{
+  if (_bStreamDumpOpen) {
+    _strmStreamDump.Close();
+    _bStreamDumpOpen = FALSE;
+  }
+}
+
+// append first part of an unpacked game stream message, that was sent, to the dump if dumping is on
+// (message holds the batch as it was tried last, and given size is how much of it was sent)
+extern void DumpGameStreamBlocks(const CNetworkMessage &nmBlocks, SLONG slSentSize)
+{
+  extern INDEX net_bDumpStreamBlocks;
+  if (!net_bDumpStreamBlocks) {
+    CloseGameStreamDump();
+    return;
+  }
+  try {
+    if (!_bStreamDumpOpen) {
+      _strmStreamDump.Create_t(CTString(STREAMDUMP_FILE));
+      _strmStreamDump.WriteID_t("GSDM");
+      _bStreamDumpOpen = TRUE;
+    }
+    SLONG slSize = slSentSize-sizeof(UBYTE);
+    if (slSize<=0) {
+      return;
+    }
+    _strmStreamDump<<slSize;
+    _strmStreamDump.Write_t(nmBlocks.nm_pubMessage+sizeof(UBYTE), slSize);
+  } catch (char *strError) {
+    CPrintF(TRANS("Cannot dump game stream: %s\n"), strError);
+    CloseGameStreamDump();
+    net_bDumpStreamBlocks = 0;
+  }
+}
+
+// messages read from a game stream dump
+class CGameStreamDump {
+public:
+  CTString gsd_strFile;
+  UBYTE *gsd_pubMessages;               // all messages one after another
+  CStaticStackArray<SLONG> gsd_aslOffsets;
+  CStaticStackArray<SLONG> gsd_aslSizes;
+  SLONG gsd_slTotalSize;
+  SLONG gsd_slMaxSize;
+  CGameStreamDump(void) { gsd_pubMessages = NULL; gsd_slTotalSize = 0; gsd_slMaxSize = 0; };
+  ~CGameStreamDump(void) { if (gsd_pubMessages!=NULL) { FreeMemory(gsd_pubMessages); } };
+  // read all messages from given dump (last one if no name given), report and return FALSE if failed
+  BOOL Read(const CTString &strDumpFile);
+};
+
+BOOL CGameStreamDump::Read(const CTString &strDumpFile)
+{
+  // stop dumping, so that the file is complete
+  extern INDEX net_bDumpStreamBlocks;
+  CloseGameStreamDump();
+  net_bDumpStreamBlocks = 0;
+
+  CTString &strFile = gsd_strFile;
+  strFile = strDumpFile;
+  if (strFile=="") {
+    strFile = STREAMDUMP_FILE;
+  }
+
+  // read all messages
+  CStaticStackArray<SLONG> &aslOffsets = gsd_aslOffsets;
+  CStaticStackArray<SLONG> &aslSizes = gsd_aslSizes;
+  UBYTE *&pubMessages = gsd_pubMessages;
+  SLONG &slTotalSize = gsd_slTotalSize;
+  SLONG &slMaxSize = gsd_slMaxSize;
+  try {
+    CTFileStream strm;
+    strm.Open_t(CTString(strFile));
+    strm.ExpectID_t("GSDM");
+    pubMessages = (UBYTE*)AllocMemory(ClampDn(strm.GetStreamSize(), 1L));
+    while (!strm.AtEOF()) {
+      SLONG slSize;
+      strm>>slSize;
+      if (slSize<0 || slSize>MAX_NETWORKMESSAGE_SIZE) {
+        ThrowF_t(TRANS("Invalid message size %d"), slSize);
+      }
+      strm.Read_t(pubMessages+slTotalSize, slSize);
+      aslOffsets.Push() = slTotalSize;
+      aslSizes.Push() = slSize;
+      slTotalSize += slSize;
+      slMaxSize = Max(slMaxSize, slSize);
+    }
+  } catch (char *strError) {
+    CPrintF(TRANS("Cannot read game stream dump '%s': %s\n"), (const char*)strFile, strError);
+    return FALSE;
+  }
+  const INDEX ctMessages = aslSizes.Count();
+  if (ctMessages==0) {
+    CPrintF(TRANS("Game stream dump '%s' is empty.\n"), (const char*)strFile);
+    return FALSE;
+  }
+  CPrintF(TRANS("%d game stream messages, %d bytes (%.1f bytes per message)\n"),
+    ctMessages, slTotalSize, FLOAT(slTotalSize)/ctMessages);
+  return TRUE;
+}
+
+#define BENCHMARK_PASSES 5
+
+// pack and unpack all messages from a game stream dump with each codec,
+// check that they unpack to the original and report sizes and speeds
+extern void BenchmarkCompression(const CTString &strDumpFile)
+{
+  CGameStreamDump gsd;
+  if (!gsd.Read(strDumpFile)) {
+    return;
+  }
+  const UBYTE *pubMessages = gsd.gsd_pubMessages;
+  const CStaticStackArray<SLONG> &aslOffsets = gsd.gsd_aslOffsets;
+  const CStaticStackArray<SLONG> &aslSizes = gsd.gsd_aslSizes;
+  const SLONG slTotalSize = gsd.gsd_slTotalSize;
+  const SLONG slMaxSize = gsd.gsd_slMaxSize;
+  const INDEX ctMessages = aslSizes.Count();
+
+  if (!_cdGameStream.IsSet()) {
+    MakeGameStreamDictionary();
+  }
+  CLZCompressor compLZ;
+  CzlibCompressor compzlib;
+  CDictCompressor compDict(&_cdGameStream);
+  CCompressor *apcomp[3] = { &compLZ, &compzlib, &compDict };
+  const char *astrNames[3] = { "LZ", "zlib", "dictionary" };
+
+  UBYTE *pubUnpacked = (UBYTE*)AllocMemory(slMaxSize+1);
+  for (INDEX iCodec=0; iCodec<3; iCodec++) {
+    CCompressor &comp = *apcomp[iCodec];
+    // each message gets its own room in the packed buffer
+    CStaticStackArray<SLONG> aslPackedOffsets;
+    CStaticStackArray<SLONG> aslPackedSizes;
+    SLONG slPackedRoom = 0;
+    INDEX iMsg;
+    for (iMsg=0; iMsg<ctMessages; iMsg++) {
+      aslPackedOffsets.Push() = slPackedRoom;
+      aslPackedSizes.Push() = 0;
+      slPackedRoom += comp.NeededDestinationSize(aslSizes[iMsg]);
+    }
+    UBYTE *pubPacked = (UBYTE*)AllocMemory(ClampDn(slPackedRoom, 1L));
+
+    DOUBLE dPackSeconds = 1E10, dUnpackSeconds = 1E10;
+    SLONG slPackedTotal = 0;
+    INDEX ctFailed = 0;
+    for (INDEX iPass=0; iPass<BENCHMARK_PASSES; iPass++) {
+      CTimerValue tvStart = _pTimer->GetHighPrecisionTimer();
+      for (iMsg=0; iMsg<ctMessages; iMsg++) {
+        SLONG slPacked = comp.NeededDestinationSize(aslSizes[iMsg]);
+        if (!comp.Pack(pubMessages+aslOffsets[iMsg], aslSizes[iMsg], pubPacked+aslPackedOffsets[iMsg], slPacked)) {
+          slPacked = -1;
+        }
+        aslPackedSizes[iMsg] = slPacked;
+      }
+      dPackSeconds = Min(dPackSeconds, (_pTimer->GetHighPrecisionTimer()-tvStart).GetSeconds());
+
+      tvStart = _pTimer->GetHighPrecisionTimer();
+      for (iMsg=0; iMsg<ctMessages; iMsg++) {
+        SLONG slUnpacked = slMaxSize+1;
+        if (aslPackedSizes[iMsg]>=0) {
+          comp.Unpack(pubPacked+aslPackedOffsets[iMsg], aslPackedSizes[iMsg], pubUnpacked, slUnpacked);
+        }
+      }
+      dUnpackSeconds = Min(dUnpackSeconds, (_pTimer->GetHighPrecisionTimer()-tvStart).GetSeconds());
+    }
+
+    // check results and sum up sizes outside of timing
+    for (iMsg=0; iMsg<ctMessages; iMsg++) {
+      SLONG slUnpacked = slMaxSize+1;
+      if (aslPackedSizes[iMsg]<0
+        || !comp.Unpack(pubPacked+aslPackedOffsets[iMsg], aslPackedSizes[iMsg], pubUnpacked, slUnpacked)
+        || slUnpacked!=aslSizes[iMsg]
+        || memcmp(pubUnpacked, pubMessages+aslOffsets[iMsg], slUnpacked)!=0) {
+        ctFailed++;
+        continue;
+      }
+      slPackedTotal += aslPackedSizes[iMsg];
+    }
+    FreeMemory(pubPacked);
+
+    const DOUBLE dMB = slTotalSize/(1024.0*1024.0);
+    CPrintF(TRANS("%-10s %8d bytes (%5.1f%%), pack %7.1f MB/s (%.2f us/msg), unpack %7.1f MB/s (%.2f us/msg)"),
+      astrNames[iCodec], slPackedTotal, slPackedTotal*100.0/slTotalSize,
+      dMB/ClampDn(dPackSeconds, 1E-9), dPackSeconds*1E6/ctMessages,
+      dMB/ClampDn(dUnpackSeconds, 1E-9), dUnpackSeconds*1E6/ctMessages);
+    if (ctFailed>0) {
+      CPrintF(TRANS(", %d messages FAILED\n"), ctFailed);
+    } else {
+      CPrintF("\n");
+    }
+  }
+  FreeMemory(pubUnpacked);
+}
+
+#define DICTTRAIN_HASHBITS 16
+
+// hash of a byte sequence as long as shortest match of dictionary compression
+static inline INDEX DictTrainHash(const UBYTE *pub)
+{
+  return INDEX((*(ULONG*)pub*2654435761UL)>>(32-DICTTRAIN_HASHBITS));
+}
+
+// make a dictionary out of pieces of given messages, that hold the byte sequences
+// which appear in most messages
+static void TrainDictionary(const CGameStreamDump &gsd, INDEX iFirst, INDEX ctMessages,
+  CStaticStackArray<UBYTE> &aubDictionary)
+{
+  const INDEX ctSequence = sizeof(ULONG);
+  // count in how many messages each sequence appears
+  CStaticArray<SLONG> aslCounts;
+  CStaticArray<INDEX> aiLastMessage;
+  aslCounts.New(1<<DICTTRAIN_HASHBITS);
+  aiLastMessage.New(1<<DICTTRAIN_HASHBITS);
+  {for (INDEX iHash=0; iHash<(1<<DICTTRAIN_HASHBITS); iHash++) {
+    aslCounts[iHash] = 0;
+    aiLastMessage[iHash] = -1;
+  }}
+  {for (INDEX iMsg=iFirst; iMsg<iFirst+ctMessages; iMsg++) {
+    const UBYTE *pub = gsd.gsd_pubMessages+gsd.gsd_aslOffsets[iMsg];
+    for (SLONG sl=0; sl+ctSequence<=gsd.gsd_aslSizes[iMsg]; sl++) {
+      INDEX iHash = DictTrainHash(pub+sl);
+      if (aiLastMessage[iHash]!=iMsg) {
+        aiLastMessage[iHash] = iMsg;
+        aslCounts[iHash]++;
+      }
+    }
+  }}
+
+  // pick best pieces one by one, and forget sequences that are in the dictionary already
+  // (sequences found in only one message are of no use, so they don't add to score)
+  CStaticStackArray<SLONG> aslPickedOffsets;
+  CStaticStackArray<SLONG> aslPickedSizes;
+  SLONG slDictionary = 0;
+  while (slDictionary<GAMESTREAMDICT_SIZE) {
+    SLONG slBestScore = 0;
+    SLONG slBestOffset = 0;
+    SLONG slBestSize = 0;
+    for (INDEX iMsg=iFirst; iMsg<iFirst+ctMessages; iMsg++) {
+      const SLONG slOffset = gsd.gsd_aslOffsets[iMsg];
+      const UBYTE *pub = gsd.gsd_pubMessages+slOffset;
+      const SLONG slSize = gsd.gsd_aslSizes[iMsg];
+      const SLONG slPiece = Min(slSize, SLONG(GAMESTREAMDICT_SEGMENT));
+      if (slPiece<ctSequence) {
+        continue;
+      }
+      // slide the piece along the message, keeping score of sequences that start in it
+      const SLONG ctInPiece = slPiece-ctSequence+1;
+      SLONG slScore = 0;
+      for (SLONG sl=0; sl+ctSequence<=slSize; sl++) {
+        slScore += ClampDn(aslCounts[DictTrainHash(pub+sl)]-1, SLONG(0));
+        if (sl>=ctInPiece) {
+          slScore -= ClampDn(aslCounts[DictTrainHash(pub+sl-ctInPiece)]-1, SLONG(0));
+        }
+        if (sl>=ctInPiece-1 && slScore>slBestScore) {
+          slBestScore = slScore;
+          slBestOffset = slOffset+sl-ctInPiece+1;
+          slBestSize = slPiece;
+        }
+      }
+    }
+    if (slBestScore==0) {
+      break;
+    }
+    slBestSize = Min(slBestSize, GAMESTREAMDICT_SIZE-slDictionary);
+    aslPickedOffsets.Push() = slBestOffset;
+    aslPickedSizes.Push() = slBestSize;
+    slDictionary += slBestSize;
+    for (SLONG sl=0; sl+ctSequence<=slBestSize; sl++) {
+      aslCounts[DictTrainHash(gsd.gsd_pubMessages+slBestOffset+sl)] = 0;
+    }
+  }
+
+  // most common pieces go last, as the most common ones should be closest to the data
+  aubDictionary.PopAll();
+  {for (INDEX iPicked=aslPickedOffsets.Count()-1; iPicked>=0; iPicked--) {
+    const SLONG slSize = aslPickedSizes[iPicked];
+    UBYTE *pubDst = aubDictionary.Push(slSize);
+    memcpy(pubDst, gsd.gsd_pubMessages+aslPickedOffsets[iPicked], slSize);
+  }}
+}
+
+// size of given messages packed with given dictionary (or -1 if any of them fails)
+static SLONG DictionaryPackedSize(const CGameStreamDump &gsd, INDEX iFirst, INDEX ctMessages,
+  CCompressionDictionary &cd)
+{
+  CDictCompressor compDict(&cd);
+  UBYTE *pubPacked = (UBYTE*)AllocMemory(compDict.NeededDestinationSize(gsd.gsd_slMaxSize));
+  SLONG slTotal = 0;
+  for (INDEX iMsg=iFirst; iMsg<iFirst+ctMessages; iMsg++) {
+    const SLONG slSize = gsd.gsd_aslSizes[iMsg];
+    SLONG slPacked = compDict.NeededDestinationSize(slSize);
+    if (!compDict.Pack(gsd.gsd_pubMessages+gsd.gsd_aslOffsets[iMsg], slSize, pubPacked, slPacked)) {
+      slTotal = -1;
+      break;
+    }
+    // as PackDefault(), send unpacked if it doesn't get any smaller
+    slTotal += Min(slPacked, slSize);
+  }
+  FreeMemory(pubPacked);
+  return slTotal;
+}
+
+// train the game stream dictionary on a game stream dump (last one if no name given) and save it
+// NOTE: it is used only between server and clients that all have the same dictionary file
+extern void TrainGameStreamDictionary(const CTString &strDumpFile)
+{
+  // dictionary must not change under a running game
+  if (_pShell->GetINDEX("pwoCurrentWorld")!=NULL) {
+    CPrintF(TRANS("Stop the game before training the game stream dictionary.\n"));
+    return;
+  }
+  CGameStreamDump gsd;
+  if (!gsd.Read(strDumpFile)) {
+    return;
+  }
+  const INDEX ctMessages = gsd.gsd_aslSizes.Count();
+  if (ctMessages<2) {
+    CPrintF(TRANS("Need at least two messages to train a dictionary.\n"));
+    return;
+  }
+
+  // see how it does on messages it wasn't trained on
+  const INDEX ctTrain = ctMessages/2;
+  const INDEX ctTest = ctMessages-ctTrain;
+  SLONG slTestSize = 0;
+  {for (INDEX iMsg=ctTrain; iMsg<ctMessages; iMsg++) {
+    slTestSize += gsd.gsd_aslSizes[iMsg];
+  }}
+  CStaticStackArray<UBYTE> aubDictionary;
+  CCompressionDictionary cdSamples;
+  CCompressionDictionary cdTrained;
+  _cdGameStream.Clear();
+  MakeSampleGameStreamDictionary();
+  cdSamples.Set(_cdGameStream.cd_pubData, _cdGameStream.cd_slSize);
+  _cdGameStream.Clear();
+  TrainDictionary(gsd, 0, ctTrain, aubDictionary);
+  if (aubDictionary.Count()>0) {
+    cdTrained.Set(&aubDictionary[0], aubDictionary.Count());
+  }
+  const SLONG slSamples = DictionaryPackedSize(gsd, ctTrain, ctTest, cdSamples);
+  const SLONG slTrained = DictionaryPackedSize(gsd, ctTrain, ctTest, cdTrained);
+  CPrintF(TRANS("Trained on first %d messages, packed last %d messages (%d bytes):\n"), ctTrain, ctTest, slTestSize);
+  CPrintF(TRANS("  sample dictionary:  %d bytes (%.1f%%)\n"), slSamples, slSamples*100.0f/slTestSize);
+  CPrintF(TRANS("  trained dictionary: %d bytes (%.1f%%)\n"), slTrained, slTrained*100.0f/slTestSize);
+
+  // train on all of them and save it
+  TrainDictionary(gsd, 0, ctMessages, aubDictionary);
+  const SLONG slSize = aubDictionary.Count();
+  if (slSize==0) {
+    CPrintF(TRANS("Nothing is common to the messages, dictionary is not saved.\n"));
+    return;
+  }
+  try {
+    CTFileStream strm;
+    strm.Create_t(CTString(GAMESTREAMDICT_FILE));
+    strm.WriteID_t("GSDC");
+    strm<<slSize;
+    strm.Write_t(&aubDictionary[0], slSize);
+  } catch (char *strError) {
+    CPrintF(TRANS("Cannot save game stream dictionary: %s\n"), strError);
+    return;
+  }
+  // it will be read from there when needed
+  _cdGameStream.Clear();
+  CPrintF(TRANS("Saved %d byte dictionary to '%s' (crc %08X), server and clients need the same file to use it.\n"),
+    slSize, GAMESTREAMDICT_FILE, GetGameStreamDictionaryCRC());
+}
+
 // dump message to console
 void CNetworkMessage::Dump(void)
 {
@@ -507,6 +1021,94 @@ void CNetworkMessage::WriteBits(const void *pvBuffer, INDEX ctBits)
   }
 }
 
+// values are compressed by preceding them with a bit sequence telling how many bits
+// are saved after that:
+//   (0)          1       = no bits follow, value is 0
+//   (1)          01      = no bits follow, value is 1
+//   (2-3)        001     = 1 bit follows, value is 1x where x is the given bit
+//   (4-15)       0001    = 4 bit value follows
+//   (16-255)     00001   = 8 bit value follows
+//   (256-65535)  000001  = 16 bit value follows
+//   (65536-)     000000  = 32 bit value follows
+// note: above bits are ordered in reverse as they come when scanning bit by bit
+
+void CNetworkMessage::WriteCode(ULONG ulValue)
+{
+  // (0)          1       = no bits follow, value is 0
+  if (ulValue==0) {
+    UBYTE ub=1;
+    WriteBits(&ub, 1);
+  // (1)          01      = no bits follow, value is 1
+  } else if (ulValue==1) {
+    UBYTE ub=2;
+    WriteBits(&ub, 2);
+  // (2-3)        001     = 1 bit follows, value is 1x where x is the given bit
+  } else if (ulValue <= 3) {
+    UBYTE ub=4;
+    WriteBits(&ub, 3);
+    WriteBits(&ulValue, 1);
+  // (4-15)       0001    = 4 bit value follows
+  } else if (ulValue <= 15) {
+    UBYTE ub=8;
+    WriteBits(&ub, 4);
+    WriteBits(&ulValue, 4);
+  // (16-255)     00001   = 8 bit value follows
+  } else if (ulValue <= 255) {
+    UBYTE ub=16;
+    WriteBits(&ub, 5);
+    WriteBits(&ulValue, 8);
+  // (256-65535)  000001  = 16 bit value follows
+  } else if (ulValue <= 65535) {
+    UBYTE ub=32;
+    WriteBits(&ub, 6);
+    WriteBits(&ulValue, 16);
+  // (65536-)     000000  = 32 bit value follows
+  } else {
+    UBYTE ub=0;
+    WriteBits(&ub, 6);
+    WriteBits(&ulValue, 32);
+  }
+}
+
+ULONG CNetworkMessage::ReadCode(void)
+{
+  // find number of zero bits
+  INDEX iZeros=0;
+  for(; iZeros<6; iZeros++) {
+    UBYTE ub=0;
+    ReadBits(&ub, 1);
+    if (ub!=0) {
+      break;
+    }
+  }
+  ULONG ulValue = 0;
+  // now read value according to the number of bits
+  // (0)          1       = no bits follow, value is 0
+  if (iZeros==0) {
+    ulValue = 0;
+  // (1)          01      = no bits follow, value is 1
+  } else if (iZeros==1) {
+    ulValue = 1;
+  // (2-3)        001     = 1 bit follows, value is 1x where x is the given bit
+  } else if (iZeros==2) {
+    ReadBits(&ulValue, 1);
+    ulValue |= 2;
+  // (4-15)       0001    = 4 bit value follows
+  } else if (iZeros==3) {
+    ReadBits(&ulValue, 4);
+  // (16-255)     00001   = 8 bit value follows
+  } else if (iZeros==4) {
+    ReadBits(&ulValue, 8);
+  // (256-65535)  000001  = 16 bit value follows
+  } else if (iZeros==5) {
+    ReadBits(&ulValue, 16);
+  // (65536-)     000000  = 32 bit value follows
+  } else {
+    ReadBits(&ulValue, 32);
+  }
+  return ulValue;
+}
+
 /////////////////////////////////////////////////////////////////////
 // CNetworkStreamBlock
 
@@ -552,13 +1154,6 @@ void CNetworkStreamBlock::WriteToMessage(CNetworkMessage &nmToWrite)
   nmToWrite.InsertSubMessage(*this);
 }
 
-/*
- * Remove the block from stream. */
-void CNetworkStreamBlock::RemoveFromStream(void)
-{
-  nsb_lnInStream.Remove();
-}
-
 /* Read/write the block from file stream. */
 void CNetworkStreamBlock::Write_t(CTStream &strm) // throw char *
 {
@@ -588,11 +1183,20 @@ void CNetworkStreamBlock::Read_t(CTStream &strm) // throw char *
 
 /////////////////////////////////////////////////////////////////////
 // CNetworkStream
+
+#define NS_MINRING 64       // initial ring size
+#define NS_MAXRING 65536    // max. span of sequences kept in one stream
+#define NS_BLOCKGRANULARITY 32  // reused block buffers are allocated in these steps
+
 /*
  * Constructor.
  */
 CNetworkStream::CNetworkStream(void)
 {
+  ns_iOldestSequence = -1;
+  ns_iNewestSequence = -1;
+  ns_ctBlocks = 0;
+  ns_pnsbRead = NULL;
 }
 
 /*
@@ -600,8 +1204,6 @@ CNetworkStream::CNetworkStream(void)
  */
 CNetworkStream::~CNetworkStream(void)
 {
-  // report number of blocks left in stream
-  //_RPT1(_CRT_WARN, "Destructing stream, %d blocks contained.\n", ns_lhBlocks.Count());
   // remove all blocks
   Clear();
 }
@@ -611,37 +1213,59 @@ CNetworkStream::~CNetworkStream(void)
  */
 void CNetworkStream::Clear(void)
 {
-  // for each block in list
-  FORDELETELIST(CNetworkStreamBlock, nsb_lnInStream, ns_lhBlocks, itnsbInList) {
-    // remove it from list
-    itnsbInList->nsb_lnInStream.Remove();
-    // delete it
-    delete &*itnsbInList;
+  // delete all blocks in the ring
+  for (INDEX i=0; i<ns_apnsbRing.Count(); i++) {
+    if (ns_apnsbRing[i]!=NULL) {
+      delete ns_apnsbRing[i];
+    }
+  }
+  ns_apnsbRing.Clear();
+  ns_iOldestSequence = -1;
+  ns_iNewestSequence = -1;
+  ns_ctBlocks = 0;
+  // delete all blocks kept for reuse
+  FORDELETELIST(CNetworkStreamBlock, nsb_lnInStream, ns_lhFree, itnsb) {
+    itnsb->nsb_lnInStream.Remove();
+    delete &*itnsb;
+  }
+  if (ns_pnsbRead!=NULL) {
+    delete ns_pnsbRead;
+    ns_pnsbRead = NULL;
   }
 }
+
 /* Copy from another network stream. */
 void CNetworkStream::Copy(CNetworkStream &nsOther)
 {
-  // for each block in list
-  FOREACHINLIST(CNetworkStreamBlock, nsb_lnInStream, nsOther.ns_lhBlocks, itnsb) {
-    // add it here
-    AddBlock(*itnsb);
+  // for each block in the other stream
+  for (INDEX iSequence=nsOther.ns_iOldestSequence; iSequence<=nsOther.ns_iNewestSequence; iSequence++) {
+    CNetworkStreamBlock *pnsb = nsOther.FindBlock(iSequence);
+    if (pnsb!=NULL) {
+      // add it here
+      PutBlock(*pnsb);
+    }
   }
 }
 
 // get number of blocks used by this object
 INDEX CNetworkStream::GetUsedBlocks(void)
 {
-  return ns_lhBlocks.Count();
+  return ns_ctBlocks;
 }
 
 // get amount of memory used by this object
 SLONG CNetworkStream::GetUsedMemory(void)
 {
-  SLONG slMem = 0;
-  // for each block in list
-  FOREACHINLIST(CNetworkStreamBlock, nsb_lnInStream, ns_lhBlocks, itnsb) {
-    // add its usage
+  SLONG slMem = ns_apnsbRing.Count()*sizeof(CNetworkStreamBlock*);
+  // for each block in the ring
+  for (INDEX i=0; i<ns_apnsbRing.Count(); i++) {
+    if (ns_apnsbRing[i]!=NULL) {
+      // add its usage
+      slMem+=sizeof(CNetworkStreamBlock)+ns_apnsbRing[i]->nm_slMaxSize;
+    }
+  }
+  // and of each block kept for reuse
+  FOREACHINLIST(CNetworkStreamBlock, nsb_lnInStream, ns_lhFree, itnsb) {
     slMem+=sizeof(CNetworkStreamBlock)+itnsb->nm_slMaxSize;
   }
   return slMem;
@@ -650,38 +1274,146 @@ SLONG CNetworkStream::GetUsedMemory(void)
 // get index of newest sequence stored
 INDEX CNetworkStream::GetNewestSequence(void)
 {
-  // if the stream is empty
-  if (ns_lhBlocks.IsEmpty()) {
-    // return dummy
-    return -1;
+  return ns_iNewestSequence;
+}
+
+// get block with given sequence, if it is in the ring
+CNetworkStreamBlock *CNetworkStream::FindBlock(INDEX iSequenceNumber)
+{
+  if (ns_ctBlocks==0 || iSequenceNumber<ns_iOldestSequence || iSequenceNumber>ns_iNewestSequence) {
+    return NULL;
   }
-  // get head of list
-  CNetworkStreamBlock *pnsb = LIST_HEAD(ns_lhBlocks, CNetworkStreamBlock, nsb_lnInStream);
-  // return its index
-  return pnsb->nsb_iSequenceNumber;
+  return ns_apnsbRing[iSequenceNumber&(ns_apnsbRing.Count()-1)];
 }
 
-/*
- * Add a block that is already allocated to the stream.
- */
-void CNetworkStream::AddAllocatedBlock(CNetworkStreamBlock *pnsbBlock)
-{
-  // search all blocks already in list
-  FOREACHINLISTKEEP(CNetworkStreamBlock, nsb_lnInStream, ns_lhBlocks, itnsbInList) {
-    // if the block in list has same sequence as the one to add
-    if (itnsbInList->nsb_iSequenceNumber == pnsbBlock->nsb_iSequenceNumber) {
-      // just discard the new block
-      delete pnsbBlock;
-      return;
+// make the ring big enough to hold given range of sequences
+BOOL CNetworkStream::ResizeRing(INDEX iOldest, INDEX iNewest)
+{
+  const INDEX ctSpan = iNewest-iOldest+1;
+  if (ctSpan>NS_MAXRING) {
+    return FALSE;
+  }
+  // if it fits already
+  INDEX ctRing = ns_apnsbRing.Count();
+  if (ctSpan<=ctRing) {
+    return TRUE;
+  }
+  // find new size (power of two, so that sequence can be masked)
+  if (ctRing==0) {
+    ctRing = NS_MINRING;
+  }
+  while (ctRing<ctSpan) {
+    ctRing*=2;
+  }
+  // move the blocks to a new ring
+  CStaticArray<CNetworkStreamBlock*> apnsbRing;
+  apnsbRing.New(ctRing);
+  for (INDEX i=0; i<ctRing; i++) {
+    apnsbRing[i] = NULL;
+  }
+  for (INDEX iOld=0; iOld<ns_apnsbRing.Count(); iOld++) {
+    CNetworkStreamBlock *pnsb = ns_apnsbRing[iOld];
+    if (pnsb!=NULL) {
+      apnsbRing[pnsb->nsb_iSequenceNumber&(ctRing-1)] = pnsb;
     }
-    // if the block in list has lower sequence than the one to add
-    if (itnsbInList->nsb_iSequenceNumber < pnsbBlock->nsb_iSequenceNumber) {
-      // stop searching
-      break;
+  }
+  ns_apnsbRing.MoveArray(apnsbRing);
+  return TRUE;
+}
+
+// put a copy of a block in the ring
+void CNetworkStream::PutBlock(const CNetworkStreamBlock &nsbBlock)
+{
+  const INDEX iSequence = nsbBlock.nsb_iSequenceNumber;
+  ASSERT(iSequence>=0);
+  // if already there
+  if (FindBlock(iSequence)!=NULL) {
+    // ignore the duplicate
+    return;
+  }
+
+  // make room for it
+  if (ns_ctBlocks==0) {
+    ResizeRing(iSequence, iSequence);
+    ns_iOldestSequence = iSequence;
+    ns_iNewestSequence = iSequence;
+  } else {
+    INDEX iOldest = Min(ns_iOldestSequence, iSequence);
+    INDEX iNewest = Max(ns_iNewestSequence, iSequence);
+    if (!ResizeRing(iOldest, iNewest)) {
+      // if it is too old to keep along with the others
+      if (iSequence<ns_iOldestSequence) {
+        // discard it
+        ASSERT(FALSE);
+        return;
+      }
+      // the stream has moved too far ahead, drop oldest blocks
+      RemoveOlderBlocksBySequence(iSequence-NS_MAXRING+1);
+      if (ns_ctBlocks==0) {
+        PutBlock(nsbBlock);
+        return;
+      }
+      BOOL bResized = ResizeRing(ns_iOldestSequence, iSequence);
+      ASSERT(bResized);
     }
+    ns_iOldestSequence = Min(ns_iOldestSequence, iSequence);
+    ns_iNewestSequence = Max(ns_iNewestSequence, iSequence);
+  }
+
+  // get a block to copy to
+  CNetworkStreamBlock *pnsb;
+  if (!ns_lhFree.IsEmpty()) {
+    pnsb = LIST_HEAD(ns_lhFree, CNetworkStreamBlock, nsb_lnInStream);
+    pnsb->nsb_lnInStream.Remove();
+  } else {
+    pnsb = new CNetworkStreamBlock;
+  }
+  // reallocate its buffer only if it is too small, or much too large
+  const SLONG slSize = nsbBlock.nm_slSize;
+  if (pnsb->nm_slMaxSize<slSize || pnsb->nm_slMaxSize>slSize*4+NS_BLOCKGRANULARITY) {
+    FreeMemory(pnsb->nm_pubMessage);
+    pnsb->nm_slMaxSize = (slSize+NS_BLOCKGRANULARITY-1)&~(NS_BLOCKGRANULARITY-1);
+    pnsb->nm_pubMessage = (UBYTE*)AllocMemory(pnsb->nm_slMaxSize);
+  }
+  // copy the block there, ready for reading
+  memcpy(pnsb->nm_pubMessage, nsbBlock.nm_pubMessage, slSize);
+  pnsb->nm_slSize = slSize;
+  pnsb->nm_pubPointer = pnsb->nm_pubMessage+sizeof(UBYTE);
+  pnsb->nm_iBit = 0;
+  pnsb->nm_mtType = nsbBlock.nm_mtType;
+  pnsb->nsb_iSequenceNumber = iSequence;
+
+  ns_apnsbRing[iSequence&(ns_apnsbRing.Count()-1)] = pnsb;
+  ns_ctBlocks++;
+}
+
+// take a block out of the ring and keep it for reuse
+void CNetworkStream::FreeBlock(INDEX iSequenceNumber)
+{
+  CNetworkStreamBlock *pnsb = FindBlock(iSequenceNumber);
+  if (pnsb==NULL) {
+    return;
+  }
+  ns_apnsbRing[iSequenceNumber&(ns_apnsbRing.Count()-1)] = NULL;
+  ns_lhFree.AddHead(pnsb->nsb_lnInStream);
+  ns_ctBlocks--;
+
+  // if it was the last one
+  if (ns_ctBlocks==0) {
+    ns_iOldestSequence = -1;
+    ns_iNewestSequence = -1;
+    return;
+  }
+  // if on the edge, move the edge to next block that is there
+  if (iSequenceNumber==ns_iOldestSequence) {
+    do {
+      ns_iOldestSequence++;
+    } while (FindBlock(ns_iOldestSequence)==NULL);
+  } else if (iSequenceNumber==ns_iNewestSequence) {
+    do {
+      ns_iNewestSequence--;
+    } while (FindBlock(ns_iNewestSequence)==NULL);
   }
-  // add the new block before current one
-  itnsbInList.InsertBeforeCurrent(pnsbBlock->nsb_lnInStream);
 }
 
 /*
@@ -689,12 +1421,7 @@ void CNetworkStream::AddAllocatedBlock(CNetworkStreamBlock *pnsbBlock)
  */
 void CNetworkStream::AddBlock(CNetworkStreamBlock &nsbBlock)
 {
-  // create a copy of the block
-  CNetworkStreamBlock *pnsbCopy = new CNetworkStreamBlock(nsbBlock);
-  // shrink it
-  pnsbCopy->Shrink();
-  // add it to the list
-  AddAllocatedBlock(pnsbCopy);
+  PutBlock(nsbBlock);
 }
 
 /*
@@ -702,14 +1429,13 @@ void CNetworkStream::AddBlock(CNetworkStreamBlock &nsbBlock)
  */
 void CNetworkStream::ReadBlock(CNetworkMessage &nmMessage)
 {
-  // create an empty block
-  CNetworkStreamBlock *pnsbRead = new CNetworkStreamBlock();
-  // read it from message
-  pnsbRead->ReadFromMessage(nmMessage);
-  // shrink it
-  pnsbRead->Shrink();
-  // add it to the list
-  AddAllocatedBlock(pnsbRead);
+  // read it to a full sized block
+  if (ns_pnsbRead==NULL) {
+    ns_pnsbRead = new CNetworkStreamBlock;
+  }
+  ns_pnsbRead->ReadFromMessage(nmMessage);
+  // add a copy to the ring
+  PutBlock(*ns_pnsbRead);
 }
 
 /*
@@ -718,59 +1444,38 @@ void CNetworkStream::ReadBlock(CNetworkMessage &nmMessage)
 CNetworkStream::Result CNetworkStream::GetBlockBySequence(
   INDEX iSequenceNumber, CNetworkStreamBlock *&pnsbBlock)
 {
-  BOOL bNewerFound = FALSE;
-  // search all blocks in list
-  FOREACHINLIST(CNetworkStreamBlock, nsb_lnInStream, ns_lhBlocks, itnsbInList) {
-    CNetworkStreamBlock &nsbInList = *itnsbInList;
-    // if the block in list has newer sequence
-    if (nsbInList.nsb_iSequenceNumber >= iSequenceNumber) {
-      // remember that at least one newer block was found
-      bNewerFound = TRUE;
-    }
-
-    // if the block in list has wanted sequence
-    if (nsbInList.nsb_iSequenceNumber == iSequenceNumber) {
-      // return it
-      pnsbBlock = itnsbInList;
-      return R_OK;
-    }
-    // if the block in list has older sequence
-    if (nsbInList.nsb_iSequenceNumber < iSequenceNumber) {
-      // stop searching
-      break;
-    }
+  pnsbBlock = FindBlock(iSequenceNumber);
+  // if found
+  if (pnsbBlock!=NULL) {
+    return R_OK;
   }
 
-  // ...if none found
-
-  // if some block of newer sequence number was found
-  if (bNewerFound) {
+  // if some block of newer sequence number is there
+  if (ns_ctBlocks>0 && ns_iNewestSequence>iSequenceNumber) {
     // return that the block is missing (probably should be resent)
-    pnsbBlock = NULL;
     return R_BLOCKMISSING;
-  // if no newer blocks were found
+  // if no newer blocks are there
   } else {
     // we assume that the wanted block is not yet received
-    pnsbBlock = NULL;
     return R_BLOCKNOTRECEIVEDYET;
   }
 }
 
+/* Remove a block from stream by its sequence number. */
+void CNetworkStream::RemoveBlockBySequence(INDEX iSequenceNumber)
+{
+  FreeBlock(iSequenceNumber);
+}
+
 // find oldest block after given one (for batching missing sequences)
 INDEX CNetworkStream::GetOldestSequenceAfter(INDEX iSequenceNumber)
 {
-  // block are sorted newer first, so we just remember the last block found
-  // until we find the given one
-  INDEX iOldest = iSequenceNumber;
-  FOREACHINLIST(CNetworkStreamBlock, nsb_lnInStream, ns_lhBlocks, itnsb) {
-    CNetworkStreamBlock &nsb = *itnsb;
-    if (nsb.nsb_iSequenceNumber<iSequenceNumber) {
-      break;
-    } else {
-      iOldest = nsb.nsb_iSequenceNumber;
+  for (INDEX iSequence=Max(iSequenceNumber, ns_iOldestSequence); iSequence<=ns_iNewestSequence; iSequence++) {
+    if (FindBlock(iSequence)!=NULL) {
+      return iSequence;
     }
   }
-  return iOldest;
+  return iSequenceNumber;
 }
 
 /*
@@ -778,14 +1483,14 @@ INDEX CNetworkStream::GetOldestSequenceAfter(INDEX iSequenceNumber)
  */
 INDEX CNetworkStream::WriteBlocksToMessage(CNetworkMessage &nmMessage, INDEX ctBlocks)
 {
-  // for given number of newest blocks in list
+  // for given number of newest blocks
   INDEX iBlock=0;
-  FOREACHINLIST(CNetworkStreamBlock, nsb_lnInStream, ns_lhBlocks, itnsbInList) {
-    // write the block to message
-    itnsbInList->WriteToMessage(nmMessage);
-    iBlock++;
-    if (iBlock>=ctBlocks) {
-      return iBlock;
+  for (INDEX iSequence=ns_iNewestSequence; iSequence>=ns_iOldestSequence && iBlock<ctBlocks; iSequence--) {
+    CNetworkStreamBlock *pnsb = FindBlock(iSequence);
+    if (pnsb!=NULL) {
+      // write the block to message
+      pnsb->WriteToMessage(nmMessage);
+      iBlock++;
     }
   }
   return iBlock;
@@ -796,35 +1501,17 @@ INDEX CNetworkStream::WriteBlocksToMessage(CNetworkMessage &nmMessage, INDEX ctB
  */
 void CNetworkStream::RemoveOlderBlocks(INDEX ctBlocksToKeep)
 {
-  // for each block in list
-  INDEX iBlock = 0;
-  FORDELETELIST(CNetworkStreamBlock, nsb_lnInStream, ns_lhBlocks, itnsbInList) {
-    iBlock++;
-    // if it is older that given count
-    if (iBlock>ctBlocksToKeep) {
-      // remove it from list
-      itnsbInList->nsb_lnInStream.Remove();
-      // delete it
-      delete &*itnsbInList;
-    }
+  while (ns_ctBlocks>ctBlocksToKeep) {
+    FreeBlock(ns_iOldestSequence);
   }
 }
 
 /* Remove all blocks with sequence older than given. */
 void CNetworkStream::RemoveOlderBlocksBySequence(INDEX iLastSequenceToKeep)
 {
-  // while there are any blocks in the list
-  while(!ns_lhBlocks.IsEmpty()) {
-    // get the tail of the list
-    CNetworkStreamBlock *pnsb = LIST_TAIL(ns_lhBlocks, CNetworkStreamBlock, nsb_lnInStream);
-    // if it is not too old
-    if (pnsb->nsb_iSequenceNumber >= iLastSequenceToKeep) {
-      // stop
-      break;
-    }
-    // remove the tail
-    delete pnsb;
-  };
+  while (ns_ctBlocks>0 && ns_iOldestSequence<iLastSequenceToKeep) {
+    FreeBlock(ns_iOldestSequence);
+  }
 }
 
 /////////////////////////////////////////////////////////////////////
@@ -857,6 +1544,30 @@ void CPlayerAction::Normalize(void)
     pf++;
   }
 }
+// round angles to steps that can be sent in short form
+void CPlayerAction::QuantizeAngles(void)
+{
+  FLOAT *pf = (FLOAT*)&pa_aRotation;
+  for (INDEX i=0; i<6; i++) {
+    if (Abs(pf[i])<32767.0f/PA_ANGLESTEPS) {
+      pf[i] = FLOAT(floor(pf[i]*PA_ANGLESTEPS+0.5f))/PA_ANGLESTEPS;
+    }
+  }
+}
+
+// check if action has same contents as the other one (timetag optional)
+BOOL CPlayerAction::IsSameAs(const CPlayerAction &pa, BOOL bTimeTag) const
+{
+  const ULONG *pul = (const ULONG*)&pa_vTranslation;
+  const ULONG *pulOther = (const ULONG*)&pa.pa_vTranslation;
+  for (INDEX i=0; i<9; i++) {
+    if (pul[i]!=pulOther[i]) {
+      return FALSE;
+    }
+  }
+  return pa_ulButtons==pa.pa_ulButtons && (!bTimeTag || pa_llCreated==pa.pa_llCreated);
+}
+
 // create a checksum value for sync-check
 void CPlayerAction::ChecksumForSync(ULONG &ulCRC)
 {
@@ -890,16 +1601,7 @@ void CPlayerAction::Lerp(const CPlayerAction &pa0, const CPlayerAction &pa1, FLO
 // - all axes (9 of them) are compressed as one bit telling whether the axis value is used
 // if that bit is ==0, then the axis value is 0.0, if it is 1, the value follows in next 32 
 // bits
-// - the flags are compressed by preceding them with a bit sequence telling how many bits
-// are saved after that:
-//   (0)          1       = no bits follow, value is 0
-//   (1)          01      = no bits follow, value is 1
-//   (2-3)        001     = 1 bit follows, value is 1x where x is the given bit
-//   (4-15)       0001    = 4 bit value follows
-//   (16-255)     00001   = 8 bit value follows
-//   (256-65535)  000001  = 16 bit value follows
-//   (65536-)     000000  = 32 bit value follows
-// note: above bits are ordered in reverse as they come when scanning bit by bit
+// - the flags are compressed with CNetworkMessage::WriteCode()
 
 /* Write an object into message. */
 CNetworkMessage &operator<<(CNetworkMessage &nm, const CPlayerAction &pa)
@@ -918,42 +1620,7 @@ CNetworkMessage &operator<<(CNetworkMessage &nm, const CPlayerAction &pa)
     }
     pul++;
   }
-  ULONG ulFlags = pa.pa_ulButtons;
-
-  // (0)          1       = no bits follow, value is 0
-  if (ulFlags==0) {
-    UBYTE ub=1;
-    nm.WriteBits(&ub, 1);
-  // (1)          01      = no bits follow, value is 1
-  } else if (ulFlags==1) {
-    UBYTE ub=2;
-    nm.WriteBits(&ub, 2);
-  // (2-3)        001     = 1 bit follows, value is 1x where x is the given bit
-  } else if (ulFlags <= 3) {
-    UBYTE ub=4;
-    nm.WriteBits(&ub, 3);
-    nm.WriteBits(&ulFlags, 1);
-  // (4-15)       0001    = 4 bit value follows
-  } else if (ulFlags <= 15) {
-    UBYTE ub=8;
-    nm.WriteBits(&ub, 4);
-    nm.WriteBits(&ulFlags, 4);
-  // (16-255)     00001   = 8 bit value follows
-  } else if (ulFlags <= 255) {
-    UBYTE ub=16;
-    nm.WriteBits(&ub, 5);
-    nm.WriteBits(&ulFlags, 8);
-  // (256-65535)  000001  = 16 bit value follows
-  } else if (ulFlags <= 65535) {
-    UBYTE ub=32;
-    nm.WriteBits(&ub, 6);
-    nm.WriteBits(&ulFlags, 16);
-  // (65536-)     000000  = 32 bit value follows
-  } else {
-    UBYTE ub=0;
-    nm.WriteBits(&ub, 6);
-    nm.WriteBits(&ulFlags, 32);
-  }
+  nm.WriteCode(pa.pa_ulButtons);
   return nm;
 }
 /* Read an object from message. */
@@ -972,49 +1639,129 @@ CNetworkMessage &operator>>(CNetworkMessage &nm, CPlayerAction &pa)
     }
     pul++;
   }
+  pa.pa_ulButtons = nm.ReadCode();
+  return nm;
+}
 
-  // find number of zero bits for flags
-  INDEX iZeros=0;
-  for(; iZeros<6; iZeros++) {
-    UBYTE ub=0;
-    nm.ReadBits(&ub, 1);
-    if (ub!=0) {
-      break;
+// delta action compression algorithm (used in all-actions blocks):
+// - each axis is preceded by one bit telling whether it has changed since last action,
+// changed translation axes follow in 32 bits, and changed angles are preceded by one bit
+// telling whether they are given as 16 bit count of 1/PA_ANGLESTEPS degree steps (1) or
+// as 32 bit float (0)
+// - buttons are preceded by one bit telling if they have changed, and if so, they follow
+// xor-ed with last buttons, compressed with CNetworkMessage::WriteCode()
+// - timetag is preceded by one bit telling if it has changed, and if so, its delta follows
+// compressed with WriteCode() if it fits (1), or raw in 64 bits (0)
+
+// get angle in short form if it can be sent so without loss
+static BOOL GetShortAngle(ULONG ulAngle, SWORD &swSteps)
+{
+  FLOAT fAngle = (FLOAT&)ulAngle;
+  if (!(Abs(fAngle)<32767.0f/PA_ANGLESTEPS)) {
+    return FALSE;
+  }
+  swSteps = (SWORD)floor(fAngle*PA_ANGLESTEPS+0.5f);
+  FLOAT fShort = FLOAT(swSteps)/PA_ANGLESTEPS;
+  return (ULONG&)fShort==ulAngle;
+}
+
+// write only fields that differ from last action (with timetag delta if requested)
+void CPlayerAction::WriteDelta(CNetworkMessage &nm, const CPlayerAction &paLast, BOOL bTimeTag) const
+{
+  const ULONG *pul = (const ULONG*)&pa_vTranslation;
+  const ULONG *pulLast = (const ULONG*)&paLast.pa_vTranslation;
+  for (INDEX i=0; i<9; i++) {
+    UBYTE ubChanged = pul[i]!=pulLast[i];
+    nm.WriteBits(&ubChanged, 1);
+    if (!ubChanged) {
+      continue;
+    }
+    // translation is always sent as is
+    if (i<3) {
+      nm.WriteBits(pul+i, 32);
+      continue;
+    }
+    SWORD swSteps;
+    UBYTE ubShort = GetShortAngle(pul[i], swSteps);
+    nm.WriteBits(&ubShort, 1);
+    if (ubShort) {
+      nm.WriteBits(&swSteps, 16);
+    } else {
+      nm.WriteBits(pul+i, 32);
     }
   }
-  ULONG ulFlags = 0;
-  // now read flags according to the number of bits
-  // (0)          1       = no bits follow, value is 0
-  if (iZeros==0) {
-    ulFlags = 0;
-  // (1)          01      = no bits follow, value is 1
-  } else if (iZeros==1) {
-    ulFlags = 1;
-  // (2-3)        001     = 1 bit follows, value is 1x where x is the given bit
-  } else if (iZeros==2) {
-    ulFlags = 0;
-    nm.ReadBits(&ulFlags, 1);
-    ulFlags |= 2;
-  // (4-15)       0001    = 4 bit value follows
-  } else if (iZeros==3) {
-    ulFlags = 0;
-    nm.ReadBits(&ulFlags, 4);
-  // (16-255)     00001   = 8 bit value follows
-  } else if (iZeros==4) {
-    ulFlags = 0;
-    nm.ReadBits(&ulFlags, 8);
-  // (256-65535)  000001  = 16 bit value follows
-  } else if (iZeros==5) {
-    ulFlags = 0;
-    nm.ReadBits(&ulFlags, 16);
-  // (65536-)     000000  = 32 bit value follows
-  } else {
-    ulFlags = 0;
-    nm.ReadBits(&ulFlags, 32);
+
+  UBYTE ubButtons = pa_ulButtons!=paLast.pa_ulButtons;
+  nm.WriteBits(&ubButtons, 1);
+  if (ubButtons) {
+    nm.WriteCode(pa_ulButtons^paLast.pa_ulButtons);
+  }
+
+  __int64 llDelta = bTimeTag ? pa_llCreated-paLast.pa_llCreated : 0;
+  UBYTE ubTimeTag = llDelta!=0;
+  nm.WriteBits(&ubTimeTag, 1);
+  if (ubTimeTag) {
+    UBYTE ubShort = llDelta>0 && llDelta<=0xFFFFFFFF;
+    nm.WriteBits(&ubShort, 1);
+    if (ubShort) {
+      nm.WriteCode((ULONG)llDelta);
+    } else {
+      nm.WriteBits(&llDelta, 64);
+    }
   }
-  pa.pa_ulButtons = ulFlags;
-  return nm;
 }
+
+// read fields written by WriteDelta() as delta packet for CPlayerTarget::ApplyActionPacket()
+void CPlayerAction::ReadDelta(CNetworkMessage &nm, const CPlayerAction &paLast)
+{
+  ULONG *pul = (ULONG*)&pa_vTranslation;
+  const ULONG *pulLast = (const ULONG*)&paLast.pa_vTranslation;
+  for (INDEX i=0; i<9; i++) {
+    pul[i] = 0;
+    UBYTE ubChanged = 0;
+    nm.ReadBits(&ubChanged, 1);
+    if (!ubChanged) {
+      continue;
+    }
+    ULONG ulValue = 0;
+    UBYTE ubShort = 0;
+    if (i>=3) {
+      nm.ReadBits(&ubShort, 1);
+    }
+    if (ubShort) {
+      SWORD swSteps = 0;
+      nm.ReadBits(&swSteps, 16);
+      FLOAT fAngle = FLOAT(swSteps)/PA_ANGLESTEPS;
+      ulValue = (ULONG&)fAngle;
+    } else {
+      nm.ReadBits(&ulValue, 32);
+    }
+    // delta packets are xor-ed into last action
+    pul[i] = ulValue^pulLast[i];
+  }
+
+  pa_ulButtons = 0;
+  UBYTE ubButtons = 0;
+  nm.ReadBits(&ubButtons, 1);
+  if (ubButtons) {
+    pa_ulButtons = nm.ReadCode();
+  }
+
+  // timetag is added to last one
+  pa_llCreated = 0;
+  UBYTE ubTimeTag = 0;
+  nm.ReadBits(&ubTimeTag, 1);
+  if (ubTimeTag) {
+    UBYTE ubShort = 0;
+    nm.ReadBits(&ubShort, 1);
+    if (ubShort) {
+      pa_llCreated = nm.ReadCode();
+    } else {
+      nm.ReadBits(&pa_llCreated, 64);
+    }
+  }
+}
+
 /* Write an object into stream. */
 CTStream &operator<<(CTStream &strm, const CPlayerAction &pa)
 {
@@ -20,6 +20,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #endif
 
 #include <Engine/Base/Lists.h>
+#include <Engine/Templates/StaticArray.h>
 #include <Engine/Math/Vector.h>
 
 // message type 
@@ -102,6 +103,10 @@ typedef enum NetworkMessageType {
   // disconnection confirmation from the client
 	MSG_REP_DISCONNECTED,
 
+  // state delta sent in chunks
+  MSG_REP_STATEDELTACHUNK,  // one chunk of state delta (server to client)
+  MSG_REQ_STATEDELTACHUNK,  // acknowledge of received chunks, or request to resend them
+
 
 } MESSAGETYPE;
 
@@ -115,6 +120,7 @@ public:
   MESSAGETYPE nm_mtType;                  // type of this message
 
 #define MAX_NETWORKMESSAGE_SIZE 2048      // max. length of message buffer
+#define NET_DICTIONARY_VERSION 3          // change when way of making game stream dictionary changes
   UBYTE *nm_pubMessage;       // the message data itself
   SLONG nm_slMaxSize;         // size of message buffer
 
@@ -148,7 +154,7 @@ public:
 
   /* Pack a message to another message (message type is left untouched). */
   void Pack(CNetworkMessage &nmPacked, CCompressor &comp);
-  void PackDefault(CNetworkMessage &nmPacked);
+  void PackDefault(CNetworkMessage &nmPacked, BOOL bAllowDictionary=FALSE);
   /* Unpack a message to another message (message type is left untouched). */
   void Unpack(CNetworkMessage &nmUnpacked, CCompressor &comp);
   void UnpackDefault(CNetworkMessage &nmUnpacked);
@@ -158,6 +164,9 @@ public:
   void Write(const void *pvBuffer, SLONG slSize);
   void ReadBits(void *pvBuffer, INDEX ctBits);
   void WriteBits(const void *pvBuffer, INDEX ctBits);
+  // read/write unsigned value preceded by prefix telling its size (small values take few bits)
+  ULONG ReadCode(void);
+  void WriteCode(ULONG ulValue);
 
   /* Read an object from message. */
   inline CNetworkMessage &operator>>(float  &f) { Read( &f, sizeof( f)); return *this; }
@@ -200,9 +209,9 @@ public:
  */
 class CNetworkStreamBlock : public CNetworkMessage {
 public:
-  CListNode nsb_lnInStream;     // node in list of blocks in stream
+  CListNode nsb_lnInStream;     // node in list of free blocks of a stream
 public:
-  INDEX nsb_iSequenceNumber;    // index for sorting in list
+  INDEX nsb_iSequenceNumber;    // index for placing in stream
 public:
   /* Constructor for receiving -- uninitialized block. */
   CNetworkStreamBlock(void);
@@ -214,9 +223,6 @@ public:
   /* Add a block to a message to send. */
   void WriteToMessage(CNetworkMessage &nmToWrite);
 
-  /* Remove the block from stream. */
-  void RemoveFromStream(void);
-
   /* Read/write the block from file stream. */
   void Read_t(CTStream &strm); // throw char *
   void Write_t(CTStream &strm); // throw char *
@@ -224,6 +230,10 @@ public:
 
 /*
  * Stream of message blocks that can be sent across network.
+ *
+ * Blocks are kept in a ring indexed by sequence number, so finding, adding and
+ * removing a block doesn't depend on how many are buffered. Removed blocks are
+ * kept for reuse, so that a stream that is running doesn't allocate memory.
  */
 class CNetworkStream {
 public:
@@ -233,10 +243,21 @@ public:
     R_BLOCKNOTRECEIVEDYET,    // block is not yet received
   };
 public:
-  CListHead ns_lhBlocks;   // list of blocks of this stream (higher sequences first)
-
-  /* Add a block that is already allocated to the stream. */
-  void AddAllocatedBlock(CNetworkStreamBlock *pnsbBlock);
+  CStaticArray<CNetworkStreamBlock*> ns_apnsbRing;  // blocks by sequence modulo ring size (NULL if none)
+  INDEX ns_iOldestSequence;   // oldest sequence in the ring (-1 if empty)
+  INDEX ns_iNewestSequence;   // newest sequence in the ring (-1 if empty)
+  INDEX ns_ctBlocks;          // number of blocks in the ring
+  CListHead ns_lhFree;        // blocks removed from the ring, for reuse
+  CNetworkStreamBlock *ns_pnsbRead;  // block for reading from messages
+
+  // get block with given sequence, if it is in the ring
+  CNetworkStreamBlock *FindBlock(INDEX iSequenceNumber);
+  // make the ring big enough to hold given range of sequences
+  BOOL ResizeRing(INDEX iOldest, INDEX iNewest);
+  // put a copy of a block in the ring
+  void PutBlock(const CNetworkStreamBlock &nsbBlock);
+  // take a block out of the ring and keep it for reuse
+  void FreeBlock(INDEX iSequenceNumber);
 public:
   /* Constructor. */
   CNetworkStream(void);
@@ -260,6 +281,8 @@ public:
   /* Get a block from stream by its sequence number. */
   CNetworkStream::Result GetBlockBySequence(
     INDEX iSequenceNumber, CNetworkStreamBlock *&pnsbBlock);
+  /* Remove a block from stream by its sequence number. */
+  void RemoveBlockBySequence(INDEX iSequenceNumber);
   // find oldest block after given one (for batching missing sequences)
   INDEX GetOldestSequenceAfter(INDEX iSequenceNumber);
 
@@ -271,6 +294,8 @@ public:
   void RemoveOlderBlocksBySequence(INDEX iLastSequenceToKeep);
 };
 
+#define PA_ANGLESTEPS 128.0f   // angles are quantized to 1/PA_ANGLESTEPS of a degree
+
 class ENGINE_API CPlayerAction {
 public:
   // order is important for compression and normalization - do not reorder!
@@ -288,6 +313,15 @@ public:
   void Clear(void);
   // normalize action (remove invalid floats like -0)
   void Normalize(void);
+  // round angles to steps that can be sent in short form
+  void QuantizeAngles(void);
+  // check if action has same contents as the other one (timetag optional)
+  BOOL IsSameAs(const CPlayerAction &pa, BOOL bTimeTag) const;
+
+  // write only fields that differ from last action (with timetag delta if requested)
+  void WriteDelta(CNetworkMessage &nm, const CPlayerAction &paLast, BOOL bTimeTag) const;
+  // read fields written by WriteDelta() as delta packet for CPlayerTarget::ApplyActionPacket()
+  void ReadDelta(CNetworkMessage &nm, const CPlayerAction &paLast);
 
   // create a checksum value for sync-check
   void ChecksumForSync(ULONG &ulCRC);
@@ -97,12 +97,10 @@ void CPlayerBuffer::ReceiveActionPacket(CNetworkMessage *pnm, INDEX iMaxBuffer)
   }
 }
 
-/* Create action packet for player target from oldest buffered action. */
-// (prepares lag info for given client number)
-void CPlayerBuffer::CreateActionPacket(CNetworkMessage *pnm, INDEX iClient)
+/* Get action to send for current tick (oldest buffered action). */
+void CPlayerBuffer::GetCurrentAction(CPlayerAction &paCurrent)
 {
   ASSERT(plb_Active);
-  CPlayerAction paCurrent;
 
   //CPrintF("Send: buffered %d\n", plb_abReceived.GetCount());
 
@@ -116,23 +114,27 @@ void CPlayerBuffer::CreateActionPacket(CNetworkMessage *pnm, INDEX iClient)
     paCurrent = plb_paLastAction;
     //CPrintF("Send: BUFFER EMPTY ---------\n");
   }
+}
 
-  // create a new delta action packet between last sent and current action
-  CPlayerAction paDelta;
-  for (INDEX i=0; i<sizeof(CPlayerAction); i++) {
-    ((UBYTE*)&paDelta)[i] = ((UBYTE*)&paCurrent)[i] ^ ((UBYTE*)&plb_paLastAction)[i];
-  }
-  // if the client that message is sent to owns the player
-  if (iClient==plb_iClient) {
-    // send delta of the timetag
-    paDelta.pa_llCreated = paCurrent.pa_llCreated-plb_paLastAction.pa_llCreated;
-  // if the client doesn't own the player
-  } else {
-    // no timetag information
-    paDelta.pa_llCreated = 0;
-  }
-  // send the delta packet
-  (*pnm)<<paDelta;
+/* Check if action for current tick is same as last one, as seen by given client. */
+BOOL CPlayerBuffer::IsActionIdle(INDEX iClient)
+{
+  CPlayerAction paCurrent;
+  GetCurrentAction(paCurrent);
+  // only the client that owns the player gets the timetag
+  return paCurrent.IsSameAs(plb_paLastAction, iClient==plb_iClient);
+}
+
+/* Create action packet for player target from oldest buffered action. */
+// (prepares lag info for given client number)
+void CPlayerBuffer::CreateActionPacket(CNetworkMessage *pnm, INDEX iClient)
+{
+  CPlayerAction paCurrent;
+  GetCurrentAction(paCurrent);
+
+  // send fields that changed since last sent action,
+  // and delta of the timetag only if the client that message is sent to owns the player
+  paCurrent.WriteDelta(*pnm, plb_paLastAction, iClient==plb_iClient);
 }
 
 /* Advance action buffer by one tick by removing oldest action. */
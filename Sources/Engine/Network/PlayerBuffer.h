@@ -51,6 +51,10 @@ public:
 
   /* Receive action packet from player source. */
   void ReceiveActionPacket(CNetworkMessage *pnm, INDEX iMaxBuffer);
+  /* Get action to send for current tick (oldest buffered action). */
+  void GetCurrentAction(CPlayerAction &paCurrent);
+  /* Check if action for current tick is same as last one, as seen by given client. */
+  BOOL IsActionIdle(INDEX iClient);
   /* Create action packet for player target from oldest buffered action. */
   // (prepares lag info for given client number)
   void CreateActionPacket(CNetworkMessage *pnm, INDEX iClient);
@@ -187,6 +187,9 @@ void CPlayerSource::WriteActionPacket(CNetworkMessage &nm)
     return;
   }
 
+  // round angles so that they can be sent in short form to other clients,
+  // and so that predicted and received actions are the same
+  pls_paAction.QuantizeAngles();
   // normalize action (remove invalid floats like -0)
   pls_paAction.Normalize();
 
@@ -52,8 +52,16 @@ extern CClientInterface cm_aciClients[SERVER_CLIENTS];
 CSessionSocket::CSessionSocket(void)
 {
   sso_bActive = FALSE;
+  sso_bStateInChunks = FALSE;
+  sso_bDictionaryCompression = FALSE;
+  sso_pubStateDelta = NULL;
+  sso_slStateDeltaSize = 0;
+  sso_slStateChunkSize = 0;
+  sso_iStateChunkAcked = 0;
+  sso_iStateChunkSent = 0;
   sso_bVIP = FALSE;
   sso_bSendStream = FALSE;
+  sso_bWaitingForState = FALSE;
   sso_iDisconnectedState = 0;
   sso_iLastSentSequence  = -1;
   sso_ctBadSyncs = 0;
@@ -63,8 +71,10 @@ CSessionSocket::CSessionSocket(void)
 CSessionSocket::~CSessionSocket(void)
 {
   sso_bActive = FALSE;
+  FreeStateDelta();
   sso_bVIP = FALSE;
   sso_bSendStream = FALSE;
+  sso_bWaitingForState = FALSE;
   sso_iLastSentSequence  = -1;
   sso_ctBadSyncs = 0;
   sso_tvLastMessageSent.Clear();
@@ -75,6 +85,10 @@ void CSessionSocket::Clear(void)
   sso_bActive = FALSE;
   sso_bVIP = FALSE;
   sso_bSendStream = FALSE;
+  sso_bWaitingForState = FALSE;
+  sso_bStateInChunks = FALSE;
+  sso_bDictionaryCompression = FALSE;
+  FreeStateDelta();
   sso_tvMessageReceived.Clear();
   sso_tmLastSyncReceived = -1.0f;
   sso_iLastSentSequence  = -1;
@@ -96,6 +110,10 @@ void CSessionSocket::Activate(void)
   sso_bActive = TRUE;
   sso_bVIP = FALSE;
   sso_bSendStream = FALSE;
+  sso_bWaitingForState = FALSE;
+  sso_bStateInChunks = FALSE;
+  sso_bDictionaryCompression = FALSE;
+  FreeStateDelta();
   sso_tvMessageReceived.Clear();
   sso_tmLastSyncReceived = -1.0f;
   sso_iLastSentSequence  = -1;
@@ -115,6 +133,10 @@ void CSessionSocket::Deactivate(void)
   sso_tvLastPingSent.Clear();
   sso_ctBadSyncs = 0;
   sso_bActive = FALSE;
+  sso_bWaitingForState = FALSE;
+  sso_bStateInChunks = FALSE;
+  sso_bDictionaryCompression = FALSE;
+  FreeStateDelta();
   sso_nsBuffer.Clear();
   sso_sspParams.Clear();
 }
@@ -122,6 +144,18 @@ BOOL CSessionSocket::IsActive(void)
 {
   return sso_bActive;
 }
+// stop sending session state data in chunks
+void CSessionSocket::FreeStateDelta(void)
+{
+  if (sso_pubStateDelta!=NULL) {
+    FreeMemory(sso_pubStateDelta);
+    sso_pubStateDelta = NULL;
+  }
+  sso_slStateDeltaSize = 0;
+  sso_slStateChunkSize = 0;
+  sso_iStateChunkAcked = 0;
+  sso_iStateChunkSent = 0;
+}
 
 extern INDEX cli_iBufferActions;
 extern INDEX cli_iMaxBPS;
@@ -177,6 +211,205 @@ CNetworkMessage &operator>>(CNetworkMessage &nm, CSessionSocketParams &ssp)
   return nm;
 }
 
+/*
+Session state for connecting clients is prepared once and then shared by all clients that
+connect while it is fresh. The state itself is written on the main thread, but making the
+delta against the default state and compressing it is done in a background thread, so the
+server keeps running meanwhile. All game stream blocks made after the state was taken are
+remembered with it, so a client that gets an older snapshot just receives more blocks.
+NOTE: DIFF_Diff_t() keeps all its data in a local context, so it may run here while main
+thread diffs or undiffs something else (e.g. BenchmarkDiff).
+*/
+class CJoinSnapshot {
+public:
+  INDEX js_iSequence;              // last processed sequence of the state (-1 if none)
+  CNetworkStream js_nsBuffer;      // game stream blocks made since the state was taken
+  CTMemoryStream *js_pstrmDefault; // default state to make delta from
+  CTMemoryStream *js_pstrmState;   // full session state
+  CTMemoryStream *js_pstrmDelta;   // delta from default state
+  CTMemoryStream *js_pstrmInfo;    // message with compressed delta, once prepared
+  SLONG js_slFullSize;
+  SLONG js_slDeltaSize;
+  CTString js_strError;            // set by the thread if preparing failed
+  HANDLE js_hThread;               // thread preparing the message (NULL when done)
+  CTimerValue js_tvPrepared;       // when the message was prepared
+
+  CJoinSnapshot(void);
+  ~CJoinSnapshot(void);
+  void Clear(void);
+  // take current session state and start preparing it
+  void Start_t(void);
+  // check if it is being prepared or it was prepared recently enough to be reused
+  BOOL IsFresh(void);
+  // check if the message is prepared
+  BOOL IsPrepared(void);
+  // free data that is no longer needed once the message is prepared
+  void FreeTemporary(void);
+};
+
+static CJoinSnapshot _jsSnapshot;
+
+CJoinSnapshot::CJoinSnapshot(void)
+{
+  js_iSequence = -1;
+  js_pstrmDefault = NULL;
+  js_pstrmState = NULL;
+  js_pstrmDelta = NULL;
+  js_pstrmInfo = NULL;
+  js_slFullSize = 0;
+  js_slDeltaSize = 0;
+  js_hThread = NULL;
+}
+
+CJoinSnapshot::~CJoinSnapshot(void)
+{
+  // NOTE: streams must be freed on main thread before this, can only wait for the thread here
+  if (js_hThread!=NULL) {
+    WaitForSingleObject(js_hThread, INFINITE);
+    CloseHandle(js_hThread);
+    js_hThread = NULL;
+  }
+}
+
+void CJoinSnapshot::FreeTemporary(void)
+{
+  ASSERT(js_hThread==NULL);
+  if (js_pstrmDefault!=NULL) { delete js_pstrmDefault; js_pstrmDefault = NULL; }
+  if (js_pstrmState  !=NULL) { delete js_pstrmState;   js_pstrmState   = NULL; }
+  if (js_pstrmDelta  !=NULL) { delete js_pstrmDelta;   js_pstrmDelta   = NULL; }
+}
+
+void CJoinSnapshot::Clear(void)
+{
+  // wait until the thread is done with the streams
+  if (js_hThread!=NULL) {
+    WaitForSingleObject(js_hThread, INFINITE);
+    CloseHandle(js_hThread);
+    js_hThread = NULL;
+  }
+  FreeTemporary();
+  if (js_pstrmInfo!=NULL) { delete js_pstrmInfo; js_pstrmInfo = NULL; }
+  js_nsBuffer.Clear();
+  js_iSequence = -1;
+  js_slFullSize = 0;
+  js_slDeltaSize = 0;
+  js_strError = "";
+}
+
+BOOL CJoinSnapshot::IsFresh(void)
+{
+  if (js_iSequence<0) {
+    return FALSE;
+  }
+  if (js_hThread!=NULL) {
+    return TRUE;
+  }
+  extern FLOAT ser_tmJoinSnapshotReuse;
+  return js_pstrmInfo!=NULL && js_strError=="" &&
+    (_pTimer->GetHighPrecisionTimer()-js_tvPrepared).GetSeconds()<=ser_tmJoinSnapshotReuse;
+}
+
+BOOL CJoinSnapshot::IsPrepared(void)
+{
+  // if thread is running
+  if (js_hThread!=NULL) {
+    // if not finished
+    if (WaitForSingleObject(js_hThread, 0)!=WAIT_OBJECT_0) {
+      return FALSE;
+    }
+    // it is done
+    CloseHandle(js_hThread);
+    js_hThread = NULL;
+    js_tvPrepared = _pTimer->GetHighPrecisionTimer();
+    FreeTemporary();
+  }
+  return js_iSequence>=0;
+}
+
+// make delta from default state and compress it
+static DWORD WINAPI PrepareJoinSnapshot(LPVOID lpParameter)
+{
+  CJoinSnapshot &js = *(CJoinSnapshot*)lpParameter;
+  try {
+    DIFF_Diff_t(js.js_pstrmDefault, js.js_pstrmState, js.js_pstrmDelta);
+    js.js_pstrmDelta->SetPos_t(0);
+    js.js_slDeltaSize = js.js_pstrmDelta->GetStreamSize();
+    CzlibCompressor comp;
+    comp.PackStream_t(*js.js_pstrmDelta, *js.js_pstrmInfo);
+  } catch (char *strError) {
+    js.js_strError = strError;
+  }
+  return 0;
+}
+
+void CJoinSnapshot::Start_t(void)
+{
+  Clear();
+  // NOTE: streams are created here, because only main thread can handle streams
+  js_pstrmDefault = new CTMemoryStream;
+  js_pstrmState = new CTMemoryStream;
+  js_pstrmDelta = new CTMemoryStream;
+  js_pstrmInfo = new CTMemoryStream;
+
+  try {
+    // write main session state
+    CSessionState &ses = _pNetwork->ga_sesSessionState;
+    ses.Write_t(js_pstrmState);
+    js_pstrmState->SetPos_t(0);
+    js_slFullSize = js_pstrmState->GetStreamSize();
+    js_iSequence = ses.ses_iLastProcessedSequence;
+    // remember all blocks that the local session didn't process yet
+    js_nsBuffer.Copy(_pNetwork->ga_srvServer.srv_assoSessions[0].sso_nsBuffer);
+
+    // copy default state, as it may change while this is prepared
+    js_pstrmDefault->Write_t(_pNetwork->ga_pubDefaultState, _pNetwork->ga_slDefaultStateSize);
+    js_pstrmDefault->SetPos_t(0);
+    *js_pstrmInfo<<INDEX(MSG_REP_STATEDELTA);
+  } catch (char *) {
+    Clear();
+    throw;
+  }
+
+  // prepare the message in background
+  DWORD dwThreadID;
+  js_hThread = CreateThread(NULL, 0, PrepareJoinSnapshot, this, 0, &dwThreadID);
+  // if cannot start the thread
+  if (js_hThread==NULL) {
+    // do it here
+    PrepareJoinSnapshot(this);
+  }
+}
+
+/* Remember a game stream block for clients that will get the shared session state. */
+static void AddBlockToJoinSnapshot(CNetworkStreamBlock &nsb)
+{
+  // if the snapshot can still be used
+  if (_jsSnapshot.IsFresh()) {
+    // the block will be needed after it
+    _jsSnapshot.js_nsBuffer.AddBlock(nsb);
+  // if it is too old
+  } else if (_jsSnapshot.js_iSequence>=0) {
+    // free it
+    _jsSnapshot.Clear();
+  }
+}
+
+// game stream batches packed in current tick, so that clients that get same blocks
+// (usually all clients that are up to date, except for their own player actions)
+// don't pack them again each
+#define SHAREDPACKS_MAX 64
+class CSharedPack {
+public:
+  ULONG sp_ulCRC;
+  INDEX sp_iCompression;
+  BOOL sp_bDictionary;
+  CNetworkMessage sp_nmUnpacked;
+  CNetworkMessage sp_nmPacked;
+  CSharedPack(void) : sp_nmUnpacked(MSG_GAMESTREAMBLOCKS), sp_nmPacked(MSG_GAMESTREAMBLOCKS) {};
+};
+static CStaticArray<CSharedPack> _aspSharedPacks;
+static INDEX _ctSharedPacks = 0;
+
 /*
  * Constructor.
  */
@@ -207,6 +440,13 @@ CServer::~CServer()
  */
 void CServer::Stop(void)
 {
+  // finish the game stream dump, if any
+  extern void CloseGameStreamDump(void);
+  CloseGameStreamDump();
+  // finish the load test, if its clients have joined
+  extern void CloseLoadTest(void);
+  CloseLoadTest();
+
   // stop gameagent
   GameAgent_ServerEnd();
 
@@ -255,6 +495,11 @@ void CServer::Stop(void)
 
   // init buffer for sync checks
   srv_ascChecks.Clear();
+  // forget shared session state
+  _jsSnapshot.Clear();
+  // forget shared packed batches
+  _aspSharedPacks.Clear();
+  _ctSharedPacks = 0;
 
   srv_bActive = FALSE;
 };
@@ -370,6 +615,44 @@ INDEX CServer::FindSyncCheck(TIME tmTick, CSyncCheck &sc)
   }
 }
 
+// pack a batch of game stream blocks, or reuse it if already packed for another client
+static void PackGameStreamBlocks(CNetworkMessage &nmBlocks, CNetworkMessage &nmPacked, BOOL bDictionary)
+{
+  extern INDEX net_iCompression;
+  ULONG ulCRC;
+  CRC_Start(ulCRC);
+  CRC_AddBlock(ulCRC, nmBlocks.nm_pubMessage, nmBlocks.nm_slSize);
+  CRC_Finish(ulCRC);
+
+  // if already packed
+  for (INDEX iPack=0; iPack<_ctSharedPacks; iPack++) {
+    CSharedPack &sp = _aspSharedPacks[iPack];
+    if (sp.sp_ulCRC==ulCRC && sp.sp_iCompression==net_iCompression && sp.sp_bDictionary==bDictionary
+      && sp.sp_nmUnpacked.nm_slSize==nmBlocks.nm_slSize
+      && memcmp(sp.sp_nmUnpacked.nm_pubMessage, nmBlocks.nm_pubMessage, nmBlocks.nm_slSize)==0) {
+      // just copy it
+      nmPacked = sp.sp_nmPacked;
+      return;
+    }
+  }
+
+  // pack it
+  nmBlocks.PackDefault(nmPacked, bDictionary);
+
+  // remember it for other clients
+  if (_aspSharedPacks.Count()==0) {
+    _aspSharedPacks.New(SHAREDPACKS_MAX);
+  }
+  if (_ctSharedPacks<SHAREDPACKS_MAX) {
+    CSharedPack &sp = _aspSharedPacks[_ctSharedPacks++];
+    sp.sp_ulCRC = ulCRC;
+    sp.sp_iCompression = net_iCompression;
+    sp.sp_bDictionary = bDictionary;
+    sp.sp_nmUnpacked = nmBlocks;
+    sp.sp_nmPacked = nmPacked;
+  }
+}
+
 /* Send one regular batch of sequences to a client. */
 void CServer::SendGameStreamBlocks(INDEX iClient)
 {
@@ -407,6 +690,8 @@ void CServer::SendGameStreamBlocks(INDEX iClient)
   // get one message for last compressed message of valid size
   CNetworkMessage nmPackedBlocks(MSG_GAMESTREAMBLOCKS);
   CNetworkMessage nmPackedBlocksNew(MSG_GAMESTREAMBLOCKS);
+  // unpacked size of the last packed message (the rest was added only to see that it doesn't fit)
+  SLONG slPackedBlocksUnpacked = 0;
 
   // repeat for max 100 sequences
   INDEX iBlocksOk = 0;
@@ -456,7 +741,7 @@ void CServer::SendGameStreamBlocks(INDEX iClient)
     // add this block to the message and pack it
     pnsbBlock->WriteToMessage(nmGameStreamBlocks);
     nmPackedBlocksNew.Reinit();
-    nmGameStreamBlocks.PackDefault(nmPackedBlocksNew);
+    PackGameStreamBlocks(nmGameStreamBlocks, nmPackedBlocksNew, sso.sso_bDictionaryCompression);
     // if some blocks written already and the batch is too large
     if (iBlocksOk>0) {
       if (iStep>0 && nmPackedBlocksNew.nm_slSize>=ctMaxBytes ||
@@ -469,6 +754,7 @@ void CServer::SendGameStreamBlocks(INDEX iClient)
     // use new pack
 //    CPrintF("added ");
     nmPackedBlocks = nmPackedBlocksNew;
+    slPackedBlocksUnpacked = nmGameStreamBlocks.nm_slSize;
     iMaxSent = Max(iMaxSent, iSequence);
     iSequence+= iStep;
     iBlocksOk++;
@@ -492,6 +778,9 @@ void CServer::SendGameStreamBlocks(INDEX iClient)
   // send the message to the client
 //  CPrintF("sent: %d=%dB\n", iBlocksOk, nmPackedBlocks.nm_slSize);
   _pNetwork->SendToClient(iClient, nmPackedBlocks);
+  // dump what was sent for codec benchmarks, if needed
+  extern void DumpGameStreamBlocks(const CNetworkMessage &nmBlocks, SLONG slSize);
+  DumpGameStreamBlocks(nmGameStreamBlocks, slPackedBlocksUnpacked);
   sso.sso_iLastSentSequence = Max(sso.sso_iLastSentSequence, iMaxSent);
   sso.sso_tvLastMessageSent = _pTimer->GetHighPrecisionTimer();
 
@@ -537,6 +826,7 @@ void CServer::ResendGameStreamBlocks(INDEX iClient, INDEX iSequence0, INDEX ctSe
   // create a package message
   CNetworkMessage nmGameStreamBlocks(MSG_GAMESTREAMBLOCKS);
   CNetworkMessage nmPackedBlocks(MSG_GAMESTREAMBLOCKS);
+  SLONG slPackedBlocksUnpacked = 0;
 
   // for each sequence
   INDEX iSequence = iSequence0;
@@ -554,7 +844,7 @@ void CServer::ResendGameStreamBlocks(INDEX iClient, INDEX iSequence0, INDEX ctSe
     CNetworkMessage nmPackedBlocksNew(MSG_GAMESTREAMBLOCKS);
     // pack it in the batch
     pnsbBlock->WriteToMessage(nmGameStreamBlocks);
-    nmGameStreamBlocks.PackDefault(nmPackedBlocksNew);
+    PackGameStreamBlocks(nmGameStreamBlocks, nmPackedBlocksNew, sso.sso_bDictionaryCompression);
     // if the batch is too large
     if (nmPackedBlocksNew.nm_slSize>512) {
       // stop
@@ -562,11 +852,14 @@ void CServer::ResendGameStreamBlocks(INDEX iClient, INDEX iSequence0, INDEX ctSe
     }
     // use new pack
     nmPackedBlocks = nmPackedBlocksNew;
+    slPackedBlocksUnpacked = nmGameStreamBlocks.nm_slSize;
   }
 
   // send the last batch of valid size
   _pfNetworkProfile.IncrementCounter(CNetworkProfile::PCI_GAMESTREAMRESENDS);
   _pNetwork->SendToClient(iClient, nmPackedBlocks);
+  extern void DumpGameStreamBlocks(const CNetworkMessage &nmBlocks, SLONG slSize);
+  DumpGameStreamBlocks(nmGameStreamBlocks, slPackedBlocksUnpacked);
   extern INDEX net_bReportMiscErrors;
   if (net_bReportMiscErrors) {
     CPrintF(TRANS(" sent %d-%d(%d - %db)\n"), 
@@ -754,6 +1047,8 @@ void CServer::ServerLoop(void)
     }
   }
 
+  // batches packed in previous tick can't be sent anymore
+  _ctSharedPacks = 0;
   // for each active session
   for(INDEX iSession=0; iSession<srv_assoSessions.Count(); iSession++) {
     CSessionSocket &sso = srv_assoSessions[iSession];
@@ -767,6 +1062,51 @@ void CServer::ServerLoop(void)
   _pfNetworkProfile.StopTimer(CNetworkProfile::PTI_SERVER_LOOP);
 }
 
+// write run of players whose actions didn't change
+// (all-actions block holds a 0 bit and run length-1, or a 1 bit and delta action for each player)
+static void WriteIdleRun(CNetworkMessage &nm, INDEX ctIdle)
+{
+  if (ctIdle>0) {
+    UBYTE ubAction = 0;
+    nm.WriteBits(&ubAction, 1);
+    nm.WriteCode(ctIdle-1);
+  }
+}
+
+// write actions of all players for one tick, as seen by given session
+void CServer::MakeAllActionsForSession(CNetworkStreamBlock &nsbAllActions, INDEX iSession)
+{
+  // write time there
+  nsbAllActions<<srv_tmLastProcessedTick;
+
+  // for all players in game
+  INDEX iPlayer = 0;
+  INDEX ctIdle = 0;
+  FOREACHINSTATICARRAY(srv_aplbPlayers, CPlayerBuffer, itplb) {
+    // if player is active
+    if (itplb->IsActive()) {
+// player indices transmission is unneccessary unless if debugging
+//            // write its index
+//            nsbAllActions<<iPlayer;
+      // if its action didn't change
+      if (itplb->IsActionIdle(iSession)) {
+        // just count it
+        ctIdle++;
+      } else {
+        // write run of idle players before it, if any
+        WriteIdleRun(nsbAllActions, ctIdle);
+        ctIdle = 0;
+        // write its action
+        UBYTE ubAction = 1;
+        nsbAllActions.WriteBits(&ubAction, 1);
+        itplb->CreateActionPacket(&nsbAllActions, iSession);
+      }
+    }
+    iPlayer++;
+  }
+  WriteIdleRun(nsbAllActions, ctIdle);
+}
+
 // make allaction messages for one tick
 void CServer::MakeAllActions(void)
 {
@@ -774,6 +1114,11 @@ void CServer::MakeAllActions(void)
   srv_tmLastProcessedTick += _pTimer->TickQuantum;
   srv_iLastProcessedSequence++;
 
+  // all-actions message is same for all sessions that don't own any players (observers),
+  // so it is made only once for them
+  CNetworkStreamBlock nsbObserverActions(MSG_SEQ_ALLACTIONS, srv_iLastProcessedSequence);
+  MakeAllActionsForSession(nsbObserverActions, -1);
+
   // for each active session
   for(INDEX iSession=0; iSession<srv_assoSessions.Count(); iSession++) {
     CSessionSocket &sso = srv_assoSessions[iSession];
@@ -781,27 +1126,26 @@ void CServer::MakeAllActions(void)
       continue;
     }
 
-    // create all-actions message
-    CNetworkStreamBlock nsbAllActions(MSG_SEQ_ALLACTIONS, srv_iLastProcessedSequence);
-    // write time there
-    nsbAllActions<<srv_tmLastProcessedTick;
-
-    // for all players in game
-    INDEX iPlayer = 0;
-    FOREACHINSTATICARRAY(srv_aplbPlayers, CPlayerBuffer, itplb) {
-      // if player is active
-      if (itplb->IsActive()) {
-  // player indices transmission is unneccessary unless if debugging
-  //            // write its index
-  //            nsbAllActions<<iPlayer;
-        // write its action
-        itplb->CreateActionPacket(&nsbAllActions, iSession);
+    // if the session has no players
+    if (MaskOfPlayersOnClient(iSession)==0) {
+      // use the common message
+      sso.sso_nsBuffer.AddBlock(nsbObserverActions);
+      if (iSession==0) {
+        AddBlockToJoinSnapshot(nsbObserverActions);
       }
-      iPlayer++;
+      continue;
     }
 
+    // create all-actions message
+    CNetworkStreamBlock nsbAllActions(MSG_SEQ_ALLACTIONS, srv_iLastProcessedSequence);
+    MakeAllActionsForSession(nsbAllActions, iSession);
+
     // add the all-actions block to the buffer
     sso.sso_nsBuffer.AddBlock(nsbAllActions);
+    // clients that connect later get the same blocks as the local session
+    if (iSession==0) {
+      AddBlockToJoinSnapshot(nsbAllActions);
+    }
   }
 
   // for all players in game
@@ -827,6 +1171,8 @@ void CServer::AddBlockToAllSessions(CNetworkStreamBlock &nsb)
     // add the block to the buffer
     sso.sso_nsBuffer.AddBlock(nsb);
   }
+  // clients that connect later will need it too
+  AddBlockToJoinSnapshot(nsb);
 }
 
 /* Send initialization info to local client. */
@@ -842,6 +1188,8 @@ void CServer::ConnectLocalSessionState(INDEX iClient, CNetworkMessage &nm)
   nmInitMainServer<<srv_iLastProcessedSequence;
   sso.sso_ctLocalPlayers = -1;
   nm>>sso.sso_sspParams;
+  // local session state is always of the same version
+  sso.sso_bDictionaryCompression = TRUE;
 
   // send him server session state initialization message
   _pNetwork->SendToClientReliable(iClient, nmInitMainServer);
@@ -988,6 +1336,18 @@ void CServer::ConnectRemoteSessionState(INDEX iClient, CNetworkMessage &nm)
   sso.sso_ctLocalPlayers = ctWantedLocalPlayers;
   sso.sso_bVIP = bAutorizedAsVIP;
   nm>>sso.sso_sspParams;
+  // newer clients tell that they can unpack game stream with preset dictionary, and which one they have
+  if (!nm.EndOfMessage()) {
+    INDEX iTag, iVersion;
+    nm>>iTag>>iVersion;
+    sso.sso_bDictionaryCompression = FALSE;
+    if (iTag=='DICT' && iVersion==NET_DICTIONARY_VERSION) {
+      ULONG ulCRC;
+      nm>>ulCRC;
+      extern ULONG GetGameStreamDictionaryCRC(void);
+      sso.sso_bDictionaryCompression = ulCRC==GetGameStreamDictionaryCRC();
+    }
+  }
 
   // try to
   try {
@@ -1022,70 +1382,156 @@ void CServer::SendSessionStateData(INDEX iClient)
   ASSERT(iClient>0);
   // find session of this client
   CSessionSocket &sso = srv_assoSessions[iClient];
-  // copy its buffer from local session state
-  sso.sso_nsBuffer.Copy(srv_assoSessions[0].sso_nsBuffer);
 
-  // try to
-  try {
-    // prepare files or memory streams for connection info
-    CTFileStream strmStateFile; CTMemoryStream strmStateMem;
-    CTFileStream strmDeltaFile; CTMemoryStream strmDeltaMem;
-    CTStream *pstrmState; CTMemoryStream *pstrmDelta;
-    extern INDEX net_bDumpConnectionInfo;
-
-    UBYTE* pubSrc = NULL;
-    /*if (net_bDumpConnectionInfo) {
-      strmStateFile.Create_t(CTString("Temp\\State.bin"));
-      strmDeltaFile.Create_t(CTString("Temp\\Delta.bin"));
-      pstrmState = &strmStateFile;
-      pstrmDelta = &strmDeltaFile;
-    } else {*/
-      pstrmState = &strmStateMem;
-      pstrmDelta = &strmDeltaMem;
-
-      pubSrc = strmDeltaMem.mstrm_pubBuffer + strmDeltaMem.mstrm_slLocation;
-    //}
-
-    ASSERT(pubSrc != NULL);
+  // if there is no snapshot that can be shared
+  if (!_jsSnapshot.IsFresh()) {
+    // try to
+    try {
+      // take a new one
+      _jsSnapshot.Start_t();
+    // if failed
+    } catch (char *strError) {
+      // deactivate it
+      sso.Deactivate();
 
-    // write main session state
-    _pNetwork->ga_sesSessionState.Write_t(pstrmState);
-    pstrmState->SetPos_t(0);
-    SLONG slFullSize = pstrmState->GetStreamSize();
+      // report error
+      CPrintF(TRANS("Server: Cannot prepare connection data: %s\n"), strError);
+      return;
+    }
+  }
 
-    CTMemoryStream strmInfo;
-    strmInfo<<INDEX(MSG_REP_STATEDELTA);
-
-    // compress it to another one, using delta from original
-    CTMemoryStream strmDefaultState;
-    strmDefaultState.Write_t
-      (_pNetwork->ga_pubDefaultState, _pNetwork->ga_slDefaultStateSize);
-    strmDefaultState.SetPos_t(0);
-    DIFF_Diff_t(&strmDefaultState, pstrmState, pstrmDelta);
-    pstrmDelta->SetPos_t(0);
-    SLONG slDeltaSize = pstrmDelta->GetStreamSize();
-    CzlibCompressor comp;
-    comp.PackStream_t(*pstrmDelta, strmInfo);
+  // send it when ready
+  sso.sso_bWaitingForState = TRUE;
+  SendPreparedSessionStateData();
+}
 
-    SLONG slSize = strmInfo.GetStreamSize();
+/* Send session state data to clients that wait for it, if it is prepared. */
+void CServer::SendPreparedSessionStateData(void)
+{
+  // if not prepared yet
+  if (!_jsSnapshot.IsPrepared()) {
+    return;
+  }
+
+  // for each remote session
+  for(INDEX iClient=1; iClient<srv_assoSessions.Count(); iClient++) {
+    CSessionSocket &sso = srv_assoSessions[iClient];
+    // if not waiting for the state
+    if (!sso.IsActive() || !sso.sso_bWaitingForState) {
+      continue;
+    }
+    sso.sso_bWaitingForState = FALSE;
+
+    // if failed to prepare it
+    if (_jsSnapshot.js_strError!="") {
+      // deactivate it
+      sso.Deactivate();
+
+      // report error
+      CPrintF(TRANS("Server: Cannot prepare connection data: %s\n"),
+        (const char*)_jsSnapshot.js_strError);
+      continue;
+    }
+
+    // give it all blocks since the state was taken
+    sso.sso_nsBuffer.Copy(_jsSnapshot.js_nsBuffer);
+
+    extern INDEX ser_iStateChunkSize;
+    // if client can receive the state in chunks
+    if (sso.sso_bStateInChunks && ser_iStateChunkSize>0) {
+      // keep a copy of the data without message id, so it doesn't depend on the snapshot
+      void *pvInfo;
+      SLONG slInfo;
+      _jsSnapshot.js_pstrmInfo->LockBuffer(&pvInfo, &slInfo);
+      sso.FreeStateDelta();
+      sso.sso_slStateDeltaSize = slInfo-sizeof(INDEX);
+      sso.sso_pubStateDelta = (UBYTE*)AllocMemory(sso.sso_slStateDeltaSize);
+      memcpy(sso.sso_pubStateDelta, (UBYTE*)pvInfo+sizeof(INDEX), sso.sso_slStateDeltaSize);
+      _jsSnapshot.js_pstrmInfo->UnlockBuffer();
+      sso.sso_slStateChunkSize = Clamp(ser_iStateChunkSize, INDEX(1024), INDEX(1024*1024));
+      // start sending the chunks
+      SendStateDeltaChunks(iClient);
+    // if not
+    } else {
+      // send the whole stream to the remote session state
+      _pNetwork->SendToClientReliable(iClient, *_jsSnapshot.js_pstrmInfo);
+    }
 
-    // send the stream to the remote session state
-    _pNetwork->SendToClientReliable(iClient, strmInfo);
-  
     CPrintF(TRANS("Server: Sent connection data to '%s' (%dk->%dk->%dk)\n"),
       (const char*)_cmiComm.Server_GetClientName(iClient), 
-      slFullSize/1024, slDeltaSize/1024, slSize/1024);
-    if (net_bDumpConnectionInfo) {
-      CPrintF(TRANS("Server: Connection data dumped.\n"));
+      _jsSnapshot.js_slFullSize/1024, _jsSnapshot.js_slDeltaSize/1024,
+      _jsSnapshot.js_pstrmInfo->GetStreamSize()/1024);
+  }
+
+  // if failed, don't try to reuse it
+  if (_jsSnapshot.js_strError!="") {
+    _jsSnapshot.Clear();
+  }
+}
+
+/* Send more chunks of session state data to a client, as much as it has acknowledged. */
+void CServer::SendStateDeltaChunks(INDEX iClient)
+{
+  CSessionSocket &sso = srv_assoSessions[iClient];
+  if (sso.sso_pubStateDelta==NULL) {
+    return;
+  }
+
+  extern INDEX ser_iStateChunkWindow;
+  const SLONG slChunkSize = sso.sso_slStateChunkSize;
+  const INDEX ctChunks = (sso.sso_slStateDeltaSize+slChunkSize-1)/slChunkSize;
+  const INDEX ctWindow = Clamp(ser_iStateChunkWindow, INDEX(1), INDEX(64));
+
+  // buffer for one chunk message with header:
+  // message id, chunk index, number of chunks, total size, chunk crc
+  const SLONG slHeader = 4*sizeof(INDEX)+sizeof(ULONG);
+  UBYTE *pubMessage = NULL;
+
+  // while there are chunks that client should get now
+  while (sso.sso_iStateChunkSent<ctChunks && sso.sso_iStateChunkSent<sso.sso_iStateChunkAcked+ctWindow) {
+    if (pubMessage==NULL) {
+      pubMessage = (UBYTE*)AllocMemory(slHeader+slChunkSize);
     }
+    // get the chunk
+    const INDEX iChunk = sso.sso_iStateChunkSent;
+    const UBYTE *pubChunk = sso.sso_pubStateDelta+iChunk*slChunkSize;
+    const SLONG slChunk = Min(slChunkSize, sso.sso_slStateDeltaSize-iChunk*slChunkSize);
+    ULONG ulCRC;
+    CRC_Start(ulCRC);
+    CRC_AddBlock(ulCRC, (UBYTE*)pubChunk, slChunk);
+    CRC_Finish(ulCRC);
+
+    // make the message
+    INDEX *piHeader = (INDEX*)pubMessage;
+    piHeader[0] = MSG_REP_STATEDELTACHUNK;
+    piHeader[1] = iChunk;
+    piHeader[2] = ctChunks;
+    piHeader[3] = sso.sso_slStateDeltaSize;
+    *(ULONG*)(pubMessage+4*sizeof(INDEX)) = ulCRC;
+    memcpy(pubMessage+slHeader, pubChunk, slChunk);
 
-  // if failed
-  } catch (char *strError) {
-    // deactivate it
-    sso.Deactivate();
+    // send it
+    _pNetwork->SendToClientReliable(iClient, pubMessage, slHeader+slChunk);
+    sso.sso_iStateChunkSent++;
+  }
 
-    // report error
-    CPrintF(TRANS("Server: Cannot prepare connection data: %s\n"), strError);
+  if (pubMessage!=NULL) {
+    FreeMemory(pubMessage);
+  }
+}
+
+/* Forget shared session state, because it is no longer valid. */
+void CServer::InvalidateJoinSnapshot(void)
+{
+  _jsSnapshot.Clear();
+
+  // clients that were waiting for it cannot get it anymore
+  for(INDEX iClient=1; iClient<srv_assoSessions.Count(); iClient++) {
+    CSessionSocket &sso = srv_assoSessions[iClient];
+    if (sso.IsActive() && sso.sso_bWaitingForState) {
+      sso.sso_bWaitingForState = FALSE;
+      SendDisconnectMessage(iClient, TRANS("Level change in progress. Please retry."));
+    }
   }
 }
 
@@ -1105,6 +1551,13 @@ void CServer::HandleAll()
     // handle all of its messages
     HandleAllForAClient(iClient);
   }}
+
+  // send session state to connecting clients if it was prepared meanwhile
+  SendPreparedSessionStateData();
+  // send more of the session state to clients that receive it in chunks
+  {for( INDEX iClient=1; iClient<srv_assoSessions.Count(); iClient++) {
+    SendStateDeltaChunks(iClient);
+  }}
 }
 
 
@@ -1250,8 +1703,42 @@ void CServer::Handle(INDEX iClient, CNetworkMessage &nmMessage)
   // if remote server asks for data
   case MSG_REQ_STATEDELTA: {
     CPrintF(TRANS("Sending statedelta response\n"));
+    // newer clients tell that they can receive the state in chunks
+    sso.sso_bStateInChunks = FALSE;
+    if (!nmMessage.EndOfMessage()) {
+      INDEX iTag;
+      nmMessage>>iTag;
+      sso.sso_bStateInChunks = iTag=='CHNK';
+    }
     SendSessionStateData(iClient);
     } break;
+  // if client received some chunks of the state, or wants them resent
+  case MSG_REQ_STATEDELTACHUNK: {
+    INDEX iNextChunk;
+    UBYTE ubResend;
+    nmMessage>>iNextChunk>>ubResend;
+    // if not sending the state to it
+    if (sso.sso_pubStateDelta==NULL) {
+      // ignore
+      break;
+    }
+    const SLONG slChunkSize = sso.sso_slStateChunkSize;
+    const INDEX ctChunks = (sso.sso_slStateDeltaSize+slChunkSize-1)/slChunkSize;
+    iNextChunk = Clamp(iNextChunk, INDEX(0), ctChunks);
+    // if all received
+    if (iNextChunk>=ctChunks) {
+      // done with it
+      sso.FreeStateDelta();
+      break;
+    }
+    // if client wants the chunks resent from there, and those sent are not still on their way
+    if (ubResend && !_cmiComm.Server_IsReliableQueued(iClient)) {
+      // continue sending from there
+      sso.sso_iStateChunkSent = iNextChunk;
+    }
+    sso.sso_iStateChunkAcked = iNextChunk;
+    SendStateDeltaChunks(iClient);
+    } break;
   // if player asks for registration
   case MSG_REQ_CONNECTPLAYER: {
 
@@ -1389,7 +1876,11 @@ void CServer::Handle(INDEX iClient, CNetworkMessage &nmMessage)
 
       // read sync check from the packet
       CSyncCheck scRemote;
-      nmMessage.Read(&scRemote, sizeof(scRemote));
+      nmMessage>>scRemote.sc_tmTick>>scRemote.sc_iSequence>>scRemote.sc_ulCRC>>scRemote.sc_iLevel;
+      // branch checksums are there only if all entities are checked
+      if (_pNetwork->ga_sesSessionState.ses_iExtensiveSyncCheck>1) {
+        nmMessage.Read(scRemote.sc_aulBranchCRCs, sizeof(scRemote.sc_aulBranchCRCs));
+      }
     
       // try to find it in buffer
       CSyncCheck scLocal;
@@ -1411,6 +1902,16 @@ void CServer::Handle(INDEX iClient, CNetworkMessage &nmMessage)
           if( ser_bReportSyncBad) {
             CPrintF( TRANS("SYNCBAD: Client '%s', Sequence %d Tick %.2f - bad %d\n"), 
               _cmiComm.Server_GetClientName(iClient), scRemote.sc_iSequence , scRemote.sc_tmTick, sso.sso_ctBadSyncs);
+            // report entity branches that differ (if all entities were checked)
+            ULONG ulBadBranches = 0;
+            for (INDEX iBranch=0; iBranch<SYNC_BRANCHES; iBranch++) {
+              if (scLocal.sc_aulBranchCRCs[iBranch]!=scRemote.sc_aulBranchCRCs[iBranch]) {
+                ulBadBranches |= 1UL<<iBranch;
+              }
+            }
+            if (ulBadBranches!=0) {
+              CPrintF( TRANS("  bad entity branches: 0x%04X\n"), ulBadBranches);
+            }
           }
           if (ser_iKickOnSyncBad>0) {
             if (sso.sso_ctBadSyncs>=ser_iKickOnSyncBad) {
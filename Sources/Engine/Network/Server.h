@@ -67,6 +67,10 @@ public:
   void ConnectRemoteSessionState(INDEX iClient, CNetworkMessage &nm);
   /* Send session state data to remote client. */
   void SendSessionStateData(INDEX iClient);
+  /* Send session state data to clients that wait for it, if it is prepared. */
+  void SendPreparedSessionStateData(void);
+  /* Send more chunks of session state data to a client, as much as it has acknowledged. */
+  void SendStateDeltaChunks(INDEX iClient);
 
   /* Send one regular batch of sequences to a client. */
   void SendGameStreamBlocks(INDEX iClient);
@@ -80,6 +84,8 @@ public:
 
   // make allaction messages for one tick
   void MakeAllActions(void);
+  // write actions of all players for one tick, as seen by given session
+  void MakeAllActionsForSession(CNetworkStreamBlock &nsbAllActions, INDEX iSession);
   // add a block to streams for all sessions
   void AddBlockToAllSessions(CNetworkStreamBlock &nsb);
   // find a mask of all players on a certain client
@@ -98,6 +104,8 @@ public:
   void ServerLoop(void);
   /* Make synchronization test message and add it to game stream. */
   void MakeSynchronisationCheck(void);
+  /* Forget shared session state, because it is no longer valid. */
+  void InvalidateJoinSnapshot(void);
 
   /* Handle incoming network messages. */
   void HandleAll();
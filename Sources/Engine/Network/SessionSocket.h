@@ -46,6 +46,14 @@ class CSessionSocket {
 public:
   BOOL sso_bActive;
   BOOL sso_bSendStream;
+  BOOL sso_bWaitingForState;  // set while waiting for session state data to be prepared
+  BOOL sso_bStateInChunks;    // set if client can receive session state data in chunks
+  BOOL sso_bDictionaryCompression;  // set if client can unpack game stream with preset dictionary
+  UBYTE *sso_pubStateDelta;   // session state data being sent in chunks (NULL if none)
+  SLONG sso_slStateDeltaSize;
+  SLONG sso_slStateChunkSize;
+  INDEX sso_iStateChunkAcked; // number of chunks that client has received
+  INDEX sso_iStateChunkSent;  // number of chunks sent so far
   CTimerValue sso_tvMessageReceived;
   TIME sso_tmLastSyncReceived;
   INDEX sso_iDisconnectedState;
@@ -64,6 +72,8 @@ public:
   void Activate(void);
   void Deactivate(void);
   BOOL IsActive(void);
+  // stop sending session state data in chunks
+  void FreeStateDelta(void);
 };
 
 
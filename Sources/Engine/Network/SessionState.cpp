@@ -25,6 +25,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <Engine/Base/ProgressHook.h>
 #include <Engine/Base/CRCTable.h>
 #include <Engine/Base/Shell.h>
+#include <Engine/Base/Jobs.h>
 #include <Engine/Network/SessionState.h>
 #include <Engine/Network/PlayerSource.h>
 #include <Engine/Entities/EntityClass.h>
@@ -41,6 +42,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include <Engine/Templates/DynamicContainer.cpp>
 #include <Engine/Templates/StaticArray.cpp>
+#include <Engine/Templates/StaticStackArray.cpp>
 #include <Engine/Base/ListIterator.inl>
 #include <Engine/Base/CRC.h>
 
@@ -102,6 +104,9 @@ CSessionState::CSessionState(void)
   ses_tmPredictionHeadTick = -2.0f;
   ses_tmLastSyncCheck = 0;
   ses_tmLastPredictionProcessed = -200;
+  ses_ctPredictedSteps = 0;
+  ses_ulPredictedRandomSeed = 0;
+  ses_ulPredictedEntityID = 0;
 
   ses_bPause = FALSE;
   ses_bWantPause = FALSE;
@@ -327,6 +332,8 @@ void CSessionState::Start_AtClient_t(INDEX ctLocalPlayers)     // throw char *
   nmRegisterSessionState<<ctLocalPlayers;
   ses_sspParams.Update();
   nmRegisterSessionState<<ses_sspParams;
+  extern ULONG GetGameStreamDictionaryCRC(void);
+  nmRegisterSessionState<<INDEX('DICT')<<INDEX(NET_DICTIONARY_VERSION)<<GetGameStreamDictionaryCRC();
   _pNetwork->SendToServerReliable(nmRegisterSessionState);
 
   // prepare file or memory stream for state
@@ -364,16 +371,14 @@ void CSessionState::Start_AtClient_t(INDEX ctLocalPlayers)     // throw char *
   // send data request
   CPrintF(TRANS("Sending statedelta request\n"));
   CNetworkMessage nmRequestDelta(MSG_REQ_STATEDELTA);
+  // tell that the delta can be sent in chunks
+  nmRequestDelta<<INDEX('CHNK');
   _pNetwork->SendToServerReliable(nmRequestDelta);
 
   {
     // wait for server's response
-    CTMemoryStream strmMessage;
-    WaitStream_t(strmMessage, "data", MSG_REP_STATEDELTA);
-    // decompress saved session state
     CTMemoryStream strmDelta;
-    CzlibCompressor comp;
-    comp.UnpackStream_t(strmMessage, strmDelta);
+    WaitStateDelta_t(strmDelta);
     CTMemoryStream strmNew;
     DIFF_Undiff_t(pstrmState, &strmDelta, &strmNew);
     strmNew.SetPos_t(0);
@@ -519,6 +524,196 @@ void CSessionState::WaitStream_t(CTMemoryStream &strmMessage, const CTString &st
   ThrowF_t(TRANS("Timeout while waiting for %s"), strName);
 }
 
+// acknowledge chunks of state delta received so far, or ask to resend from there
+static void SendStateChunkAck(INDEX iNextChunk, BOOL bResend)
+{
+  CNetworkMessage nmAck(MSG_REQ_STATEDELTACHUNK);
+  nmAck<<iNextChunk<<UBYTE(bResend);
+  _pNetwork->SendToServerReliable(nmAck);
+}
+
+// wait for state delta to come from server, whole or in chunks
+void CSessionState::WaitStateDelta_t(CTMemoryStream &strmDelta)
+{
+  CzlibCompressor comp;
+  // older servers send it whole
+  CTMemoryStream strmMessage;
+
+  // packed delta being received in chunks
+  UBYTE *pubPacked = NULL;
+  SLONG slPackedSize = 0;
+  INDEX ctChunks = 0;
+  INDEX iNextChunk = 0;
+  SLONG slAccepted = 0;
+  SLONG slReceived = 0;
+  TIME tmLastChunk = 0;
+
+  // start waiting for server's response
+  SetProgressDescription(TRANS("waiting for ")+CTString("data"));
+  CallProgressHook_t(0.0f);
+  // yes, we need the client/server updates in the progres hook
+  _bRunNetUpdates = TRUE;
+
+  try {
+    // repeat until timed out
+    for(TIME tmWait=0; tmWait<net_tmConnectionTimeout*1000;
+      Sleep(NET_WAITMESSAGE_DELAY), tmWait+=NET_WAITMESSAGE_DELAY) {
+      // update network connection sockets
+      if (_cmiComm.Client_Update() == FALSE) {
+        break;
+      }
+      // if client is disconnected
+      if (!_cmiComm.Client_IsConnected()) {
+        // quit
+        ThrowF_t(TRANS("Client disconnected"));
+      }
+
+      // if receiving chunks, but none came for a while
+      if (ctChunks>0 && tmWait-tmLastChunk>net_tmConnectionTimeout*1000/4) {
+        // ask for them again, from the first one that is missing
+        SendStateChunkAck(iNextChunk, TRUE);
+        tmLastChunk = tmWait;
+      }
+
+      // if nothing received
+      strmMessage.SetPos_t(0);
+      if (!_pNetwork->ReceiveFromServerReliable(strmMessage)) {
+        // update progress
+        if (ctChunks==0) {
+          SLONG slExpectedSize, slReceivedSize;
+          _cmiComm.Client_PeekSize_Reliable(slExpectedSize, slReceivedSize);
+          if (slExpectedSize==0) {
+            CallProgressHook_t(tmWait/(net_tmConnectionTimeout*1000));
+          } else {
+            if (slReceivedSize!=slReceived) {
+              slReceived = slReceivedSize;
+              tmWait = 0;
+            }
+            SetProgressDescription(TRANS("receiving ")+CTString("data  "));
+            CallProgressHook_t((float)slReceivedSize/slExpectedSize);
+          }
+        }
+        // continue waiting
+        continue;
+      }
+      const SLONG slMessageSize = strmMessage.GetPos_t();
+      // read message identifier
+      strmMessage.SetPos_t(0);
+      INDEX iID;
+      strmMessage>>iID;
+
+      // if whole delta
+      if (iID==MSG_REP_STATEDELTA) {
+        // decompress it
+        comp.UnpackStream_t(strmMessage, strmDelta);
+        break;
+
+      // if a chunk of it
+      } else if (iID==MSG_REP_STATEDELTACHUNK) {
+        INDEX iChunk, ctChunksInMsg;
+        SLONG slTotal;
+        ULONG ulCRCInMsg;
+        strmMessage>>iChunk>>ctChunksInMsg>>slTotal>>ulCRCInMsg;
+        const SLONG slChunk = slMessageSize-strmMessage.GetPos_t();
+        // if first one
+        if (pubPacked==NULL) {
+          // whole state must fit in a memory stream, so don't trust larger sizes
+          extern ULONG _ulMaxLenghtOfSavingFile;
+          if (slTotal<SLONG(2*sizeof(SLONG)) || ULONG(slTotal)>_ulMaxLenghtOfSavingFile
+            || ctChunksInMsg<=0 || ctChunksInMsg>slTotal) {
+            ThrowF_t(TRANS("Invalid stream while waiting for %s"), "data");
+          }
+          // prepare buffer for all
+          ctChunks = ctChunksInMsg;
+          slPackedSize = slTotal;
+          pubPacked = (UBYTE*)AllocMemory(slPackedSize);
+          SetProgressDescription(TRANS("receiving ")+CTString("data  "));
+        }
+        // if not the one that is expected next
+        if (iChunk!=iNextChunk) {
+          // ignore it, it is either repeated or coming after a bad one
+          continue;
+        }
+        // check it
+        UBYTE *pubChunk = strmMessage.mstrm_pubBuffer+strmMessage.mstrm_slLocation;
+        ULONG ulCRC;
+        CRC_Start(ulCRC);
+        CRC_AddBlock(ulCRC, pubChunk, slChunk);
+        CRC_Finish(ulCRC);
+        if (ulCRC!=ulCRCInMsg || slChunk<=0 || slAccepted+slChunk>slPackedSize) {
+          // ask to resend it and all after it
+          SendStateChunkAck(iNextChunk, TRUE);
+          tmLastChunk = tmWait;
+          continue;
+        }
+
+        // accept it
+        memcpy(pubPacked+slAccepted, pubChunk, slChunk);
+        slAccepted += slChunk;
+        iNextChunk++;
+        tmLastChunk = tmWait = 0;
+        SendStateChunkAck(iNextChunk, FALSE);
+        CallProgressHook_t((float)iNextChunk/ctChunks);
+
+        // if all received
+        if (iNextChunk>=ctChunks) {
+          // decompress it
+          SLONG slSizeDst = ((SLONG*)pubPacked)[0];
+          SLONG slSizeSrc = ((SLONG*)pubPacked)[1];
+          extern ULONG _ulMaxLenghtOfSavingFile;
+          if (slAccepted!=slPackedSize || slSizeSrc!=slPackedSize-2*sizeof(SLONG)
+            || slSizeDst<=0 || ULONG(slSizeDst)>_ulMaxLenghtOfSavingFile) {
+            ThrowF_t(TRANS("Error while unpacking a stream."));
+          }
+          UBYTE *pubDelta = (UBYTE*)AllocMemory(slSizeDst);
+          if (!comp.Unpack(pubPacked+2*sizeof(SLONG), slSizeSrc, pubDelta, slSizeDst)) {
+            FreeMemory(pubDelta);
+            ThrowF_t(TRANS("Error while unpacking a stream."));
+          }
+          strmDelta.Write_t(pubDelta, slSizeDst);
+          strmDelta.SetPos_t(0);
+          FreeMemory(pubDelta);
+          break;
+        }
+
+      // if disconnected
+      } else if (iID==MSG_INF_DISCONNECTED) {
+        // confirm disconnect
+        CNetworkMessage nmConfirmDisconnect(MSG_REP_DISCONNECTED);
+        _pNetwork->SendToServerReliable(nmConfirmDisconnect);
+        // report the reason
+        CTString strReason;
+        strmMessage>>strReason;
+        ses_strDisconnected = strReason;
+        ThrowF_t(TRANS("Disconnected: %s\n"), strReason);
+      // otherwise
+      } else {
+        // it is invalid message
+        ThrowF_t(TRANS("Invalid stream while waiting for %s"), "data");
+      }
+    }
+  } catch (char *) {
+    if (pubPacked!=NULL) {
+      FreeMemory(pubPacked);
+    }
+    // no more client/server updates in the progres hook
+    _bRunNetUpdates = FALSE;
+    throw;
+  }
+
+  if (pubPacked!=NULL) {
+    FreeMemory(pubPacked);
+  }
+  // if not received
+  if (strmDelta.GetStreamSize()==0) {
+    // no more client/server updates in the progres hook
+    _bRunNetUpdates = FALSE;
+    ThrowF_t(TRANS("Timeout while waiting for %s"), "data");
+  }
+  // all ok
+  CallProgressHook_t(1.0f);
+}
+
 // check if disconnected
 BOOL CSessionState::IsDisconnected(void)
 {
@@ -575,6 +770,56 @@ cannot be processed in this tick.
 guarantee that they are not freed from memory.
 */
 
+extern INDEX phy_bParallelMovers;
+
+// per-mover passes that can be spread over job threads
+enum MoverPass {
+  MP_CLEARMOVINGTEMP,
+  MP_PREMOVING,
+  MP_POSTMOVING,
+};
+
+// fixed job size, so that merged events don't depend on number of threads
+#define MOVERS_PER_JOB 16
+
+// movers collected for a parallel pass, in order of the serial pass
+static CStaticStackArray<CMovableEntity *> _apenParallelMovers;
+
+static void MoverPassJob(INDEX iJob, void *pvPass)
+{
+  // fpu precision is per thread
+  CSetFPUPrecision FPUPrecision(FPT_24BIT);
+  const MoverPass mp = *(MoverPass *)pvPass;
+
+  CEntity::SetDeferredEventsJob(iJob);
+  const INDEX iFirst = iJob*MOVERS_PER_JOB;
+  const INDEX iLast = Min(iFirst+MOVERS_PER_JOB, _apenParallelMovers.Count());
+  for (INDEX iMover=iFirst; iMover<iLast; iMover++) {
+    CMovableEntity *pen = _apenParallelMovers[iMover];
+    switch (mp) {
+    case MP_CLEARMOVINGTEMP: pen->ClearMovingTemp(); break;
+    case MP_PREMOVING:       pen->PreMoving();       break;
+    case MP_POSTMOVING:      pen->PostMoving();      break;
+    }
+  }
+  CEntity::SetDeferredEventsJob(-1);
+}
+
+// do a pass over all collected movers on job threads
+static void FlushParallelMovers(MoverPass mp)
+{
+  const INDEX ctMovers = _apenParallelMovers.Count();
+  if (ctMovers==0) {
+    return;
+  }
+  const INDEX ctJobs = (ctMovers+MOVERS_PER_JOB-1)/MOVERS_PER_JOB;
+  CEntity::BeginDeferredEvents(ctJobs);
+  JOB_Run(ctJobs, MoverPassJob, &mp);
+  // events sent meanwhile are queued in same order as if the pass was serial
+  CEntity::EndDeferredEvents();
+  _apenParallelMovers.PopAll();
+}
+
 // do physics for a game tick
 void CSessionState::HandleMovers(void)
 {
@@ -602,17 +847,33 @@ void CSessionState::HandleMovers(void)
     }
   }}
 
+  // if parallel, movers that allow it are collected and done in parallel before the
+  // next one that doesn't, so the order of side effects is same as in serial passes
+  const BOOL bParallel = phy_bParallelMovers;
+
   // for each active mover
   {FORDELETELIST(CMovableEntity, en_lnInMovers, lhActiveMovers, itenMover) {
+    // clearing touches only the mover itself, so all can be done in parallel
+    if (bParallel) {
+      _apenParallelMovers.Push() = itenMover;
+      continue;
+    }
     // let it clear its temporary variables to prevent bad syncs
     itenMover->ClearMovingTemp();
   }}
+  FlushParallelMovers(MP_CLEARMOVINGTEMP);
 
   // for each active mover
   {FORDELETELIST(CMovableEntity, en_lnInMovers, lhActiveMovers, itenMover) {
+    if (bParallel && itenMover->IsMovingThreadSafe()) {
+      _apenParallelMovers.Push() = itenMover;
+      continue;
+    }
+    FlushParallelMovers(MP_PREMOVING);
     // let it calculate its wanted parameters for this tick
     itenMover->PreMoving();
   }}
+  FlushParallelMovers(MP_PREMOVING);
 
   // while there are some active movers
   while(!lhActiveMovers.IsEmpty()) {
@@ -657,9 +918,15 @@ void CSessionState::HandleMovers(void)
       // skip it
       continue;
     }
+    if (bParallel && itenMover->IsMovingThreadSafe()) {
+      _apenParallelMovers.Push() = itenMover;
+      continue;
+    }
+    FlushParallelMovers(MP_POSTMOVING);
     // let it calculate its parameters after all movement has been resolved
     itenMover->PostMoving();
   }}
+  FlushParallelMovers(MP_POSTMOVING);
 
   // for each done mover
 
@@ -676,9 +943,14 @@ void CSessionState::HandleMovers(void)
       pen->en_ulFlags&=~ENF_INRENDERING;
       pen->en_lnInMovers.Remove();
     }
+    if (bParallel) {
+      _apenParallelMovers.Push() = pen;
+      continue;
+    }
     // let it clear its temporary variables to prevent bad syncs
     pen->ClearMovingTemp();
   }}
+  FlushParallelMovers(MP_CLEARMOVINGTEMP);
   
   // return all done movers to the world's list
   _pNetwork->ga_World.wo_lhMovers.MoveList(lhDummyMovers);
@@ -698,26 +970,10 @@ void CSessionState::HandleTimers(TIME tmCurrentTick)
 
   _pfPhysicsProfile.StartTimer(CPhysicsProfile::PTI_HANDLETIMERS);
   // repeat
-  CListHead &lhTimers = _pNetwork->ga_World.wo_lhTimers;
+  CWorld &wo = _pNetwork->ga_World;
   for (;;) {
-    // no entity found initially
-    CRationalEntity *penTimer = NULL;
-    // for each entity in list of timers
-    FOREACHINLIST(CRationalEntity, en_lnInTimers, lhTimers, iten) {
-      // if due after current time
-      if(iten->en_timeTimer>tmCurrentTick+TIME_EPSILON) {
-        // stop searching
-        break;
-      }
-      // if now predicting and it is not a predictor
-      if (ses_bPredicting && !iten->IsPredictor()) {
-        // skip it
-        continue;
-      }
-      // remember found entity, and stop searching
-      penTimer = iten;
-      break;
-    }
+    // get first timer that is due (only predictors if now predicting)
+    CRationalEntity *penTimer = wo.GetDueTimer(tmCurrentTick+TIME_EPSILON, ses_bPredicting);
 
     // if no entity is found
     if (penTimer==NULL) {
@@ -731,8 +987,8 @@ void CSessionState::HandleTimers(TIME tmCurrentTick)
     IFDEBUG(tmLast=penTimer->en_timeTimer);
 
     // remove the timer from the list
+    wo.RemoveTimer(penTimer);
     penTimer->en_timeTimer = THINKTIME_NEVER;
-    penTimer->en_lnInTimers.Remove();
     // send timer event to the entity
     penTimer->SendEvent(ETimer());
   }
@@ -762,8 +1018,18 @@ void CSessionState::WarmUpWorld(void)
   ProcessGameStream();
 }
 
-// create a checksum value for sync-check
-void CSessionState::ChecksumForSync(ULONG &ulCRC, INDEX iExtensiveSyncCheck)
+// get checksum of one entity
+static ULONG EntityChecksum(CEntity &en, INDEX iExtensiveSyncCheck)
+{
+  ULONG ulCRC;
+  CRC_Start(ulCRC);
+  en.ChecksumForSync(ulCRC, iExtensiveSyncCheck);
+  CRC_Finish(ulCRC);
+  return ulCRC;
+}
+
+// create a checksum value for sync-check (and optionally get checksums of entity branches)
+void CSessionState::ChecksumForSync(ULONG &ulCRC, INDEX iExtensiveSyncCheck, ULONG *pulBranchCRCs/*=NULL*/)
 {
   CRC_AddLONG(ulCRC, ses_iLastProcessedSequence);
   CRC_AddLONG(ulCRC, ses_iLevel);
@@ -775,19 +1041,34 @@ void CSessionState::ChecksumForSync(ULONG &ulCRC, INDEX iExtensiveSyncCheck)
 
   // if all entities should be synced
   if (iExtensiveSyncCheck>1) {
-    // for each active entity in the world
-    {FOREACHINDYNAMICCONTAINER(_pNetwork->ga_World.wo_cenEntities, CEntity, iten) {
+    // each entity is checksummed once, on its own, and those checksums are combined
+    // in branches by entity ID, so a bad sync can be narrowed down to a branch
+    // NOTE: entity crcs are not cached between checks, because game code writes members
+    // of other entities directly, so no dirty flag would catch all changes
+    ULONG aulBranchCRCs[SYNC_BRANCHES];
+    {for (INDEX iBranch=0; iBranch<SYNC_BRANCHES; iBranch++) {
+      CRC_Start(aulBranchCRCs[iBranch]);
+    }}
+    // for each entity in the world
+    {FOREACHINDYNAMICCONTAINER(_pNetwork->ga_World.wo_cenAllEntities, CEntity, iten) {
       if (iten->IsPredictor()) {
         continue;
       }
-      iten->ChecksumForSync(ulCRC, iExtensiveSyncCheck);
+      CRC_AddLONG(aulBranchCRCs[iten->en_ulID%SYNC_BRANCHES], EntityChecksum(*iten, iExtensiveSyncCheck));
     }}
-    // for each entity in the world
-    {FOREACHINDYNAMICCONTAINER(_pNetwork->ga_World.wo_cenAllEntities, CEntity, iten) {
+    {for (INDEX iBranch=0; iBranch<SYNC_BRANCHES; iBranch++) {
+      CRC_Finish(aulBranchCRCs[iBranch]);
+      CRC_AddLONG(ulCRC, aulBranchCRCs[iBranch]);
+      if (pulBranchCRCs!=NULL) {
+        pulBranchCRCs[iBranch] = aulBranchCRCs[iBranch];
+      }
+    }}
+    // active entities are already in there, so only their order is checked
+    {FOREACHINDYNAMICCONTAINER(_pNetwork->ga_World.wo_cenEntities, CEntity, iten) {
       if (iten->IsPredictor()) {
         continue;
       }
-      iten->ChecksumForSync(ulCRC, iExtensiveSyncCheck);
+      CRC_AddLONG(ulCRC, iten->en_ulID);
     }}
   }
 
@@ -797,7 +1078,12 @@ void CSessionState::ChecksumForSync(ULONG &ulCRC, INDEX iExtensiveSyncCheck)
       if (iten->IsPredictor()) {
         continue;
       }
-      iten->ChecksumForSync(ulCRC, iExtensiveSyncCheck);
+      // if all entities are synced, only order of movers is left to check
+      if (iExtensiveSyncCheck>1) {
+        CRC_AddLONG(ulCRC, iten->en_ulID);
+      } else {
+        iten->ChecksumForSync(ulCRC, iExtensiveSyncCheck);
+      }
     }}
   }
   // checksum all active players
@@ -867,6 +1153,8 @@ void CSessionState::DumpSync_t(CTStream &strm, INDEX iExtensiveSyncCheck)  // th
         continue;
       }
       iten->DumpSync_t(strm, iExtensiveSyncCheck);
+      strm.FPrintF_t("sync branch: %d crc: 0x%08X\n",
+        iten->en_ulID%SYNC_BRANCHES, EntityChecksum(*iten, iExtensiveSyncCheck));
     }}
   }
 
@@ -896,6 +1184,132 @@ void ClearDumpStream(void)
 }
 #endif
 
+// all-actions blocks are measured in old and new layout while this is set (see MeasureActionBlocks())
+static BOOL _bMeasureActionBlocks = FALSE;
+// minimal number of players for a block to be counted separately
+#define MEASURE_MANYPLAYERS 16
+// counts and sizes of measured blocks ([0] for all blocks, [1] for blocks with many players)
+static INDEX _actMeasuredBlocks[2];
+static INDEX _actMeasuredPlayers[2];
+static SLONG _aslMeasuredOldBytes[2];
+static SLONG _aslMeasuredNewBytes[2];
+// actions of players in block being measured, as last action and delta applied to it
+static CStaticStackArray<CPlayerAction> _apaMeasuredLast;
+static CStaticStackArray<CPlayerAction> _apaMeasuredDelta;
+
+// write actions of all players in measured block in the old and new layout, and count their sizes
+static void MeasureActionBlock(void)
+{
+  const INDEX ctPlayers = _apaMeasuredDelta.Count();
+  CNetworkMessage nmOld(MSG_SEQ_ALLACTIONS);
+  CNetworkMessage nmNew(MSG_SEQ_ALLACTIONS);
+  INDEX ctIdle = 0;
+  for (INDEX iPlayer=0; iPlayer<ctPlayers; iPlayer++) {
+    const CPlayerAction &paDelta = _apaMeasuredDelta[iPlayer];
+    // old layout has full delta for each player
+    nmOld<<paDelta;
+
+    // new layout writes changed fields of current action, as CServer::MakeAllActionsForSession() does
+    CPlayerAction paLast = _apaMeasuredLast[iPlayer];
+    CPlayerAction paCurrent = paLast;
+    ULONG *pul = (ULONG*)&paCurrent.pa_vTranslation;
+    const ULONG *pulDelta = (const ULONG*)&paDelta.pa_vTranslation;
+    for (INDEX i=0; i<9; i++) {
+      pul[i] ^= pulDelta[i];
+    }
+    paCurrent.pa_ulButtons ^= paDelta.pa_ulButtons;
+    // timetag is sent as delta, and only if the receiving client owns the player
+    paLast.pa_llCreated = 0;
+    paCurrent.pa_llCreated = paDelta.pa_llCreated;
+    if (paCurrent.IsSameAs(paLast, TRUE)) {
+      ctIdle++;
+      continue;
+    }
+    if (ctIdle>0) {
+      UBYTE ubAction = 0;
+      nmNew.WriteBits(&ubAction, 1);
+      nmNew.WriteCode(ctIdle-1);
+      ctIdle = 0;
+    }
+    UBYTE ubAction = 1;
+    nmNew.WriteBits(&ubAction, 1);
+    paCurrent.WriteDelta(nmNew, paLast, paDelta.pa_llCreated!=0);
+  }
+  if (ctIdle>0) {
+    UBYTE ubAction = 0;
+    nmNew.WriteBits(&ubAction, 1);
+    nmNew.WriteCode(ctIdle-1);
+  }
+  _apaMeasuredLast.PopAll();
+  _apaMeasuredDelta.PopAll();
+
+  for (INDEX iGroup=0; iGroup<2; iGroup++) {
+    if (iGroup==1 && ctPlayers<MEASURE_MANYPLAYERS) {
+      break;
+    }
+    _actMeasuredBlocks[iGroup]++;
+    _actMeasuredPlayers[iGroup] += ctPlayers;
+    _aslMeasuredOldBytes[iGroup] += nmOld.nm_slSize-sizeof(UBYTE);
+    _aslMeasuredNewBytes[iGroup] += nmNew.nm_slSize-sizeof(UBYTE);
+  }
+}
+
+// play a demo through and report sizes of its all-actions blocks in the old and the new layout
+extern void MeasureActionBlocks(const CTString &strDemo)
+{
+  if (_pShell->GetINDEX("pwoCurrentWorld")!=NULL) {
+    CPrintF(TRANS("Stop the game before measuring action blocks.\n"));
+    return;
+  }
+  try {
+    _pNetwork->StartDemoPlay_t(strDemo);
+  } catch (char *strError) {
+    CPrintF(TRANS("Cannot play demo '%s': %s\n"), (const char*)strDemo, strError);
+    return;
+  }
+  {for (INDEX iGroup=0; iGroup<2; iGroup++) {
+    _actMeasuredBlocks[iGroup] = 0;
+    _actMeasuredPlayers[iGroup] = 0;
+    _aslMeasuredOldBytes[iGroup] = 0;
+    _aslMeasuredNewBytes[iGroup] = 0;
+  }}
+  {
+    CTSingleLock slHooks(&_pTimer->tm_csHooks, TRUE);
+    CTSingleLock slNetwork(&_pNetwork->ga_csNetwork, TRUE);
+    CSessionState &ses = _pNetwork->ga_sesSessionState;
+    _bMeasureActionBlocks = TRUE;
+    // step the demo one tick at a time, as fast as it can go
+    while (!_pNetwork->ga_bDemoPlayFinished) {
+      _pNetwork->ga_fDemoTimer += _pTimer->TickQuantum;
+      ses.ProcessGameStream();
+      // stop on read errors
+      if (!_pNetwork->ga_bDemoPlayFinished && ses.ses_tmLastDemoSequence<_pNetwork->ga_fDemoTimer) {
+        break;
+      }
+    }
+    _bMeasureActionBlocks = FALSE;
+  }
+  _pNetwork->StopGame();
+
+  CPrintF(TRANS("Demo '%s': all-actions blocks (actions only, without tick time)\n"), (const char*)strDemo);
+  {for (INDEX iGroup=0; iGroup<2; iGroup++) {
+    const INDEX ctBlocks = _actMeasuredBlocks[iGroup];
+    if (iGroup==0) {
+      CPrintF(TRANS("  all blocks: "));
+    } else {
+      CPrintF(TRANS("  blocks with %d+ players: "), MEASURE_MANYPLAYERS);
+    }
+    if (ctBlocks==0) {
+      CPrintF(TRANS("none\n"));
+      continue;
+    }
+    CPrintF(TRANS("%d, %.1f players avg, old %.1f bytes, new %.1f bytes per block (%.1f%%)\n"),
+      ctBlocks, FLOAT(_actMeasuredPlayers[iGroup])/ctBlocks,
+      FLOAT(_aslMeasuredOldBytes[iGroup])/ctBlocks, FLOAT(_aslMeasuredNewBytes[iGroup])/ctBlocks,
+      _aslMeasuredNewBytes[iGroup]*100.0f/ClampDn(_aslMeasuredOldBytes[iGroup], SLONG(1)));
+  }}
+}
+
 /*
  * Process a game tick.
  */
@@ -933,6 +1347,10 @@ void CSessionState::ProcessGameTick(CNetworkMessage &nmMessage, TIME tmCurrentTi
   ses_bAllowRandom = TRUE;
 
   _pfPhysicsProfile.StartTimer(CPhysicsProfile::PTI_APPLYACTIONS);
+  // older versions sent full delta action for each player
+  const BOOL bDeltaActions = _pNetwork->ga_ulDemoMinorVersion>=11;
+  INDEX ctIdle = 0;
+
   // for all clients
   INDEX iClient = 0;
   FOREACHINSTATICARRAY(ses_apltPlayers, CPlayerTarget, itplt) {
@@ -945,7 +1363,30 @@ void CSessionState::ProcessGameTick(CNetworkMessage &nmMessage, TIME tmCurrentTi
 //      ASSERT(iClient==iClientInMessage);
       // read the action
       CPlayerAction paAction;
-      nmMessage>>paAction;
+      if (!bDeltaActions) {
+        nmMessage>>paAction;
+      } else {
+        // if not inside a run of idle players, see if next player starts one
+        if (ctIdle==0) {
+          UBYTE ubAction = 0;
+          nmMessage.ReadBits(&ubAction, 1);
+          if (!ubAction) {
+            ctIdle = nmMessage.ReadCode()+1;
+          }
+        }
+        // idle player gets empty delta
+        if (ctIdle>0) {
+          ctIdle--;
+          memset(&paAction, 0, sizeof(paAction));
+        } else {
+          paAction.ReadDelta(nmMessage, itplt->plt_paLastAction);
+        }
+      }
+      // remember it for measuring, with last action it is applied to
+      if (_bMeasureActionBlocks) {
+        _apaMeasuredLast.Push() = itplt->plt_paLastAction;
+        _apaMeasuredDelta.Push() = paAction;
+      }
       // apply the action
       itplt->ApplyActionPacket(paAction);
 
@@ -957,6 +1398,9 @@ void CSessionState::ProcessGameTick(CNetworkMessage &nmMessage, TIME tmCurrentTi
     iClient++;
   }
   cli_bEmulateDesync = FALSE;
+  if (_bMeasureActionBlocks) {
+    MeasureActionBlock();
+  }
 
   // handle all the sent events
   CEntity::HandleSentEvents();
@@ -1173,8 +1617,7 @@ void CSessionState::ProcessGameStream(void)
       // process the stream block
       ProcessGameStreamBlock(*pnsbBlock);
       // remove the block from the stream
-      pnsbBlock->RemoveFromStream();
-      delete pnsbBlock;
+      ses_nsGameStream.RemoveBlockBySequence(iSequence);
       // remove eventual resent blocks that have already been processed
       ses_nsGameStream.RemoveOlderBlocksBySequence(ses_iLastProcessedSequence-2);
 
@@ -1293,19 +1736,45 @@ void CSessionState::ProcessPrediction(void)
   ULONG ulOldRandom = ses_ulRandomSeed;
   ULONG ulEntityID = _pNetwork->ga_World.wo_ulNextEntityID;
 
-  // delete all predictors (if any left from last time)
-  _pNetwork->ga_World.DeletePredictors();
-  // create new predictors
-  _pNetwork->ga_World.CreatePredictors();
+  // NOTE: Every processed gamestream block deletes predictors, so if there are some left from
+  // last time, the entities they were copied from haven't changed since. If they are still for
+  // the same entities, they can go on from the step where they stopped, instead of copying
+  // everything again and repeating all the steps.
+  // (Lerped actions of remote players depend on total number of steps, so they can't.)
+  extern INDEX cli_bLerpActions;
+  extern INDEX cli_bPredictRemotePlayers;
+  INDEX iFirstStep = 0;
+  if (ses_ctPredictedSteps>0 && ses_ctPredictedSteps<ctSteps
+    && !(cli_bLerpActions && cli_bPredictRemotePlayers)
+    && _pNetwork->ga_World.ArePredictorsForMarked()) {
+    // continue where last prediction stopped
+    iFirstStep = ses_ctPredictedSteps;
+    ses_ulRandomSeed = ses_ulPredictedRandomSeed;
+    _pNetwork->ga_World.wo_ulNextEntityID = ses_ulPredictedEntityID;
+  } else {
+    // delete all predictors (if any left from last time)
+    _pNetwork->ga_World.DeletePredictors();
+    // create new predictors
+    _pNetwork->ga_World.CreatePredictors();
+  }
 
-  // for each step
+  // for each step (ticks are summed the same way as when all steps are done)
   TIME tmPredictedTick = ses_tmLastProcessedTick;
-  for(INDEX iPredictionStep=0; iPredictionStep<ctSteps; iPredictionStep++) {
+  {for(INDEX iStep=0; iStep<iFirstStep; iStep++) {
+    tmPredictedTick+=_pTimer->TickQuantum;
+  }}
+  for(INDEX iPredictionStep=iFirstStep; iPredictionStep<ctSteps; iPredictionStep++) {
     tmPredictedTick+=_pTimer->TickQuantum;
     //ses_tmPredictionHeadTick = Max(ses_tmPredictionHeadTick, tmPredictedTick);
     // predict it
     ProcessPredictedGameTick(iPredictionStep, FLOAT(iPredictionStep)/ctSteps, tmPredictedTick);
   }
+
+  // remember where predictors stopped
+  ses_ctPredictedSteps = ctSteps;
+  ses_ulPredictedRandomSeed = ses_ulRandomSeed;
+  ses_ulPredictedEntityID = _pNetwork->ga_World.wo_ulNextEntityID;
+
   // restore random seed and entity ID
   ses_ulRandomSeed = ulOldRandom;
   _pNetwork->ga_World.wo_ulNextEntityID = ulEntityID;
@@ -1657,13 +2126,13 @@ void CSessionState::ReadWorldAndState_t(CTStream *pstr)   // throw char *
   // read world situation
   _pNetwork->ga_World.ReadState_t(pstr);
 
-  // create an empty list for relinking timers
-  CListHead lhNewTimers;
+  // create an empty list for reordering timers
+  CStaticStackArray<CRationalEntity*> apenNewTimers;
   // read number of entities in timer list
   pstr->ExpectID_t("TMRS");   // timers
   INDEX ctTimers;
   *pstr>>ctTimers;
-//  ASSERT(ctTimers == _pNetwork->ga_World.wo_lhTimers.Count());
+//  ASSERT(ctTimers == _pNetwork->ga_World.wo_apenTimers.Count());
   // for each entity in the timer list
   {for(INDEX ienTimer=0; ienTimer<ctTimers; ienTimer++) {
     // read its index in container of all entities
@@ -1671,15 +2140,14 @@ void CSessionState::ReadWorldAndState_t(CTStream *pstr)   // throw char *
     *pstr>>ien;
     // get the entity
     CRationalEntity *pen = (CRationalEntity*)_pNetwork->ga_World.EntityFromID(ien);
-    // remove it from the timer list and add it at the end of the new timer list
-    if (pen->en_lnInTimers.IsLinked()) {
-      pen->en_lnInTimers.Remove();
-      lhNewTimers.AddTail(pen->en_lnInTimers);
+    // add it at the end of the new timer order
+    if (pen->IsWaitingForTimer()) {
+      apenNewTimers.Push() = pen;
     }
   }}
-  // use the new timer list instead the old one
-  ASSERT(_pNetwork->ga_World.wo_lhTimers.IsEmpty());
-  _pNetwork->ga_World.wo_lhTimers.MoveList(lhNewTimers);
+  // use the saved order for timers that are due at the same time
+  ASSERT(apenNewTimers.Count()==_pNetwork->ga_World.wo_apenTimers.Count());
+  _pNetwork->ga_World.ReorderTimers(apenNewTimers);
 
   // create an empty list for relinking movers
   CListHead lhNewMovers;
@@ -1787,12 +2255,13 @@ void CSessionState::WriteWorldAndState_t(CTStream *pstr)   // throw char *
 
   // write number of entities in timer list
   pstr->WriteID_t("TMRS");   // timers
-  CListHead &lhTimers = _pNetwork->ga_World.wo_lhTimers;
-  *pstr<<lhTimers.Count();
-  // for each entity in the timer list
-  {FOREACHINLIST(CRationalEntity, en_lnInTimers, lhTimers, iten) {
+  CStaticStackArray<CRationalEntity*> apenTimers;
+  _pNetwork->ga_World.GetTimersInOrder(apenTimers);
+  *pstr<<apenTimers.Count();
+  // for each entity in the timer list, in order of execution
+  {for(INDEX iTimer=0; iTimer<apenTimers.Count(); iTimer++) {
     // save its index in container
-    *pstr<<iten->en_ulID;
+    *pstr<<apenTimers[iTimer]->en_ulID;
   }}
 
   // write number of entities in mover list
@@ -1887,13 +2356,13 @@ void CSessionState::MakeSynchronisationCheck(void)
   }
 
   // make local checksum
+  CSyncCheck sc;
   ULONG ulLocalCRC;
   CRC_Start(ulLocalCRC);
-  ChecksumForSync(ulLocalCRC, ses_iExtensiveSyncCheck);
+  ChecksumForSync(ulLocalCRC, ses_iExtensiveSyncCheck, sc.sc_aulBranchCRCs);
   CRC_Finish(ulLocalCRC);
 
   // create sync-check
-  CSyncCheck sc;
   ses_tmLastSyncCheck = ses_tmLastProcessedTick;
   sc.sc_tmTick = ses_tmLastSyncCheck;
   sc.sc_iSequence = ses_iLastProcessedSequence; 
@@ -1912,7 +2381,11 @@ void CSessionState::MakeSynchronisationCheck(void)
 
   // create a message with sync check
   CNetworkMessage nmSyncCheck(MSG_SYNCCHECK);
-  nmSyncCheck.Write(&sc, sizeof(sc));
+  nmSyncCheck<<sc.sc_tmTick<<sc.sc_iSequence<<sc.sc_ulCRC<<sc.sc_iLevel;
+  // branch checksums are sent only if all entities are checked
+  if (ses_iExtensiveSyncCheck>1) {
+    nmSyncCheck.Write(sc.sc_aulBranchCRCs, sizeof(sc.sc_aulBranchCRCs));
+  }
   // send it to server
   _pNetwork->SendToServer(nmSyncCheck);
 }
@@ -39,6 +39,9 @@ with this program; if not, write to the Free Software Foundation, Inc.,
   void ClearDumpStream(void);
 #endif
 
+// number of branches that entity checksums are grouped in (by entity ID)
+#define SYNC_BRANCHES 16
+
 // checksum of world snapshot at given point in time - used for sync-checking
 class CSyncCheck {
 public:
@@ -46,8 +49,12 @@ public:
   INDEX sc_iSequence;   // sequence number last processed before this checksum
   ULONG sc_ulCRC;       // checksum
   INDEX sc_iLevel;  // checksum of level filename
-  CSyncCheck(void) { sc_tmTick = -1.0f; sc_iSequence = -1; sc_ulCRC = 0; sc_iLevel = 0; }
-  void Clear(void) { sc_tmTick = -1.0f; sc_iSequence = -1; sc_ulCRC = 0; sc_iLevel = 0; }
+  ULONG sc_aulBranchCRCs[SYNC_BRANCHES];  // entity checksums per branch (if checking all entities)
+  CSyncCheck(void) { Clear(); }
+  void Clear(void) {
+    sc_tmTick = -1.0f; sc_iSequence = -1; sc_ulCRC = 0; sc_iLevel = 0;
+    memset(sc_aulBranchCRCs, 0, sizeof(sc_aulBranchCRCs));
+  }
 };
 
 // info about an event that was predicted to happen
@@ -86,6 +93,9 @@ public:
   TIME ses_tmPredictionHeadTick;     // newest tick that was ever predicted
   TIME ses_tmLastSyncCheck;          // last time sync-check was generated
   TIME ses_tmLastPredictionProcessed;  // for determining when to do a new prediction cycle
+  INDEX ses_ctPredictedSteps;          // steps that current predictors went through (0 if none)
+  ULONG ses_ulPredictedRandomSeed;     // random seed after those steps
+  ULONG ses_ulPredictedEntityID;       // next entity ID after those steps
 
   INDEX ses_iMissingSequence;       // first missing sequence
   CTimerValue ses_tvResendTime;     // timer for missing sequence retransmission
@@ -126,6 +136,8 @@ public:
   void SendLevelChangeNotification(class CEntityEvent &ee);
   // wait for a stream to come from server
   void WaitStream_t(CTMemoryStream &strmMessage, const CTString &strName, INDEX iMsgCode);
+  // wait for state delta to come from server, whole or in chunks
+  void WaitStateDelta_t(CTMemoryStream &strmDelta);
   // check if disconnected
   BOOL IsDisconnected(void);
 
@@ -179,8 +191,8 @@ public:
 
   // make synchronization test message and send it to server (if client), or add to buffer (if server)
   void MakeSynchronisationCheck(void);
-  // create a checksum value for sync-check
-  void ChecksumForSync(ULONG &ulCRC, INDEX iExtensiveSyncCheck);
+  // create a checksum value for sync-check (and optionally get checksums of entity branches)
+  void ChecksumForSync(ULONG &ulCRC, INDEX iExtensiveSyncCheck, ULONG *pulBranchCRCs=NULL);
   // dump sync data to text file
   void DumpSync_t(CTStream &strm, INDEX iExtensiveSyncCheck);  // throw char *
 
@@ -109,5 +109,10 @@ CPhysicsProfile::CPhysicsProfile(void)
   SETCOUNTERNAME(PCI_NEARCELLSFOUND,  "cells found in FindEntitiesNearBox()");
   SETCOUNTERNAME(PCI_NEAROCCUPIEDCELLSFOUND, "occupied cells found in FindEntitiesNearBox()");
   SETCOUNTERNAME(PCI_NEARENTITIESFOUND,  "entities found in FindEntitiesNearBox()");
+  SETCOUNTERNAME(PCI_NEARLOOSECELLSFOUND, "loose cells found in FindEntitiesNearBox()");
+  SETCOUNTERNAME(PCI_GRIDHASHPROBES,  "collision grid hash probes");
+
+  SETCOUNTERNAME(PCI_SENTEVENTS,      "events sent");
+  SETCOUNTERNAME(PCI_SENTEVENTBYTES,  "bytes used by sent events");
 }
 
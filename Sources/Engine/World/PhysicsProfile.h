@@ -116,6 +116,11 @@ public:
     PCI_NEARCELLSFOUND,           // cells found in FindEntitiesNearBox()
     PCI_NEAROCCUPIEDCELLSFOUND,   // occupied cells found in FindEntitiesNearBox()
     PCI_NEARENTITIESFOUND,        // near entities found in FindEntitiesNearBox()
+    PCI_NEARLOOSECELLSFOUND,      // occupied upper level (loose) cells found in FindEntitiesNearBox()
+    PCI_GRIDHASHPROBES,           // hash table probes when looking up collision grid cells
+
+    PCI_SENTEVENTS,               // events sent to entities
+    PCI_SENTEVENTBYTES,           // bytes used for copies of sent events
     PCI_COUNT
   };
   // constructor
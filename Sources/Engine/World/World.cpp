@@ -16,6 +16,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "stdh.h"
 
 #include <Engine/Base/Console.h>
+#include <Engine/Base/CRC.h>
 #include <Engine/Math/Float.h>
 #include <Engine/World/World.h>
 #include <Engine/World/WorldEditingProfile.h>
@@ -37,6 +38,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <Engine/Light/LightSource.h>
 #include <Engine/Base/ProgressHook.h>
 #include <Engine/Templates/StaticArray.cpp>
+#include <Engine/Templates/StaticStackArray.cpp>
 #include <Engine/Templates/Selection.cpp>
 #include <Engine/Terrain/Terrain.h>
 
@@ -87,6 +89,7 @@ CWorld::CWorld(void)
   : wo_colBackground(C_lGRAY)       // clear background color
   , wo_pecWorldBaseClass(NULL)      // worldbase class must be obtained before using the world
   , wo_bPortalLinksUpToDate(FALSE)  // portal-sector links must be updated
+  , wo_bZoningBrushesUpToDate(FALSE)  // zoning entities must be found
   , wo_baBrushes(*new CBrushArchive)
   , wo_taTerrains(*new CTerrainArchive)
   , wo_ulSpawnFlags(0)
@@ -115,6 +118,9 @@ CWorld::CWorld(void)
   wo_fRtL = wo_fRtH = 1.0f; wo_fRtCZ = wo_fRtCY = 0.0f;
 
   wo_ulNextEntityID = 1;
+  wo_ctEntitiesByID = 0;
+  wo_ulNextTimerSequence = 0;
+  wo_apenTimers.SetAllocationStep(256);
 
   // set default placement
   wo_plFocus = CPlacement3D( FLOAT3D(3.0f, 4.0f, 10.0f),
@@ -173,7 +179,14 @@ void CWorld::Clear(void)
     ASSERT(wo_cenAllEntities.Count()==0);
     wo_cenEntities.Clear();
     wo_cenAllEntities.Clear();
+    wo_cenZoningBrushes.Clear();
+    MarkZoningBrushesChanged();
     cenToDestroy.Clear();
+    ASSERT(wo_ctEntitiesByID==0);
+    wo_apenEntitiesByID.Clear();
+    wo_ctEntitiesByID = 0;
+    ASSERT(wo_apenTimers.Count()==0);
+    wo_apenTimers.PopAll();
     wo_ulNextEntityID = 1;
   }
 
@@ -189,6 +202,25 @@ void CWorld::Clear(void)
   ClearCollisionGrid();
 }
 
+/*
+ * Get all zoning entities (in order of wo_cenEntities).
+ */
+CDynamicContainer<CEntity> &CWorld::GetZoningBrushes(void)
+{
+  // if not valid
+  if (!wo_bZoningBrushesUpToDate) {
+    // find all zoning entities again, keeping their order
+    wo_cenZoningBrushes.Clear();
+    FOREACHINDYNAMICCONTAINER(wo_cenEntities, CEntity, iten) {
+      if (iten->en_ulFlags&ENF_ZONING) {
+        wo_cenZoningBrushes.Add(iten);
+      }
+    }
+    wo_bZoningBrushesUpToDate = TRUE;
+  }
+  return wo_cenZoningBrushes;
+}
+
 /*
  * Create a new entity of given class.
  */
@@ -222,6 +254,7 @@ CEntity *CWorld::CreateEntity(const CPlacement3D &plPlacement, CEntityClass *pec
   wo_cenAllEntities.Add(penEntity);
   // set a new identifier
   penEntity->en_ulID = wo_ulNextEntityID++;
+  AddEntityToIDTable(penEntity);
   // set up the placement
   penEntity->en_plPlacement = plPlacement;
   // calculate rotation matrix
@@ -359,29 +392,185 @@ CPlayerEntity *CWorld::FindEntityWithCharacter(CPlayerCharacter &pcCharacter)
   return NULL;
 }
 
+// check if one timer should be executed before the other
+// (heap functions are templates only so that the timer benchmark can use them without entities)
+template<class Type>
+static inline BOOL TimerBefore(const Type *penA, const Type *penB)
+{
+  if (penA->en_timeTimer!=penB->en_timeTimer) {
+    return penA->en_timeTimer<penB->en_timeTimer;
+  }
+  // timers due at the same time are executed in reverse order of scheduling
+  return penA->en_ulTimerSequence>penB->en_ulTimerSequence;
+}
+
+static int qsort_CompareTimers(const void *ppen0, const void *ppen1)
+{
+  const CRationalEntity *pen0 = *(const CRationalEntity**)ppen0;
+  const CRationalEntity *pen1 = *(const CRationalEntity**)ppen1;
+  if (TimerBefore(pen0, pen1)) return -1;
+  if (TimerBefore(pen1, pen0)) return +1;
+  return 0;
+}
+
+// move a timer towards the top of the heap until it is in order
+template<class Type>
+static void TimerHeapUp(CStaticStackArray<Type*> &apen, INDEX i)
+{
+  Type *pen = apen[i];
+  while (i>0) {
+    INDEX iParent = (i-1)/2;
+    if (!TimerBefore(pen, apen[iParent])) {
+      break;
+    }
+    apen[i] = apen[iParent];
+    apen[i]->en_iInTimers = i;
+    i = iParent;
+  }
+  apen[i] = pen;
+  pen->en_iInTimers = i;
+}
+
+// move a timer towards the bottom of the heap until it is in order
+template<class Type>
+static void TimerHeapDown(CStaticStackArray<Type*> &apen, INDEX i)
+{
+  const INDEX ct = apen.Count();
+  Type *pen = apen[i];
+  for (;;) {
+    INDEX iChild = i*2+1;
+    if (iChild>=ct) {
+      break;
+    }
+    if (iChild+1<ct && TimerBefore(apen[iChild+1], apen[iChild])) {
+      iChild++;
+    }
+    if (!TimerBefore(apen[iChild], pen)) {
+      break;
+    }
+    apen[i] = apen[iChild];
+    apen[i]->en_iInTimers = i;
+    i = iChild;
+  }
+  apen[i] = pen;
+  pen->en_iInTimers = i;
+}
+
+// restore heap order of all timers
+static void TimerHeapRebuild(CStaticStackArray<CRationalEntity*> &apen)
+{
+  for (INDEX i=apen.Count()/2-1; i>=0; i--) {
+    TimerHeapDown(apen, i);
+  }
+}
+
 /*
- * Add an entity to list of thinkers.
+ * Add an entity to list of timers.
  */
 void CWorld::AddTimer(CRationalEntity *penThinker)
 {
   ASSERT(penThinker->en_timeTimer>_pTimer->CurrentTick());
   ASSERT(GetFPUPrecision()==FPT_24BIT);
 
-  // if the entity is already in the list
-  if (penThinker->en_lnInTimers.IsLinked()) {
-    // remove it
-    penThinker->en_lnInTimers.Remove();
+  // newest timer goes before all others that are due at the same time
+  penThinker->en_ulTimerSequence = wo_ulNextTimerSequence++;
+
+  // if the entity is already in the heap
+  if (penThinker->IsWaitingForTimer()) {
+    // just reposition it
+    INDEX i = penThinker->en_iInTimers;
+    TimerHeapUp(wo_apenTimers, i);
+    TimerHeapDown(wo_apenTimers, penThinker->en_iInTimers);
+  // if not in heap
+  } else {
+    // add it at the bottom and let it float up
+    wo_apenTimers.Push() = penThinker;
+    TimerHeapUp(wo_apenTimers, wo_apenTimers.Count()-1);
   }
-  // for each entity in the thinker list
-  FOREACHINLISTKEEP(CRationalEntity, en_lnInTimers, wo_lhTimers, iten) {
-    // if the entity in list has greater or same think time than the one to add
-    if (iten->en_timeTimer>=penThinker->en_timeTimer) {
-      // stop searching
-      break;
+}
+
+/*
+ * Remove an entity from list of timers.
+ */
+void CWorld::RemoveTimer(CRationalEntity *penThinker)
+{
+  INDEX i = penThinker->en_iInTimers;
+  ASSERT(i>=0 && i<wo_apenTimers.Count() && wo_apenTimers[i]==penThinker);
+  penThinker->en_iInTimers = -1;
+
+  // put last timer in its place
+  CRationalEntity *penLast = wo_apenTimers.Pop();
+  if (penLast!=penThinker) {
+    wo_apenTimers[i] = penLast;
+    TimerHeapUp(wo_apenTimers, i);
+    TimerHeapDown(wo_apenTimers, penLast->en_iInTimers);
+  }
+}
+
+/*
+ * Get first timer that is due until given time (NULL if none).
+ */
+CRationalEntity *CWorld::GetDueTimer(TIME tmDue, bool bPredictorsOnly)
+{
+  if (wo_apenTimers.Count()==0 || wo_apenTimers[0]->en_timeTimer>tmDue) {
+    return NULL;
+  }
+  if (!bPredictorsOnly) {
+    return wo_apenTimers[0];
+  }
+
+  // search only the part of the heap that is due, for the first predictor in order
+  static CStaticStackArray<INDEX> aiToCheck;
+  aiToCheck.PopAll();
+  aiToCheck.Push() = 0;
+  CRationalEntity *penFound = NULL;
+  const INDEX ct = wo_apenTimers.Count();
+  while (aiToCheck.Count()>0) {
+    INDEX i = aiToCheck.Pop();
+    CRationalEntity *pen = wo_apenTimers[i];
+    // if not due, none below it is due either
+    if (pen->en_timeTimer>tmDue) {
+      continue;
     }
+    // if already found one that is before this, none below is better
+    if (penFound!=NULL && TimerBefore(penFound, pen)) {
+      continue;
+    }
+    if (pen->IsPredictor()) {
+      penFound = pen;
+    }
+    if (i*2+1<ct) aiToCheck.Push() = i*2+1;
+    if (i*2+2<ct) aiToCheck.Push() = i*2+2;
   }
-  // add the new entity before current one
-  iten.InsertBeforeCurrent(penThinker->en_lnInTimers);
+  return penFound;
+}
+
+// get all timers in order of their execution
+void CWorld::GetTimersInOrder(CStaticStackArray<CRationalEntity*> &apenTimers)
+{
+  apenTimers.PopAll();
+  const INDEX ct = wo_apenTimers.Count();
+  if (ct==0) {
+    return;
+  }
+  CRationalEntity **ppen = apenTimers.Push(ct);
+  for (INDEX i=0; i<ct; i++) {
+    ppen[i] = wo_apenTimers[i];
+  }
+  qsort(ppen, ct, sizeof(CRationalEntity*), qsort_CompareTimers);
+}
+
+// force execution order of timers that are due at the same time (used when loading)
+void CWorld::ReorderTimers(CStaticStackArray<CRationalEntity*> &apenTimers)
+{
+  // give sequence numbers so that earlier in the array goes first
+  const INDEX ct = apenTimers.Count();
+  for (INDEX i=0; i<ct; i++) {
+    ASSERT(apenTimers[i]->IsWaitingForTimer());
+    apenTimers[i]->en_ulTimerSequence = wo_ulNextTimerSequence+(ct-1-i);
+  }
+  wo_ulNextTimerSequence += ct;
+  TimerHeapRebuild(wo_apenTimers);
 }
 
 // set overdue timers to be due in current time
@@ -390,14 +579,150 @@ void CWorld::AdjustLateTimers(TIME tmCurrentTime)
   // must be in 24bit mode when managing entities
   CSetFPUPrecision FPUPrecision(FPT_24BIT);
 
-  // for each entity in the thinker list
-  FOREACHINLIST(CRationalEntity, en_lnInTimers, wo_lhTimers, iten) {
-    CRationalEntity &en = *iten;
-    // if the entity in list is overdue
-    if (en.en_timeTimer<tmCurrentTime) {
-      // set it to current time
-      en.en_timeTimer = tmCurrentTime;
+  // find all overdue timers in order of execution
+  CStaticStackArray<CRationalEntity*> apenLate;
+  GetTimersInOrder(apenLate);
+  INDEX ctLate = 0;
+  while (ctLate<apenLate.Count() && apenLate[ctLate]->en_timeTimer<tmCurrentTime) {
+    ctLate++;
+  }
+  if (ctLate==0) {
+    return;
+  }
+  apenLate.PopUntil(ctLate-1);
+
+  // set them to current time, keeping their relative order and before others due now
+  {for (INDEX i=0; i<ctLate; i++) {
+    apenLate[i]->en_timeTimer = tmCurrentTime;
+  }}
+  ReorderTimers(apenLate);
+}
+
+// stand-in for a timer entity in the timer benchmark
+class CBenchmarkTimer {
+public:
+  TIME en_timeTimer;
+  ULONG en_ulTimerSequence;
+  INDEX en_iInTimers;
+  CListNode en_lnInTimers;
+};
+
+// random think delay for timer benchmark, from one tick to a few seconds, same on each run
+static TIME BenchmarkThinkDelay(ULONG &ulSeed)
+{
+  ulSeed = ulSeed*1103515245+12345;
+  return ((ulSeed>>16)%60+1)*_pTimer->TickQuantum;
+}
+
+// run given timers through a number of ticks, kept in a sorted list as before or in a heap
+// (returns checksum of order in which timers fired)
+static ULONG RunBenchmarkTimers(CStaticArray<CBenchmarkTimer> &abt, BOOL bHeap, INDEX ctTicks,
+  DOUBLE &dInsert, DOUBLE &dTicks)
+{
+  CListHead lhTimers;
+  CStaticStackArray<CBenchmarkTimer*> apbtTimers;
+  ULONG ulSequence = 0;
+  ULONG ulSeed = 1;
+  ULONG ulCRC;
+  CRC_Start(ulCRC);
+
+  // schedule all timers
+  CTimerValue tvStart = _pTimer->GetHighPrecisionTimer();
+  {for (INDEX i=0; i<abt.Count(); i++) {
+    CBenchmarkTimer *pbt = &abt[i];
+    pbt->en_timeTimer = BenchmarkThinkDelay(ulSeed);
+    if (bHeap) {
+      pbt->en_ulTimerSequence = ulSequence++;
+      apbtTimers.Push() = pbt;
+      TimerHeapUp(apbtTimers, apbtTimers.Count()-1);
+    } else {
+      FOREACHINLISTKEEP(CBenchmarkTimer, en_lnInTimers, lhTimers, itbt) {
+        if (itbt->en_timeTimer>=pbt->en_timeTimer) {
+          break;
+        }
+      }
+      itbt.InsertBeforeCurrent(pbt->en_lnInTimers);
     }
+  }}
+  dInsert = (_pTimer->GetHighPrecisionTimer()-tvStart).GetSeconds();
+
+  // in each tick, fire all due timers and schedule them again
+  tvStart = _pTimer->GetHighPrecisionTimer();
+  {for (INDEX iTick=1; iTick<=ctTicks; iTick++) {
+    const TIME tmNow = iTick*_pTimer->TickQuantum;
+    for (;;) {
+      CBenchmarkTimer *pbt;
+      if (bHeap) {
+        if (apbtTimers.Count()==0 || apbtTimers[0]->en_timeTimer>tmNow) {
+          break;
+        }
+        pbt = apbtTimers[0];
+        CBenchmarkTimer *pbtLast = apbtTimers.Pop();
+        if (pbtLast!=pbt) {
+          apbtTimers[0] = pbtLast;
+          TimerHeapDown(apbtTimers, 0);
+        }
+      } else {
+        if (lhTimers.IsEmpty()) {
+          break;
+        }
+        pbt = LIST_HEAD(lhTimers, CBenchmarkTimer, en_lnInTimers);
+        if (pbt->en_timeTimer>tmNow) {
+          break;
+        }
+        pbt->en_lnInTimers.Remove();
+      }
+      CRC_AddLONG(ulCRC, pbt-&abt[0]);
+
+      pbt->en_timeTimer = tmNow+BenchmarkThinkDelay(ulSeed);
+      if (bHeap) {
+        pbt->en_ulTimerSequence = ulSequence++;
+        apbtTimers.Push() = pbt;
+        TimerHeapUp(apbtTimers, apbtTimers.Count()-1);
+      } else {
+        FOREACHINLISTKEEP(CBenchmarkTimer, en_lnInTimers, lhTimers, itbt) {
+          if (itbt->en_timeTimer>=pbt->en_timeTimer) {
+            break;
+          }
+        }
+        itbt.InsertBeforeCurrent(pbt->en_lnInTimers);
+      }
+    }
+  }}
+  dTicks = (_pTimer->GetHighPrecisionTimer()-tvStart).GetSeconds();
+
+  // unlink all, timers are on stack of the caller
+  {FORDELETELIST(CBenchmarkTimer, en_lnInTimers, lhTimers, itbt) {
+    itbt->en_lnInTimers.Remove();
+  }}
+  CRC_Finish(ulCRC);
+  return ulCRC;
+}
+
+// schedule given number of timers and run them through a few seconds of ticks with old sorted
+// list and with the heap, and report times
+void BenchmarkTimers(INDEX ctTimers)
+{
+  ctTimers = Clamp(ctTimers, INDEX(1), INDEX(1000000));
+  const INDEX ctTicks = 200;
+  CStaticArray<CBenchmarkTimer> abt;
+  abt.New(ctTimers);
+
+  DOUBLE adInsert[2], adTicks[2];
+  ULONG aulCRC[2];
+  {for (INDEX iPass=0; iPass<2; iPass++) {
+    aulCRC[iPass] = RunBenchmarkTimers(abt, iPass, ctTicks, adInsert[iPass], adTicks[iPass]);
+  }}
+
+  CPrintF(TRANS("%d timers, %d ticks (think delays of 1-60 ticks):\n"), ctTimers, ctTicks);
+  CPrintF(TRANS("  sorted list: scheduling %.3fms, ticks %.3fms (%.1fus per tick)\n"),
+    adInsert[0]*1000.0, adTicks[0]*1000.0, adTicks[0]*1000000.0/ctTicks);
+  CPrintF(TRANS("  heap:        scheduling %.3fms, ticks %.3fms (%.1fus per tick)\n"),
+    adInsert[1]*1000.0, adTicks[1]*1000.0, adTicks[1]*1000000.0/ctTicks);
+  if (aulCRC[0]==aulCRC[1]) {
+    CPrintF(TRANS("  timers fired in same order\n"));
+  } else {
+    CPrintF(TRANS("  TIMERS FIRED IN DIFFERENT ORDER!\n"));
   }
 }
 
@@ -491,6 +816,8 @@ ULONG CWorld::GetSpawnFlags(void)
 /////////////////////////////////////////////////////////////////////
 // Shadow manipulation functions
 
+extern INDEX MakeQueuedShadowMaps(CWorld *pwoWorld, bool bDoDirectionalLights, bool bReportProgress);
+
 /*
  * Recalculate all shadow maps that are not valid or of smaller precision.
  */
@@ -505,29 +832,23 @@ void CWorld::CalculateDirectionalShadows(void)
   _ctShadowLayers=0;
   _ctShadowClusters=0;
 
-  // for each shadow map that is queued for calculation
-  FORDELETELIST(CBrushShadowMap, bsm_lnInUncalculatedShadowMaps,
-    wo_baBrushes.ba_lhUncalculatedShadowMaps, itbsm) {
-    // calculate shadows on it
-    itbsm->GetBrushPolygon()->MakeShadowMap(this, TRUE);
-  }
+  // calculate shadows on each shadow map that is queued for calculation
+  INDEX ctThreads = MakeQueuedShadowMaps(this, TRUE, TRUE);
 
   // report shadow rendering stats
   CTimerValue tvStop = _pTimer->GetHighPrecisionTimer();
-  CPrintF("Shadow calculation: total %d clusters in %d layers, %fs\n",
+  CPrintF("Shadow calculation: total %d clusters in %d layers, %fs on %d threads\n",
     _ctShadowClusters,
     _ctShadowLayers,
-    (tvStop-tvStart).GetSeconds());
+    (tvStop-tvStart).GetSeconds(),
+    ctThreads);
 }
 
 void CWorld::CalculateNonDirectionalShadows(void)
 {
-  // for each shadow map that is queued for calculation
-  FORDELETELIST(CBrushShadowMap, bsm_lnInUncalculatedShadowMaps,
-    wo_baBrushes.ba_lhUncalculatedShadowMaps, itbsm) {
-    // calculate shadows on it
-    itbsm->GetBrushPolygon()->MakeShadowMap(this, FALSE);
-  }
+  // calculate shadows on each shadow map that is queued for calculation
+  // (this is done while rendering, so progress is not reported)
+  MakeQueuedShadowMaps(this, FALSE, FALSE);
 }
 
 
@@ -1058,6 +1379,25 @@ void CWorld::CreatePredictors(void)
   CopyEntitiesToPredictors(cenForPrediction);
 }
 
+// check if existing predictors are for exactly those entities marked for prediction
+BOOL CWorld::ArePredictorsForMarked(void)
+{
+  INDEX ctMarked = 0;
+  // for each entity marked
+  {FOREACHINDYNAMICCONTAINER(wo_cenWillBePredicted, CEntity, iten){
+    // if not deleted
+    if (!(iten->en_ulFlags&ENF_DELETED)) {
+      // it must have a predictor already
+      if (!iten->IsPredicted()) {
+        return FALSE;
+      }
+      ctMarked++;
+    }
+  }}
+  // and no others may have it
+  return ctMarked==wo_cenPredicted.Count();
+}
+
 // delete all predictor entities
 void CWorld::DeletePredictors(void)
 {
@@ -1066,6 +1406,8 @@ void CWorld::DeletePredictors(void)
 
   // first remember eventual predicted player positions
   _pNetwork->ga_sesSessionState.RememberPlayerPredictorPositions();
+  // prediction must start over with new predictors
+  _pNetwork->ga_sesSessionState.ses_ctPredictedSteps = 0;
 
   // make a copy of predictor container (for safe iteration)
   CDynamicContainer<CEntity> cenPredictor = wo_cenPredictor;
@@ -1099,12 +1441,115 @@ void CWorld::DeletePredictors(void)
   }
 }
 
+// initial size of the entity ID hash (must be power of 2)
+#define ENTITYIDHASH_MINSIZE 1024
+
+// find first slot in the ID hash that belongs to given ID
+static inline INDEX IDHashSlot(ULONG ulID, INDEX ctSlots)
+{
+  // IDs are given out sequentially, so lower bits are well distributed already
+  return INDEX(ulID&(ctSlots-1));
+}
+
+// add an entity to the ID lookup table
+void CWorld::AddEntityToIDTable(CEntity *pen)
+{
+  ASSERT(pen!=NULL && pen->en_pwoWorld==this);
+  // if table would get more than half full
+  INDEX ctSlots = wo_apenEntitiesByID.Count();
+  if ((wo_ctEntitiesByID+1)*2>ctSlots) {
+    // rehash all entities into a bigger table
+    CStaticArray<CEntity*> apenOld;
+    apenOld.MoveArray(wo_apenEntitiesByID);
+    INDEX ctNew = Max(ctSlots*2, INDEX(ENTITYIDHASH_MINSIZE));
+    wo_apenEntitiesByID.New(ctNew);
+    for (INDEX iSlot=0; iSlot<ctNew; iSlot++) {
+      wo_apenEntitiesByID[iSlot] = NULL;
+    }
+    wo_ctEntitiesByID = 0;
+    for (INDEX iOld=0; iOld<apenOld.Count(); iOld++) {
+      if (apenOld[iOld]!=NULL) {
+        AddEntityToIDTable(apenOld[iOld]);
+      }
+    }
+    ctSlots = ctNew;
+  }
+
+  // find first free slot on the probe sequence
+  // NOTE: same ID may appear more than once while temporary predictors live
+  INDEX iSlot = IDHashSlot(pen->en_ulID, ctSlots);
+  while (wo_apenEntitiesByID[iSlot]!=NULL) {
+    ASSERT(wo_apenEntitiesByID[iSlot]!=pen);
+    iSlot = (iSlot+1)&(ctSlots-1);
+  }
+  wo_apenEntitiesByID[iSlot] = pen;
+  wo_ctEntitiesByID++;
+}
+
+// remove an entity from the ID lookup table
+void CWorld::RemoveEntityFromIDTable(CEntity *pen)
+{
+  INDEX ctSlots = wo_apenEntitiesByID.Count();
+  if (ctSlots==0) {
+    return;
+  }
+  // find its slot
+  INDEX iSlot = IDHashSlot(pen->en_ulID, ctSlots);
+  while (wo_apenEntitiesByID[iSlot]!=pen) {
+    if (wo_apenEntitiesByID[iSlot]==NULL) {
+      ASSERT(FALSE);
+      return;
+    }
+    iSlot = (iSlot+1)&(ctSlots-1);
+  }
+  wo_apenEntitiesByID[iSlot] = NULL;
+  wo_ctEntitiesByID--;
+
+  // shift following entries back so that no probe sequence gets broken
+  INDEX iHole = iSlot;
+  iSlot = (iSlot+1)&(ctSlots-1);
+  while (wo_apenEntitiesByID[iSlot]!=NULL) {
+    INDEX iHome = IDHashSlot(wo_apenEntitiesByID[iSlot]->en_ulID, ctSlots);
+    // if home slot is not cyclically in (hole, slot], entry can fill the hole
+    if (((iSlot-iHome)&(ctSlots-1)) >= ((iSlot-iHole)&(ctSlots-1))) {
+      wo_apenEntitiesByID[iHole] = wo_apenEntitiesByID[iSlot];
+      wo_apenEntitiesByID[iSlot] = NULL;
+      iHole = iSlot;
+    }
+    iSlot = (iSlot+1)&(ctSlots-1);
+  }
+}
+
+// change ID of an entity, keeping the lookup table in sync
+void CWorld::SetEntityID(CEntity *pen, ULONG ulID)
+{
+  RemoveEntityFromIDTable(pen);
+  pen->en_ulID = ulID;
+  AddEntityToIDTable(pen);
+}
+
 // get entity by its ID
 CEntity *CWorld::EntityFromID(ULONG ulID)
 {
-  FOREACHINDYNAMICCONTAINER(wo_cenAllEntities, CEntity, iten) {
-    if (iten->en_ulID==ulID) {
-      return iten;
+  INDEX ctSlots = wo_apenEntitiesByID.Count();
+  if (ctSlots>0) {
+    CEntity *penPredictor = NULL;
+    // walk the probe sequence
+    INDEX iSlot = IDHashSlot(ulID, ctSlots);
+    CEntity *pen;
+    while ((pen=wo_apenEntitiesByID[iSlot])!=NULL) {
+      if (pen->en_ulID==ulID) {
+        // real entities take precedence over predictors that reused the ID
+        if (!pen->IsPredictor()) {
+          return pen;
+        } else if (penPredictor==NULL) {
+          penPredictor = pen;
+        }
+      }
+      iSlot = (iSlot+1)&(ctSlots-1);
+    }
+    if (penPredictor!=NULL) {
+      return penPredictor;
     }
   }
   ASSERT(FALSE);
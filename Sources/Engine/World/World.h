@@ -69,8 +69,12 @@ public:
   CDynamicContainer<CEntity> wo_cenWillBePredicted;  // entities that will be predicted
   CDynamicContainer<CEntity> wo_cenPredicted;  // predicted entities
   CDynamicContainer<CEntity> wo_cenPredictor;  // predictor entities
+  CStaticArray<CEntity*> wo_apenEntitiesByID;  // open-addressed hash of all entities by ID
+  INDEX wo_ctEntitiesByID;                     // number of used slots in the ID hash
 
   class CCollisionGrid *wo_pcgCollisionGrid;
+  CDynamicContainer<CEntity> wo_cenZoningBrushes;  // zoning entities, in same order as in wo_cenEntities
+  bool wo_bZoningBrushesUpToDate;  // set if container of zoning entities is valid
 
   COLOR wo_colBackground;                 // background color of this world
   CEntityPointer wo_penBackgroundViewer;  // viewer entity for background rendering
@@ -95,7 +99,8 @@ public:
   CTString wo_strDescription; // description of the level (intro, mission, etc.)
 
   uint32_t wo_ulNextEntityID;    // next free ID for entities
-  CListHead wo_lhTimers;      // timer scheduled entities
+  CStaticStackArray<CRationalEntity*> wo_apenTimers; // timer scheduled entities - heap sorted by wait time
+  ULONG wo_ulNextTimerSequence; // next scheduling order number for timers
   CListHead wo_lhMovers;        // entities that want to/have to move
   bool wo_bPortalLinksUpToDate; // set if portal-sector links are up to date
 
@@ -105,6 +110,8 @@ public:
   void DestroyCollisionGrid(void);
   /* Clear collision grid. */
   void ClearCollisionGrid(void);
+  /* Adapt collision grid cell size to loaded world brushes. */
+  void AdaptCollisionGrid(void);
 
   /* Add an entity to cell(s) in collision grid. */
   void AddEntityToCollisionGrid(CEntity *pen, const FLOATaabbox3D &boxEntity);
@@ -117,6 +124,11 @@ public:
   void FindEntitiesNearBox(const FLOATaabbox3D &boxNear,
     CStaticStackArray<CEntity*> &apenNearEntities);
 
+  /* Mark that set or order of zoning entities might have changed. */
+  inline void MarkZoningBrushesChanged(void) { wo_bZoningBrushesUpToDate = FALSE; };
+  /* Get all zoning entities (in order of wo_cenEntities). */
+  CDynamicContainer<CEntity> &GetZoningBrushes(void);
+
   /* Create a new entity of given class. */
   CEntity *CreateEntity(const CPlacement3D &plPlacement, CEntityClass *pecClass);
   /* Clear all entity pointers that point to this entity. */
@@ -124,6 +136,14 @@ public:
 
   /* Add an entity to list of timers. */
   void AddTimer(CRationalEntity *penTimer);
+  /* Remove an entity from list of timers. */
+  void RemoveTimer(CRationalEntity *penTimer);
+  /* Get first timer that is due until given time (NULL if none). */
+  CRationalEntity *GetDueTimer(TIME tmDue, bool bPredictorsOnly);
+  // get all timers in order of their execution
+  void GetTimersInOrder(CStaticStackArray<CRationalEntity*> &apenTimers);
+  // force execution order of timers that are due at the same time (used when loading)
+  void ReorderTimers(CStaticStackArray<CRationalEntity*> &apenTimers);
   // set overdue timers to be due in current time
   void AdjustLateTimers(TIME tmCurrentTime);
 
@@ -175,9 +195,16 @@ public:
   void UnmarkForPrediction(void);
   // create predictors for predictable entities that are marked for prediction
   void CreatePredictors(void);
+  // check if existing predictors are for exactly those entities marked for prediction
+  BOOL ArePredictorsForMarked(void);
   // delete all predictor entities
   void DeletePredictors(void);
 
+  // add/remove an entity to/from the ID lookup table
+  void AddEntityToIDTable(CEntity *pen);
+  void RemoveEntityFromIDTable(CEntity *pen);
+  // change ID of an entity, keeping the lookup table in sync
+  void SetEntityID(CEntity *pen, uint32_t ulID);
   // get entity by its ID
   CEntity *EntityFromID(uint32_t ulID);
   // triangularize selected polygons
@@ -17,6 +17,10 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include <Engine/World/World.h>
 #include <Engine/World/PhysicsProfile.h>
+#include <Engine/Brushes/Brush.h>
+#include <Engine/Brushes/BrushArchive.h>
+#include <Engine/Terrain/Terrain.h>
+#include <Engine/Terrain/TerrainArchive.h>
 #include <Engine/Templates/StaticStackArray.cpp>
 #include <Engine/Templates/AllocationArray.h>
 #include <Engine/Templates/AllocationArray.cpp>
@@ -28,29 +32,50 @@ with this program; if not, write to the Free Software Foundation, Inc.,
   #include <Engine/Templates/DynamicContainer.cpp>
 #endif
 
-// allowed grid dimensions (meters)
+// allowed grid dimensions (cells)
 #define GRID_MIN (-32000)
 #define GRID_MAX (+32000)
 
-#define GRID_CELLSIZE  2.0 // size of one grid cell (meters)
-// number of hash table entries for grid cells
-#define GRID_HASHTABLESIZE_LOG2  12 // must be even for bit-shuffling
-#define GRID_HASHTABLESIZE (1<<GRID_HASHTABLESIZE_LOG2)
+// default size of one grid cell in lowest level (meters)
+#define GRID_CELLSIZE 2.0
+// largest size of one grid cell in lowest level (meters)
+#define GRID_CELLSIZE_MAX 16.0
+// how many cells the world geometry should span (per axis) in lowest level
+#define GRID_WORLDSPAN 2048
+// number of levels in loose grid hierarchy, each having cells twice as big as the one below
+#define GRID_LEVELS 6
+// how many cells an entity may span (per axis) before it is put in an upper level
+#define GRID_LOOSESPAN 4
+// initial number of hash table entries for grid cells (must be power of 2)
+#define GRID_HASHTABLESIZE_MIN 4096
 
 //#pragma inline_depth(0)
 
+// find grid level in which entity with given box should be
+static inline INDEX BoxToLevel(const FLOATaabbox3D &boxEntity, DOUBLE dCellSize)
+{
+  FLOAT fSize = Max(boxEntity.Size()(1), boxEntity.Size()(3));
+  INDEX iLevel = 0;
+  while (iLevel<GRID_LEVELS-1 && fSize>dCellSize*GRID_LOOSESPAN) {
+    dCellSize*=2;
+    iLevel++;
+  }
+  return iLevel;
+}
+
 // find grid box from float coordinates
 static inline void BoxToGrid(
-  const FLOATaabbox3D &boxEntity, INDEX &iMinX, INDEX &iMaxX, INDEX &iMinZ, INDEX &iMaxZ)
+  const FLOATaabbox3D &boxEntity, DOUBLE dCellSize,
+  INDEX &iMinX, INDEX &iMaxX, INDEX &iMinZ, INDEX &iMaxZ)
 {
   float fMinX = boxEntity.Min()(1);
   float fMinZ = boxEntity.Min()(3);
   float fMaxX = boxEntity.Max()(1);
   float fMaxZ = boxEntity.Max()(3);
-  iMinX = INDEX(floor(fMinX/GRID_CELLSIZE));
-  iMinZ = INDEX(floor(fMinZ/GRID_CELLSIZE));
-  iMaxX = INDEX(ceil(fMaxX/GRID_CELLSIZE));
-  iMaxZ = INDEX(ceil(fMaxZ/GRID_CELLSIZE));
+  iMinX = INDEX(floor(fMinX/dCellSize));
+  iMinZ = INDEX(floor(fMinZ/dCellSize));
+  iMaxX = INDEX(ceil(fMaxX/dCellSize));
+  iMaxZ = INDEX(ceil(fMaxZ/dCellSize));
 
   iMinX = Clamp(iMinX, (INDEX)GRID_MIN, (INDEX)GRID_MAX);
   iMinZ = Clamp(iMinZ, (INDEX)GRID_MIN, (INDEX)GRID_MAX);
@@ -64,30 +89,18 @@ static inline ULONG MakeCode(INDEX iX, INDEX iZ)
   return (iX<<16)|(iZ&0xffff);
 }
 
-static inline INDEX MakeKey(INDEX iX, INDEX iZ)
-{
-  //INDEX iKey = (iX+iZ)&(GRID_HASHTABLESIZE-1);  // x+z
-  // use absolute x and z, swap upper and lower bits in z, xor x and z
-  INDEX iZ2 = abs(iZ);
-  INDEX iKey = (iZ2>>(GRID_HASHTABLESIZE_LOG2/2)) | (
-    (iZ2&(GRID_HASHTABLESIZE/2-1))<<(GRID_HASHTABLESIZE_LOG2/2));
-  iKey = iKey^abs(iX);
-  iKey = iKey&(GRID_HASHTABLESIZE-1);
-  return iKey;
-}
-
-static inline INDEX MakeKeyFromCode(ULONG ulCode)
+static inline ULONG MakeHash(ULONG ulCode, INDEX iLevel)
 {
-  INDEX iX = SLONG(ulCode)>>16;
-  INDEX iZ = SLONG(SWORD(ulCode&0xffff));
-  return MakeKey(iX, iZ);
+  // mix all bits of the code, so that neighbouring cells scatter across the table
+  ULONG ulHash = (ulCode^(ULONG(iLevel)*0x9E3779B9UL))*0x85EBCA6BUL;
+  return ulHash^(ulHash>>15);
 }
 
 // collision grid classes
 class CGridCell {
 public:
   ULONG gc_ulCode;      // 32 bit uid of the cell (from its coordinates in grid)
-  INDEX gc_iNextCell;   // next cell with this hash code
+  INDEX gc_iLevel;      // level of the loose grid the cell is in
   INDEX gc_iFirstEntry; // first entry in this cell
 };
 class CGridEntry {
@@ -98,23 +111,33 @@ public:
 
 class CCollisionGrid {
 public:
-  CStaticArray<INDEX> cg_aiFirstCells;     // first cell for each hash entry
+  DOUBLE cg_dCellSize;                      // size of one cell in lowest level (meters)
+  CStaticArray<INDEX> cg_aiCellSlots;       // hash table of cells, open addressing (-1 if empty)
+  INDEX cg_ctUsedSlots;                     // number of used entries in hash table
+  INDEX cg_actLevelEntries[GRID_LEVELS];    // number of entries in each level
   CAllocationArray<CGridCell> cg_agcCells;     // all cells
   CAllocationArray<CGridEntry> cg_ageEntries;  // all entries
 
   CCollisionGrid(void);
   ~CCollisionGrid(void);
   void Clear(void);
+  // get size of cells in given level
+  inline DOUBLE CellSize(INDEX iLevel) { return cg_dCellSize*(1<<iLevel); };
+  // resize the hash table and reinsert all cells
+  void Rehash(INDEX ctSlots);
   // create a new grid cell in given hash table entry
-  INDEX CreateCell(INDEX iKey, ULONG ulCode);
+  INDEX CreateCell(INDEX iSlot, INDEX iLevel, ULONG ulCode);
   // remove a cell
   void RemoveCell(INDEX igc);
   // get grid cell for its coordinates
-  INDEX FindCell(INDEX iX, INDEX iZ, BOOL bCreate);
+  INDEX FindCell(INDEX iLevel, INDEX iX, INDEX iZ, BOOL bCreate);
   // add entry to a given cell
   void AddEntry(INDEX igc, CEntity *pen);
   // remove entry from a given cell
   void RemoveEntry(INDEX igc, CEntity *pen);
+  // add/remove an entity to/from all cells its box spans
+  void AddEntity(CEntity *pen, const FLOATaabbox3D &boxEntity);
+  void RemoveEntity(CEntity *pen, const FLOATaabbox3D &boxEntity);
 };
 
 
@@ -132,34 +155,68 @@ CCollisionGrid::~CCollisionGrid(void)
 
 void CCollisionGrid::Clear(void)
 {
-  cg_aiFirstCells.Clear();
+  cg_aiCellSlots.Clear();
   cg_agcCells.Clear();
   cg_ageEntries.Clear();
 
-  cg_aiFirstCells.New(GRID_HASHTABLESIZE);
+  // until world brushes are loaded, use default cell size
+  cg_dCellSize = GRID_CELLSIZE;
+
+  cg_aiCellSlots.New(GRID_HASHTABLESIZE_MIN);
   cg_agcCells.SetAllocationStep(1024);
   cg_ageEntries.SetAllocationStep(1024);
 
   // mark all cells as unused
-  for(INDEX iKey=0; iKey<GRID_HASHTABLESIZE; iKey++) {
-    cg_aiFirstCells[iKey] = -1;
+  for(INDEX iSlot=0; iSlot<GRID_HASHTABLESIZE_MIN; iSlot++) {
+    cg_aiCellSlots[iSlot] = -1;
+  }
+  cg_ctUsedSlots = 0;
+  for(INDEX iLevel=0; iLevel<GRID_LEVELS; iLevel++) {
+    cg_actLevelEntries[iLevel] = 0;
   }
 }
 
+// resize the hash table and reinsert all cells
+void CCollisionGrid::Rehash(INDEX ctSlots)
+{
+  CStaticArray<INDEX> aiOld;
+  aiOld.MoveArray(cg_aiCellSlots);
+  cg_aiCellSlots.New(ctSlots);
+  {for(INDEX iSlot=0; iSlot<ctSlots; iSlot++) {
+    cg_aiCellSlots[iSlot] = -1;
+  }}
+  // for each used old slot
+  {for(INDEX iOld=0; iOld<aiOld.Count(); iOld++) {
+    INDEX igc = aiOld[iOld];
+    if (igc<0) {
+      continue;
+    }
+    // put the cell in first free slot
+    CGridCell &gc = cg_agcCells[igc];
+    INDEX iSlot = MakeHash(gc.gc_ulCode, gc.gc_iLevel)&(ctSlots-1);
+    while (cg_aiCellSlots[iSlot]>=0) {
+      iSlot = (iSlot+1)&(ctSlots-1);
+    }
+    cg_aiCellSlots[iSlot] = igc;
+  }}
+}
+
 // create a new grid cell in given hash table entry
-INDEX CCollisionGrid::CreateCell(INDEX iKey, ULONG ulCode)
+INDEX CCollisionGrid::CreateCell(INDEX iSlot, INDEX iLevel, ULONG ulCode)
 {
+  ASSERT(cg_aiCellSlots[iSlot]<0);
   // find an empty cell
   INDEX igc = cg_agcCells.Allocate();
   CGridCell &gc = cg_agcCells[igc];
 
   // set up the cell
   gc.gc_ulCode = ulCode;
+  gc.gc_iLevel = iLevel;
   gc.gc_iFirstEntry = -1;
 
-  // link it by hash key
-  gc.gc_iNextCell = cg_aiFirstCells[iKey];
-  cg_aiFirstCells[iKey] = igc;
+  // put it in hash table
+  cg_aiCellSlots[iSlot] = igc;
+  cg_ctUsedSlots++;
 
   return igc;
 }
@@ -167,62 +224,81 @@ INDEX CCollisionGrid::CreateCell(INDEX iKey, ULONG ulCode)
 // remove a cell
 void CCollisionGrid::RemoveCell(INDEX igc)
 {
-  // get key of the cell
+  const INDEX ctSlots = cg_aiCellSlots.Count();
+  // find the cell's slot
   CGridCell &gc = cg_agcCells[igc];
-  INDEX iKey = MakeKeyFromCode(gc.gc_ulCode);
-
-  // find the cell's index pointer
-  INDEX *pigc = &cg_aiFirstCells[iKey];
-  ASSERT(*pigc>=0);
-  while(*pigc>=0) {
-    CGridCell &gc = cg_agcCells[*pigc];
-    if (*pigc==igc) {
-      *pigc = gc.gc_iNextCell;
-      gc.gc_iNextCell = -2;
-      gc.gc_iFirstEntry = -1;
-      gc.gc_ulCode = 0x12345678;
-      cg_agcCells.Free(igc);
+  INDEX iSlot = MakeHash(gc.gc_ulCode, gc.gc_iLevel)&(ctSlots-1);
+  while (cg_aiCellSlots[iSlot]!=igc) {
+    ASSERT(cg_aiCellSlots[iSlot]>=0);
+    if (cg_aiCellSlots[iSlot]<0) {
       return;
     }
-    pigc = &gc.gc_iNextCell;
+    iSlot = (iSlot+1)&(ctSlots-1);
+  }
+
+  // free the cell
+  cg_aiCellSlots[iSlot] = -1;
+  cg_ctUsedSlots--;
+  gc.gc_iFirstEntry = -1;
+  gc.gc_ulCode = 0x12345678;
+  cg_agcCells.Free(igc);
+
+  // shift following cells back so that no probe sequence gets broken
+  INDEX iHole = iSlot;
+  iSlot = (iSlot+1)&(ctSlots-1);
+  while (cg_aiCellSlots[iSlot]>=0) {
+    CGridCell &gcNext = cg_agcCells[cg_aiCellSlots[iSlot]];
+    INDEX iHome = MakeHash(gcNext.gc_ulCode, gcNext.gc_iLevel)&(ctSlots-1);
+    // if home slot is not cyclically in (hole, slot], cell can fill the hole
+    if (((iSlot-iHome)&(ctSlots-1)) >= ((iSlot-iHole)&(ctSlots-1))) {
+      cg_aiCellSlots[iHole] = cg_aiCellSlots[iSlot];
+      cg_aiCellSlots[iSlot] = -1;
+      iHole = iSlot;
+    }
+    iSlot = (iSlot+1)&(ctSlots-1);
   }
-  ASSERT(FALSE);
 }
 
 // get grid cell for its coordinates
-INDEX CCollisionGrid::FindCell(INDEX iX, INDEX iZ, BOOL bCreate)
+INDEX CCollisionGrid::FindCell(INDEX iLevel, INDEX iX, INDEX iZ, BOOL bCreate)
 {
   // make uid of the cell
   ASSERT(iX>=GRID_MIN && iX<=GRID_MAX);
   ASSERT(iZ>=GRID_MIN && iZ<=GRID_MAX);
+  ASSERT(iLevel>=0 && iLevel<GRID_LEVELS);
   ULONG ulCode = MakeCode(iX, iZ);
-  // get the hash key for the cell
-  INDEX iKey = MakeKey(iX, iZ);  // x+z, use lower bits
-  ASSERT(iKey==MakeKeyFromCode(ulCode));
-  // find the cell in list of cells with that key
-  INDEX igcFound = -1;
-  for (INDEX igc=cg_aiFirstCells[iKey]; igc>=0; igc = cg_agcCells[igc].gc_iNextCell) {
-    if (cg_agcCells[igc].gc_ulCode==ulCode) {
-      igcFound = igc;
-      break;
-    }
+
+  // if creating and hash table would get more than half full
+  if (bCreate && (cg_ctUsedSlots+1)*2>cg_aiCellSlots.Count()) {
+    // make it bigger
+    Rehash(cg_aiCellSlots.Count()*2);
   }
 
-  // if the cell is found
-  if (igcFound>=0) {
-    // use existing one
-    return igcFound;
-  // if the cell is not found
-  } else {
-    // if new one may be created
-    if (bCreate) {
-      // create a new one
-      return CreateCell(iKey, ulCode);
-    // if new one may not be created
-    } else {
-      // return nothing
-      return -1;
+  // find the cell on the probe sequence of its hash
+  const INDEX ctSlots = cg_aiCellSlots.Count();
+  INDEX iSlot = MakeHash(ulCode, iLevel)&(ctSlots-1);
+  for(;;) {
+    _pfPhysicsProfile.IncrementCounter(CPhysicsProfile::PCI_GRIDHASHPROBES);
+    INDEX igc = cg_aiCellSlots[iSlot];
+    // if empty slot is reached
+    if (igc<0) {
+      // if new one may be created
+      if (bCreate) {
+        // create a new one here
+        return CreateCell(iSlot, iLevel, ulCode);
+      // if new one may not be created
+      } else {
+        // return nothing
+        return -1;
+      }
+    }
+    // if the cell is found
+    CGridCell &gc = cg_agcCells[igc];
+    if (gc.gc_ulCode==ulCode && gc.gc_iLevel==iLevel) {
+      // use existing one
+      return igc;
     }
+    iSlot = (iSlot+1)&(ctSlots-1);
   }
 }
 
@@ -238,6 +314,7 @@ void CCollisionGrid::AddEntry(INDEX igc, CEntity *pen)
   CGridCell &gc = cg_agcCells[igc];
   ge.ge_iNextEntry = gc.gc_iFirstEntry;
   gc.gc_iFirstEntry = ige;
+  cg_actLevelEntries[gc.gc_iLevel]++;
 }
 
 // remove entry from a given cell
@@ -256,6 +333,7 @@ void CCollisionGrid::RemoveEntry(INDEX igc, CEntity *pen)
       *pige = ge.ge_iNextEntry;
       ge.ge_iNextEntry = -2;
       ge.ge_penEntity = NULL;
+      cg_actLevelEntries[gc.gc_iLevel]--;
       // if the cell becomes empty
       if (gc.gc_iFirstEntry<0) {
         // remove the cell
@@ -268,6 +346,45 @@ void CCollisionGrid::RemoveEntry(INDEX igc, CEntity *pen)
   ASSERT(FALSE);
 }
 
+// add an entity to all cells its box spans
+void CCollisionGrid::AddEntity(CEntity *pen, const FLOATaabbox3D &boxEntity)
+{
+  // find grid coordinates
+  INDEX iLevel = BoxToLevel(boxEntity, cg_dCellSize);
+  INDEX iMinX, iMaxX, iMinZ, iMaxZ;
+  BoxToGrid(boxEntity, CellSize(iLevel), iMinX, iMaxX, iMinZ, iMaxZ);
+  // for each cell spanned by the entity
+  for(INDEX iX=iMinX; iX<=iMaxX; iX++) {
+    for(INDEX iZ=iMinZ; iZ<=iMaxZ; iZ++) {
+      // find that cell
+      INDEX igc = FindCell(iLevel, iX, iZ, TRUE);
+      // add the entity to the cell
+      AddEntry(igc, pen);
+    }
+  }
+}
+
+// remove an entity from all cells its box spans
+void CCollisionGrid::RemoveEntity(CEntity *pen, const FLOATaabbox3D &boxEntity)
+{
+  // find grid coordinates
+  INDEX iLevel = BoxToLevel(boxEntity, cg_dCellSize);
+  INDEX iMinX, iMaxX, iMinZ, iMaxZ;
+  BoxToGrid(boxEntity, CellSize(iLevel), iMinX, iMaxX, iMinZ, iMaxZ);
+  // for each cell spanned by the entity
+  for(INDEX iX=iMinX; iX<=iMaxX; iX++) {
+    for(INDEX iZ=iMinZ; iZ<=iMaxZ; iZ++) {
+      // find that cell
+      INDEX igc = FindCell(iLevel, iX, iZ, FALSE);
+      ASSERT(igc>=0);
+      // remove the entity from the cell
+      if (igc>=0) {
+        RemoveEntry(igc, pen);
+      }
+    }
+  }
+}
+
 
 
 /* Initialize collision grid. */
@@ -286,24 +403,54 @@ void CWorld::ClearCollisionGrid(void)
 {
   wo_pcgCollisionGrid->Clear();
 }
+// adapt collision grid cell size to world brushes and terrains
+void CWorld::AdaptCollisionGrid(void)
+{
+  CCollisionGrid &cg = *wo_pcgCollisionGrid;
+  // cells cannot be resized while there are entities in them
+  ASSERT(cg.cg_ctUsedSlots==0);
+  if (cg.cg_ctUsedSlots>0) {
+    return;
+  }
+
+  // find largest horizontal extent of any brush or terrain
+  // (only data from the world file is used, so all peers get the same grid)
+  DOUBLE dExtent = 0.0;
+  {FOREACHINDYNAMICARRAY(wo_baBrushes.ba_abrBrushes, CBrush3D, itbr) {
+    CBrushMip *pbm = itbr->GetFirstMip();
+    if (pbm==NULL) {
+      continue;
+    }
+    DOUBLEaabbox3D boxBrush;
+    FOREACHINDYNAMICARRAY(pbm->bm_abscSectors, CBrushSector, itbsc) {
+      CStaticArray<CBrushVertex> &abvx = itbsc->bsc_abvxVertices;
+      for(INDEX ivx=0; ivx<abvx.Count(); ivx++) {
+        boxBrush |= DOUBLEaabbox3D(abvx[ivx].bvx_vdPreciseRelative);
+      }
+    }
+    if (!boxBrush.IsEmpty()) {
+      dExtent = Max(dExtent, Max(boxBrush.Size()(1), boxBrush.Size()(3)));
+    }
+  }}
+  {FOREACHINDYNAMICARRAY(wo_taTerrains.ta_atrTerrains, CTerrain, ittr) {
+    const FLOAT3D &vSize = ittr->tr_vTerrainSize;
+    dExtent = Max(dExtent, DOUBLE(Max(vSize(1), vSize(3))));
+  }}
+
+  // make cells bigger until the world fits in wanted number of cells
+  DOUBLE dCellSize = GRID_CELLSIZE;
+  while (dCellSize<GRID_CELLSIZE_MAX && dExtent>dCellSize*GRID_WORLDSPAN) {
+    dCellSize*=2;
+  }
+  cg.cg_dCellSize = dCellSize;
+}
 
 
 /* Add an entity to cell(s) in collision grid. */
 void CWorld::AddEntityToCollisionGrid(CEntity *pen, const FLOATaabbox3D &boxEntity)
 {
   _pfPhysicsProfile.StartTimer(CPhysicsProfile::PTI_ADDENTITYTOGRID);
-  // find grid coordinates
-  INDEX iMinX, iMaxX, iMinZ, iMaxZ;
-  BoxToGrid(boxEntity, iMinX, iMaxX, iMinZ, iMaxZ);
-  // for each cell spanned by the entity
-  for(INDEX iX=iMinX; iX<=iMaxX; iX++) {
-    for(INDEX iZ=iMinZ; iZ<=iMaxZ; iZ++) {
-      // find that cell
-      INDEX igc = wo_pcgCollisionGrid->FindCell(iX, iZ, TRUE);
-      // add the entity to the cell
-      wo_pcgCollisionGrid->AddEntry(igc, pen);
-    }
-  }
+  wo_pcgCollisionGrid->AddEntity(pen, boxEntity);
   _pfPhysicsProfile.StopTimer(CPhysicsProfile::PTI_ADDENTITYTOGRID);
 }
 
@@ -312,21 +459,7 @@ void CWorld::AddEntityToCollisionGrid(CEntity *pen, const FLOATaabbox3D &boxEnti
 void CWorld::RemoveEntityFromCollisionGrid(CEntity *pen, const FLOATaabbox3D &boxEntity)
 {
   _pfPhysicsProfile.StartTimer(CPhysicsProfile::PTI_REMENTITYFROMGRID);
-  // find grid coordinates
-  INDEX iMinX, iMaxX, iMinZ, iMaxZ;
-  BoxToGrid(boxEntity, iMinX, iMaxX, iMinZ, iMaxZ);
-  // for each cell spanned by the entity
-  for(INDEX iX=iMinX; iX<=iMaxX; iX++) {
-    for(INDEX iZ=iMinZ; iZ<=iMaxZ; iZ++) {
-      // find that cell
-      INDEX igc = wo_pcgCollisionGrid->FindCell(iX, iZ, FALSE);
-      ASSERT(igc>=0);
-      // remove the entity from the cell
-      if (igc>=0) {
-        wo_pcgCollisionGrid->RemoveEntry(igc, pen);
-      }
-    }
-  }
+  wo_pcgCollisionGrid->RemoveEntity(pen, boxEntity);
   _pfPhysicsProfile.StopTimer(CPhysicsProfile::PTI_REMENTITYFROMGRID);
 }
 
@@ -335,12 +468,25 @@ void CWorld::MoveEntityInCollisionGrid(CEntity *pen,
   const FLOATaabbox3D &boxOld, const FLOATaabbox3D &boxNew)
 {
   _pfPhysicsProfile.StartTimer(CPhysicsProfile::PTI_MOVEENTITYINGRID);
+  CCollisionGrid &cg = *wo_pcgCollisionGrid;
+
+  // if entity changes level in loose grid
+  INDEX iOldLevel = BoxToLevel(boxOld, cg.cg_dCellSize);
+  INDEX iNewLevel = BoxToLevel(boxNew, cg.cg_dCellSize);
+  if (iOldLevel!=iNewLevel) {
+    // just relink it entirely
+    cg.RemoveEntity(pen, boxOld);
+    cg.AddEntity(pen, boxNew);
+    _pfPhysicsProfile.StopTimer(CPhysicsProfile::PTI_MOVEENTITYINGRID);
+    return;
+  }
 
   // find grid coordinates
+  const DOUBLE dCellSize = cg.CellSize(iNewLevel);
   INDEX iOldMinX, iOldMaxX, iOldMinZ, iOldMaxZ;
-  BoxToGrid(boxOld, iOldMinX, iOldMaxX, iOldMinZ, iOldMaxZ);
+  BoxToGrid(boxOld, dCellSize, iOldMinX, iOldMaxX, iOldMinZ, iOldMaxZ);
   INDEX iNewMinX, iNewMaxX, iNewMinZ, iNewMaxZ;
-  BoxToGrid(boxNew, iNewMinX, iNewMaxX, iNewMinZ, iNewMaxZ);
+  BoxToGrid(boxNew, dCellSize, iNewMinX, iNewMaxX, iNewMinZ, iNewMaxZ);
 
   // for each cell spanned by the entity before moving but not after moving
   {for(INDEX iX=iOldMinX; iX<=iOldMaxX; iX++) {
@@ -350,11 +496,11 @@ void CWorld::MoveEntityInCollisionGrid(CEntity *pen,
         continue;
       }
       // find that cell
-      INDEX igc = wo_pcgCollisionGrid->FindCell(iX, iZ, FALSE);
+      INDEX igc = cg.FindCell(iOldLevel, iX, iZ, FALSE);
       ASSERT(igc>=0);
       // remove the entity from the cell
       if (igc>=0) {
-        wo_pcgCollisionGrid->RemoveEntry(igc, pen);
+        cg.RemoveEntry(igc, pen);
       }
     }
   }}
@@ -367,8 +513,8 @@ void CWorld::MoveEntityInCollisionGrid(CEntity *pen,
         continue;
       }
       // find that cell
-      INDEX igc = wo_pcgCollisionGrid->FindCell(iX, iZ, TRUE);
-      wo_pcgCollisionGrid->AddEntry(igc, pen);
+      INDEX igc = cg.FindCell(iNewLevel, iX, iZ, TRUE);
+      cg.AddEntry(igc, pen);
     }
   }}
   _pfPhysicsProfile.StopTimer(CPhysicsProfile::PTI_MOVEENTITYINGRID);
@@ -396,38 +542,51 @@ void CWorld::FindEntitiesNearBox(const FLOATaabbox3D &boxNear,
   _pfPhysicsProfile.StartTimer(CPhysicsProfile::PTI_FINDENTITIESNEARBOX);
   _pfPhysicsProfile.IncrementCounter(CPhysicsProfile::PCI_FINDINGNEARENTITIES);
 
-  // find grid coordinates
-  INDEX iMinX, iMaxX, iMinZ, iMaxZ;
-  BoxToGrid(boxNear, iMinX, iMaxX, iMinZ, iMaxZ);
+  CCollisionGrid &cg = *wo_pcgCollisionGrid;
   apenNearEntities.PopAll();
 
-  // for each cell spanned by the box
-  {for(INDEX iX=iMinX; iX<=iMaxX; iX++) {
-    for(INDEX iZ=iMinZ; iZ<=iMaxZ; iZ++) {
-      _pfPhysicsProfile.IncrementCounter(CPhysicsProfile::PCI_NEARCELLSFOUND);
-      // find that cell
-      INDEX igc = wo_pcgCollisionGrid->FindCell(iX, iZ, FALSE);
-      // if the cell is empty
-      if (igc<0) {
-        // skip it
-        continue;
-      }
-      _pfPhysicsProfile.IncrementCounter(CPhysicsProfile::PCI_NEAROCCUPIEDCELLSFOUND);
-      // for each entity in the cell
-      for(INDEX iEntry = wo_pcgCollisionGrid->cg_agcCells[igc].gc_iFirstEntry;
-          iEntry>=0;
-          iEntry = wo_pcgCollisionGrid->cg_ageEntries[iEntry].ge_iNextEntry) {
-        CEntity *penEntity = wo_pcgCollisionGrid->cg_ageEntries[iEntry].ge_penEntity;
-        // if it is not already found
-        if (!(penEntity->en_ulFlags&ENF_FOUNDINGRIDSEARCH)) {
-          // add it
-          apenNearEntities.Push() = penEntity;
-          // mark it as found
-          penEntity->en_ulFlags|=ENF_FOUNDINGRIDSEARCH;
+  // for each level of the loose grid
+  for(INDEX iLevel=0; iLevel<GRID_LEVELS; iLevel++) {
+    // if nothing in this level
+    if (cg.cg_actLevelEntries[iLevel]==0) {
+      // skip it
+      continue;
+    }
+    // find grid coordinates
+    INDEX iMinX, iMaxX, iMinZ, iMaxZ;
+    BoxToGrid(boxNear, cg.CellSize(iLevel), iMinX, iMaxX, iMinZ, iMaxZ);
+
+    // for each cell spanned by the box
+    {for(INDEX iX=iMinX; iX<=iMaxX; iX++) {
+      for(INDEX iZ=iMinZ; iZ<=iMaxZ; iZ++) {
+        _pfPhysicsProfile.IncrementCounter(CPhysicsProfile::PCI_NEARCELLSFOUND);
+        // find that cell
+        INDEX igc = cg.FindCell(iLevel, iX, iZ, FALSE);
+        // if the cell is empty
+        if (igc<0) {
+          // skip it
+          continue;
+        }
+        _pfPhysicsProfile.IncrementCounter(CPhysicsProfile::PCI_NEAROCCUPIEDCELLSFOUND);
+        if (iLevel>0) {
+          _pfPhysicsProfile.IncrementCounter(CPhysicsProfile::PCI_NEARLOOSECELLSFOUND);
+        }
+        // for each entity in the cell
+        for(INDEX iEntry = cg.cg_agcCells[igc].gc_iFirstEntry;
+            iEntry>=0;
+            iEntry = cg.cg_ageEntries[iEntry].ge_iNextEntry) {
+          CEntity *penEntity = cg.cg_ageEntries[iEntry].ge_penEntity;
+          // if it is not already found
+          if (!(penEntity->en_ulFlags&ENF_FOUNDINGRIDSEARCH)) {
+            // add it
+            apenNearEntities.Push() = penEntity;
+            // mark it as found
+            penEntity->en_ulFlags|=ENF_FOUNDINGRIDSEARCH;
+          }
         }
       }
-    }
-  }}
+    }}
+  }
 
 
   _pfPhysicsProfile.IncrementCounter(
@@ -449,10 +608,20 @@ extern SLONG GetCollisionGridMemory( CCollisionGrid *pcg)
   if( pcg==NULL) return 0;
 
   // phew, it's here!
-  SLONG slUsedMemory = pcg->cg_aiFirstCells.Count() * sizeof(INDEX);
+  SLONG slUsedMemory = pcg->cg_aiCellSlots.Count() * sizeof(INDEX);
   slUsedMemory += pcg->cg_agcCells.Count()   * sizeof(CGridCell);
   slUsedMemory += pcg->cg_ageEntries.Count() * sizeof(CGridEntry);
   slUsedMemory += pcg->cg_agcCells.aa_aiFreeElements.sa_Count   * sizeof(INDEX);
   slUsedMemory += pcg->cg_ageEntries.aa_aiFreeElements.sa_Count * sizeof(INDEX);
   return slUsedMemory;
 }
+
+// get occupancy of the collision grid hash table
+extern void GetCollisionGridOccupancy( CCollisionGrid *pcg, INDEX &ctCells, INDEX &ctSlots, INDEX &ctLooseEntries)
+{
+  ctCells = ctSlots = ctLooseEntries = 0;
+  if( pcg==NULL) return;
+  ctCells = pcg->cg_ctUsedSlots;
+  ctSlots = pcg->cg_aiCellSlots.Count();
+  for( INDEX iLevel=1; iLevel<GRID_LEVELS; iLevel++) ctLooseEntries += pcg->cg_actLevelEntries[iLevel];
+}
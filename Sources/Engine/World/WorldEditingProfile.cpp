@@ -56,6 +56,7 @@ CWorldEditingProfile::CWorldEditingProfile(void)
   SETTIMERNAME(PTI_AMBIENTFILL,            "CLayerMixer::FillWithAmbientLight()", "");
   SETTIMERNAME(PTI_ADDONELAYERPOINT,       "CLayerMixer::AddOneLayerPoint()", "");
   SETTIMERNAME(PTI_ADDONELAYERDIRECTIONAL, "CLayerMixer::AddOneLayerDirectional()", "");
+  SETTIMERNAME(PTI_ADDONELAYERGRADIENT,    "CLayerMixer::AddOneLayerGradient()", "");
 
   SETCOUNTERNAME(PCI_SECTORSOPTIMIZED, "sectors optimized");
   SETCOUNTERNAME(PCI_SHADOWIMAGES,     "shadow images generated");
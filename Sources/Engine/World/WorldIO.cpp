@@ -27,6 +27,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <Engine/Terrain/TerrainArchive.h>
 #include <Engine/Base/ProgressHook.h>
 #include <Engine/Network/Network.h>
+#include <Engine/Graphics/Texture.h>
 #include <Engine/Templates/StaticArray.cpp>
 #include <Engine/Terrain/Terrain.h>
 
@@ -61,6 +62,9 @@ void CWorld::Save_t(const CTFileName &fnmWorld) // throw char *
  */
 void CWorld::Load_t(const CTFileName &fnmWorld) // throw char *
 {
+  // make mip-maps of all textures that the world needs at once, when they are all loaded
+  CTextureBatch tbTextures;
+
   // remember the file
   wo_fnmFileName = fnmWorld;
   // open the file
@@ -205,6 +209,9 @@ void CWorld::ReadBrushes_t( CTStream *istrm)// throw char *
 
   istrm->DictionaryReadEnd_t();
   _pwoCurrentLoading = NULL;
+
+  // size collision grid cells for this world before any entities are added
+  AdaptCollisionGrid();
   _pfWorldEditingProfile.StopTimer(CWorldEditingProfile::PTI_READBRUSHES);
 }
 
@@ -279,6 +286,8 @@ void CWorld::ReadState_t( CTStream *istr) // throw char *
     }
   }
   istr->DictionaryReadEnd_t();
+  // entities were created, removed and reordered
+  MarkZoningBrushesChanged();
 
   SetProgressDescription(TRANS("precaching"));
   CallProgressHook_t(0.0f);
@@ -617,7 +626,7 @@ void CWorld::ReadState_new_t( CTStream *istr) // throw char *
     // adjust id if needed
     if (_bReadEntitiesByID) {
       wo_ulNextEntityID--;
-      penNew->en_ulID = ulID;
+      SetEntityID(penNew, ulID);
     }
     CallProgressHook_t(FLOAT(iEntity)/ctEntities);
   }}
@@ -201,6 +201,12 @@ functions:
     MakeRotationMatrixFast(mRotTarget, aDir);
   }
 
+  // pre and post moving change only the camera itself
+  BOOL IsMovingThreadSafe(void)
+  {
+    return TRUE;
+  }
+
   void PreMoving()
   {
     // remember old placement for lerping